@@ -123,14 +123,22 @@ void UpdateHandlerClient::extract(UpdateContainer *updateContainer)
       readFrameBuffer(&m_backupFrameBuffer, &r, m_forwGate);
     }
 
-    // Get "copyrect"
-    unsigned char hasCopyRect = m_forwGate->readUInt8();
-    if (hasCopyRect) {
-      m_log->info(_T("UpdateHandlerClient: has \"CopyRect\""));
-      updCont.copySrc = readPoint(m_forwGate);
-      Rect r = readRect(m_forwGate);
-      updCont.copiedRegion.addRect(&r);
-      readFrameBuffer(&m_backupFrameBuffer, &r, m_forwGate);
+    // Get "copyrect" moves
+    unsigned int countCopyMoves = m_forwGate->readUInt32();
+    if (countCopyMoves != 0) {
+      m_log->info(_T("UpdateHandlerClient: count \"CopyRect\" moves = %u"),
+                  countCopyMoves);
+    }
+    for (unsigned int i = 0; i < countCopyMoves; i++) {
+      Point srcOffset = readPoint(m_forwGate);
+      Region dstRegion;
+      readRegion(&dstRegion, m_forwGate);
+      updCont.addCopyMove(&dstRegion, &srcOffset);
+    }
+    std::vector<Rect> copyRects;
+    updCont.copiedRegion.getRectVector(&copyRects);
+    for (size_t i = 0; i < copyRects.size(); i++) {
+      readFrameBuffer(&m_backupFrameBuffer, &copyRects[i], m_forwGate);
     }
 
     // Get cursor position if it has been changed.
@@ -139,15 +139,18 @@ void UpdateHandlerServer::extractReply(BlockingGate *backGate)
     sendFrameBuffer(fb, rect, backGate);
   }
 
-  // Send "copyrect"
-  m_log->debug(_T("UpdateHandlerServer: Send copyrect"));
-  bool hasCopyRect = !updCont.copiedRegion.isEmpty();
-  backGate->writeUInt8(hasCopyRect);
-  if (hasCopyRect) {
-    sendPoint(&updCont.copySrc, backGate);
-    updCont.copiedRegion.getRectVector(&rects);
-    iRect = rects.begin();
-    sendRect(&(*iRect), backGate);
+  // Send "copyrect" moves in their order
+  unsigned int countCopyMoves = (unsigned int)updCont.copyMoves.size();
+  m_log->debug(_T("UpdateHandlerServer: Send %u copyrect moves"),
+               countCopyMoves);
+  backGate->writeUInt32(countCopyMoves);
+  for (size_t i = 0; i < updCont.copyMoves.size(); i++) {
+    sendPoint(&updCont.copyMoves[i].srcOffset, backGate);
+    sendRegion(&updCont.copyMoves[i].dstRegion, backGate);
+  }
+  // The resulting pixels of all the moves
+  updCont.copiedRegion.getRectVector(&rects);
+  for (iRect = rects.begin(); iRect < rects.end(); iRect++) {
     sendFrameBuffer(fb, &(*iRect), backGate);
   }
 
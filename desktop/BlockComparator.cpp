@@ -0,0 +1,176 @@
+// Copyright (C) 2012 GlavSoft LLC.
+// All rights reserved.
+//
+//-------------------------------------------------------------------------
+// This file is part of the TightVNC software.  Please visit our Web site:
+//
+//                       http://www.tightvnc.com/
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+//-------------------------------------------------------------------------
+//
+
+
+#include "BlockComparator.h"
+#include "util/CpuFeatures.h"
+
+#include <intrin.h>
+#include <emmintrin.h>
+#if _MSC_VER >= 1800
+#include <immintrin.h>
+#endif
+
+BlockComparator::BlockComparator()
+: m_compareRow(compareRowScalar)
+{
+  if (CpuFeatures::hasSse2()) {
+    m_compareRow = compareRowSse2;
+  }
+#if _MSC_VER >= 1800
+  if (CpuFeatures::hasAvx2()) {
+    m_compareRow = compareRowAvx2;
+  }
+#endif
+}
+
+bool BlockComparator::compare(const UINT8 *oldPixels, const UINT8 *newPixels,
+                              size_t bytesPerRow, size_t rowSize, int height,
+                              Change *change) const
+{
+  bool changed = false;
+  for (int y = 0; y < height; y++) {
+    size_t first, last;
+    if (m_compareRow(oldPixels, newPixels, rowSize, &first, &last)) {
+      if (!changed) {
+        changed = true;
+        change->top = y;
+        change->left = first;
+        change->right = last + 1;
+      } else {
+        if (first < change->left) {
+          change->left = first;
+        }
+        if (last + 1 > change->right) {
+          change->right = last + 1;
+        }
+      }
+      change->bottom = y + 1;
+    }
+    oldPixels += bytesPerRow;
+    newPixels += bytesPerRow;
+  }
+  return changed;
+}
+
+bool BlockComparator::compareRowScalar(const UINT8 *oldRow,
+                                       const UINT8 *newRow, size_t rowSize,
+                                       size_t *first, size_t *last)
+{
+  size_t i = 0;
+  while (i < rowSize && oldRow[i] == newRow[i]) {
+    i++;
+  }
+  if (i == rowSize) {
+    return false;
+  }
+  *first = i;
+  size_t j = rowSize - 1;
+  while (oldRow[j] == newRow[j]) {
+    j--;
+  }
+  *last = j;
+  return true;
+}
+
+bool BlockComparator::compareRowSse2(const UINT8 *oldRow, const UINT8 *newRow,
+                                     size_t rowSize, size_t *first,
+                                     size_t *last)
+{
+  // Bit i of a mask is set if byte i differs.
+  bool changed = false;
+  unsigned long bit;
+  size_t i = 0;
+  for (; i + 16 <= rowSize; i += 16) {
+    __m128i o = _mm_loadu_si128((const __m128i *)(oldRow + i));
+    __m128i n = _mm_loadu_si128((const __m128i *)(newRow + i));
+    unsigned int mask = ~_mm_movemask_epi8(_mm_cmpeq_epi8(o, n)) & 0xFFFF;
+    if (mask != 0) {
+      if (!changed) {
+        changed = true;
+        _BitScanForward(&bit, mask);
+        *first = i + bit;
+      }
+      _BitScanReverse(&bit, mask);
+      *last = i + bit;
+    }
+  }
+  for (; i < rowSize; i++) {
+    if (oldRow[i] != newRow[i]) {
+      if (!changed) {
+        changed = true;
+        *first = i;
+      }
+      *last = i;
+    }
+  }
+  return changed;
+}
+
+#if _MSC_VER >= 1800
+bool BlockComparator::compareRowAvx2(const UINT8 *oldRow, const UINT8 *newRow,
+                                     size_t rowSize, size_t *first,
+                                     size_t *last)
+{
+  bool changed = false;
+  unsigned long bit;
+  size_t i = 0;
+  for (; i + 32 <= rowSize; i += 32) {
+    __m256i o = _mm256_loadu_si256((const __m256i *)(oldRow + i));
+    __m256i n = _mm256_loadu_si256((const __m256i *)(newRow + i));
+    unsigned int mask = ~(unsigned int)_mm256_movemask_epi8(
+                          _mm256_cmpeq_epi8(o, n));
+    if (mask != 0) {
+      if (!changed) {
+        changed = true;
+        _BitScanForward(&bit, mask);
+        *first = i + bit;
+      }
+      _BitScanReverse(&bit, mask);
+      *last = i + bit;
+    }
+  }
+  // Leave the upper half of the registers clean for the SSE2 tail and for
+  // the caller, this is the only way out of the AVX part.
+  _mm256_zeroupper();
+  size_t tailFirst, tailLast;
+  if (i < rowSize &&
+      compareRowSse2(oldRow + i, newRow + i, rowSize - i,
+                     &tailFirst, &tailLast)) {
+    if (!changed) {
+      changed = true;
+      *first = i + tailFirst;
+    }
+    *last = i + tailLast;
+  }
+  return changed;
+}
+#else
+bool BlockComparator::compareRowAvx2(const UINT8 *oldRow, const UINT8 *newRow,
+                                     size_t rowSize, size_t *first,
+                                     size_t *last)
+{
+  return compareRowSse2(oldRow, newRow, rowSize, first, last);
+}
+#endif
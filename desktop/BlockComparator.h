@@ -0,0 +1,76 @@
+// Copyright (C) 2012 GlavSoft LLC.
+// All rights reserved.
+//
+//-------------------------------------------------------------------------
+// This file is part of the TightVNC software.  Please visit our Web site:
+//
+//                       http://www.tightvnc.com/
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+//-------------------------------------------------------------------------
+//
+
+
+#ifndef __BLOCKCOMPARATOR_H__
+#define __BLOCKCOMPARATOR_H__
+
+#include "util/inttypes.h"
+#include <stddef.h>
+
+// BlockComparator finds the pixels that differ between two frame buffers
+// within a block of pixels. The rows of the block are compared with the
+// widest vector instructions supported by the processor (AVX2 or SSE2),
+// the bounds of the differing bytes are found from the comparison masks
+// directly, without a second pass.
+class BlockComparator
+{
+public:
+  // Bounds of the differing bytes of a block, rows and bytes are counted
+  // from the top left corner of the block, right and bottom are exclusive.
+  struct Change
+  {
+    int top;
+    int bottom;
+    size_t left;
+    size_t right;
+  };
+
+  BlockComparator();
+
+  // Compares height rows of rowSize bytes, rows are bytesPerRow bytes
+  // apart in both buffers. Returns false if the blocks are equal, otherwise
+  // fills in the change and returns true.
+  bool compare(const UINT8 *oldPixels, const UINT8 *newPixels,
+               size_t bytesPerRow, size_t rowSize, int height,
+               Change *change) const;
+
+protected:
+  // Finds the first and the last differing bytes of the rows. Returns false
+  // if the rows are equal.
+  typedef bool (*CompareRowFunc)(const UINT8 *oldRow, const UINT8 *newRow,
+                                 size_t rowSize, size_t *first,
+                                 size_t *last);
+
+  static bool compareRowScalar(const UINT8 *oldRow, const UINT8 *newRow,
+                               size_t rowSize, size_t *first, size_t *last);
+  static bool compareRowSse2(const UINT8 *oldRow, const UINT8 *newRow,
+                             size_t rowSize, size_t *first, size_t *last);
+  static bool compareRowAvx2(const UINT8 *oldRow, const UINT8 *newRow,
+                             size_t rowSize, size_t *first, size_t *last);
+
+  CompareRowFunc m_compareRow;
+};
+
+#endif // __BLOCKCOMPARATOR_H__
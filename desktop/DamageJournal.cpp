@@ -0,0 +1,141 @@
+// Copyright (C) 2012 GlavSoft LLC.
+// All rights reserved.
+//
+//-------------------------------------------------------------------------
+// This file is part of the TightVNC software.  Please visit our Web site:
+//
+//                       http://www.tightvnc.com/
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+//-------------------------------------------------------------------------
+//
+
+#include "DamageJournal.h"
+#include "thread/AutoLock.h"
+
+#include <algorithm>
+
+DamageJournal::DamageJournal()
+: m_nextSeq(0)
+{
+}
+
+DamageJournal::~DamageJournal()
+{
+}
+
+void DamageJournal::append(const UpdateContainer *updateContainer)
+{
+  AutoLock al(&m_lock);
+
+  m_entries.push_back(Entry());
+  Entry *entry = &m_entries.back();
+  entry->seq = m_nextSeq++;
+  entry->update = *updateContainer;
+
+  compact();
+}
+
+void DamageJournal::addCursor(UINT64 *cursor)
+{
+  AutoLock al(&m_lock);
+  *cursor = m_nextSeq;
+  m_cursors.push_back(cursor);
+}
+
+void DamageJournal::removeCursor(UINT64 *cursor)
+{
+  AutoLock al(&m_lock);
+  m_cursors.erase(std::remove(m_cursors.begin(), m_cursors.end(), cursor),
+                  m_cursors.end());
+  compact();
+}
+
+void DamageJournal::skip(UINT64 *cursor)
+{
+  AutoLock al(&m_lock);
+  *cursor = m_nextSeq;
+}
+
+bool DamageJournal::fold(UINT64 *cursor, UpdateKeeper *updateKeeper,
+                         int dx, int dy)
+{
+  AutoLock al(&m_lock);
+
+  // The entries are sorted by their sequence numbers, skip the ones the
+  // cursor has passed.
+  size_t first = 0;
+  size_t last = m_entries.size();
+  while (first < last) {
+    size_t middle = (first + last) / 2;
+    if (m_entries[middle].seq < *cursor) {
+      first = middle + 1;
+    } else {
+      last = middle;
+    }
+  }
+
+  bool hasEntries = first < m_entries.size();
+  for (size_t i = first; i < m_entries.size(); i++) {
+    const UpdateContainer *update = &m_entries[i].update;
+    if (dx == 0 && dy == 0) {
+      updateKeeper->addUpdateContainer(update);
+    } else {
+      UpdateContainer updCont = *update;
+      updCont.videoRegion.translate(dx, dy);
+      updCont.changedRegion.translate(dx, dy);
+      updCont.translateCopies(dx, dy);
+      updateKeeper->addUpdateContainer(&updCont);
+    }
+  }
+  *cursor = m_nextSeq;
+
+  compact();
+  return hasEntries;
+}
+
+void DamageJournal::compact()
+{
+  UINT64 minCursor = m_nextSeq;
+  for (size_t i = 0; i < m_cursors.size(); i++) {
+    if (*m_cursors[i] < minCursor) {
+      minCursor = *m_cursors[i];
+    }
+  }
+  while (!m_entries.empty() && m_entries.front().seq < minCursor) {
+    m_entries.pop_front();
+  }
+  while (m_entries.size() > MAX_ENTRIES) {
+    merge(&m_entries[1].update, &m_entries[0].update);
+    m_entries.pop_front();
+  }
+}
+
+void DamageJournal::merge(UpdateContainer *dst, const UpdateContainer *older)
+{
+  // Cursors between the two entries would repeat the older moves, so
+  // the moves of both are sent as pixels.
+  dst->convertCopiesToChanges();
+  dst->changedRegion.add(&older->changedRegion);
+  dst->changedRegion.add(&older->copiedRegion);
+  dst->videoRegion.add(&older->videoRegion);
+  dst->screenSizeChanged = dst->screenSizeChanged || older->screenSizeChanged;
+  dst->cursorPosChanged = dst->cursorPosChanged || older->cursorPosChanged;
+  dst->cursorShapeChanged = dst->cursorShapeChanged ||
+                            older->cursorShapeChanged;
+  if (older->frameGeneration > dst->frameGeneration) {
+    dst->frameGeneration = older->frameGeneration;
+  }
+}
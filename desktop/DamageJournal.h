@@ -0,0 +1,91 @@
+// Copyright (C) 2012 GlavSoft LLC.
+// All rights reserved.
+//
+//-------------------------------------------------------------------------
+// This file is part of the TightVNC software.  Please visit our Web site:
+//
+//                       http://www.tightvnc.com/
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+//-------------------------------------------------------------------------
+//
+
+#ifndef __DAMAGEJOURNAL_H__
+#define __DAMAGEJOURNAL_H__
+
+#include "thread/LocalMutex.h"
+#include "util/inttypes.h"
+#include "UpdateContainer.h"
+#include "UpdateKeeper.h"
+#include <deque>
+#include <vector>
+
+// The class keeps the updates of the desktop for all update senders. Each
+// update is appended once as an entry with the next sequence number. A
+// sender has a cursor, the sequence number of the first entry it has not
+// taken yet, and folds the entries after its cursor into its own
+// UpdateKeeper only when it is about to send.
+//
+// Entries all the cursors have passed are dropped. When more than
+// MAX_ENTRIES entries are kept for a lagging cursor, the oldest two are
+// merged into one, and the CopyRect moves of the merged entry become
+// changed pixels. A cursor pointing inside a merged entry takes all of it,
+// which sends some pixels again but never repeats a move.
+//
+// All functions are thread safe.
+class DamageJournal
+{
+public:
+  DamageJournal();
+  virtual ~DamageJournal();
+
+  // Appends the update as a new entry.
+  void append(const UpdateContainer *updateContainer);
+
+  // Registers the cursor and sets it after the last entry. The cursor must
+  // be removed before it is destroyed.
+  void addCursor(UINT64 *cursor);
+  void removeCursor(UINT64 *cursor);
+
+  // Moves the cursor after the last entry without taking the entries.
+  void skip(UINT64 *cursor);
+
+  // Adds the entries after the cursor to the update keeper, translated by
+  // (dx, dy), and moves the cursor after the last entry. Returns false if
+  // there were no entries to add.
+  bool fold(UINT64 *cursor, UpdateKeeper *updateKeeper, int dx, int dy);
+
+  static const size_t MAX_ENTRIES = 64;
+
+protected:
+  struct Entry
+  {
+    // Sequence number of the last update in the entry.
+    UINT64 seq;
+    UpdateContainer update;
+  };
+
+  // Drops the entries every cursor has passed and merges the oldest ones
+  // while there are too many entries.
+  void compact();
+  static void merge(UpdateContainer *dst, const UpdateContainer *older);
+
+  std::deque<Entry> m_entries;
+  std::vector<UINT64 *> m_cursors;
+  UINT64 m_nextSeq;
+  LocalMutex m_lock;
+};
+
+#endif // __DAMAGEJOURNAL_H__
@@ -30,6 +30,7 @@
 #include "region/Region.h"
 #include "rfb/PixelFormat.h"
 #include "rfb/FrameBuffer.h"
+#include "SharedFrameBuffer.h"
 #include "fb-update-sender/UpdateRequestListener.h"
 
 // This class is a public interface to a desktop.
@@ -66,6 +67,12 @@ public:
   // If view port is out of central frame buffer bounds the function will return false.
   virtual bool updateExternalFrameBuffer(FrameBuffer *fb, const Region *region,
                                          const Rect *viewPort) = 0;
+
+  // Makes the snapshot reference the current pixels of the central frame
+  // buffer without copying them. The snapshot stays valid until the next
+  // call or its release(). Returns false if the frame buffer dimension or
+  // pixel format have changed since the previous call for the snapshot.
+  virtual bool acquireFrameSnapshot(FrameSnapshot *snapshot) = 0;
 };
 
 #endif // __DESKTOP_H__
@@ -253,6 +253,11 @@ void DesktopBaseImpl::sendUpdate()
 
     m_log->detail(_T("extracting updates from UpdateHandler"));
     m_updateHandler->extract(&updCont);
+    if (Configurator::getInstance()->getServerConfig()->isSharedFrameBufferEnabled()) {
+      m_updateHandler->publishFrameBuffer(&updCont);
+    } else {
+      m_updateHandler->freeSharedFrameBuffer();
+    }
   } catch (Exception &e) {
     m_log->info(_T("WinDesktop::sendUpdate() failed with error:%s"),
                e.getMessage());
@@ -315,3 +320,8 @@ bool DesktopBaseImpl::updateExternalFrameBuffer(FrameBuffer *fb, const Region *r
 {
   return m_updateHandler->updateExternalFrameBuffer(fb, region, viewPort);
 }
+
+bool DesktopBaseImpl::acquireFrameSnapshot(FrameSnapshot *snapshot)
+{
+  return m_updateHandler->acquireFrameSnapshot(snapshot);
+}
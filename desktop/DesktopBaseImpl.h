@@ -86,6 +86,7 @@ protected:
 
   virtual bool updateExternalFrameBuffer(FrameBuffer *fb, const Region *region,
                                          const Rect *viewPort);
+  virtual bool acquireFrameSnapshot(FrameSnapshot *snapshot);
 
   void sendUpdate();
 
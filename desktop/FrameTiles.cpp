@@ -0,0 +1,188 @@
+// Copyright (C) 2012 GlavSoft LLC.
+// All rights reserved.
+//
+//-------------------------------------------------------------------------
+// This file is part of the TightVNC software.  Please visit our Web site:
+//
+//                       http://www.tightvnc.com/
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+//-------------------------------------------------------------------------
+//
+
+
+#include "FrameTiles.h"
+#include <algorithm>
+#include <string.h>
+
+FrameTiles::FrameTiles()
+: m_numColumns(0)
+{
+}
+
+FrameTiles::~FrameTiles()
+{
+}
+
+void FrameTiles::setDimension(const Dimension *dim)
+{
+  m_dimension = *dim;
+  if (m_dimension.isEmpty()) {
+    m_numColumns = 0;
+    m_tiles.clear();
+    return;
+  }
+  m_numColumns = (m_dimension.width + TILE_SIZE - 1) / TILE_SIZE;
+  int numRows = (m_dimension.height + TILE_SIZE - 1) / TILE_SIZE;
+  Tile emptyTile = { 0, { 0, 0 } };
+  m_tiles.assign((size_t)m_numColumns * numRows, emptyTile);
+}
+
+size_t FrameTiles::getNumTiles() const
+{
+  return m_tiles.size();
+}
+
+Rect FrameTiles::getTileRect(size_t index) const
+{
+  int left = (int)(index % m_numColumns) * TILE_SIZE;
+  int top = (int)(index / m_numColumns) * TILE_SIZE;
+  return Rect(left, top,
+              min(left + TILE_SIZE, m_dimension.width),
+              min(top + TILE_SIZE, m_dimension.height));
+}
+
+UINT64 FrameTiles::getGeneration(size_t index) const
+{
+  return m_tiles[index].generation;
+}
+
+FrameTiles::Hash FrameTiles::getHash(size_t index) const
+{
+  return m_tiles[index].hash;
+}
+
+void FrameTiles::getTileIndices(const Region *region,
+                                std::vector<size_t> *tileIndices) const
+{
+  size_t firstIndex = tileIndices->size();
+  std::vector<Rect> rects;
+  region->getRectVector(&rects);
+  Rect fbRect = m_dimension.getRect();
+  for (size_t i = 0; i < rects.size(); i++) {
+    Rect r = rects[i].intersection(&fbRect);
+    if (r.isEmpty()) {
+      continue;
+    }
+    int right = (r.right - 1) / TILE_SIZE;
+    int bottom = (r.bottom - 1) / TILE_SIZE;
+    for (int row = r.top / TILE_SIZE; row <= bottom; row++) {
+      for (int column = r.left / TILE_SIZE; column <= right; column++) {
+        tileIndices->push_back((size_t)row * m_numColumns + column);
+      }
+    }
+  }
+  // Rectangles of a region may share tiles.
+  std::vector<size_t>::iterator first = tileIndices->begin() + firstIndex;
+  std::sort(first, tileIndices->end());
+  tileIndices->erase(std::unique(first, tileIndices->end()),
+                     tileIndices->end());
+}
+
+bool FrameTiles::updateTile(size_t index, const void *topLeft,
+                            size_t bytesPerRow, size_t bytesPerPixel,
+                            UINT64 generation)
+{
+  Rect tileRect = getTileRect(index);
+  Hash hash = hashTile((const UINT8 *)topLeft, bytesPerRow,
+                       tileRect.getWidth() * bytesPerPixel,
+                       tileRect.getHeight());
+  Tile *tile = &m_tiles[index];
+  if (tile->hash.isEqualTo(&hash) && tile->generation != 0) {
+    return false;
+  }
+  tile->hash = hash;
+  tile->generation = generation;
+  return true;
+}
+
+bool FrameTiles::Hash::isEqualTo(const Hash *other) const
+{
+  return low == other->low && high == other->high;
+}
+
+UINT64 FrameTiles::hashPixels(const UINT8 *topLeft, size_t bytesPerRow,
+                              size_t rowSize, int height)
+{
+  const UINT64 prime = 0x9E3779B97F4A7C15ULL;
+  UINT64 lanes[NUM_LANES];
+  hashLanes(topLeft, bytesPerRow, rowSize, height, lanes);
+  UINT64 hash = rowSize * height;
+  for (int l = 0; l < NUM_LANES; l++) {
+    hash = (hash ^ lanes[l]) * prime;
+    hash ^= hash >> 32;
+  }
+  return hash;
+}
+
+FrameTiles::Hash FrameTiles::hashTile(const UINT8 *topLeft,
+                                      size_t bytesPerRow, size_t rowSize,
+                                      int height)
+{
+  const UINT64 primes[2] = { 0x9E3779B97F4A7C15ULL, 0xC2B2AE3D27D4EB4FULL };
+  UINT64 lanes[NUM_LANES];
+  hashLanes(topLeft, bytesPerRow, rowSize, height, lanes);
+
+  // Each half depends on all the lanes, combined in a different order.
+  UINT64 halves[2] = { rowSize * height, ~(UINT64)(rowSize * height) };
+  for (int h = 0; h < 2; h++) {
+    for (int l = 0; l < NUM_LANES; l++) {
+      UINT64 lane = lanes[h == 0 ? l : NUM_LANES - 1 - l];
+      halves[h] = (halves[h] ^ lane) * primes[h];
+      halves[h] ^= halves[h] >> 32;
+    }
+    halves[h] ^= halves[h] >> 33;
+    halves[h] *= primes[1 - h];
+    halves[h] ^= halves[h] >> 29;
+  }
+  Hash hash = { halves[0], halves[1] };
+  return hash;
+}
+
+void FrameTiles::hashLanes(const UINT8 *topLeft, size_t bytesPerRow,
+                           size_t rowSize, int height, UINT64 *lanes)
+{
+  const UINT64 prime = 0x9E3779B97F4A7C15ULL;
+  // Independent lanes keep the multiplier busy.
+  for (int l = 0; l < NUM_LANES; l++) {
+    lanes[l] = l + 1;
+  }
+  const UINT8 *row = topLeft;
+  for (int y = 0; y < height; y++, row += bytesPerRow) {
+    size_t i = 0;
+    for (; i + NUM_LANES * sizeof(UINT64) <= rowSize;
+         i += NUM_LANES * sizeof(UINT64)) {
+      for (int l = 0; l < NUM_LANES; l++) {
+        UINT64 word;
+        memcpy(&word, row + i + l * sizeof(UINT64), sizeof(UINT64));
+        lanes[l] = (lanes[l] ^ word) * prime;
+        lanes[l] ^= lanes[l] >> 29;
+      }
+    }
+    for (; i < rowSize; i++) {
+      lanes[0] = (lanes[0] ^ row[i]) * prime;
+    }
+  }
+}
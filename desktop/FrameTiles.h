@@ -0,0 +1,105 @@
+// Copyright (C) 2012 GlavSoft LLC.
+// All rights reserved.
+//
+//-------------------------------------------------------------------------
+// This file is part of the TightVNC software.  Please visit our Web site:
+//
+//                       http://www.tightvnc.com/
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+//-------------------------------------------------------------------------
+//
+
+
+#ifndef __FRAMETILES_H__
+#define __FRAMETILES_H__
+
+#include "region/Dimension.h"
+#include "region/Region.h"
+#include "util/inttypes.h"
+#include <vector>
+
+// The class splits a frame buffer to TILE_SIZE x TILE_SIZE tiles and keeps
+// a generation number and a content hash for each tile. The generation of
+// a tile is the number of the frame buffer update that has changed the
+// tile content last time, so anyone who has seen the frame buffer as of
+// some generation knows which tiles have changed since then by comparing
+// numbers instead of regions. The hash is 128 bits long, so tiles with
+// equal hashes are taken as equal without comparing the pixels.
+class FrameTiles
+{
+public:
+  struct Hash
+  {
+    UINT64 low;
+    UINT64 high;
+
+    bool isEqualTo(const Hash *other) const;
+  };
+
+  FrameTiles();
+  virtual ~FrameTiles();
+
+  // Splits a frame buffer of the new dimension. All tiles get zero
+  // generation and hash.
+  void setDimension(const Dimension *dim);
+
+  size_t getNumTiles() const;
+  Rect getTileRect(size_t index) const;
+  UINT64 getGeneration(size_t index) const;
+  Hash getHash(size_t index) const;
+
+  // Appends to tileIndices the indices of the tiles intersecting the
+  // region, in ascending order and each index once.
+  void getTileIndices(const Region *region,
+                      std::vector<size_t> *tileIndices) const;
+
+  // Hashes the tile pixels starting at topLeft, rows are bytesPerRow bytes
+  // apart. If the hash differs from the previous one, the tile gets the
+  // generation passed. Returns true if the tile content has changed.
+  bool updateTile(size_t index, const void *topLeft, size_t bytesPerRow,
+                  size_t bytesPerPixel, UINT64 generation);
+
+  static const int TILE_SIZE = 64;
+
+  // Hashes height rows of rowSize bytes starting at topLeft, rows are
+  // bytesPerRow bytes apart. The 64-bit hash is good for finding matching
+  // lines to be compared afterwards, tiles are hashed by hashTile().
+  static UINT64 hashPixels(const UINT8 *topLeft, size_t bytesPerRow,
+                           size_t rowSize, int height);
+
+  // The same as hashPixels() with a 128-bit result.
+  static Hash hashTile(const UINT8 *topLeft, size_t bytesPerRow,
+                       size_t rowSize, int height);
+
+private:
+  static const int NUM_LANES = 4;
+
+  // Mixes the pixels into NUM_LANES independent lanes.
+  static void hashLanes(const UINT8 *topLeft, size_t bytesPerRow,
+                        size_t rowSize, int height, UINT64 *lanes);
+
+  struct Tile
+  {
+    UINT64 generation;
+    Hash hash;
+  };
+
+  Dimension m_dimension;
+  int m_numColumns;
+  std::vector<Tile> m_tiles;
+};
+
+#endif // __FRAMETILES_H__
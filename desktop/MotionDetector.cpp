@@ -0,0 +1,257 @@
+// Copyright (C) 2012 GlavSoft LLC.
+// All rights reserved.
+//
+//-------------------------------------------------------------------------
+// This file is part of the TightVNC software.  Please visit our Web site:
+//
+//                       http://www.tightvnc.com/
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+//-------------------------------------------------------------------------
+//
+
+
+#include "MotionDetector.h"
+#include "FrameTiles.h"
+
+#include <map>
+
+MotionDetector::MotionDetector()
+{
+}
+
+MotionDetector::~MotionDetector()
+{
+}
+
+bool MotionDetector::detect(const FrameBuffer *oldFb,
+                            const FrameBuffer *newFb,
+                            const Region *changedRegion,
+                            const Region *grabbedRegion,
+                            Rect *dstRect, Point *src)
+{
+  std::vector<Rect> rects;
+  changedRegion->getRectVector(&rects);
+  const Rect *seed = 0;
+  for (size_t i = 0; i < rects.size(); i++) {
+    if (seed == 0 || rects[i].area() > seed->area()) {
+      seed = &rects[i];
+    }
+  }
+  if (seed == 0) {
+    return false;
+  }
+
+  // The moved area is taken as the changes in the columns (or the rows) of
+  // the largest changed rectangle.
+  Rect bounds = changedRegion->getBounds();
+  for (int pass = 0; pass < 2; pass++) {
+    bool vertical = pass == 0;
+    Rect lines;
+    if (vertical) {
+      lines.setRect(seed->left, bounds.top, seed->right, bounds.bottom);
+    } else {
+      lines.setRect(bounds.left, seed->top, bounds.right, seed->bottom);
+    }
+    if (lines.getWidth() < MIN_SIZE || lines.getHeight() < MIN_SIZE) {
+      continue;
+    }
+    Region area(lines);
+    area.intersect(changedRegion);
+    Rect window = area.getBounds();
+    if (window.getWidth() < MIN_SIZE || window.getHeight() < MIN_SIZE) {
+      continue;
+    }
+    if (detectShift(oldFb, newFb, &window, vertical, dstRect, src)) {
+      Region notGrabbed(dstRect);
+      notGrabbed.subtract(grabbedRegion);
+      if (notGrabbed.isEmpty()) {
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+bool MotionDetector::detectShift(const FrameBuffer *oldFb,
+                                 const FrameBuffer *newFb,
+                                 const Rect *window, bool vertical,
+                                 Rect *dstRect, Point *src)
+{
+  // Lines are hashed across the middle half of the window only, that part
+  // is more likely to lie within the moved area than the whole window.
+  Rect strip(window);
+  if (vertical) {
+    strip.left += window->getWidth() / 4;
+    strip.right -= window->getWidth() / 4;
+  } else {
+    strip.top += window->getHeight() / 4;
+    strip.bottom -= window->getHeight() / 4;
+  }
+  hashLines(oldFb, &strip, vertical, &m_oldHashes, &m_oldFlat);
+  hashLines(newFb, &strip, vertical, &m_newHashes, &m_newFlat);
+  int numLines = (int)m_newHashes.size();
+
+  // Index the old lines by hash, a hash seen twice tells nothing.
+  std::map<UINT64, int> oldLines;
+  for (int i = 0; i < numLines; i++) {
+    if (!m_oldFlat[i]) {
+      std::pair<std::map<UINT64, int>::iterator, bool> inserted =
+        oldLines.insert(std::make_pair(m_oldHashes[i], i));
+      if (!inserted.second) {
+        inserted.first->second = -1;
+      }
+    }
+  }
+
+  // Each changed line found elsewhere in the old frame votes for its shift.
+  std::map<int, int> votes;
+  int shift = 0;
+  int maxVotes = 0;
+  for (int i = 0; i < numLines; i++) {
+    if (m_newFlat[i] || m_newHashes[i] == m_oldHashes[i]) {
+      continue;
+    }
+    std::map<UINT64, int>::const_iterator found = oldLines.find(m_newHashes[i]);
+    if (found != oldLines.end() && found->second >= 0) {
+      int lineShift = i - found->second;
+      int numVotes = ++votes[lineShift];
+      if (numVotes > maxVotes) {
+        maxVotes = numVotes;
+        shift = lineShift;
+      }
+    }
+  }
+  if (maxVotes < MIN_VOTES) {
+    return false;
+  }
+
+  // Find the longest run of lines equal at the shift.
+  int first = max(0, shift);
+  int last = min(numLines, numLines + shift);
+  int runStart = 0;
+  int runLength = 0;
+  int start = first;
+  for (int i = first; i <= last; i++) {
+    if (i < last && m_newHashes[i] == m_oldHashes[i - shift]) {
+      continue;
+    }
+    if (i - start > runLength) {
+      runStart = start;
+      runLength = i - start;
+    }
+    start = i + 1;
+  }
+  if (runLength < MIN_SIZE) {
+    return false;
+  }
+
+  int dx = vertical ? 0 : shift;
+  int dy = vertical ? shift : 0;
+  Rect dst;
+  if (vertical) {
+    dst.setRect(strip.left, strip.top + runStart,
+                strip.right, strip.top + runStart + runLength);
+  } else {
+    dst.setRect(strip.left + runStart, strip.top,
+                strip.left + runStart + runLength, strip.bottom);
+  }
+  if (!isMoved(oldFb, newFb, &dst, dx, dy)) {
+    return false;
+  }
+
+  // Widen the area across the lines as long as it moves as a whole.
+  Rect line;
+  if (vertical) {
+    for (; dst.left > window->left; dst.left--) {
+      line.setRect(dst.left - 1, dst.top, dst.left, dst.bottom);
+      if (!isMoved(oldFb, newFb, &line, dx, dy)) {
+        break;
+      }
+    }
+    for (; dst.right < window->right; dst.right++) {
+      line.setRect(dst.right, dst.top, dst.right + 1, dst.bottom);
+      if (!isMoved(oldFb, newFb, &line, dx, dy)) {
+        break;
+      }
+    }
+  } else {
+    for (; dst.top > window->top; dst.top--) {
+      line.setRect(dst.left, dst.top - 1, dst.right, dst.top);
+      if (!isMoved(oldFb, newFb, &line, dx, dy)) {
+        break;
+      }
+    }
+    for (; dst.bottom < window->bottom; dst.bottom++) {
+      line.setRect(dst.left, dst.bottom, dst.right, dst.bottom + 1);
+      if (!isMoved(oldFb, newFb, &line, dx, dy)) {
+        break;
+      }
+    }
+  }
+
+  *dstRect = dst;
+  src->setPoint(dst.left - dx, dst.top - dy);
+  return true;
+}
+
+void MotionDetector::hashLines(const FrameBuffer *fb, const Rect *window,
+                               bool vertical, std::vector<UINT64> *hashes,
+                               std::vector<UINT8> *flat)
+{
+  size_t bytesPerPixel = fb->getBytesPerPixel();
+  size_t bytesPerRow = fb->getBytesPerRow();
+  int width = window->getWidth();
+  int height = window->getHeight();
+  int numLines = vertical ? height : width;
+  hashes->resize(numLines);
+  flat->resize(numLines);
+  for (int i = 0; i < numLines; i++) {
+    if (vertical) {
+      const UINT8 *row =
+        (const UINT8 *)fb->getBufferPtr(window->left, window->top + i);
+      size_t rowSize = width * bytesPerPixel;
+      (*hashes)[i] = FrameTiles::hashPixels(row, bytesPerRow, rowSize, 1);
+      // All pixels equal their right neighbours.
+      (*flat)[i] = memcmp(row, row + bytesPerPixel,
+                          rowSize - bytesPerPixel) == 0;
+    } else {
+      const UINT8 *column =
+        (const UINT8 *)fb->getBufferPtr(window->left + i, window->top);
+      (*hashes)[i] = FrameTiles::hashPixels(column, bytesPerRow,
+                                            bytesPerPixel, height);
+      int y = 1;
+      while (y < height &&
+             memcmp(column + y * bytesPerRow, column, bytesPerPixel) == 0) {
+        y++;
+      }
+      (*flat)[i] = y == height;
+    }
+  }
+}
+
+bool MotionDetector::isMoved(const FrameBuffer *oldFb,
+                             const FrameBuffer *newFb,
+                             const Rect *rect, int dx, int dy)
+{
+  size_t rowSize = rect->getWidth() * newFb->getBytesPerPixel();
+  for (int y = rect->top; y < rect->bottom; y++) {
+    if (memcmp(oldFb->getBufferPtr(rect->left - dx, y - dy),
+               newFb->getBufferPtr(rect->left, y), rowSize) != 0) {
+      return false;
+    }
+  }
+  return true;
+}
@@ -0,0 +1,84 @@
+// Copyright (C) 2012 GlavSoft LLC.
+// All rights reserved.
+//
+//-------------------------------------------------------------------------
+// This file is part of the TightVNC software.  Please visit our Web site:
+//
+//                       http://www.tightvnc.com/
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+//-------------------------------------------------------------------------
+//
+
+
+#ifndef __MOTIONDETECTOR_H__
+#define __MOTIONDETECTOR_H__
+
+#include "rfb/FrameBuffer.h"
+#include "region/Region.h"
+#include "region/Point.h"
+#include "util/inttypes.h"
+#include <vector>
+
+// MotionDetector finds an area of the screen that has moved as a whole, as
+// it happens when the content of a browser, an editor or a terminal is
+// scrolled. It looks at pixels only, so it catches what window movement
+// detection cannot see.
+//
+// The rows (or the columns) of a changed area are hashed in the old and the
+// new frame, the shift most of the matching lines agree on is taken, and
+// the longest run of lines equal at that shift is verified pixel by pixel.
+// Lines of one color are ignored when voting as they match at any shift.
+class MotionDetector
+{
+public:
+  MotionDetector();
+  virtual ~MotionDetector();
+
+  // Looks for a moved area around the largest rectangle of changedRegion.
+  // The new frame is trusted only within grabbedRegion. Returns true if the
+  // area at *dstRect in newFb equals the area at *src in oldFb.
+  bool detect(const FrameBuffer *oldFb, const FrameBuffer *newFb,
+              const Region *changedRegion, const Region *grabbedRegion,
+              Rect *dstRect, Point *src);
+
+  // A moved area should be at least that wide and high.
+  static const int MIN_SIZE = 64;
+  // The shift should be agreed on by at least that many lines.
+  static const int MIN_VOTES = 4;
+
+private:
+  // Looks for rows moving up or down (vertical is true) or columns moving
+  // left or right within the window.
+  bool detectShift(const FrameBuffer *oldFb, const FrameBuffer *newFb,
+                   const Rect *window, bool vertical,
+                   Rect *dstRect, Point *src);
+
+  // Hashes the lines of the window and marks the lines of one color.
+  static void hashLines(const FrameBuffer *fb, const Rect *window,
+                        bool vertical, std::vector<UINT64> *hashes,
+                        std::vector<UINT8> *flat);
+  // Returns true if the rect of newFb equals the rect of oldFb shifted by
+  // (-dx, -dy).
+  static bool isMoved(const FrameBuffer *oldFb, const FrameBuffer *newFb,
+                      const Rect *rect, int dx, int dy);
+
+  std::vector<UINT64> m_oldHashes;
+  std::vector<UINT64> m_newHashes;
+  std::vector<UINT8> m_oldFlat;
+  std::vector<UINT8> m_newFlat;
+};
+
+#endif // __MOTIONDETECTOR_H__
@@ -37,6 +37,8 @@ Poller::Poller(UpdateKeeper *updateKeeper,
   m_screenGrabber(screenGrabber),
   m_backupFrameBuffer(backupFrameBuffer),
   m_fbMutex(frameBufferCriticalSection),
+  m_scanCycle(0),
+  m_scanInterval(0),
   m_log(log)
 {
   m_pollingRect.setRect(0, 0, 16, 16);
@@ -68,6 +70,8 @@ void Poller::execute()
 
   while (!isTerminating()) {
     Region region;
+    ServerConfig *config = Configurator::getInstance()->getServerConfig();
+    bool incremental = config->isIncrementalPollingEnabled();
 
     {
       AutoLock al(m_fbMutex);
@@ -76,28 +80,11 @@ void Poller::execute()
       if (!screenFrameBuffer->isEqualTo(m_backupFrameBuffer)) {
         m_updateKeeper->setScreenSizeChanged();
       } else {
-        m_log->info(_T("grabbing screen for polling"));
-        m_screenGrabber->grab();
-        m_log->info(_T("end of grabbing screen for polling"));
-
-        // Polling
-        int pollingWidth = m_pollingRect.getWidth();
-        int pollingHeight = m_pollingRect.getHeight();
-        int screenWidth = screenFrameBuffer->getDimension().width;
-        int screenHeight = screenFrameBuffer->getDimension().height;
-
-        Rect scanRect;
-        for (int iRow = 0; iRow < screenHeight; iRow += pollingHeight) {
-          for (int iCol = 0; iCol < screenWidth; iCol += pollingWidth) {
-            scanRect.setRect(iCol, iRow, min(iCol + pollingWidth, screenWidth),
-                             min(iRow + pollingHeight, screenHeight));
-            if (!screenFrameBuffer->cmpFrom(&scanRect, m_backupFrameBuffer,
-                                            scanRect.left, scanRect.top)) {
-              region.addRect(&scanRect);
-            }
-          }
+        if (incremental) {
+          pollScanlines(screenFrameBuffer, &region);
+        } else {
+          pollWholeScreen(screenFrameBuffer, &region);
         }
-
         m_updateKeeper->addChangedRegion(&region);
       }
     } // AutoLock
@@ -107,8 +94,96 @@ void Poller::execute()
       doUpdate();
     }
 
-    unsigned int pollInterval = Configurator::getInstance()->
-                                getServerConfig()->getPollingInterval();
+    unsigned int pollInterval = config->getPollingInterval();
+    if (incremental) {
+      pollInterval = getScanInterval(pollInterval, !region.isEmpty());
+    }
     m_intervalWaiter.waitForEvent(pollInterval);
   }
 }
+
+void Poller::pollWholeScreen(FrameBuffer *screenFrameBuffer,
+                             Region *changedRegion)
+{
+  m_log->info(_T("grabbing screen for polling"));
+  m_screenGrabber->grab();
+  m_log->info(_T("end of grabbing screen for polling"));
+
+  // Polling
+  int pollingWidth = m_pollingRect.getWidth();
+  int pollingHeight = m_pollingRect.getHeight();
+  int screenWidth = screenFrameBuffer->getDimension().width;
+  int screenHeight = screenFrameBuffer->getDimension().height;
+
+  Rect scanRect;
+  for (int iRow = 0; iRow < screenHeight; iRow += pollingHeight) {
+    for (int iCol = 0; iCol < screenWidth; iCol += pollingWidth) {
+      scanRect.setRect(iCol, iRow, min(iCol + pollingWidth, screenWidth),
+                       min(iRow + pollingHeight, screenHeight));
+      if (!screenFrameBuffer->cmpFrom(&scanRect, m_backupFrameBuffer,
+                                      scanRect.left, scanRect.top)) {
+        changedRegion->addRect(&scanRect);
+      }
+    }
+  }
+}
+
+void Poller::pollScanlines(FrameBuffer *screenFrameBuffer,
+                           Region *changedRegion)
+{
+  // Consecutive cycles take scanlines far from each other, so a change
+  // spanning several scanlines is found in a few cycles.
+  unsigned int offset = 0;
+  for (unsigned int bit = 1; bit < SCAN_CYCLES; bit <<= 1) {
+    offset = (offset << 1) | ((m_scanCycle & bit) != 0 ? 1 : 0);
+  }
+  m_scanCycle = (m_scanCycle + 1) % SCAN_CYCLES;
+
+  Rect screenRect = screenFrameBuffer->getDimension().getRect();
+  size_t bytesPerPixel = screenFrameBuffer->getBytesPerPixel();
+  std::vector<Rect> aroundRects;
+  for (int tileTop = 0; tileTop < screenRect.bottom; tileTop += TILE_SIZE) {
+    int y = min(tileTop + (int)offset, screenRect.bottom - 1);
+    Rect lineRect(0, y, screenRect.right, y + 1);
+    if (!m_screenGrabber->grab(&lineRect)) {
+      continue;
+    }
+    const UINT8 *newLine = (const UINT8 *)screenFrameBuffer->getBufferPtr(0, y);
+    const UINT8 *oldLine = (const UINT8 *)m_backupFrameBuffer->getBufferPtr(0, y);
+    for (int left = 0; left < screenRect.right; left += TILE_SIZE) {
+      int right = min(left + TILE_SIZE, screenRect.right);
+      if (memcmp(newLine + left * bytesPerPixel, oldLine + left * bytesPerPixel,
+                 (right - left) * bytesPerPixel) != 0) {
+        // The changed pixels are likely to continue in the neighbours.
+        Rect around(left - TILE_SIZE, tileTop - TILE_SIZE,
+                    right + TILE_SIZE, tileTop + 2 * TILE_SIZE);
+        aroundRects.push_back(around.intersection(&screenRect));
+      }
+    }
+  }
+  changedRegion->addRects(&aroundRects);
+  if (!aroundRects.empty()) {
+    m_log->debug(_T("Polling found changes in %d tiles at scanline offset %u"),
+                 (int)aroundRects.size(), offset);
+  }
+}
+
+unsigned int Poller::getScanInterval(unsigned int pollingInterval,
+                                     bool changed)
+{
+  // While the screen changes, all scanlines are checked in about the
+  // configured interval. An idle screen is checked IDLE_INTERVAL_DIVISOR
+  // times slower than that at most.
+  unsigned int activeInterval = max(pollingInterval / SCAN_CYCLES,
+                                    ServerConfig::MINIMAL_POLLING_INTERVAL);
+  unsigned int idleInterval = max(pollingInterval / IDLE_INTERVAL_DIVISOR,
+                                  activeInterval);
+  if (changed || m_scanInterval < activeInterval) {
+    m_scanInterval = activeInterval;
+  } else {
+    // Back off gradually.
+    m_scanInterval = min(m_scanInterval + m_scanInterval / 4 + 1,
+                         idleInterval);
+  }
+  return m_scanInterval;
+}
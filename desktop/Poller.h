@@ -29,11 +29,22 @@
 #include "ScreenGrabber.h"
 #include "rfb/FrameBuffer.h"
 #include "region/Rect.h"
+#include "region/Region.h"
 #include "win-system/WindowsEvent.h"
 #include "log-writer/LogWriter.h"
 
 #define DEFAULT_SLEEP_TIME 1000
 
+// Poller finds screen changes missed by other detectors by comparing the
+// screen with the backup frame buffer periodically.
+//
+// In the incremental mode a polling cycle grabs and compares one scanline
+// of each row of tiles, the next cycle takes another scanline, so all
+// scanlines are checked in SCAN_CYCLES cycles. The tiles where the
+// scanline has changed are reported together with their neighbours, and
+// the update filter grabs and compares them fully. Cycles are frequent
+// while the screen changes and get rarer when it's idle. In the exhaustive
+// mode each cycle grabs the whole screen and compares all tiles.
 class Poller : public UpdateDetector
 {
 public:
@@ -51,12 +62,28 @@ protected:
   virtual void onTerminate();
 
 private:
+  // Grabs the whole screen and adds the changed tiles to changedRegion.
+  void pollWholeScreen(FrameBuffer *screenFrameBuffer, Region *changedRegion);
+  // Grabs the scanlines of the current cycle and adds the tiles around the
+  // changed ones to changedRegion.
+  void pollScanlines(FrameBuffer *screenFrameBuffer, Region *changedRegion);
+  // Returns the interval before the next incremental cycle.
+  unsigned int getScanInterval(unsigned int pollingInterval, bool changed);
+
+  static const int TILE_SIZE = 32;
+  static const unsigned int SCAN_CYCLES = TILE_SIZE;
+  // The idle interval is the configured one divided by that.
+  static const unsigned int IDLE_INTERVAL_DIVISOR = 8;
+
   ScreenGrabber *m_screenGrabber;
   FrameBuffer *m_backupFrameBuffer;
   LocalMutex *m_fbMutex;
   Rect m_pollingRect;
   WindowsEvent m_intervalWaiter;
 
+  unsigned int m_scanCycle;
+  unsigned int m_scanInterval;
+
   LogWriter *m_log;
 };
 
@@ -0,0 +1,243 @@
+// Copyright (C) 2012 GlavSoft LLC.
+// All rights reserved.
+//
+//-------------------------------------------------------------------------
+// This file is part of the TightVNC software.  Please visit our Web site:
+//
+//                       http://www.tightvnc.com/
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+//-------------------------------------------------------------------------
+//
+
+
+#include "SharedFrameBuffer.h"
+#include "thread/AutoLock.h"
+#include <string.h>
+
+SharedFrameBuffer::SharedFrameBuffer()
+: m_generation(0)
+{
+}
+
+SharedFrameBuffer::~SharedFrameBuffer()
+{
+  // Snapshots may still reference the bands, they will free them.
+  releaseBands();
+}
+
+UINT64 SharedFrameBuffer::update(const FrameBuffer *srcFb, const Region *region)
+{
+  AutoLock al(&m_lock);
+
+  Dimension dim = srcFb->getDimension();
+  PixelFormat pf = srcFb->getPixelFormat();
+  Region toCopy = *region;
+  if (!dim.isEqualTo(&m_dimension) || !pf.isEqualTo(&m_pixelFormat)) {
+    releaseBands();
+    m_dimension = dim;
+    m_pixelFormat = pf;
+    m_tiles.setDimension(&dim);
+    size_t numBands = (dim.height + BAND_HEIGHT - 1) / BAND_HEIGHT;
+    for (size_t i = 0; i < numBands; i++) {
+      m_bands.push_back(allocBand(getBandSize()));
+    }
+    toCopy.addRect(&dim.getRect());
+  }
+  Rect fbRect = dim.getRect();
+  toCopy.crop(&fbRect);
+
+  size_t pixelSize = pf.bitsPerPixel / 8;
+  size_t bytesPerRow = srcFb->getBytesPerRow();
+  std::vector<Rect> rects;
+  toCopy.getRectVector(&rects);
+  for (size_t i = 0; i < rects.size(); i++) {
+    const Rect *r = &rects[i];
+    size_t lineSize = r->getWidth() * pixelSize;
+    int bottom;
+    for (int top = r->top; top < r->bottom; top = bottom) {
+      size_t bandIndex = top / BAND_HEIGHT;
+      int bandTop = (int)bandIndex * BAND_HEIGHT;
+      int bandBottom = min(bandTop + BAND_HEIGHT, dim.height);
+      bottom = min(r->bottom, bandBottom);
+      bool overwriteAll = r->left == 0 && r->right == dim.width &&
+                          top == bandTop && bottom == bandBottom;
+
+      Band *band = getWritableBand(bandIndex, overwriteAll);
+      UINT8 *dst = band->pixels + (top - bandTop) * bytesPerRow +
+                   r->left * pixelSize;
+      const UINT8 *src = (const UINT8 *)srcFb->getBufferPtr(r->left, top);
+      for (int y = top; y < bottom; y++, dst += bytesPerRow,
+                                         src += bytesPerRow) {
+        memcpy(dst, src, lineSize);
+      }
+    }
+  }
+
+  // Pixels may be written over with the same values, the generation grows
+  // only if the content of a tile has changed.
+  std::vector<size_t> tileIndices;
+  m_tiles.getTileIndices(&toCopy, &tileIndices);
+  UINT64 generation = m_generation + 1;
+  bool changed = false;
+  for (size_t i = 0; i < tileIndices.size(); i++) {
+    Rect tileRect = m_tiles.getTileRect(tileIndices[i]);
+    const UINT8 *topLeft = m_bands[tileRect.top / BAND_HEIGHT]->pixels +
+                           tileRect.left * pixelSize;
+    if (m_tiles.updateTile(tileIndices[i], topLeft, bytesPerRow, pixelSize,
+                           generation)) {
+      changed = true;
+    }
+  }
+  if (changed) {
+    m_generation = generation;
+  }
+  return m_generation;
+}
+
+void SharedFrameBuffer::clear()
+{
+  AutoLock al(&m_lock);
+  releaseBands();
+  m_dimension.setDim(0, 0);
+  m_tiles.setDimension(&m_dimension);
+}
+
+SharedFrameBuffer::Band *SharedFrameBuffer::allocBand(size_t size)
+{
+  Band *band = new Band;
+  band->refCount = 1;
+  band->pixels = new UINT8[size];
+  return band;
+}
+
+void SharedFrameBuffer::addRef(Band *band)
+{
+  InterlockedIncrement(&band->refCount);
+}
+
+void SharedFrameBuffer::release(Band *band)
+{
+  if (InterlockedDecrement(&band->refCount) == 0) {
+    delete[] band->pixels;
+    delete band;
+  }
+}
+
+void SharedFrameBuffer::releaseBands()
+{
+  for (size_t i = 0; i < m_bands.size(); i++) {
+    release(m_bands[i]);
+  }
+  m_bands.clear();
+}
+
+SharedFrameBuffer::Band *SharedFrameBuffer::getWritableBand(size_t bandIndex,
+                                                            bool overwriteAll)
+{
+  Band *band = m_bands[bandIndex];
+  // Only this object references the band, nobody reads it.
+  if (band->refCount == 1) {
+    return band;
+  }
+  // A snapshot is still encoding from the band, leave it to the snapshot.
+  size_t size = getBandSize();
+  Band *newBand = allocBand(size);
+  if (!overwriteAll) {
+    memcpy(newBand->pixels, band->pixels, size);
+  }
+  release(band);
+  m_bands[bandIndex] = newBand;
+  return newBand;
+}
+
+size_t SharedFrameBuffer::getBandSize() const
+{
+  return (size_t)BAND_HEIGHT * m_dimension.width *
+         (m_pixelFormat.bitsPerPixel / 8);
+}
+
+//--------------------------------------------------------------------------//
+
+FrameSnapshot::FrameSnapshot()
+{
+}
+
+FrameSnapshot::~FrameSnapshot()
+{
+  release();
+}
+
+bool FrameSnapshot::acquire(SharedFrameBuffer *source)
+{
+  std::vector<SharedFrameBuffer::Band *> bands;
+  bool sameProperties;
+  {
+    AutoLock al(&source->m_lock);
+    sameProperties = m_dimension.isEqualTo(&source->m_dimension) &&
+                    m_pixelFormat.isEqualTo(&source->m_pixelFormat);
+    bands = source->m_bands;
+    for (size_t i = 0; i < bands.size(); i++) {
+      SharedFrameBuffer::addRef(bands[i]);
+    }
+    setPropertiesWithoutResize(&source->m_dimension, &source->m_pixelFormat);
+    m_tiles = source->m_tiles;
+  }
+  // The bands that remain the same are referenced twice by now, so they are
+  // not freed here.
+  for (size_t i = 0; i < m_bands.size(); i++) {
+    SharedFrameBuffer::release(m_bands[i]);
+  }
+  m_bands.swap(bands);
+  return sameProperties;
+}
+
+void FrameSnapshot::release()
+{
+  for (size_t i = 0; i < m_bands.size(); i++) {
+    SharedFrameBuffer::release(m_bands[i]);
+  }
+  m_bands.clear();
+}
+
+const FrameTiles *FrameSnapshot::getTiles() const
+{
+  return &m_tiles;
+}
+
+void FrameSnapshot::cutAtBands(std::vector<Rect> *rects) const
+{
+  const int bandHeight = SharedFrameBuffer::BAND_HEIGHT;
+  std::vector<Rect> result;
+  result.reserve(rects->size());
+  for (size_t i = 0; i < rects->size(); i++) {
+    const Rect *r = &(*rects)[i];
+    int bottom;
+    for (int top = r->top; top < r->bottom; top = bottom) {
+      bottom = min(r->bottom, (top / bandHeight + 1) * bandHeight);
+      result.push_back(Rect(r->left, top, r->right, bottom));
+    }
+  }
+  rects->swap(result);
+}
+
+void *FrameSnapshot::getBufferPtr(int x, int y) const
+{
+  const int bandHeight = SharedFrameBuffer::BAND_HEIGHT;
+  _ASSERT(y >= 0 && (size_t)(y / bandHeight) < m_bands.size());
+  UINT8 *pixels = m_bands[y / bandHeight]->pixels;
+  return pixels + (y % bandHeight) * getBytesPerRow() +
+         x * getBytesPerPixel();
+}
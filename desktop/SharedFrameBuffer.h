@@ -0,0 +1,135 @@
+// Copyright (C) 2012 GlavSoft LLC.
+// All rights reserved.
+//
+//-------------------------------------------------------------------------
+// This file is part of the TightVNC software.  Please visit our Web site:
+//
+//                       http://www.tightvnc.com/
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+//-------------------------------------------------------------------------
+//
+
+
+#ifndef __SHAREDFRAMEBUFFER_H__
+#define __SHAREDFRAMEBUFFER_H__
+
+#include "region/Region.h"
+#include "rfb/FrameBuffer.h"
+#include "thread/LocalMutex.h"
+#include "FrameTiles.h"
+#include <vector>
+
+class FrameSnapshot;
+
+// The class keeps one copy of the desktop frame buffer for all update
+// senders. The frame buffer is split to full-width bands of BAND_HEIGHT
+// rows, each band is a reference counted block of memory. The rows of a
+// band follow each other, so any rectangle which does not cross a band
+// border can be read the same way as from a plain FrameBuffer.
+//
+// Senders reference the current bands through a FrameSnapshot while they
+// encode an update. A band referenced by a snapshot is never modified:
+// update() writes into a new copy of it instead, and the old version lives
+// until the last snapshot releases it. Bands nobody encodes from are
+// updated in place, so in the common case the desktop pixels are copied
+// once regardless of the number of senders.
+//
+// A band is one row of tiles of the FrameTiles that track the generation
+// and the content hash of each tile.
+//
+// All functions are thread safe.
+class SharedFrameBuffer
+{
+public:
+  SharedFrameBuffer();
+  virtual ~SharedFrameBuffer();
+
+  // Copies the region from srcFb. If the dimension or the pixel format of
+  // srcFb differ from the current ones, all bands are replaced and the
+  // whole srcFb is copied. Returns the generation of the frame buffer
+  // after the update, it grows each time the content of a tile changes.
+  UINT64 update(const FrameBuffer *srcFb, const Region *region);
+
+  // Releases all bands. The next update() copies the whole frame buffer.
+  void clear();
+
+  static const int BAND_HEIGHT = FrameTiles::TILE_SIZE;
+
+protected:
+  friend class FrameSnapshot;
+
+  struct Band
+  {
+    volatile LONG refCount;
+    UINT8 *pixels;
+  };
+
+  static Band *allocBand(size_t size);
+  static void addRef(Band *band);
+  static void release(Band *band);
+
+  void releaseBands();
+  // Returns the band number bandIndex ready to be written.
+  Band *getWritableBand(size_t bandIndex, bool overwriteAll);
+  size_t getBandSize() const;
+
+  Dimension m_dimension;
+  PixelFormat m_pixelFormat;
+  std::vector<Band *> m_bands;
+  FrameTiles m_tiles;
+  UINT64 m_generation;
+  LocalMutex m_lock;
+};
+
+// The class is a read only frame buffer made of the bands of a
+// SharedFrameBuffer referenced at the time of acquire(). Pixels must be
+// read with getBufferPtr() and rows are getBytesPerRow() bytes apart, but
+// only within one band, so rectangles read from the snapshot must be cut by
+// cutAtBands() first. getBuffer() returns 0 and the functions modifying the
+// frame buffer must not be used.
+class FrameSnapshot : public FrameBuffer
+{
+public:
+  FrameSnapshot();
+  virtual ~FrameSnapshot();
+
+  // Releases the bands referenced before and references the current bands
+  // of source. Returns false if the dimension or the pixel format of the
+  // snapshot has changed.
+  bool acquire(SharedFrameBuffer *source);
+
+  // Releases the referenced bands, the snapshot becomes empty.
+  void release();
+
+  // Cuts the rectangles so that no rectangle crosses a band border.
+  void cutAtBands(std::vector<Rect> *rects) const;
+
+  // Returns the generations and hashes of the tiles as of acquire().
+  const FrameTiles *getTiles() const;
+
+  virtual void *getBufferPtr(int x, int y) const;
+
+protected:
+  std::vector<SharedFrameBuffer::Band *> m_bands;
+  FrameTiles m_tiles;
+
+private:
+  // Do not allow copying objects.
+  FrameSnapshot(const FrameSnapshot &other);
+  FrameSnapshot &operator=(const FrameSnapshot &other);
+};
+
+#endif // __SHAREDFRAMEBUFFER_H__
@@ -24,6 +24,32 @@
 
 #include "UpdateContainer.h"
 
+#include <algorithm>
+
+void CopyMove::getRectsInCopyOrder(std::vector<Rect> *rects) const
+{
+  dstRegion.getRectVector(rects);
+
+  // The rectangles are banded top to bottom and left to right. The ones
+  // nearer to the source go last.
+  bool bottomUp = srcOffset.y < 0;
+  bool rightToLeft = srcOffset.x < 0;
+  if (bottomUp) {
+    std::reverse(rects->begin(), rects->end());
+  }
+  if (bottomUp != rightToLeft) {
+    std::vector<Rect>::iterator bandStart = rects->begin();
+    while (bandStart != rects->end()) {
+      std::vector<Rect>::iterator bandEnd = bandStart + 1;
+      while (bandEnd != rects->end() && bandEnd->top == bandStart->top) {
+        bandEnd++;
+      }
+      std::reverse(bandStart, bandEnd);
+      bandStart = bandEnd;
+    }
+  }
+}
+
 UpdateContainer::UpdateContainer()
 {
   clear();
@@ -41,8 +67,9 @@ void UpdateContainer::clear()
   screenSizeChanged = false;
   cursorPosChanged = false;
   cursorShapeChanged = false;
-  copySrc.clear();
+  copyMoves.clear();
   cursorPos.clear();
+  frameGeneration = 0;
 }
 
 UpdateContainer& UpdateContainer::operator=(const UpdateContainer& src)
@@ -53,12 +80,93 @@ UpdateContainer& UpdateContainer::operator=(const UpdateContainer& src)
   screenSizeChanged   = src.screenSizeChanged;
   cursorPosChanged    = src.cursorPosChanged;
   cursorShapeChanged  = src.cursorShapeChanged;
-  copySrc             = src.copySrc;
+  copyMoves           = src.copyMoves;
   cursorPos           = src.cursorPos;
+  frameGeneration     = src.frameGeneration;
 
   return *this;
 }
 
+void UpdateContainer::swap(UpdateContainer *other)
+{
+  copiedRegion.swap(&other->copiedRegion);
+  changedRegion.swap(&other->changedRegion);
+  videoRegion.swap(&other->videoRegion);
+  std::swap(screenSizeChanged, other->screenSizeChanged);
+  std::swap(cursorPosChanged, other->cursorPosChanged);
+  std::swap(cursorShapeChanged, other->cursorShapeChanged);
+  copyMoves.swap(other->copyMoves);
+  std::swap(cursorPos, other->cursorPos);
+  std::swap(frameGeneration, other->frameGeneration);
+}
+
+void UpdateContainer::addCopyMove(const Region *dstRegion,
+                                  const Point *srcOffset)
+{
+  if (dstRegion->isEmpty()) {
+    return;
+  }
+  CopyMove move;
+  move.dstRegion = *dstRegion;
+  move.srcOffset = *srcOffset;
+  copyMoves.push_back(move);
+  copiedRegion.add(dstRegion);
+}
+
+void UpdateContainer::cropCopies(const Rect *rect)
+{
+  for (size_t i = 0; i < copyMoves.size(); i++) {
+    copyMoves[i].dstRegion.crop(rect);
+  }
+  copiedRegion.crop(rect);
+  eraseEmptyCopies();
+}
+
+void UpdateContainer::subtractFromCopies(const Region *region)
+{
+  for (size_t i = 0; i < copyMoves.size(); i++) {
+    copyMoves[i].dstRegion.subtract(region);
+  }
+  copiedRegion.subtract(region);
+  eraseEmptyCopies();
+}
+
+void UpdateContainer::translateCopies(int dx, int dy)
+{
+  // The offsets are relative and stay the same.
+  for (size_t i = 0; i < copyMoves.size(); i++) {
+    copyMoves[i].dstRegion.translate(dx, dy);
+  }
+  copiedRegion.translate(dx, dy);
+}
+
+void UpdateContainer::convertCopiesToChanges()
+{
+  changedRegion.add(&copiedRegion);
+  clearCopies();
+}
+
+void UpdateContainer::clearCopies()
+{
+  copyMoves.clear();
+  copiedRegion.clear();
+}
+
+void UpdateContainer::eraseEmptyCopies()
+{
+  size_t numMoves = 0;
+  for (size_t i = 0; i < copyMoves.size(); i++) {
+    if (!copyMoves[i].dstRegion.isEmpty()) {
+      if (numMoves != i) {
+        copyMoves[numMoves].dstRegion.swap(&copyMoves[i].dstRegion);
+        copyMoves[numMoves].srcOffset = copyMoves[i].srcOffset;
+      }
+      numMoves++;
+    }
+  }
+  copyMoves.resize(numMoves);
+}
+
 bool UpdateContainer::isEmpty() const
 {
   return copiedRegion.isEmpty() &&
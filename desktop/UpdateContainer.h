@@ -27,6 +27,21 @@
 
 #include "region/Region.h"
 #include "region/Point.h"
+#include "util/inttypes.h"
+
+#include <vector>
+
+// Pixels moved on the screen: every pixel of dstRegion takes the value of
+// the pixel at srcOffset from it.
+struct CopyMove
+{
+  Region dstRegion;
+  Point srcOffset;
+
+  // Returns the destination rectangles in the order they can be copied one
+  // after another without overwriting the source of the following ones.
+  void getRectsInCopyOrder(std::vector<Rect> *rects) const;
+};
 
 class UpdateContainer
 {
@@ -36,18 +51,42 @@ public:
 
   UpdateContainer(const UpdateContainer& updateContainer) { *this = updateContainer; }
   UpdateContainer &operator=(const UpdateContainer& src);
+  // Exchanges contents with another container, the regions are not copied.
+  void swap(UpdateContainer *other);
 
+  // Union of the destinations of copyMoves. Both are changed together
+  // through the copy functions below.
   Region copiedRegion;
   Region changedRegion;
   Region videoRegion;
   bool screenSizeChanged;
   bool cursorPosChanged;
   bool cursorShapeChanged;
-  Point copySrc;
+  // Moves to apply in this order, each one reads the screen left by the
+  // previous ones. The changed region is sent after all the moves.
+  std::vector<CopyMove> copyMoves;
   Point cursorPos;
+  // Generation of the shared frame buffer that has all the changes made so
+  // far, zero if the frame buffer is not shared.
+  UINT64 frameGeneration;
+
+  // Further moves are sent as changed pixels.
+  static const size_t MAX_COPY_MOVES = 16;
+
+  // Appends a move, the caller must have composed it with changedRegion.
+  void addCopyMove(const Region *dstRegion, const Point *srcOffset);
+  void cropCopies(const Rect *rect);
+  void subtractFromCopies(const Region *region);
+  void translateCopies(int dx, int dy);
+  // Drops the moves and sends their destinations as changed pixels.
+  void convertCopiesToChanges();
+  void clearCopies();
 
   void clear();
   bool isEmpty() const;
+
+private:
+  void eraseEmptyCopies();
 };
 
 #endif // __UPDATECONTAINER_H__
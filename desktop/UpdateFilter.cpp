@@ -24,8 +24,13 @@
 
 #include "UpdateFilter.h"
 #include "util/CommonHeader.h"
+#include "server-config-lib/Configurator.h"
 
 static const int BLOCK_SIZE = 32;
+// Smaller regions are compared by the calling thread alone.
+static const int MIN_PARALLEL_AREA = 256 * 256;
+// Memory bandwidth is the limit beyond that.
+static const size_t MAX_STRIPES = 8;
 
 UpdateFilter::UpdateFilter(ScreenDriver *screenDriver,
                            FrameBuffer *frameBuffer,
@@ -35,12 +40,26 @@ UpdateFilter::UpdateFilter(ScreenDriver *screenDriver,
   m_frameBuffer(frameBuffer),
   m_fbMutex(frameBufferCriticalSection),
   m_grabOptimizator(log),
+  m_stripePool(0),
   m_log(log)
 {
+  size_t numStripes = min(ThreadPool::getNumberOfProcessors(), MAX_STRIPES);
+  if (numStripes > 1) {
+    m_stripePool = new ThreadPool(numStripes - 1);
+  } else {
+    numStripes = 1;
+  }
+  for (size_t i = 0; i < numStripes; i++) {
+    m_stripeTasks.push_back(new StripeTask);
+  }
 }
 
 UpdateFilter::~UpdateFilter()
 {
+  delete m_stripePool;
+  for (size_t i = 0; i < m_stripeTasks.size(); i++) {
+    delete m_stripeTasks[i];
+  }
 }
 
 void UpdateFilter::filter(UpdateContainer *updateContainer)
@@ -65,10 +84,14 @@ void UpdateFilter::filter(UpdateContainer *updateContainer)
 
   // Reproduce CopyRect operations in m_frameBuffer.
   m_log->debug(_T("UpdateFilter::filter : Reproduce CopyRect operations in m_frameBuffer"));
-  updateContainer->copiedRegion.getRectVector(&rects);
-  Point *src = &updateContainer->copySrc;
-  for (iRect = rects.begin(); iRect < rects.end(); iRect++) {
-    m_frameBuffer->move(&(*iRect), src->x, src->y);
+  const std::vector<CopyMove> *moves = &updateContainer->copyMoves;
+  for (size_t i = 0; i < moves->size(); i++) {
+    const Point *offset = &(*moves)[i].srcOffset;
+    (*moves)[i].getRectsInCopyOrder(&rects);
+    for (iRect = rects.begin(); iRect < rects.end(); iRect++) {
+      m_frameBuffer->move(&(*iRect), iRect->left + offset->x,
+                          iRect->top + offset->y);
+    }
   }
 
 
@@ -101,16 +124,35 @@ void UpdateFilter::filter(UpdateContainer *updateContainer)
   // Filtering
   pt1 = m_log->checkPoint(_T("filtering changed"));
   updateContainer->changedRegion.clear();
-  Rect *rect;
-  for (iRect = rects.begin(); iRect < rects.end(); iRect++) {
-    rect = &(*iRect);
-    getChangedRegion(&updateContainer->changedRegion, rect);
+  getChangedRegion(&updateContainer->changedRegion, &toCheck);
+
+  // Look for scrolled content among the remaining changes. The moved pixels
+  // are verified, so they are reproduced in m_frameBuffer and are not
+  // changed any more. The move goes after the known ones.
+  if (updateContainer->copyMoves.size() < UpdateContainer::MAX_COPY_MOVES &&
+      Configurator::getInstance()->getServerConfig()->
+        isMotionDetectionEnabled()) {
+    Rect dstRect;
+    Point src;
+    if (m_motionDetector.detect(m_frameBuffer, screenFrameBuffer,
+                                &updateContainer->changedRegion, &toCheck,
+                                &dstRect, &src)) {
+      m_log->debug(_T("Detected motion of %dx%d pixels from (%d,%d)")
+                   _T(" to (%d,%d)"),
+                   dstRect.getWidth(), dstRect.getHeight(),
+                   src.x, src.y, dstRect.left, dstRect.top);
+      m_frameBuffer->move(&dstRect, src.x, src.y);
+      Region dstRegion(dstRect);
+      Point srcOffset(src.x - dstRect.left, src.y - dstRect.top);
+      updateContainer->changedRegion.subtract(&dstRegion);
+      updateContainer->addCopyMove(&dstRegion, &srcOffset);
+    }
   }
 
   // Copy actually changed pixels into m_frameBuffer.
   updateContainer->changedRegion.getRectVector(&rects);
   for (iRect = rects.begin(); iRect < rects.end(); iRect++) {
-    rect = &(*iRect);
+    Rect *rect = &(*iRect);
     m_frameBuffer->copyFrom(rect, screenFrameBuffer, rect->left, rect->top);
   }
   pt2 = m_log->checkPoint(_T("after filtering changed"));
@@ -122,188 +164,124 @@ void UpdateFilter::filter(UpdateContainer *updateContainer)
   m_log->debug(_T("After filtering changed %f process time, %f kernel time, %f wall clock time"), pt2.process, pt2.kernel, dt);
 }
 
-void UpdateFilter::getChangedRegion(Region *rgn, const Rect *rect)
+void UpdateFilter::getChangedRegion(Region *changedRegion,
+                                    const Region *toCheck)
 {
-  
-  const UINT bytesPerPixel = m_frameBuffer->getBytesPerPixel();
-  const int bytes_per_scanline = (rect->right - rect->left) * bytesPerPixel;
-
-  const int bytesPerRow = m_frameBuffer->getBytesPerRow();
-  const int offset = rect->top * bytesPerRow + rect->left * bytesPerPixel;
-  unsigned char *o_ptr = (unsigned char *)m_frameBuffer->getBuffer() + offset;
-  unsigned char *n_ptr = (unsigned char *)m_screenDriver->getScreenBuffer()->getBuffer() + offset;
-
-  Rect new_rect = rect;
+  Rect bounds = toCheck->getBounds();
+  if (bounds.isEmpty()) {
+    return;
+  }
+  std::vector<Rect> rects;
+  toCheck->getRectVector(&rects);
+  size_t numStripes = 1;
+  if (Rect::totalArea(rects) >= MIN_PARALLEL_AREA) {
+    numStripes = m_stripeTasks.size();
+  }
 
-  // Fast processing for small rectangles
-  if ( rect->right - rect->left <= BLOCK_SIZE &&
-       rect->bottom - rect->top <= BLOCK_SIZE ) {
-      for (int y = rect->top; y < rect->bottom; y++) {
-        if (memcmp(o_ptr, n_ptr, bytes_per_scanline) != 0) {
-          new_rect.top = y;
-          updateChangedSubRect(rgn, &new_rect);
-          break;
-        }
-        o_ptr += bytesPerRow;
-        n_ptr += bytesPerRow;
-      }
-      return;
+  // Stripes consist of whole rows of blocks.
+  int top = bounds.top / BLOCK_SIZE * BLOCK_SIZE;
+  int numBlockRows = (bounds.bottom - top + BLOCK_SIZE - 1) / BLOCK_SIZE;
+  int blockRowsPerStripe = (numBlockRows + (int)numStripes - 1) /
+                           (int)numStripes;
+  numStripes = (numBlockRows + blockRowsPerStripe - 1) / blockRowsPerStripe;
+  int stripeHeight = blockRowsPerStripe * BLOCK_SIZE;
+  const FrameBuffer *screenFb = m_screenDriver->getScreenBuffer();
+  for (size_t i = 0; i < numStripes; i++) {
+    Rect stripeRect(bounds.left, top + (int)i * stripeHeight, bounds.right,
+                    min(top + ((int)i + 1) * stripeHeight, bounds.bottom));
+    m_stripeTasks[i]->setStripe(toCheck, &stripeRect, m_frameBuffer,
+                                screenFb, &m_comparator);
   }
+  m_log->debug(_T("Comparing %d rectangles in %d stripes"),
+               (int)rects.size(), (int)numStripes);
 
-  // Process bigger rectangles
-  new_rect.top = -1;
-  for (int y = rect->top; y < rect->bottom; y++) {
-    if (memcmp(o_ptr, n_ptr, bytes_per_scanline) != 0) {
-      if (new_rect.top == -1) {
-        new_rect.top = y;
-      }
-      // Skip a number of lines after a non-matched one
-      int n = BLOCK_SIZE / 2 - 1;
-      y += n;
-      o_ptr += n * bytesPerRow;
-      n_ptr += n * bytesPerRow;
-    } else {
-      if (new_rect.top != -1) {
-        new_rect.bottom = y;
-        updateChangedRect(rgn, &new_rect);
-        new_rect.top = -1;
-      }
-    }
-    o_ptr += bytesPerRow;
-    n_ptr += bytesPerRow;
+  for (size_t i = 1; i < numStripes; i++) {
+    m_stripePool->addTask(m_stripeTasks[i]);
   }
-  if (new_rect.top != -1) {
-    new_rect.bottom = rect->bottom;
-    updateChangedRect(rgn, &new_rect);
+  m_stripeTasks[0]->run();
+  for (size_t i = 1; i < numStripes; i++) {
+    m_stripePool->waitForTask(m_stripeTasks[i]);
   }
-}
 
-void UpdateFilter::updateChangedRect(Region *rgn, const Rect *rect)
-{
-  // Pass small rectangles directly to updateChangedSubRect
-  if ( rect->right - rect->left <= BLOCK_SIZE &&
-       rect->bottom - rect->top <= BLOCK_SIZE ) {
-      updateChangedSubRect(rgn, rect);
-      return;
+  // Merge the results at once.
+  std::vector<Rect> changedRects;
+  for (size_t i = 0; i < numStripes; i++) {
+    std::vector<Rect> *stripeRects = &m_stripeTasks[i]->changedRects;
+    changedRects.insert(changedRects.end(), stripeRects->begin(),
+                        stripeRects->end());
   }
+  changedRegion->addRects(&changedRects);
+}
 
-  const UINT bytesPerPixel = m_frameBuffer->getBytesPerPixel();
-
-  Rect new_rect;
-  int x, y, ay;
-
-  // Scan down the rectangle
-  const int bytesPerRow = m_frameBuffer->getBytesPerRow();
-  const int offset = rect->top * bytesPerRow + rect->left * bytesPerPixel;
-  unsigned char *o_topleft_ptr = (unsigned char *)m_frameBuffer->getBuffer() + offset;
-  unsigned char *n_topleft_ptr = (unsigned char *)m_screenDriver->getScreenBuffer()->getBuffer() + offset;
-
-  for (y = rect->top; y < rect->bottom; y += BLOCK_SIZE)
-  {
-    // Work out way down the bitmap
-    unsigned char *o_row_ptr = o_topleft_ptr;
-    unsigned char *n_row_ptr = n_topleft_ptr;
-
-    const int blockbottom = min(y + BLOCK_SIZE, rect->bottom);
-    new_rect.bottom = blockbottom;
-    new_rect.left = -1;
-
-    for (x = rect->left; x < rect->right; x += BLOCK_SIZE)
-    {
-      // Work our way across the row
-      unsigned char *n_block_ptr = n_row_ptr;
-      unsigned char *o_block_ptr = o_row_ptr;
-
-      const UINT blockright = min(x + BLOCK_SIZE, rect->right);
-      const UINT bytesPerBlockRow = (blockright-x) * bytesPerPixel;
-
-      // Scan this block
-      for (ay = y; ay < blockbottom; ay++) {
-        if (memcmp(n_block_ptr, o_block_ptr, bytesPerBlockRow) != 0)
-          break;
-        n_block_ptr += bytesPerRow;
-        o_block_ptr += bytesPerRow;
-      }
-      if (ay < blockbottom) {
-        // There were changes, so this block will need to be updated
-        if (new_rect.left == -1) {
-          new_rect.left = x;
-          new_rect.top = ay;
-        } else if (ay < new_rect.top) {
-          new_rect.top = ay;
-        }
-      } else {
-        // No changes in this block, process previous changed blocks if any
-        if (new_rect.left != -1) {
-          new_rect.right = x;
-          updateChangedSubRect(rgn, &new_rect);
-          new_rect.left = -1;
-        }
-      }
-
-      o_row_ptr += bytesPerBlockRow;
-      n_row_ptr += bytesPerBlockRow;
-    }
-
-    if (new_rect.left != -1) {
-      new_rect.right = rect->right;
-      updateChangedSubRect(rgn, &new_rect);
-    }
-
-    o_topleft_ptr += bytesPerRow * BLOCK_SIZE;
-    n_topleft_ptr += bytesPerRow * BLOCK_SIZE;
-  }
+UpdateFilter::StripeTask::StripeTask()
+: m_oldFb(0),
+  m_newFb(0),
+  m_comparator(0)
+{
 }
 
-void UpdateFilter::updateChangedSubRect(Region *rgn, const Rect *rect)
+void UpdateFilter::StripeTask::setStripe(const Region *toCheck,
+                                         const Rect *stripeRect,
+                                         const FrameBuffer *oldFb,
+                                         const FrameBuffer *newFb,
+                                         const BlockComparator *comparator)
 {
-  const UINT bytesPerPixel = m_frameBuffer->getBytesPerPixel();
-  int bytes_in_row = (rect->right - rect->left) * bytesPerPixel;
-  int y, i;
+  m_region = *toCheck;
+  m_region.crop(stripeRect);
+  m_oldFb = oldFb;
+  m_newFb = newFb;
+  m_comparator = comparator;
+}
 
-  // Exclude unchanged scan lines at the bottom
-  const int bytesPerRow = m_frameBuffer->getBytesPerRow();
-  int offset = (rect->bottom - 1) * bytesPerRow + rect->left * bytesPerPixel;
-  unsigned char *o_ptr = (unsigned char *)m_frameBuffer->getBuffer() + offset;
-  unsigned char *n_ptr = (unsigned char *)m_screenDriver->getScreenBuffer()->getBuffer() + offset;
-  Rect final_rect = rect;
-  final_rect.bottom = rect->top + 1;
-  for (y = rect->bottom - 1; y > rect->top; y--) {
-    if (memcmp(o_ptr, n_ptr, bytes_in_row) != 0) {
-      final_rect.bottom = y + 1;
-      break;
-    }
-    n_ptr -= bytesPerRow;
-    o_ptr -= bytesPerRow;
+void UpdateFilter::StripeTask::run() throw(Exception)
+{
+  changedRects.clear();
+  std::vector<Rect> rects;
+  m_region.getRectVector(&rects);
+  for (size_t i = 0; i < rects.size(); i++) {
+    compareRect(&rects[i]);
   }
+}
 
-  // Exclude unchanged pixels at left and right sides
-  offset = final_rect.top * bytesPerRow + final_rect.left * bytesPerPixel;
-  o_ptr = (unsigned char *)m_frameBuffer->getBuffer() + offset;
-  n_ptr = (unsigned char *)m_screenDriver->getScreenBuffer()->getBuffer() + offset;
-  int left_delta = bytes_in_row - 1;
-  int right_delta = 0;
-  for (y = final_rect.top; y < final_rect.bottom; y++) {
-    for (i = 0; i < bytes_in_row - 1; i++) {
-      if (n_ptr[i] != o_ptr[i]) {
-        if (i < left_delta)
-          left_delta = i;
-        break;
+void UpdateFilter::StripeTask::compareRect(const Rect *rect)
+{
+  const size_t bytesPerPixel = m_newFb->getBytesPerPixel();
+  const size_t bytesPerRow = m_newFb->getBytesPerRow();
+
+  // Blocks are aligned to the frame buffer origin and clipped by the rect.
+  int bottom;
+  for (int top = rect->top; top < rect->bottom; top = bottom) {
+    bottom = min(rect->bottom, (top / BLOCK_SIZE + 1) * BLOCK_SIZE);
+    Rect run;
+    bool inRun = false;
+    int right;
+    for (int left = rect->left; left < rect->right; left = right) {
+      right = min(rect->right, (left / BLOCK_SIZE + 1) * BLOCK_SIZE);
+      const UINT8 *oldPixels = (const UINT8 *)m_oldFb->getBufferPtr(left, top);
+      const UINT8 *newPixels = (const UINT8 *)m_newFb->getBufferPtr(left, top);
+      BlockComparator::Change change;
+      if (m_comparator->compare(oldPixels, newPixels, bytesPerRow,
+                                (right - left) * bytesPerPixel, bottom - top,
+                                &change)) {
+        Rect changed(left + (int)(change.left / bytesPerPixel),
+                     top + change.top,
+                     left + (int)((change.right - 1) / bytesPerPixel) + 1,
+                     top + change.bottom);
+        if (inRun) {
+          run.right = changed.right;
+          run.top = min(run.top, changed.top);
+          run.bottom = max(run.bottom, changed.bottom);
+        } else {
+          run = changed;
+          inRun = true;
+        }
+      } else if (inRun) {
+        changedRects.push_back(run);
+        inRun = false;
       }
     }
-    for (i = bytes_in_row - 1; i > 0; i--) {
-      if (n_ptr[i] != o_ptr[i]) {
-        if (i > right_delta)
-          right_delta = i;
-        break;
-      }
+    if (inRun) {
+      changedRects.push_back(run);
     }
-    n_ptr += bytesPerRow;
-    o_ptr += bytesPerRow;
   }
-  final_rect.right = final_rect.left + right_delta / bytesPerPixel + 1;
-  final_rect.left += left_delta / bytesPerPixel;
-
-  // Update the rectangle
-  rgn->addRect(&final_rect);
 }
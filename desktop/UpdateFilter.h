@@ -31,6 +31,10 @@
 #include "thread/LocalMutex.h"
 #include "UpdateContainer.h"
 #include "GrabOptimizator.h"
+#include "BlockComparator.h"
+#include "MotionDetector.h"
+#include "thread/ThreadPool.h"
+#include <vector>
 
 class UpdateFilter
 {
@@ -44,9 +48,35 @@ public:
   void filter(UpdateContainer *updateContainer);
 
 private:
-  void getChangedRegion(Region *rgn, const Rect *rect);
-  void updateChangedRect(Region *rgn, const Rect *rect);
-  void updateChangedSubRect(Region *rgn, const Rect *rect);
+  // Compares a horizontal stripe of the grabbed region with the pixels of
+  // m_frameBuffer block by block.
+  class StripeTask : public ThreadPoolTask
+  {
+  public:
+    StripeTask();
+
+    void setStripe(const Region *toCheck, const Rect *stripeRect,
+                   const FrameBuffer *oldFb, const FrameBuffer *newFb,
+                   const BlockComparator *comparator);
+
+    virtual void run() throw(Exception);
+
+    // Bounds of the changed pixels found in the stripe, one rectangle for
+    // each run of changed blocks in a row of blocks.
+    std::vector<Rect> changedRects;
+
+  private:
+    void compareRect(const Rect *rect);
+
+    Region m_region;
+    const FrameBuffer *m_oldFb;
+    const FrameBuffer *m_newFb;
+    const BlockComparator *m_comparator;
+  };
+
+  // Finds the pixels of toCheck which differ between the screen and
+  // m_frameBuffer. Large regions are split to stripes compared in parallel.
+  void getChangedRegion(Region *changedRegion, const Region *toCheck);
 
   // This function update the screen grabber frame buffer.
   // If success the function returns the true.
@@ -59,6 +89,14 @@ private:
   LocalMutex *m_fbMutex;
   GrabOptimizator m_grabOptimizator;
 
+  BlockComparator m_comparator;
+  // Workers comparing stripes, zero if there is a single processor. The
+  // calling thread compares a stripe too.
+  ThreadPool *m_stripePool;
+  std::vector<StripeTask *> m_stripeTasks;
+
+  MotionDetector m_motionDetector;
+
   LogWriter *m_log;
 };
 
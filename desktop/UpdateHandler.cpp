@@ -45,6 +45,30 @@ bool UpdateHandler::updateExternalFrameBuffer(FrameBuffer *fb, const Region *reg
   return updateExternalFrameBuffer(fb, &m_backupFrameBuffer, region, viewPort);
 }
 
+void UpdateHandler::publishFrameBuffer(UpdateContainer *updateContainer)
+{
+  Region changed = updateContainer->changedRegion;
+  changed.add(&updateContainer->copiedRegion);
+  AutoLock al(&m_fbLocMut);
+  // The whole frame buffer may have been read again without pixel format or
+  // dimension changes.
+  if (updateContainer->screenSizeChanged) {
+    changed.addRect(&m_backupFrameBuffer.getDimension().getRect());
+  }
+  updateContainer->frameGeneration =
+    m_sharedFrameBuffer.update(&m_backupFrameBuffer, &changed);
+}
+
+bool UpdateHandler::acquireFrameSnapshot(FrameSnapshot *snapshot)
+{
+  return snapshot->acquire(&m_sharedFrameBuffer);
+}
+
+void UpdateHandler::freeSharedFrameBuffer()
+{
+  m_sharedFrameBuffer.clear();
+}
+
 bool UpdateHandler::updateExternalFrameBuffer(FrameBuffer *dstFb, FrameBuffer *srcFb,
                                               const Region *region,
                                               const Rect *viewPort)
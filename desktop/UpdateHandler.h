@@ -35,6 +35,7 @@
 #include "UpdateListener.h"
 #include "UpdateDetector.h"
 #include "CopyRectDetector.h"
+#include "SharedFrameBuffer.h"
 #include "desktop-ipc/BlockingGate.h"
 
 class UpdateHandler
@@ -106,6 +107,19 @@ public:
   virtual bool updateExternalFrameBuffer(FrameBuffer *fb, const Region *region,
                                          const Rect *viewPort);
 
+  // Copies the pixels changed by the last extract() call to the shared
+  // frame buffer and sets the frame generation of the container. Must be
+  // called after each extract() before the update is given to the senders.
+  void publishFrameBuffer(UpdateContainer *updateContainer);
+
+  // Makes the snapshot reference the current state of the shared frame
+  // buffer. Returns false if the dimension or the pixel format have changed
+  // since the previous call for the snapshot.
+  bool acquireFrameSnapshot(FrameSnapshot *snapshot);
+
+  // Frees the shared frame buffer while it is not used.
+  void freeSharedFrameBuffer();
+
   // FIXME: It's no good idea to place this function to here.
   // Because it uses only for the UpdateHandlerClient class.
   virtual void sendInit(BlockingGate *gate) {}
@@ -118,6 +132,9 @@ protected:
   FrameBuffer m_backupFrameBuffer;
   LocalMutex m_fbLocMut;
 
+  // Copy of m_backupFrameBuffer shared by all update senders.
+  SharedFrameBuffer m_sharedFrameBuffer;
+
   // m_cursorShape not thread safed
   CursorShape m_cursorShape;
 };
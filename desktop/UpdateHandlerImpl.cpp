@@ -23,11 +23,13 @@
 //
 
 #include "UpdateHandlerImpl.h"
+#include "server-config-lib/Configurator.h"
 
 UpdateHandlerImpl::UpdateHandlerImpl(UpdateListener *externalUpdateListener, ScreenDriverFactory *scrDriverFactory,
                                      LogWriter *log)
 : m_externalUpdateListener(externalUpdateListener),
   m_fullUpdateRequested(false),
+  m_videoClassifier(log),
   m_log(log)
 {
   m_screenDriver = scrDriverFactory->createScreenDriver(&m_updateKeeper,
@@ -70,10 +72,26 @@ void UpdateHandlerImpl::extract(UpdateContainer *updateContainer)
     m_updateKeeper.extract(updateContainer);
   }
 
+  unsigned int videoDetectionMode =
+    Configurator::getInstance()->getServerConfig()->getVideoDetectionMode();
+  bool autoVideoDetection = videoDetectionMode != ServerConfig::VDM_CONFIGURED;
+
   // Note: The getVideoRegion() function is not a thread safe function, but it invokes
   // only from this one place and so that is why it does not cover by the mutex.
   m_log->debug(_T("UpdateHandlerImpl: getVideoRegion"));
-  updateContainer->videoRegion = m_screenDriver->getVideoRegion();
+  if (videoDetectionMode != ServerConfig::VDM_AUTOMATIC) {
+    updateContainer->videoRegion = m_screenDriver->getVideoRegion();
+  } else {
+    updateContainer->videoRegion.clear();
+  }
+  // Tiles classified as video by the previous updates.
+  if (autoVideoDetection) {
+    Region detectedVideo;
+    m_videoClassifier.getVideoRegion(&detectedVideo);
+    updateContainer->videoRegion.add(&detectedVideo);
+  } else {
+    m_videoClassifier.reset();
+  }
   // Constrain the video region to the current frame buffer border.
   m_log->debug(_T("UpdateHandlerImpl: getRect"));
   Region fbRect(getFrameBufferDimension().getRect());
@@ -83,6 +101,12 @@ void UpdateHandlerImpl::extract(UpdateContainer *updateContainer)
   m_log->debug(_T("UpdateHandlerImpl::extract : filter updates"));
   m_updateFilter->filter(updateContainer);
 
+  // The filter leaves only really changed pixels in the changed region so
+  // they are a good source for the change frequency statistics.
+  if (autoVideoDetection) {
+    m_videoClassifier.update(&updateContainer->changedRegion, &m_backupFrameBuffer);
+  }
+
   if (!m_absoluteRect.isEmpty()) {
     updateContainer->changedRegion.addRect(&m_screenDriver->getScreenBuffer()->
                                            getDimension().getRect());
@@ -109,7 +133,7 @@ void UpdateHandlerImpl::extract(UpdateContainer *updateContainer)
       m_backupFrameBuffer.clone(m_screenDriver->getScreenBuffer());
     }
     updateContainer->changedRegion.clear();
-    updateContainer->copiedRegion.clear();
+    updateContainer->clearCopies();
     m_absoluteRect = m_backupFrameBuffer.getDimension().getRect();
     m_updateKeeper.setBorderRect(&m_absoluteRect);
   }
@@ -179,6 +203,11 @@ void UpdateHandlerImpl::onUpdate()
   }
 }
 
+void UpdateHandlerImpl::getVideoClassifierStats(VideoClassifierStats *stats)
+{
+  m_videoClassifier.getStatistics(stats);
+}
+
 bool UpdateHandlerImpl::checkForUpdates(Region *region)
 {
   return m_updateKeeper.checkForUpdates(region);
@@ -28,6 +28,7 @@
 #include "UpdateHandler.h"
 #include "ScreenDriver.h"
 #include "ScreenDriverFactory.h"
+#include "VideoRegionClassifier.h"
 
 // This class contain a base architecture implementation of the UpdateHandler class.
 class UpdateHandlerImpl : public UpdateHandler, public UpdateListener
@@ -43,6 +44,9 @@ public:
 
   virtual void setExcludedRegion(const Region *excludedRegion);
 
+  // Returns the automatic video detection counters.
+  void getVideoClassifierStats(VideoClassifierStats *stats);
+
 private:
   virtual void executeDetectors();
   virtual void terminateDetectors();
@@ -61,6 +65,7 @@ private:
   UpdateKeeper m_updateKeeper;
   ScreenDriver *m_screenDriver;
   UpdateFilter *m_updateFilter;
+  VideoRegionClassifier m_videoClassifier;
   UpdateListener *m_externalUpdateListener;
 
   Rect m_absoluteRect;
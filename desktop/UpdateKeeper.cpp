@@ -25,10 +25,12 @@
 #include "UpdateKeeper.h"
 
 UpdateKeeper::UpdateKeeper()
+: m_frameGeneration(0)
 {
 }
 
 UpdateKeeper::UpdateKeeper(const Rect *borderRect)
+: m_frameGeneration(0)
 {
   m_borderRect.setRect(borderRect);
 }
@@ -55,79 +57,57 @@ void UpdateKeeper::addChangedRect(const Rect *changedRect)
 }
 
 void UpdateKeeper::addCopyRect(const Rect *copyRect, const Point *src)
+{
+  Region dstRegion(copyRect);
+  Point srcOffset(src->x - copyRect->left, src->y - copyRect->top);
+  addCopyRegion(&dstRegion, &srcOffset);
+}
+
+void UpdateKeeper::addCopyRegion(const Region *dstRegion,
+                                 const Point *srcOffset)
 {
   AutoLock al(&m_updContLocMut);
 
-  if (copyRect->isEmpty()) {
+  if (dstRegion->isEmpty()) {
     return;
   }
 
   Region *changedRegion = &m_updateContainer.changedRegion;
-  Region *copiedRegion = &m_updateContainer.copiedRegion;
-  Point *copySrc = &m_updateContainer.copySrc;
-  Rect dstCopyRect(copyRect);
-
-  // Create copy of copyRect in the source coordinates.
-  Rect srcCopyRect(copyRect);
-  srcCopyRect.setLocation(src->x, src->y);
-
-  // Clipping dstCopyRect
-  dstCopyRect = dstCopyRect.intersection(&m_borderRect);
-  // Correcting source coordinates
-  srcCopyRect.left    += dstCopyRect.left - copyRect->left;
-  srcCopyRect.top     += dstCopyRect.top - copyRect->top;
-  srcCopyRect.right   += dstCopyRect.right - copyRect->right;
-  srcCopyRect.bottom  += dstCopyRect.bottom - copyRect->bottom;
-  // Clipping srcCopyRect
-  Rect dummySrcCopyRect(&srcCopyRect);
-  srcCopyRect = srcCopyRect.intersection(&m_borderRect);
-  // Correcting destination coordinates
-  dstCopyRect.left    += srcCopyRect.left - dummySrcCopyRect.left;
-  dstCopyRect.top     += srcCopyRect.top - dummySrcCopyRect.top;
-  dstCopyRect.right   += srcCopyRect.right - dummySrcCopyRect.right;
-  dstCopyRect.bottom  += srcCopyRect.bottom - dummySrcCopyRect.bottom;
-
-  if (dstCopyRect.isEmpty()) {
-    return;
-  }
 
-  copySrc->x = srcCopyRect.left;
-  copySrc->y = srcCopyRect.top;
+  // Clipping the destination and the source.
+  Rect srcBorderRect(&m_borderRect);
+  srcBorderRect.move(-srcOffset->x, -srcOffset->y);
+  Region dstCopyRegion(*dstRegion);
+  dstCopyRegion.crop(&m_borderRect);
+  dstCopyRegion.crop(&srcBorderRect);
 
-  // Adding difference between clipped dstCopyRect and original copyRect
+  // Adding difference between clipped and original destination
   // to changedRegion. Because without update detectors this information
   // loses irretrievably.
-  Region diff(copyRect);
-  Region dstCopyRegion(&dstCopyRect);
+  Region diff(*dstRegion);
   diff.subtract(&dstCopyRegion);
   addChangedRegion(&diff);
 
-  // Old copiedRegion must be added to changedRegion - (?)
-  if (!copiedRegion->isEmpty()) {
-    changedRegion->add(copiedRegion);
-    copiedRegion->clear();
-    addChangedRect(copyRect);
+  if (dstCopyRegion.isEmpty()) {
     return;
   }
 
-  copiedRegion->clear();
-  copiedRegion->addRect(&dstCopyRect);
-
-  // copiedRegion must be substracted from changedRegion
-  changedRegion->subtract(copiedRegion);
+  if (m_updateContainer.copyMoves.size() >= UpdateContainer::MAX_COPY_MOVES) {
+    changedRegion->add(&dstCopyRegion);
+    changedRegion->crop(&m_borderRect);
+    return;
+  }
 
-  // Create region that is intersection of changedRegion and srcCopyRect.
-  Region addonChangedRegion(&srcCopyRect);
+  // Changes pending in the source move along with the pixels, the old
+  // changes in the destination are overwritten.
+  Region addonChangedRegion(dstCopyRegion);
+  addonChangedRegion.translate(srcOffset->x, srcOffset->y);
   addonChangedRegion.intersect(changedRegion);
-
-  // Move addonChangedRegion and add it to changedRegion.
-  addonChangedRegion.translate(dstCopyRect.left - copySrc->x,
-                               dstCopyRect.top - copySrc->y);
+  addonChangedRegion.translate(-srcOffset->x, -srcOffset->y);
+  changedRegion->subtract(&dstCopyRegion);
   changedRegion->add(&addonChangedRegion);
 
-  // Clipping regions
-  m_updateContainer.changedRegion.crop(&m_borderRect);
-  m_updateContainer.copiedRegion.crop(&m_borderRect);
+  m_updateContainer.addCopyMove(&dstCopyRegion, srcOffset);
 }
 
 void UpdateKeeper::setBorderRect(const Rect *borderRect)
@@ -165,15 +145,10 @@ void UpdateKeeper::addUpdateContainer(const UpdateContainer *updateContainer)
 {
   AutoLock al(&m_updContLocMut);
 
-  // FIXME: Use addCopyRegion instead of addCopyRect
-  // Add copied region
-  std::vector<Rect> rects;
-  std::vector<Rect>::iterator iRect;
-  updateContainer->copiedRegion.getRectVector(&rects);
-  size_t numRects = rects.size();
-  if (numRects > 0) {
-    iRect = rects.begin();
-    addCopyRect(&(*iRect), &updateContainer->copySrc);
+  // Add the moves in their order
+  const std::vector<CopyMove> *moves = &updateContainer->copyMoves;
+  for (size_t i = 0; i < moves->size(); i++) {
+    addCopyRegion(&(*moves)[i].dstRegion, &(*moves)[i].srcOffset);
   }
 
   // Add changed region
@@ -193,6 +168,9 @@ void UpdateKeeper::addUpdateContainer(const UpdateContainer *updateContainer)
   if (updateContainer->cursorShapeChanged) {
     setCursorShapeChanged();
   }
+  if (updateContainer->frameGeneration > m_frameGeneration) {
+    m_frameGeneration = updateContainer->frameGeneration;
+  }
 }
 
 void UpdateKeeper::getUpdateContainer(UpdateContainer *updCont)
@@ -225,15 +203,17 @@ void UpdateKeeper::extract(UpdateContainer *updateContainer)
 
     // Clipping regions
     m_updateContainer.changedRegion.crop(&m_borderRect);
-    m_updateContainer.copiedRegion.crop(&m_borderRect);
+    m_updateContainer.cropCopies(&m_borderRect);
 
-    *updateContainer = m_updateContainer;
-    m_updateContainer.clear();
+    // Hand the accumulated update over leaving the keeper empty.
+    updateContainer->clear();
+    m_updateContainer.swap(updateContainer);
+    updateContainer->frameGeneration = m_frameGeneration;
   }
   {
     AutoLock al(&m_exclRegLocMut);
     updateContainer->changedRegion.subtract(&m_excludedRegion);
-    updateContainer->copiedRegion.subtract(&m_excludedRegion);
+    updateContainer->subtractFromCopies(&m_excludedRegion);
   }
 }
 
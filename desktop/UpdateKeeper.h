@@ -57,6 +57,9 @@ public:
   }
 
   void addCopyRect(const Rect *copyRect, const Point *src);
+  // Adds a move after the already kept ones, every pixel of dstRegion takes
+  // the pixel at srcOffset from it.
+  void addCopyRegion(const Region *dstRegion, const Point *srcOffset);
 
   void setBorderRect(const Rect *borderRect);
 
@@ -80,6 +83,9 @@ private:
   LocalMutex m_exclRegLocMut;
 
   UpdateContainer m_updateContainer;
+  // The latest frame generation of the added containers, it survives
+  // extract().
+  UINT64 m_frameGeneration;
   LocalMutex m_updContLocMut;
 };
 
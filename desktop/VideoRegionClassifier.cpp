@@ -0,0 +1,255 @@
+// Copyright (C) 2012 GlavSoft LLC.
+// All rights reserved.
+//
+//-------------------------------------------------------------------------
+// This file is part of the TightVNC software.  Please visit our Web site:
+//
+//                       http://www.tightvnc.com/
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+//-------------------------------------------------------------------------
+//
+
+
+#include "VideoRegionClassifier.h"
+#include "util/DateTime.h"
+#include "thread/AutoLock.h"
+#include <algorithm>
+
+static unsigned int countSlots(UINT16 history)
+{
+  unsigned int count = 0;
+  for (; history != 0; history &= history - 1) {
+    count++;
+  }
+  return count;
+}
+
+VideoRegionClassifier::VideoRegionClassifier(LogWriter *log)
+: m_tilesX(0),
+  m_tilesY(0),
+  m_slotStart(0),
+  m_log(log)
+{
+}
+
+VideoRegionClassifier::~VideoRegionClassifier()
+{
+}
+
+void VideoRegionClassifier::update(const Region *changedRegion,
+                                   const FrameBuffer *frameBuffer)
+{
+  Dimension dim = frameBuffer->getDimension();
+  if (!m_dimension.isEqualTo(&dim)) {
+    resizeGrid(&dim);
+  }
+  if (m_history.empty()) {
+    return;
+  }
+
+  UINT64 now = DateTime::now().getTime();
+  if (m_slotStart == 0) {
+    m_slotStart = now;
+  }
+  advanceSlots(now);
+
+  std::vector<Rect> rects;
+  changedRegion->getRectVector(&rects);
+  for (std::vector<Rect>::iterator it = rects.begin(); it != rects.end(); it++) {
+    markChanged(&(*it));
+  }
+
+  classify(frameBuffer);
+}
+
+void VideoRegionClassifier::getVideoRegion(Region *dst) const
+{
+  dst->clear();
+  if (m_stats.videoTiles == 0) {
+    return;
+  }
+  // Horizontal runs of video tiles are added as single rectangles to
+  // keep the region small.
+  for (int ty = 0; ty < m_tilesY; ty++) {
+    int tx = 0;
+    while (tx < m_tilesX) {
+      if (!m_isVideo[ty * m_tilesX + tx]) {
+        tx++;
+        continue;
+      }
+      int runStart = tx;
+      while (tx < m_tilesX && m_isVideo[ty * m_tilesX + tx]) {
+        tx++;
+      }
+      Rect runRect = getTileRect(runStart, ty);
+      runRect.right = getTileRect(tx - 1, ty).right;
+      dst->addRect(&runRect);
+    }
+  }
+}
+
+void VideoRegionClassifier::reset()
+{
+  if (m_history.empty()) {
+    return;
+  }
+  std::fill(m_history.begin(), m_history.end(), 0);
+  std::fill(m_isVideo.begin(), m_isVideo.end(), false);
+  m_slotStart = 0;
+
+  AutoLock al(&m_statsLock);
+  m_stats.videoTiles = 0;
+}
+
+void VideoRegionClassifier::getStatistics(VideoClassifierStats *stats)
+{
+  AutoLock al(&m_statsLock);
+  *stats = m_stats;
+}
+
+void VideoRegionClassifier::resizeGrid(const Dimension *dim)
+{
+  m_dimension = *dim;
+  m_tilesX = (dim->width + TILE_SIZE - 1) / TILE_SIZE;
+  m_tilesY = (dim->height + TILE_SIZE - 1) / TILE_SIZE;
+  size_t tileCount = (size_t)m_tilesX * m_tilesY;
+  m_history.assign(tileCount, 0);
+  m_isVideo.assign(tileCount, false);
+  m_slotStart = 0;
+
+  AutoLock al(&m_statsLock);
+  m_stats.videoTiles = 0;
+  m_stats.totalTiles = (unsigned int)tileCount;
+}
+
+void VideoRegionClassifier::advanceSlots(UINT64 now)
+{
+  if (now < m_slotStart) {
+    // The system time has been moved back.
+    m_slotStart = now;
+    return;
+  }
+  UINT64 passed = (now - m_slotStart) / SLOT_DURATION;
+  if (passed == 0) {
+    return;
+  }
+  m_slotStart += passed * SLOT_DURATION;
+
+  const UINT16 windowMask = (1 << WINDOW_SLOTS) - 1;
+  if (passed >= WINDOW_SLOTS) {
+    std::fill(m_history.begin(), m_history.end(), 0);
+  } else {
+    for (std::vector<UINT16>::iterator it = m_history.begin();
+         it != m_history.end(); it++) {
+      *it = (UINT16)((*it << passed) & windowMask);
+    }
+  }
+}
+
+void VideoRegionClassifier::markChanged(const Rect *rect)
+{
+  int x0 = max(rect->left, 0) / TILE_SIZE;
+  int y0 = max(rect->top, 0) / TILE_SIZE;
+  int x1 = min((rect->right - 1) / TILE_SIZE, m_tilesX - 1);
+  int y1 = min((rect->bottom - 1) / TILE_SIZE, m_tilesY - 1);
+  for (int ty = y0; ty <= y1; ty++) {
+    UINT16 *row = &m_history[ty * m_tilesX];
+    for (int tx = x0; tx <= x1; tx++) {
+      row[tx] |= 1;
+    }
+  }
+}
+
+Rect VideoRegionClassifier::getTileRect(int tileX, int tileY) const
+{
+  int left = tileX * TILE_SIZE;
+  int top = tileY * TILE_SIZE;
+  return Rect(left, top,
+              min(left + TILE_SIZE, m_dimension.width),
+              min(top + TILE_SIZE, m_dimension.height));
+}
+
+bool VideoRegionClassifier::isColorful(const Rect *tileRect,
+                                       const FrameBuffer *frameBuffer) const
+{
+  UINT32 samples[SAMPLE_GRID * SAMPLE_GRID];
+  size_t numSamples = 0;
+  const int bpp = frameBuffer->getBytesPerPixel();
+  int width = tileRect->getWidth();
+  int height = tileRect->getHeight();
+  for (int sy = 0; sy < SAMPLE_GRID; sy++) {
+    int y = tileRect->top + (2 * sy + 1) * height / (2 * SAMPLE_GRID);
+    for (int sx = 0; sx < SAMPLE_GRID; sx++) {
+      int x = tileRect->left + (2 * sx + 1) * width / (2 * SAMPLE_GRID);
+      const UINT8 *pixel = (const UINT8 *)frameBuffer->getBufferPtr(x, y);
+      UINT32 value;
+      switch (bpp) {
+      case 4:
+        value = *(const UINT32 *)pixel;
+        break;
+      case 2:
+        value = *(const UINT16 *)pixel;
+        break;
+      default:
+        value = *pixel;
+      }
+      samples[numSamples++] = value;
+    }
+  }
+  std::sort(samples, samples + numSamples);
+  size_t distinct = std::unique(samples, samples + numSamples) - samples;
+  return distinct >= MIN_DISTINCT_COLORS;
+}
+
+void VideoRegionClassifier::classify(const FrameBuffer *frameBuffer)
+{
+  unsigned int promoted = 0;
+  unsigned int demoted = 0;
+  for (int ty = 0; ty < m_tilesY; ty++) {
+    for (int tx = 0; tx < m_tilesX; tx++) {
+      size_t i = ty * m_tilesX + tx;
+      unsigned int slots = countSlots(m_history[i]);
+      if (!m_isVideo[i]) {
+        // The color check is made only for candidates because it touches
+        // the frame buffer.
+        if (slots >= PROMOTE_SLOTS) {
+          Rect tileRect = getTileRect(tx, ty);
+          if (isColorful(&tileRect, frameBuffer)) {
+            m_isVideo[i] = true;
+            promoted++;
+          }
+        }
+      } else if (slots < DEMOTE_SLOTS) {
+        m_isVideo[i] = false;
+        demoted++;
+      }
+    }
+  }
+
+  if (promoted != 0 || demoted != 0) {
+    unsigned int videoTiles;
+    {
+      AutoLock al(&m_statsLock);
+      m_stats.videoTiles = m_stats.videoTiles + promoted - demoted;
+      m_stats.promotions += promoted;
+      m_stats.demotions += demoted;
+      videoTiles = m_stats.videoTiles;
+    }
+    m_log->debug(_T("Video detection: %u tiles promoted, %u demoted, %u of %u")
+                 _T(" tiles are video now"),
+                 promoted, demoted, videoTiles, (unsigned int)m_isVideo.size());
+  }
+}
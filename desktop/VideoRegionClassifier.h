@@ -0,0 +1,117 @@
+// Copyright (C) 2012 GlavSoft LLC.
+// All rights reserved.
+//
+//-------------------------------------------------------------------------
+// This file is part of the TightVNC software.  Please visit our Web site:
+//
+//                       http://www.tightvnc.com/
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+//-------------------------------------------------------------------------
+//
+
+
+#ifndef __VIDEOREGIONCLASSIFIER_H__
+#define __VIDEOREGIONCLASSIFIER_H__
+
+#include "region/Region.h"
+#include "rfb/FrameBuffer.h"
+#include "thread/LocalMutex.h"
+#include "log-writer/LogWriter.h"
+#include <vector>
+
+// Counters describing the automatic video detection state.
+struct VideoClassifierStats
+{
+  VideoClassifierStats()
+  : videoTiles(0), totalTiles(0), promotions(0), demotions(0)
+  {
+  }
+
+  // Number of tiles currently classified as video.
+  unsigned int videoTiles;
+  // Number of tiles of the whole frame buffer.
+  unsigned int totalTiles;
+  // Number of tiles promoted to / demoted from video since the last reset.
+  unsigned int promotions;
+  unsigned int demotions;
+};
+
+// The class finds video areas without any configuration. The frame buffer
+// is split to tiles and for each tile the classifier remembers in which
+// time slots of a sliding window the tile has changed. A tile that changes
+// in almost all slots and contains many distinct colors is promoted to
+// video, a video tile which becomes calm is demoted back. Distinct promote
+// and demote thresholds give a hysteresis so blinking cursors or a short
+// pause in playback do not toggle the region.
+//
+// The update() and getVideoRegion() functions must be invoked from one
+// thread, getStatistics() is thread safe.
+class VideoRegionClassifier
+{
+public:
+  VideoRegionClassifier(LogWriter *log);
+  virtual ~VideoRegionClassifier();
+
+  // Accounts changes of the current update. The frameBuffer must already
+  // contain the changed pixels and its dimension defines the tile grid.
+  void update(const Region *changedRegion, const FrameBuffer *frameBuffer);
+
+  // Returns union of all tiles that are classified as video.
+  void getVideoRegion(Region *dst) const;
+
+  // Forgets all collected history.
+  void reset();
+
+  void getStatistics(VideoClassifierStats *stats);
+
+  static const int TILE_SIZE = 64;
+
+private:
+  void resizeGrid(const Dimension *dim);
+  void advanceSlots(UINT64 now);
+  void markChanged(const Rect *rect);
+  Rect getTileRect(int tileX, int tileY) const;
+  bool isColorful(const Rect *tileRect, const FrameBuffer *frameBuffer) const;
+  void classify(const FrameBuffer *frameBuffer);
+
+  // The sliding window is WINDOW_SLOTS slots of SLOT_DURATION ms each.
+  static const unsigned int SLOT_DURATION = 100;
+  static const unsigned int WINDOW_SLOTS = 10;
+  // Hysteresis: minimal number of changed slots to become video and
+  // the number of changed slots below which a video tile is demoted.
+  static const unsigned int PROMOTE_SLOTS = 8;
+  static const unsigned int DEMOTE_SLOTS = 3;
+  // Color richness is estimated from SAMPLE_GRID x SAMPLE_GRID pixels.
+  static const int SAMPLE_GRID = 8;
+  static const unsigned int MIN_DISTINCT_COLORS = 16;
+
+  Dimension m_dimension;
+  int m_tilesX;
+  int m_tilesY;
+  // Bit N of a history is set if the tile has changed in the slot that
+  // was N slots ago, bit 0 is the current slot.
+  std::vector<UINT16> m_history;
+  std::vector<bool> m_isVideo;
+
+  UINT64 m_slotStart;
+
+  LocalMutex m_statsLock;
+  VideoClassifierStats m_stats;
+
+  LogWriter *m_log;
+};
+
+#endif // __VIDEOREGIONCLASSIFIER_H__
@@ -0,0 +1,321 @@
+// Copyright (C) 2012 GlavSoft LLC.
+// All rights reserved.
+//
+//-------------------------------------------------------------------------
+// This file is part of the TightVNC software.  Please visit our Web site:
+//
+//                       http://www.tightvnc.com/
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+//-------------------------------------------------------------------------
+//
+
+#include "EncodeGroup.h"
+#include "UpdateSender.h"
+#include "desktop/Desktop.h"
+#include "thread/AutoLock.h"
+
+EncodeGroupKey::EncodeGroupKey()
+{
+}
+
+bool EncodeGroupKey::isEqualTo(const EncodeGroupKey *other) const
+{
+  return encodeOptions.isEqualTo(&other->encodeOptions) &&
+         pixelFormat.isEqualTo(&other->pixelFormat) &&
+         viewPort.isEqualTo(&other->viewPort);
+}
+
+EncodeGroupOutputGate::EncodeGroupOutputGate(EncodeGroup *group)
+: RfbOutputGate(group),
+  m_group(group)
+{
+}
+
+EncodeGroupOutputGate::~EncodeGroupOutputGate()
+{
+}
+
+void EncodeGroupOutputGate::flush()
+{
+  RfbOutputGate::flush();
+  m_group->deliver();
+}
+
+EncodeGroup::EncodeGroup(const EncodeGroupKey *key, Desktop *desktop,
+                         DamageJournal *journal, int id,
+                         unsigned int maxLag, ThreadPool *encoderPool,
+                         LogWriter *log)
+: m_key(*key),
+  m_id(id),
+  m_maxLag(maxLag),
+  m_roundInFlight(false),
+  m_waiting(false),
+  m_numRounds(0),
+  m_numBytesEncoded(0),
+  m_numBytesSent(0),
+  m_outputGate(this),
+  m_pipeline(0),
+  m_log(log)
+{
+  m_pipeline = new UpdateSender(0, desktop, this, &m_outputGate, m_id,
+                                desktop, journal, 0, encoderPool, m_log);
+  m_pipeline->init(&Dimension(&m_key.viewPort), &m_key.pixelFormat);
+  m_pipeline->setEncodeOptions(&m_key.encodeOptions);
+
+  m_log->info(_T("Encode group #%d has been created for view port")
+              _T(" (%d,%d) (%dx%d), %d bits per pixel"),
+              m_id, m_key.viewPort.left, m_key.viewPort.top,
+              m_key.viewPort.getWidth(), m_key.viewPort.getHeight(),
+              (int)m_key.pixelFormat.bitsPerPixel);
+}
+
+EncodeGroup::~EncodeGroup()
+{
+  {
+    AutoLock al(&m_stateLock);
+    releaseAll();
+  }
+  delete m_pipeline;
+
+  m_log->info(_T("Encode group #%d has been destroyed after %d rounds,")
+              _T(" %d bytes encoded, %d bytes sent"), m_id,
+              (int)m_numRounds, (int)m_numBytesEncoded, (int)m_numBytesSent);
+}
+
+int EncodeGroup::getId() const
+{
+  return m_id;
+}
+
+bool EncodeGroup::matches(const EncodeGroupKey *key) const
+{
+  return m_key.isEqualTo(key);
+}
+
+size_t EncodeGroup::getMemberCount()
+{
+  AutoLock al(&m_stateLock);
+  return m_members.size();
+}
+
+void EncodeGroup::addMember(UpdateSender *sender)
+{
+  AutoLock al(&m_stateLock);
+
+  Member member;
+  member.sender = sender;
+  member.inRound = false;
+  m_members.push_back(member);
+  sender->enterEncodeGroup(this, &m_key);
+
+  // The new member knows nothing about the state of our encoders. The
+  // changes it has not sent yet come later by catchUpMember().
+  m_pipeline->resetEncoders();
+
+  m_log->info(_T("Update sender #%d has joined encode group #%d")
+              _T(" (%d members)"), sender->getId(), m_id,
+              (int)m_members.size());
+}
+
+void EncodeGroup::catchUpMember(const UpdateContainer *missed)
+{
+  AutoLock al(&m_stateLock);
+  m_pipeline->addMissedUpdates(missed);
+}
+
+void EncodeGroup::removeMember(UpdateSender *sender)
+{
+  AutoLock al(&m_stateLock);
+
+  for (MemberListIter iter = m_members.begin(); iter != m_members.end();
+       iter++) {
+    if (iter->sender == sender) {
+      sender->leaveEncodeGroup(iter->inRound);
+      m_members.erase(iter);
+      m_log->info(_T("Update sender #%d has left encode group #%d")
+                  _T(" (%d members)"), sender->getId(), m_id,
+                  (int)m_members.size());
+      break;
+    }
+  }
+  if (m_members.size() < 2) {
+    releaseAll();
+  } else {
+    // The removed member might be the only one we were waiting for.
+    tryStartRound();
+  }
+}
+
+void EncodeGroup::onMemberRequest()
+{
+  AutoLock al(&m_stateLock);
+  tryStartRound();
+}
+
+void EncodeGroup::newUpdates(const CursorShape *cursorShape)
+{
+  m_pipeline->newUpdates(cursorShape);
+
+  // Give a chance to check for lagging members.
+  AutoLock al(&m_stateLock);
+  tryStartRound();
+}
+
+bool EncodeGroup::isReadyToSend()
+{
+  return m_pipeline->clientIsReady();
+}
+
+size_t EncodeGroup::write(const void *buffer, size_t len)
+{
+  const char *data = (const char *)buffer;
+  m_message.insert(m_message.end(), data, data + len);
+  return len;
+}
+
+void EncodeGroup::deliver()
+{
+  if (m_message.empty()) {
+    // The pipeline had nothing to send, the round is still in progress.
+    return;
+  }
+
+  AutoLock al(&m_stateLock);
+  size_t numReceivers = 0;
+  MemberListIter iter = m_members.begin();
+  while (iter != m_members.end()) {
+    bool inRound = iter->inRound;
+    iter->inRound = false;
+    if (!inRound) {
+      iter++;
+    } else if (iter->sender->queueGroupMessage(&m_message)) {
+      numReceivers++;
+      m_numBytesSent += m_message.size();
+      iter++;
+    } else {
+      // The member is still writing an earlier update, waiting for it would
+      // stall the rest of the group. It answers this request by itself.
+      m_log->info(_T("Update sender #%d falls behind encode group #%d,")
+                  _T(" removing it from the group"),
+                  iter->sender->getId(), m_id);
+      iter->sender->leaveEncodeGroup(true);
+      iter = m_members.erase(iter);
+    }
+  }
+  m_numRounds++;
+  m_numBytesEncoded += m_message.size();
+  m_log->debug(_T("Encode group #%d has passed %d bytes to %d members")
+               _T(" (%d rounds, %d bytes encoded, %d bytes sent in total)"),
+               m_id, (int)m_message.size(), (int)numReceivers,
+               (int)m_numRounds, (int)m_numBytesEncoded,
+               (int)m_numBytesSent);
+  m_message.clear();
+
+  m_roundInFlight = false;
+  if (m_members.size() < 2) {
+    releaseAll();
+  } else {
+    tryStartRound();
+  }
+}
+
+void EncodeGroup::onGetViewPort(Rect *viewRect, bool *shareApp,
+                                Region *shareAppRegion)
+{
+  *viewRect = m_key.viewPort;
+  *shareApp = false;
+}
+
+void EncodeGroup::tryStartRound()
+{
+  if (m_roundInFlight || m_members.empty()) {
+    return;
+  }
+
+  size_t numReady = 0;
+  MemberListIter iter;
+  for (iter = m_members.begin(); iter != m_members.end(); iter++) {
+    if (iter->sender->hasUpdateRequest()) {
+      numReady++;
+    }
+  }
+  if (numReady == 0) {
+    m_waiting = false;
+    return;
+  }
+
+  if (numReady < m_members.size()) {
+    if (!m_waiting) {
+      m_waiting = true;
+      m_waitingSince = DateTime::now();
+      return;
+    }
+    if ((DateTime::now() - m_waitingSince).getTime() < m_maxLag) {
+      return;
+    }
+    // Move the lagging members to their own pipelines.
+    iter = m_members.begin();
+    while (iter != m_members.end()) {
+      if (!iter->sender->hasUpdateRequest()) {
+        m_log->info(_T("Update sender #%d lags behind encode group #%d")
+                    _T(" for more than %u ms, removing it from the group"),
+                    iter->sender->getId(), m_id, m_maxLag);
+        iter->sender->leaveEncodeGroup(false);
+        iter = m_members.erase(iter);
+      } else {
+        iter++;
+      }
+    }
+    if (m_members.size() < 2) {
+      releaseAll();
+      return;
+    }
+  }
+  m_waiting = false;
+
+  // Combine the requests of all members and pass them to the pipeline.
+  Region incrReqReg, fullReqReg;
+  DateTime reqTimePoint;
+  bool firstRequest = true;
+  for (iter = m_members.begin(); iter != m_members.end(); iter++) {
+    Region incrReg, fullReg;
+    DateTime timePoint;
+    if (iter->sender->takeUpdateRequest(&incrReg, &fullReg, &timePoint)) {
+      incrReqReg.add(&incrReg);
+      fullReqReg.add(&fullReg);
+      if (firstRequest || timePoint.getTime() < reqTimePoint.getTime()) {
+        reqTimePoint = timePoint;
+        firstRequest = false;
+      }
+    }
+    iter->inRound = true;
+  }
+  m_roundInFlight = true;
+  m_pipeline->addUpdateRequest(&incrReqReg, &fullReqReg, &reqTimePoint);
+}
+
+void EncodeGroup::releaseAll()
+{
+  for (MemberListIter iter = m_members.begin(); iter != m_members.end();
+       iter++) {
+    iter->sender->leaveEncodeGroup(iter->inRound);
+    m_log->info(_T("Update sender #%d has been released from encode")
+                _T(" group #%d"), iter->sender->getId(), m_id);
+  }
+  m_members.clear();
+  m_roundInFlight = false;
+  m_waiting = false;
+}
@@ -0,0 +1,193 @@
+// Copyright (C) 2012 GlavSoft LLC.
+// All rights reserved.
+//
+//-------------------------------------------------------------------------
+// This file is part of the TightVNC software.  Please visit our Web site:
+//
+//                       http://www.tightvnc.com/
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+//-------------------------------------------------------------------------
+//
+
+#ifndef __ENCODEGROUP_H__
+#define __ENCODEGROUP_H__
+
+#include <list>
+#include <vector>
+
+#include "io-lib/OutputStream.h"
+#include "network/RfbOutputGate.h"
+#include "rfb-sconn/EncodeOptions.h"
+#include "rfb/PixelFormat.h"
+#include "rfb/CursorShape.h"
+#include "desktop/UpdateContainer.h"
+#include "region/Rect.h"
+#include "util/DateTime.h"
+#include "util/inttypes.h"
+#include "thread/LocalMutex.h"
+#include "thread/ThreadPool.h"
+#include "log-writer/LogWriter.h"
+#include "SenderControlInformationInterface.h"
+
+class UpdateSender;
+class Desktop;
+class DamageJournal;
+class EncodeGroup;
+
+// Everything that determines the bytes produced by an encoder pipeline for a
+// client. Clients with equal keys may receive exactly the same data, so they
+// can share one pipeline (see EncodeGroup).
+class EncodeGroupKey
+{
+public:
+  EncodeGroupKey();
+
+  bool isEqualTo(const EncodeGroupKey *other) const;
+
+  EncodeOptions encodeOptions;
+  PixelFormat pixelFormat;
+  Rect viewPort;
+};
+
+// Output gate of the shared pipeline. It collects a whole message in the
+// group and passes it to EncodeGroup::deliver() on flush().
+class EncodeGroupOutputGate : public RfbOutputGate
+{
+public:
+  EncodeGroupOutputGate(EncodeGroup *group);
+  virtual ~EncodeGroupOutputGate();
+
+  virtual void flush() throw(IOException);
+
+private:
+  EncodeGroup *m_group;
+};
+
+// EncodeGroup serves a number of RFB clients with equal EncodeGroupKey by a
+// single UpdateSender (the shared pipeline). Framebuffer updates are
+// converted and encoded once, and a copy of the resulting FramebufferUpdate
+// message is handed to the sender thread of each member, which writes it to
+// its own client. The group never waits for a client.
+//
+// All members receive the same byte stream, so the group works in rounds: a
+// round starts when every member has requested an update, the union of the
+// requests is passed to the pipeline, and the encoded message is delivered to
+// all members of the round. If some members have requested an update and
+// others have not done that during maxLag milliseconds, the lagging members
+// are moved back to their own pipelines so they do not stall the group. A
+// member that has not written the previous message yet when the next one is
+// ready is moved back too.
+//
+// A new member has got the whole view port from its own pipeline before. When
+// it joins, the pipeline resets its compression streams and adds the changes
+// the member has not sent yet to its own pending changes, so the next round
+// brings the new member up to date and the other members get only a little
+// extra. A member that leaves the group resets its own encoders and sends
+// the whole view port.
+//
+// All EncodeGroup methods except write() are thread-safe. Objects of this
+// class are maintained by EncodeGroupManager.
+class EncodeGroup : public OutputStream,
+                    private SenderControlInformationInterface
+{
+public:
+  EncodeGroup(const EncodeGroupKey *key, Desktop *desktop,
+              DamageJournal *journal, int id, unsigned int maxLag,
+              ThreadPool *encoderPool, LogWriter *log);
+  // Moves all remaining members back to their own pipelines.
+  virtual ~EncodeGroup();
+
+  int getId() const;
+  bool matches(const EncodeGroupKey *key) const;
+  size_t getMemberCount();
+
+  void addMember(UpdateSender *sender);
+  // Passes the changes a new member has not sent to its client to the
+  // shared pipeline.
+  void catchUpMember(const UpdateContainer *missed);
+  // Removes the sender from the group, does nothing if it's not a member.
+  // If only one member remains after that, it's removed as well because a
+  // group of one client makes no sense.
+  void removeMember(UpdateSender *sender);
+
+  // Should be called when a member has received an update request from its
+  // client.
+  void onMemberRequest();
+
+  // Tells the shared pipeline about new updates in the journal.
+  void newUpdates(const CursorShape *cursorShape);
+
+  // Returns true if the shared pipeline waits for updates.
+  bool isReadyToSend();
+
+  // Implementation of OutputStream. Collects data written by the shared
+  // pipeline. Should be called only from the pipeline thread.
+  virtual size_t write(const void *buffer, size_t len) throw(IOException);
+
+  // Writes the collected message to the members of the current round and
+  // starts a new round if possible. Called on flushing the pipeline output.
+  void deliver();
+
+private:
+  virtual void onGetViewPort(Rect *viewRect, bool *shareApp,
+                             Region *shareAppRegion);
+
+  // Starts a new round if all members are ready, moves lagging members to
+  // their own pipelines. Must be called with m_stateLock locked.
+  void tryStartRound();
+  // Removes all members from the group. Must be called with m_stateLock
+  // locked.
+  void releaseAll();
+
+  struct Member
+  {
+    UpdateSender *sender;
+    // True if an update request of this member has been passed to the
+    // pipeline and the answer has not been delivered yet.
+    bool inRound;
+  };
+  typedef std::list<Member> MemberList;
+  typedef MemberList::iterator MemberListIter;
+
+  EncodeGroupKey m_key;
+  int m_id;
+  unsigned int m_maxLag;
+
+  MemberList m_members;
+  bool m_roundInFlight;
+  bool m_waiting;
+  // Time when some of the members got ready but others did not.
+  DateTime m_waitingSince;
+  // Protects the state above.
+  LocalMutex m_stateLock;
+
+  // The message produced by the pipeline. The buffer is reused between
+  // updates.
+  std::vector<char> m_message;
+
+  // Statistics.
+  UINT64 m_numRounds;
+  UINT64 m_numBytesEncoded;
+  // Bytes handed to the members.
+  UINT64 m_numBytesSent;
+
+  EncodeGroupOutputGate m_outputGate;
+  UpdateSender *m_pipeline;
+
+  LogWriter *m_log;
+};
+
+#endif // __ENCODEGROUP_H__
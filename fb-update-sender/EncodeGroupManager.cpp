@@ -0,0 +1,218 @@
+// Copyright (C) 2012 GlavSoft LLC.
+// All rights reserved.
+//
+//-------------------------------------------------------------------------
+// This file is part of the TightVNC software.  Please visit our Web site:
+//
+//                       http://www.tightvnc.com/
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+//-------------------------------------------------------------------------
+//
+
+#include "EncodeGroupManager.h"
+#include "UpdateSender.h"
+#include "thread/AutoLock.h"
+
+EncodeGroupManager::EncodeGroupManager(DamageJournal *journal,
+                                       ThreadPool *encoderPool,
+                                       LogWriter *log)
+: m_maxLag(500),
+  m_nextGroupId(0),
+  m_journal(journal),
+  m_encoderPool(encoderPool),
+  m_log(log)
+{
+}
+
+EncodeGroupManager::~EncodeGroupManager()
+{
+  GroupList garbage;
+  {
+    AutoLock al(&m_lock);
+    garbage = m_groups;
+    m_groups.clear();
+    m_candidates.clear();
+  }
+  destroyGroups(&garbage);
+}
+
+void EncodeGroupManager::setMaxLag(unsigned int maxLag)
+{
+  AutoLock al(&m_lock);
+  m_maxLag = maxLag;
+}
+
+void EncodeGroupManager::offerSender(UpdateSender *sender, Desktop *desktop,
+                                     const EncodeGroupKey *key)
+{
+  GroupList garbage;
+  {
+    AutoLock al(&m_lock);
+    collectEmptyGroups(&garbage);
+    if (sender->getEncodeGroup() == 0) {
+      placeSender(sender, desktop, key);
+    }
+  }
+  destroyGroups(&garbage);
+}
+
+void EncodeGroupManager::onSenderRequest(UpdateSender *sender,
+                                         bool compatible)
+{
+  GroupList garbage;
+  {
+    AutoLock al(&m_lock);
+    EncodeGroup *group = sender->getEncodeGroup();
+    if (group != 0) {
+      if (compatible) {
+        group->onMemberRequest();
+      } else {
+        m_log->info(_T("Settings of update sender #%d do not match encode")
+                    _T(" group #%d anymore"), sender->getId(),
+                    group->getId());
+        group->removeMember(sender);
+      }
+    }
+    collectEmptyGroups(&garbage);
+  }
+  destroyGroups(&garbage);
+}
+
+bool EncodeGroupManager::catchUpSender(UpdateSender *sender,
+                                       const UpdateContainer *missed)
+{
+  AutoLock al(&m_lock);
+  EncodeGroup *group = sender->getEncodeGroup();
+  if (group == 0) {
+    return false;
+  }
+  group->catchUpMember(missed);
+  return true;
+}
+
+void EncodeGroupManager::removeSender(UpdateSender *sender)
+{
+  GroupList garbage;
+  {
+    AutoLock al(&m_lock);
+    removeCandidate(sender);
+    EncodeGroup *group = sender->getEncodeGroup();
+    if (group != 0) {
+      group->removeMember(sender);
+    }
+    collectEmptyGroups(&garbage);
+  }
+  destroyGroups(&garbage);
+}
+
+void EncodeGroupManager::newUpdates(const CursorShape *cursorShape)
+{
+  GroupList garbage;
+  {
+    AutoLock al(&m_lock);
+    for (GroupList::iterator iter = m_groups.begin(); iter != m_groups.end();
+         iter++) {
+      (*iter)->newUpdates(cursorShape);
+    }
+    collectEmptyGroups(&garbage);
+  }
+  destroyGroups(&garbage);
+}
+
+bool EncodeGroupManager::isReadyToSend()
+{
+  AutoLock al(&m_lock);
+  for (GroupList::iterator iter = m_groups.begin(); iter != m_groups.end();
+       iter++) {
+    if ((*iter)->isReadyToSend()) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void EncodeGroupManager::placeSender(UpdateSender *sender, Desktop *desktop,
+                                     const EncodeGroupKey *key)
+{
+  // Join an existing group.
+  for (GroupList::iterator iter = m_groups.begin(); iter != m_groups.end();
+       iter++) {
+    if ((*iter)->matches(key)) {
+      removeCandidate(sender);
+      (*iter)->addMember(sender);
+      return;
+    }
+  }
+
+  // Form a new group with a sender that has been offered before.
+  CandidateList::iterator iter;
+  for (iter = m_candidates.begin(); iter != m_candidates.end(); iter++) {
+    UpdateSender *other = iter->sender;
+    if (other != sender && iter->key.isEqualTo(key) &&
+        other->getEncodeGroup() == 0) {
+      EncodeGroup *group = new EncodeGroup(key, desktop, m_journal,
+                                           m_nextGroupId++, m_maxLag,
+                                           m_encoderPool, m_log);
+      m_groups.push_back(group);
+      removeCandidate(other);
+      removeCandidate(sender);
+      group->addMember(other);
+      group->addMember(sender);
+      return;
+    }
+  }
+
+  // Remember the sender until another one with the same key appears.
+  removeCandidate(sender);
+  Candidate candidate;
+  candidate.sender = sender;
+  candidate.key = *key;
+  m_candidates.push_back(candidate);
+}
+
+void EncodeGroupManager::removeCandidate(UpdateSender *sender)
+{
+  CandidateList::iterator iter = m_candidates.begin();
+  while (iter != m_candidates.end()) {
+    if (iter->sender == sender) {
+      iter = m_candidates.erase(iter);
+    } else {
+      iter++;
+    }
+  }
+}
+
+void EncodeGroupManager::collectEmptyGroups(GroupList *garbage)
+{
+  GroupList::iterator iter = m_groups.begin();
+  while (iter != m_groups.end()) {
+    if ((*iter)->getMemberCount() == 0) {
+      garbage->push_back(*iter);
+      iter = m_groups.erase(iter);
+    } else {
+      iter++;
+    }
+  }
+}
+
+void EncodeGroupManager::destroyGroups(GroupList *garbage)
+{
+  for (GroupList::iterator iter = garbage->begin(); iter != garbage->end();
+       iter++) {
+    delete *iter;
+  }
+  garbage->clear();
+}
@@ -0,0 +1,112 @@
+// Copyright (C) 2012 GlavSoft LLC.
+// All rights reserved.
+//
+//-------------------------------------------------------------------------
+// This file is part of the TightVNC software.  Please visit our Web site:
+//
+//                       http://www.tightvnc.com/
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+//-------------------------------------------------------------------------
+//
+
+#ifndef __ENCODEGROUPMANAGER_H__
+#define __ENCODEGROUPMANAGER_H__
+
+#include <list>
+
+#include "EncodeGroup.h"
+
+// EncodeGroupManager forms encode groups from update senders whose clients
+// have identical encoding settings, pixel format and view port, and routes
+// desktop updates and client requests to the groups (see EncodeGroup).
+//
+// An update sender offers itself after each update it has sent privately.
+// If there is a group with the same key, the sender joins it. Otherwise, if
+// another sender with the same key has been offered before, a new group is
+// created for both of them. Empty groups are destroyed automatically.
+class EncodeGroupManager
+{
+public:
+  // The shared pipelines take the desktop updates from journal.
+  // encoderPool is passed to the shared pipelines for parallel encoding, it
+  // may be 0.
+  EncodeGroupManager(DamageJournal *journal, ThreadPool *encoderPool,
+                     LogWriter *log);
+  // Destroys all groups. By that time, all update senders should have been
+  // removed from the manager.
+  virtual ~EncodeGroupManager();
+
+  // Sets the time in milliseconds members of new groups may wait for a
+  // lagging member.
+  void setMaxLag(unsigned int maxLag);
+
+  // Offers the sender to be grouped with other senders with the same key.
+  void offerSender(UpdateSender *sender, Desktop *desktop,
+                   const EncodeGroupKey *key);
+  // Should be called by a grouped sender on receiving an update request.
+  // The compatible flag tells if the sender's key is still equal to the key
+  // of its group. If it's not, the sender will be removed from the group.
+  void onSenderRequest(UpdateSender *sender, bool compatible);
+  // Should be called by a sender that has joined a group with the changes
+  // it has not sent to its client. Returns false if the sender is not a
+  // member anymore, the changes are not taken then.
+  bool catchUpSender(UpdateSender *sender, const UpdateContainer *missed);
+  // Forgets the sender. Must be called before destroying an update sender
+  // which was passed to offerSender().
+  void removeSender(UpdateSender *sender);
+
+  // Tells all groups about new updates in the journal.
+  void newUpdates(const CursorShape *cursorShape);
+  // Returns true if any group waits for updates.
+  bool isReadyToSend();
+
+private:
+  // Adds the sender to a group or to the list of candidates. Must be called
+  // with m_lock locked.
+  void placeSender(UpdateSender *sender, Desktop *desktop,
+                   const EncodeGroupKey *key);
+  void removeCandidate(UpdateSender *sender);
+  // Moves empty groups from m_groups to the garbage list. Must be called
+  // with m_lock locked.
+  void collectEmptyGroups(std::list<EncodeGroup *> *garbage);
+  // Destroys the groups collected by collectEmptyGroups(). Must be called
+  // with m_lock unlocked because destroying a group waits for its pipeline
+  // thread.
+  void destroyGroups(std::list<EncodeGroup *> *garbage);
+
+  // A sender that has been offered but has not been grouped yet.
+  struct Candidate
+  {
+    UpdateSender *sender;
+    EncodeGroupKey key;
+  };
+  typedef std::list<Candidate> CandidateList;
+  typedef std::list<EncodeGroup *> GroupList;
+
+  CandidateList m_candidates;
+  GroupList m_groups;
+  LocalMutex m_lock;
+
+  unsigned int m_maxLag;
+  int m_nextGroupId;
+
+  DamageJournal *m_journal;
+  ThreadPool *m_encoderPool;
+
+  LogWriter *m_log;
+};
+
+#endif // __ENCODEGROUPMANAGER_H__
@@ -0,0 +1,137 @@
+// Copyright (C) 2012 GlavSoft LLC.
+// All rights reserved.
+//
+//-------------------------------------------------------------------------
+// This file is part of the TightVNC software.  Please visit our Web site:
+//
+//                       http://www.tightvnc.com/
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+//-------------------------------------------------------------------------
+//
+
+#include "FenceFlowControl.h"
+#include "thread/AutoLock.h"
+
+// Weight of a new round-trip time sample in the smoothed value.
+static const double RTT_SAMPLE_WEIGHT = 0.25;
+
+FenceFlowControl::FenceFlowControl()
+: m_nextId(0)
+{
+  reset();
+}
+
+void FenceFlowControl::reset()
+{
+  AutoLock al(&m_lock);
+  m_inFlight.clear();
+  m_bytesInFlight = 0;
+  m_window = INITIAL_WINDOW;
+  m_hasRoundTripTime = false;
+  m_roundTripTime = 0;
+  m_minRoundTripTime = 0;
+  m_lastResponseTime = DateTime(0);
+  // m_nextId keeps counting so responses to fences sent before the reset
+  // are not mistaken for new ones.
+}
+
+UINT32 FenceFlowControl::onUpdateSent(UINT64 numBytes)
+{
+  AutoLock al(&m_lock);
+  Update update;
+  update.id = m_nextId++;
+  update.numBytes = numBytes;
+  update.sendTime = DateTime::now().getTime();
+  m_inFlight.push_back(update);
+  m_bytesInFlight += numBytes;
+  return update.id;
+}
+
+bool FenceFlowControl::onFenceResponse(UINT32 id)
+{
+  AutoLock al(&m_lock);
+
+  UpdateList::iterator iter;
+  for (iter = m_inFlight.begin(); iter != m_inFlight.end(); iter++) {
+    if (iter->id == id) {
+      break;
+    }
+  }
+  if (iter == m_inFlight.end()) {
+    return false;
+  }
+
+  DateTime now = DateTime::now();
+  double rtt = (double)(now.getTime() - iter->sendTime);
+  if (!m_hasRoundTripTime) {
+    m_roundTripTime = rtt;
+    m_minRoundTripTime = rtt;
+    m_hasRoundTripTime = true;
+  } else {
+    m_roundTripTime += (rtt - m_roundTripTime) * RTT_SAMPLE_WEIGHT;
+    m_minRoundTripTime = min(m_minRoundTripTime, rtt);
+  }
+  m_lastResponseTime = now;
+
+  // Fences are answered in order, so all the earlier updates have been
+  // processed as well.
+  UINT64 ackedBytes = 0;
+  iter++;
+  while (m_inFlight.begin() != iter) {
+    ackedBytes += m_inFlight.front().numBytes;
+    m_inFlight.pop_front();
+  }
+  m_bytesInFlight -= ackedBytes;
+
+  if (m_roundTripTime > 2 * m_minRoundTripTime + CONGESTION_MARGIN) {
+    m_window = max(m_window * 3 / 4, MIN_WINDOW);
+  } else {
+    m_window = min(m_window + ackedBytes, MAX_WINDOW);
+  }
+  return true;
+}
+
+bool FenceFlowControl::canSend()
+{
+  AutoLock al(&m_lock);
+  return m_inFlight.empty() ||
+         (m_bytesInFlight < m_window &&
+          m_inFlight.size() < MAX_UPDATES_IN_FLIGHT);
+}
+
+DateTime FenceFlowControl::getLastResponseTime()
+{
+  AutoLock al(&m_lock);
+  return m_lastResponseTime;
+}
+
+UINT64 FenceFlowControl::getBytesInFlight()
+{
+  AutoLock al(&m_lock);
+  return m_bytesInFlight;
+}
+
+UINT64 FenceFlowControl::getCongestionWindow()
+{
+  AutoLock al(&m_lock);
+  return m_window;
+}
+
+unsigned int FenceFlowControl::getRoundTripTime()
+{
+  AutoLock al(&m_lock);
+  return (unsigned int)m_roundTripTime;
+}
@@ -0,0 +1,110 @@
+// Copyright (C) 2012 GlavSoft LLC.
+// All rights reserved.
+//
+//-------------------------------------------------------------------------
+// This file is part of the TightVNC software.  Please visit our Web site:
+//
+//                       http://www.tightvnc.com/
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+//-------------------------------------------------------------------------
+//
+
+#ifndef __FENCEFLOWCONTROL_H__
+#define __FENCEFLOWCONTROL_H__
+
+#include <list>
+
+#include "util/DateTime.h"
+#include "util/inttypes.h"
+#include "thread/LocalMutex.h"
+
+// FenceFlowControl limits the amount of data sent to a client in the
+// ContinuousUpdates mode, where the client does not request each update.
+//
+// A Fence request is sent after every update, and the client answers it as
+// soon as it has processed everything before the fence. The data of the
+// updates which have not been answered yet is in flight. A new update may be
+// started while the amount of data in flight is below the congestion window.
+//
+// The window grows by the amount of acknowledged data while the fence
+// round-trip time stays close to the minimal one, and shrinks when the
+// round-trip time grows, which means that the data is queued on the way.
+// At least one update is always allowed, so a single large update cannot
+// stall the client.
+//
+// All functions are thread-safe: fence responses are handled by the thread
+// reading client messages, updates are sent by the sender thread.
+class FenceFlowControl
+{
+public:
+  FenceFlowControl();
+
+  // Forgets all updates in flight and measurements.
+  void reset();
+
+  // Should be called when an update of numBytes bytes has been written.
+  // Returns the identifier to send in the fence following the update.
+  UINT32 onUpdateSent(UINT64 numBytes);
+
+  // Should be called on a fence response carrying the identifier returned by
+  // onUpdateSent(). Returns false if the identifier is not known (e.g. the
+  // flow has been reset since the fence was sent).
+  bool onFenceResponse(UINT32 id);
+
+  // Returns true if another update may be sent now.
+  bool canSend();
+
+  // Time of the most recent fence response, zero time if there was none.
+  DateTime getLastResponseTime();
+
+  // Statistics.
+  UINT64 getBytesInFlight();
+  UINT64 getCongestionWindow();
+  unsigned int getRoundTripTime();
+
+private:
+  struct Update
+  {
+    UINT32 id;
+    UINT64 numBytes;
+    UINT64 sendTime;
+  };
+  typedef std::list<Update> UpdateList;
+
+  // Limits for the congestion window, in bytes.
+  static const UINT64 MIN_WINDOW = 64 * 1024;
+  static const UINT64 INITIAL_WINDOW = 256 * 1024;
+  static const UINT64 MAX_WINDOW = 64 * 1024 * 1024;
+  // Fences are never queued deeper than that, whatever the window is.
+  static const size_t MAX_UPDATES_IN_FLIGHT = 16;
+  // The round-trip time is considered grown if it exceeds twice the
+  // minimal one plus this margin (in milliseconds).
+  static const unsigned int CONGESTION_MARGIN = 50;
+
+  UpdateList m_inFlight;
+  UINT64 m_bytesInFlight;
+  UINT32 m_nextId;
+  UINT64 m_window;
+
+  bool m_hasRoundTripTime;
+  double m_roundTripTime;
+  double m_minRoundTripTime;
+  DateTime m_lastResponseTime;
+
+  LocalMutex m_lock;
+};
+
+#endif // __FENCEFLOWCONTROL_H__
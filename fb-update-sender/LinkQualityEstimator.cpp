@@ -0,0 +1,198 @@
+// Copyright (C) 2012 GlavSoft LLC.
+// All rights reserved.
+//
+//-------------------------------------------------------------------------
+// This file is part of the TightVNC software.  Please visit our Web site:
+//
+//                       http://www.tightvnc.com/
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+//-------------------------------------------------------------------------
+//
+
+#include "LinkQualityEstimator.h"
+
+// Link classes from the fastest to the slowest one. A class is used when
+// the throughput is at least minThroughput bytes per second. lossless
+// refresh of 1/losslessDivisor part of the screen is added to every update.
+struct LinkClass
+{
+  unsigned int minThroughput;
+  int maxJpegQuality;
+  int minCompressionLevel;
+  int losslessDivisor;
+};
+
+static const LinkClass LINK_CLASSES[] = {
+  { 8 * 1024 * 1024, 9, 0, 100 },
+  { 2 * 1024 * 1024, 8, 2, 100 },
+  {      512 * 1024, 6, 5, 200 },
+  {      128 * 1024, 4, 7, 400 },
+  {               0, 2, 9, 800 }
+};
+
+static const int NUM_LINK_CLASSES = sizeof(LINK_CLASSES) / sizeof(LINK_CLASSES[0]);
+
+// Weight of a new sample in the smoothed values.
+static const double SAMPLE_WEIGHT = 0.25;
+// The base round-trip time follows longer samples this slowly, so the
+// estimator adapts to a changed route.
+static const double BASE_RTT_RISE = 1.0 / 64;
+
+LinkQualityEstimator::LinkQualityEstimator()
+{
+  reset();
+}
+
+void LinkQualityEstimator::reset()
+{
+  m_updatePending = false;
+  m_pendingBytes = 0;
+  m_pendingStartTime = 0;
+  m_pendingEndTime = 0;
+
+  m_numSamples = 0;
+  m_throughput = 0;
+  m_roundTripTime = 0;
+  m_baseRoundTripTime = 0;
+  m_congested = false;
+  m_linkClass = 0;
+}
+
+void LinkQualityEstimator::onUpdateSent(UINT64 numBytes,
+                                        const DateTime *startTime)
+{
+  DateTime endTime = DateTime::now();
+  onUpdateSent(numBytes, startTime, &endTime);
+}
+
+void LinkQualityEstimator::onUpdateSent(UINT64 numBytes,
+                                        const DateTime *startTime,
+                                        const DateTime *endTime)
+{
+  m_updatePending = true;
+  m_pendingBytes = numBytes;
+  m_pendingStartTime = startTime->getTime();
+  m_pendingEndTime = endTime->getTime();
+}
+
+void LinkQualityEstimator::onUpdateRequest(const DateTime *requestTime)
+{
+  UINT64 reqTime = requestTime->getTime();
+  if (!m_updatePending || reqTime < m_pendingEndTime) {
+    // Either nothing has been sent yet or the request was sent by the
+    // client before it got the previous update.
+    return;
+  }
+  m_updatePending = false;
+
+  double rtt = (double)(reqTime - m_pendingEndTime);
+  if (m_roundTripTime == 0 && m_baseRoundTripTime == 0) {
+    m_roundTripTime = rtt;
+    m_baseRoundTripTime = rtt;
+  } else {
+    m_roundTripTime += (rtt - m_roundTripTime) * SAMPLE_WEIGHT;
+    if (rtt < m_baseRoundTripTime) {
+      m_baseRoundTripTime = rtt;
+    } else {
+      m_baseRoundTripTime += (rtt - m_baseRoundTripTime) * BASE_RTT_RISE;
+    }
+  }
+  m_congested = m_roundTripTime > 2 * m_baseRoundTripTime + CONGESTION_MARGIN;
+
+  if (m_pendingBytes >= MIN_SAMPLE_BYTES) {
+    UINT64 interval = max(reqTime - m_pendingStartTime, (UINT64)1);
+    double throughput = (double)m_pendingBytes * 1000 / (double)interval;
+    if (m_numSamples == 0) {
+      m_throughput = throughput;
+    } else {
+      m_throughput += (throughput - m_throughput) * SAMPLE_WEIGHT;
+    }
+    m_numSamples++;
+  }
+
+  updateLinkClass();
+}
+
+void LinkQualityEstimator::updateLinkClass()
+{
+  if (m_numSamples == 0) {
+    return;
+  }
+  int target = 0;
+  while (target < NUM_LINK_CLASSES - 1 &&
+         m_throughput < LINK_CLASSES[target].minThroughput) {
+    target++;
+  }
+  // Move to a faster class only when the throughput is well above its
+  // threshold, so the parameters do not flip on every update. Either way
+  // make one step at a time.
+  if (target < m_linkClass) {
+    double threshold = LINK_CLASSES[m_linkClass - 1].minThroughput;
+    if (m_throughput >= threshold * 1.25) {
+      m_linkClass--;
+    }
+  } else if (target > m_linkClass) {
+    m_linkClass++;
+  }
+}
+
+void LinkQualityEstimator::adjustEncodeOptions(EncodeOptions *encodeOptions) const
+{
+  int linkClass = m_linkClass;
+  if (m_congested) {
+    linkClass = min(linkClass + 1, NUM_LINK_CLASSES - 1);
+  }
+  encodeOptions->limitJpegQualityLevel(LINK_CLASSES[linkClass].maxJpegQuality);
+  encodeOptions->raiseCompressionLevel(LINK_CLASSES[linkClass].minCompressionLevel);
+}
+
+int LinkQualityEstimator::getLosslessRefreshArea(int screenArea) const
+{
+  if (m_congested) {
+    return 0;
+  }
+  return screenArea / LINK_CLASSES[m_linkClass].losslessDivisor;
+}
+
+bool LinkQualityEstimator::hasEstimate() const
+{
+  return m_numSamples != 0;
+}
+
+unsigned int LinkQualityEstimator::getThroughput() const
+{
+  return (unsigned int)m_throughput;
+}
+
+unsigned int LinkQualityEstimator::getRoundTripTime() const
+{
+  return (unsigned int)m_roundTripTime;
+}
+
+unsigned int LinkQualityEstimator::getBaseRoundTripTime() const
+{
+  return (unsigned int)m_baseRoundTripTime;
+}
+
+bool LinkQualityEstimator::isCongested() const
+{
+  return m_congested;
+}
+
+int LinkQualityEstimator::getLinkClass() const
+{
+  return m_linkClass;
+}
@@ -0,0 +1,114 @@
+// Copyright (C) 2012 GlavSoft LLC.
+// All rights reserved.
+//
+//-------------------------------------------------------------------------
+// This file is part of the TightVNC software.  Please visit our Web site:
+//
+//                       http://www.tightvnc.com/
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+//-------------------------------------------------------------------------
+//
+
+#ifndef __LINKQUALITYESTIMATOR_H__
+#define __LINKQUALITYESTIMATOR_H__
+
+#include "rfb-sconn/EncodeOptions.h"
+#include "util/DateTime.h"
+#include "util/inttypes.h"
+
+// LinkQualityEstimator measures throughput and round-trip time of the link to
+// an RFB client and chooses encoding parameters that fit the link.
+//
+// Nothing special is required from the client. When a FramebufferUpdate
+// message has been written, its size and time are remembered, and the
+// arrival of the next update request marks the moment when the client has
+// received and decoded the message. The interval from the beginning of
+// writing to that request gives the effective throughput, the interval from
+// the end of writing gives an upper estimate of the round-trip time. The
+// minimal round-trip time seen is taken as the base delay of the link; a
+// delay much longer than that means the data is queued somewhere on the way,
+// i.e. the link is congested.
+//
+// Measurements are mapped to a link class which limits the JPEG quality,
+// the compression level and the amount of lossless refresh. The limits never
+// go beyond what the client has asked for: JPEG quality can only be lowered
+// and the compression level can only be raised.
+//
+// The class is not thread-safe, it should be used only by the sender thread.
+class LinkQualityEstimator
+{
+public:
+  LinkQualityEstimator();
+
+  // Forgets all measurements.
+  void reset();
+
+  // Should be called after a FramebufferUpdate message of numBytes bytes
+  // has been written and flushed. startTime is the moment when writing began.
+  void onUpdateSent(UINT64 numBytes, const DateTime *startTime);
+  // Same as above, endTime is the moment when writing was finished.
+  void onUpdateSent(UINT64 numBytes, const DateTime *startTime,
+                    const DateTime *endTime);
+
+  // Should be called with the arrival time of the update request which is
+  // about to be served. Requests which came before the previous update had
+  // been written are not used for measurement.
+  void onUpdateRequest(const DateTime *requestTime);
+
+  // Limits the JPEG quality and the compression level according to the
+  // current link class.
+  void adjustEncodeOptions(EncodeOptions *encodeOptions) const;
+
+  // Returns the area (in pixels) of lossless refresh which may be added to
+  // an update of a screen with screenArea pixels. Returns 0 while the link is
+  // congested.
+  int getLosslessRefreshArea(int screenArea) const;
+
+  // Returns true if at least one throughput sample has been taken.
+  bool hasEstimate() const;
+  // Estimated throughput, in bytes per second.
+  unsigned int getThroughput() const;
+  // Smoothed and base round-trip times, in milliseconds.
+  unsigned int getRoundTripTime() const;
+  unsigned int getBaseRoundTripTime() const;
+  bool isCongested() const;
+  // Current link class, 0 is the fastest one.
+  int getLinkClass() const;
+
+private:
+  void updateLinkClass();
+
+  // Updates smaller than this give too rough throughput samples since
+  // their delivery time is mostly the round-trip time.
+  static const UINT64 MIN_SAMPLE_BYTES = 16384;
+  // The link is considered congested if the round-trip time exceeds twice
+  // the base one plus this margin (in milliseconds).
+  static const unsigned int CONGESTION_MARGIN = 50;
+
+  bool m_updatePending;
+  UINT64 m_pendingBytes;
+  UINT64 m_pendingStartTime;
+  UINT64 m_pendingEndTime;
+
+  int m_numSamples;
+  double m_throughput;
+  double m_roundTripTime;
+  double m_baseRoundTripTime;
+  bool m_congested;
+  int m_linkClass;
+};
+
+#endif // __LINKQUALITYESTIMATOR_H__
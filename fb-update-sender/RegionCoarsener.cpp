@@ -0,0 +1,160 @@
+// Copyright (C) 2012 GlavSoft LLC.
+// All rights reserved.
+//
+//-------------------------------------------------------------------------
+// This file is part of the TightVNC software.  Please visit our Web site:
+//
+//                       http://www.tightvnc.com/
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+//-------------------------------------------------------------------------
+//
+
+
+#include "RegionCoarsener.h"
+
+// Pixels are never considered cheaper than that, the statistics are
+// collected for rectangles that are hard to compress, but the error should
+// not let big areas of unchanged pixels into the update.
+const double RegionCoarsener::MIN_PIXEL_COST = 1.0 / 16;
+
+RegionCoarsener::RegionCoarsener()
+: m_pixelCost(4.0)
+{
+}
+
+void RegionCoarsener::setPixelCost(const TightCostModel::Stats *stats,
+                                   size_t bytesPerPixel)
+{
+  if (stats != 0 && stats->selectedPixels >= MIN_STATS_PIXELS) {
+    m_pixelCost = (double)stats->actualBytes / (double)stats->selectedPixels;
+  } else {
+    m_pixelCost = (double)bytesPerPixel;
+  }
+  if (m_pixelCost < MIN_PIXEL_COST) {
+    m_pixelCost = MIN_PIXEL_COST;
+  }
+}
+
+void RegionCoarsener::coarsen(Region *region, Stats *stats) const
+{
+  std::vector<Rect> rects;
+  region->getRectVector(&rects);
+  stats->numRectsBefore = rects.size();
+  stats->numRectsAfter = rects.size();
+  stats->wastedPixels = 0;
+  if (rects.size() <= 1) {
+    return;
+  }
+
+  // The rectangles come in bands from top to bottom. Each band is joined
+  // over its gaps and then merged with the band before it if that pays.
+  std::vector<Rect> result;
+  std::vector<Rect> merged;
+  result.reserve(rects.size());
+  size_t prevBandStart = 0;
+  size_t i = 0;
+  while (i < rects.size()) {
+    size_t bandStart = result.size();
+    int top = rects[i].top;
+    for (; i < rects.size() && rects[i].top == top; i++) {
+      result.push_back(rects[i]);
+    }
+    stats->wastedPixels += fillGaps(&result, bandStart);
+    if (bandStart == 0) {
+      continue;
+    }
+
+    // Make one band of the spans of both bands, from the top of the
+    // previous band to the bottom of this one.
+    int mergedTop = result[prevBandStart].top;
+    int mergedBottom = result[bandStart].bottom;
+    merged.clear();
+    size_t a = prevBandStart;
+    size_t b = bandStart;
+    while (a < bandStart || b < result.size()) {
+      const Rect *span;
+      if (b == result.size() ||
+          a < bandStart && result[a].left < result[b].left) {
+        span = &result[a++];
+      } else {
+        span = &result[b++];
+      }
+      if (!merged.empty() && merged.back().right >= span->left) {
+        merged.back().right = max(merged.back().right, span->right);
+      } else {
+        merged.push_back(Rect(span->left, mergedTop,
+                              span->right, mergedBottom));
+      }
+    }
+    fillGaps(&merged, 0);
+
+    int addedPixels = getArea(&merged, 0, merged.size()) -
+                      getArea(&result, prevBandStart, result.size());
+    int savedRects = (int)(result.size() - prevBandStart) -
+                     (int)merged.size();
+    if (savedRects > 0 && isCheaper(addedPixels, savedRects)) {
+      result.resize(prevBandStart);
+      result.insert(result.end(), merged.begin(), merged.end());
+      stats->wastedPixels += addedPixels;
+    } else {
+      prevBandStart = bandStart;
+    }
+  }
+
+  if (result.size() < rects.size()) {
+    region->clear();
+    region->addRects(&result);
+    stats->numRectsAfter = region->getCount();
+  }
+}
+
+int RegionCoarsener::fillGaps(std::vector<Rect> *spans,
+                              size_t bandStart) const
+{
+  if (spans->size() <= bandStart) {
+    return 0;
+  }
+  int height = (*spans)[bandStart].getHeight();
+  int addedPixels = 0;
+  size_t last = bandStart;
+  for (size_t i = bandStart + 1; i < spans->size(); i++) {
+    int gapPixels = ((*spans)[i].left - (*spans)[last].right) * height;
+    if (isCheaper(gapPixels, 1)) {
+      (*spans)[last].right = (*spans)[i].right;
+      addedPixels += gapPixels;
+    } else {
+      (*spans)[++last] = (*spans)[i];
+    }
+  }
+  spans->resize(last + 1);
+  return addedPixels;
+}
+
+int RegionCoarsener::getArea(const std::vector<Rect> *spans, size_t begin,
+                             size_t end)
+{
+  int area = 0;
+  for (size_t i = begin; i < end; i++) {
+    area += (*spans)[i].area();
+  }
+  return area;
+}
+
+bool RegionCoarsener::isCheaper(int addedPixels, int savedRects) const
+{
+  return addedPixels * m_pixelCost <
+         savedRects * (double)(RECT_HEADER_SIZE + ENCODER_RECT_OVERHEAD);
+}
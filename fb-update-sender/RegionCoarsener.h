@@ -0,0 +1,85 @@
+// Copyright (C) 2012 GlavSoft LLC.
+// All rights reserved.
+//
+//-------------------------------------------------------------------------
+// This file is part of the TightVNC software.  Please visit our Web site:
+//
+//                       http://www.tightvnc.com/
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+//-------------------------------------------------------------------------
+//
+
+
+#ifndef __REGIONCOARSENER_H__
+#define __REGIONCOARSENER_H__
+
+#include <vector>
+
+#include "region/Region.h"
+#include "rfb-sconn/TightCostModel.h"
+
+// RegionCoarsener reduces the number of rectangles of a changed region by
+// adding unchanged pixels to it. Rectangles of a band are joined over the
+// gap between them, and neighbouring bands are merged into one band, when
+// sending the added pixels costs less than sending the saved rectangles.
+//
+// A rectangle costs its header and the fixed overhead the encoder has per
+// rectangle (a zlib flush and a compression control byte for Tight). A
+// pixel costs the average number of bytes the encoder has produced for a
+// pixel so far.
+class RegionCoarsener
+{
+public:
+  struct Stats
+  {
+    size_t numRectsBefore;
+    size_t numRectsAfter;
+    // The number of unchanged pixels added to the region.
+    int wastedPixels;
+  };
+
+  RegionCoarsener();
+
+  // Estimates the cost of a pixel from the statistics of Tight encoder, or
+  // from the pixel size if stats is 0 or has too few pixels to rely on.
+  void setPixelCost(const TightCostModel::Stats *stats, size_t bytesPerPixel);
+
+  void coarsen(Region *region, Stats *stats) const;
+
+  // The size of a rectangle header in FramebufferUpdate message.
+  static const int RECT_HEADER_SIZE = 12;
+  // Bytes of encoded data an encoder spends on a rectangle regardless of its
+  // size, and the time it spends on a rectangle expressed in bytes.
+  static const int ENCODER_RECT_OVERHEAD = 16;
+
+private:
+  // Joins spans of the band at [bandStart, spans->end()) over the gaps
+  // that are cheaper to send than a rectangle. Returns the added area.
+  int fillGaps(std::vector<Rect> *spans, size_t bandStart) const;
+  // Returns the area of spans in [begin, end).
+  static int getArea(const std::vector<Rect> *spans, size_t begin,
+                     size_t end);
+
+  bool isCheaper(int addedPixels, int savedRects) const;
+
+  // The statistics are used when they cover that many pixels.
+  static const UINT64 MIN_STATS_PIXELS = 65536;
+  static const double MIN_PIXEL_COST;
+
+  double m_pixelCost;
+};
+
+#endif // __REGIONCOARSENER_H__
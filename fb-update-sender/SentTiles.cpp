@@ -0,0 +1,126 @@
+// Copyright (C) 2012 GlavSoft LLC.
+// All rights reserved.
+//
+//-------------------------------------------------------------------------
+// This file is part of the TightVNC software.  Please visit our Web site:
+//
+//                       http://www.tightvnc.com/
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+//-------------------------------------------------------------------------
+//
+
+
+#include "SentTiles.h"
+
+SentTiles::SentTiles()
+{
+}
+
+void SentTiles::reset()
+{
+  m_tiles.clear();
+}
+
+void SentTiles::resize(const FrameTiles *tiles)
+{
+  if (m_tiles.size() != tiles->getNumTiles()) {
+    SentTile unknown = { false, 0, { 0, 0 } };
+    m_tiles.assign(tiles->getNumTiles(), unknown);
+  }
+}
+
+size_t SentTiles::filter(const FrameSnapshot *snapshot, Region *changedRegion,
+                         const Region *keepRegion)
+{
+  const FrameTiles *tiles = snapshot->getTiles();
+  if (m_tiles.size() != tiles->getNumTiles()) {
+    return 0;
+  }
+  std::vector<size_t> changedTiles;
+  tiles->getTileIndices(changedRegion, &changedTiles);
+  std::vector<size_t> keptTiles;
+  tiles->getTileIndices(keepRegion, &keptTiles);
+
+  // The rectangles of the tiles which remain changed.
+  std::vector<Rect> changedRects;
+  changedRects.reserve(changedTiles.size());
+  std::vector<size_t>::const_iterator kept = keptTiles.begin();
+  for (size_t i = 0; i < changedTiles.size(); i++) {
+    size_t index = changedTiles[i];
+    // Both lists are sorted.
+    while (kept != keptTiles.end() && *kept < index) {
+      kept++;
+    }
+    const SentTile *sent = &m_tiles[index];
+    bool isKept = kept != keptTiles.end() && *kept == index;
+    if (isKept || !sent->known) {
+      changedRects.push_back(tiles->getTileRect(index));
+      continue;
+    }
+    FrameTiles::Hash hash = tiles->getHash(index);
+    if (sent->generation != tiles->getGeneration(index) &&
+        !sent->hash.isEqualTo(&hash)) {
+      changedRects.push_back(tiles->getTileRect(index));
+    }
+  }
+
+  size_t numRemoved = changedTiles.size() - changedRects.size();
+  if (numRemoved != 0) {
+    Region changedTilesRegion;
+    changedTilesRegion.addRects(&changedRects);
+    changedRegion->intersect(&changedTilesRegion);
+  }
+  return numRemoved;
+}
+
+void SentTiles::onUpdateSent(const FrameSnapshot *snapshot,
+                             UINT64 frameGeneration,
+                             const Region *sentRegion,
+                             const Region *outOfSyncRegion)
+{
+  const FrameTiles *tiles = snapshot->getTiles();
+  resize(tiles);
+
+  // The tiles sent whole become known. The rest of a known tile sent in
+  // part has not changed (otherwise it would be out of sync), so the tile
+  // remains known. Changes made after frameGeneration are in the snapshot
+  // but have not reached the sender yet, such tiles become unknown.
+  std::vector<size_t> sentTiles;
+  tiles->getTileIndices(sentRegion, &sentTiles);
+  for (size_t i = 0; i < sentTiles.size(); i++) {
+    size_t index = sentTiles[i];
+    SentTile *sent = &m_tiles[index];
+    if (!sent->known) {
+      Rect tileRect = tiles->getTileRect(index);
+      Region notSent(&tileRect);
+      notSent.subtract(sentRegion);
+      sent->known = notSent.isEmpty();
+    }
+    if (tiles->getGeneration(index) > frameGeneration) {
+      sent->known = false;
+    }
+    if (sent->known) {
+      sent->generation = tiles->getGeneration(index);
+      sent->hash = tiles->getHash(index);
+    }
+  }
+
+  std::vector<size_t> outOfSyncTiles;
+  tiles->getTileIndices(outOfSyncRegion, &outOfSyncTiles);
+  for (size_t i = 0; i < outOfSyncTiles.size(); i++) {
+    m_tiles[outOfSyncTiles[i]].known = false;
+  }
+}
@@ -0,0 +1,84 @@
+// Copyright (C) 2012 GlavSoft LLC.
+// All rights reserved.
+//
+//-------------------------------------------------------------------------
+// This file is part of the TightVNC software.  Please visit our Web site:
+//
+//                       http://www.tightvnc.com/
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+//-------------------------------------------------------------------------
+//
+
+
+#ifndef __SENTTILES_H__
+#define __SENTTILES_H__
+
+#include <vector>
+
+#include "desktop/FrameTiles.h"
+#include "desktop/SharedFrameBuffer.h"
+
+// SentTiles remembers the content of the shared frame buffer tiles the
+// client has. A tile reported as changed does not need to be sent if its
+// content is the same as the one the client has got before, as it happens
+// with a blinking caret or an animation loop. The client has the current
+// content of a tile if the generation of the tile has not changed since it
+// was sent, or if the 128-bit content hashes are equal.
+//
+// The client is known to have the content of a tile as of an update if all
+// changes of the tile up to the frame generation of the update have been
+// passed to the sender, none of them are waiting in the sender and the
+// client has got the whole tile at least once since the last reset().
+//
+// The class is used by the sender thread only.
+class SentTiles
+{
+public:
+  SentTiles();
+
+  // Forgets the content of all tiles, e.g. when the client frame buffer
+  // has been replaced.
+  void reset();
+
+  // Removes the tiles the client already has from changedRegion, except
+  // the tiles intersecting keepRegion. Returns the number of removed tiles.
+  // Only the tiles of changedRegion are visited.
+  size_t filter(const FrameSnapshot *snapshot, Region *changedRegion,
+                const Region *keepRegion);
+
+  // Should be called after an update has been sent from the snapshot. All
+  // changes up to frameGeneration have been passed to the sender,
+  // sentRegion has been sent from the snapshot, and the client may have
+  // pixels different from the snapshot in outOfSyncRegion. Only the tiles
+  // of sentRegion and outOfSyncRegion are visited.
+  void onUpdateSent(const FrameSnapshot *snapshot, UINT64 frameGeneration,
+                    const Region *sentRegion, const Region *outOfSyncRegion);
+
+private:
+  // The tile content the client has, as of the snapshot it was sent from.
+  struct SentTile
+  {
+    bool known;
+    UINT64 generation;
+    FrameTiles::Hash hash;
+  };
+
+  void resize(const FrameTiles *tiles);
+
+  std::vector<SentTile> m_tiles;
+};
+
+#endif // __SENTTILES_H__
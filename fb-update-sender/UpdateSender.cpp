@@ -31,58 +31,84 @@
 #include "util/inttypes.h"
 #include "util/Exception.h"
 #include "UpdSenderMsgDefs.h"
+#include "EncodeGroupManager.h"
+#include "server-config-lib/Configurator.h"
 
 UpdateSender::UpdateSender(RfbCodeRegistrator *codeRegtor,
                            UpdateRequestListener *updReqListener,
                            SenderControlInformationInterface *senderControlInformation,
                            RfbOutputGate *output, int id,
                            Desktop *desktop,
+                           DamageJournal *journal,
+                           EncodeGroupManager *encodeGroups,
+                           ThreadPool *encoderPool,
                            LogWriter *log)
 : m_updReqListener(updReqListener),
+  m_usingSharedFrame(false),
   m_desktop(desktop),
+  m_journal(journal),
+  m_journalCursor(0),
   m_senderControlInformation(senderControlInformation),
   m_busy(false),
   m_incrUpdIsReq(false),
   m_fullUpdIsReq(false),
+  m_flowControlSupported(false),
+  m_continuousUpdates(false),
+  m_sendEndOfContinuousUpdates(false),
+  m_continuousUpdatesAnnounced(false),
+  m_fenceAnnounced(false),
   m_setColorMapEntr(false),
   m_output(output),
-  m_enbox(&m_pixelConverter, m_output),
+  m_enbox(&m_pixelConverter, m_output, encoderPool),
   m_id(id),
   m_videoFrozen(false),
   m_shareOnlyApp(false),
+  m_encodeGroups(encodeGroups),
+  m_encodeGroup(0),
+  m_lastUpdateGroupable(false),
+  m_catchUpGroup(false),
+  m_resetEncoders(false),
+  m_isSharedPipeline(codeRegtor == 0),
   m_log(log),
   m_cursorUpdates(log)
 {
   // FIXME: argument must be defined
   m_updateKeeper = new UpdateKeeper(&Rect());
-
-  // Capabilities
-  codeRegtor->addEncCap(EncodingDefs::COPYRECT,          VendorDefs::STANDARD,
-                        EncodingDefs::SIG_COPYRECT);
-  codeRegtor->addEncCap(EncodingDefs::HEXTILE,           VendorDefs::STANDARD,
-                        EncodingDefs::SIG_HEXTILE);
-  codeRegtor->addEncCap(EncodingDefs::TIGHT,             VendorDefs::TIGHTVNC,
-                        EncodingDefs::SIG_TIGHT);
-  codeRegtor->addEncCap(PseudoEncDefs::COMPR_LEVEL_0,    VendorDefs::TIGHTVNC,
-                        PseudoEncDefs::SIG_COMPR_LEVEL);
-  codeRegtor->addEncCap(PseudoEncDefs::QUALITY_LEVEL_0,  VendorDefs::TIGHTVNC,
-                        PseudoEncDefs::SIG_QUALITY_LEVEL);
-  codeRegtor->addEncCap(PseudoEncDefs::RICH_CURSOR,      VendorDefs::TIGHTVNC,
-                        PseudoEncDefs::SIG_RICH_CURSOR);
-  codeRegtor->addEncCap(PseudoEncDefs::POINTER_POS,      VendorDefs::TIGHTVNC,
-                        PseudoEncDefs::SIG_POINTER_POS);
-  codeRegtor->addEncCap(PseudoEncDefs::DESKTOP_SIZE,     VendorDefs::TIGHTVNC,
-                        PseudoEncDefs::SIG_DESKTOP_SIZE);
-
-  codeRegtor->addClToSrvCap(UpdSenderClientMsgDefs::RFB_VIDEO_FREEZE,
-                            VendorDefs::TIGHTVNC,
-                            UpdSenderClientMsgDefs::RFB_VIDEO_FREEZE_SIG);
-
-  // Request codes
-  codeRegtor->regCode(UpdSenderClientMsgDefs::RFB_VIDEO_FREEZE, this);
-  codeRegtor->regCode(ClientMsgDefs::FB_UPDATE_REQUEST, this);
-  codeRegtor->regCode(ClientMsgDefs::SET_PIXEL_FORMAT, this);
-  codeRegtor->regCode(ClientMsgDefs::SET_ENCODINGS, this);
+  m_journal->addCursor(&m_journalCursor);
+
+  // The shared pipeline of an encode group has no connection to register
+  // capabilities and handlers for.
+  if (codeRegtor != 0) {
+    // Capabilities
+    codeRegtor->addEncCap(EncodingDefs::COPYRECT,          VendorDefs::STANDARD,
+                          EncodingDefs::SIG_COPYRECT);
+    codeRegtor->addEncCap(EncodingDefs::HEXTILE,           VendorDefs::STANDARD,
+                          EncodingDefs::SIG_HEXTILE);
+    codeRegtor->addEncCap(EncodingDefs::TIGHT,             VendorDefs::TIGHTVNC,
+                          EncodingDefs::SIG_TIGHT);
+    codeRegtor->addEncCap(PseudoEncDefs::COMPR_LEVEL_0,    VendorDefs::TIGHTVNC,
+                          PseudoEncDefs::SIG_COMPR_LEVEL);
+    codeRegtor->addEncCap(PseudoEncDefs::QUALITY_LEVEL_0,  VendorDefs::TIGHTVNC,
+                          PseudoEncDefs::SIG_QUALITY_LEVEL);
+    codeRegtor->addEncCap(PseudoEncDefs::RICH_CURSOR,      VendorDefs::TIGHTVNC,
+                          PseudoEncDefs::SIG_RICH_CURSOR);
+    codeRegtor->addEncCap(PseudoEncDefs::POINTER_POS,      VendorDefs::TIGHTVNC,
+                          PseudoEncDefs::SIG_POINTER_POS);
+    codeRegtor->addEncCap(PseudoEncDefs::DESKTOP_SIZE,     VendorDefs::TIGHTVNC,
+                          PseudoEncDefs::SIG_DESKTOP_SIZE);
+
+    codeRegtor->addClToSrvCap(UpdSenderClientMsgDefs::RFB_VIDEO_FREEZE,
+                              VendorDefs::TIGHTVNC,
+                              UpdSenderClientMsgDefs::RFB_VIDEO_FREEZE_SIG);
+
+    // Request codes
+    codeRegtor->regCode(UpdSenderClientMsgDefs::RFB_VIDEO_FREEZE, this);
+    codeRegtor->regCode(ClientMsgDefs::FB_UPDATE_REQUEST, this);
+    codeRegtor->regCode(ClientMsgDefs::SET_PIXEL_FORMAT, this);
+    codeRegtor->regCode(ClientMsgDefs::SET_ENCODINGS, this);
+    codeRegtor->regCode(ClientMsgDefs::ENABLE_CONTINUOUS_UPDATES, this);
+    codeRegtor->regCode(ClientMsgDefs::FENCE, this);
+  }
 
   resume();
 }
@@ -91,6 +117,12 @@ UpdateSender::~UpdateSender()
 {
   terminate();
   wait();
+  // Make sure no encode group uses this object anymore. This must be done
+  // after stopping the thread, since the thread may offer us to the manager.
+  if (m_encodeGroups != 0) {
+    m_encodeGroups->removeSender(this);
+  }
+  m_journal->removeCursor(&m_journalCursor);
 }
 
 void UpdateSender::onTerminate()
@@ -114,6 +146,12 @@ void UpdateSender::onRequest(UINT32 reqCode, RfbInputGate *input)
   case UpdSenderClientMsgDefs::RFB_VIDEO_FREEZE:
     readVideoFreeze(input);
     break;
+  case ClientMsgDefs::ENABLE_CONTINUOUS_UPDATES:
+    readEnableContinuousUpdates(input);
+    break;
+  case ClientMsgDefs::FENCE:
+    readFence(input);
+    break;
   default:
     StringStorage errMess;
     errMess.format(_T("Unknown %d protocol code received"), (int)reqCode);
@@ -134,11 +172,14 @@ void UpdateSender::init(const Dimension *viewPortDimension,
   m_updateKeeper->setBorderRect(&viewPortDimension->getRect());
 }
 
-void UpdateSender::newUpdates(const UpdateContainer *updateContainer,
-                              const CursorShape *cursorShape)
+void UpdateSender::newUpdates(const CursorShape *cursorShape)
 {
+  // Members of an encode group get the updates from the group.
+  if (getEncodeGroup() != 0) {
+    m_journal->skip(&m_journalCursor);
+    return;
+  }
   m_log->debug(_T("New updates passed to client #%d"), m_id);
-  addUpdateContainer(updateContainer);
 
   m_cursorUpdates.updateCursorShape(cursorShape);
 
@@ -148,18 +189,11 @@ void UpdateSender::newUpdates(const UpdateContainer *updateContainer,
   m_log->debug(_T("Client #%d is waking up"), m_id);
 }
 
-void UpdateSender::addUpdateContainer(const UpdateContainer *updateContainer)
+void UpdateSender::foldUpdates()
 {
-  UpdateContainer updCont = *updateContainer;
-
   Rect viewPort = getViewPort();
-
-  updCont.videoRegion.translate(-viewPort.left, -viewPort.top);
-  updCont.changedRegion.translate(-viewPort.left, -viewPort.top);
-  updCont.copiedRegion.translate(-viewPort.left, -viewPort.top);
-  updCont.copySrc.move(-viewPort.left, -viewPort.top);
-
-  m_updateKeeper->addUpdateContainer(&updCont);
+  m_journal->fold(&m_journalCursor, m_updateKeeper,
+                  -viewPort.left, -viewPort.top);
 }
 
 void UpdateSender::blockCursorPosSending()
@@ -176,7 +210,212 @@ Rect UpdateSender::getViewPort()
 bool UpdateSender::clientIsReady()
 {
   AutoLock al(&m_reqRectLocMut);
-  return (m_incrUpdIsReq || m_fullUpdIsReq) && !m_busy;
+  // In the ContinuousUpdates mode, the client waits for updates all the time
+  // unless there is too much data in flight.
+  bool continuousReady = m_continuousUpdates && m_flowControlSupported &&
+                         m_fenceFlow.canSend();
+  return (m_incrUpdIsReq || m_fullUpdIsReq || continuousReady) && !m_busy;
+}
+
+int UpdateSender::getId() const
+{
+  return m_id;
+}
+
+RfbOutputGate *UpdateSender::getOutput()
+{
+  return m_output;
+}
+
+void UpdateSender::enterEncodeGroup(EncodeGroup *group,
+                                    const EncodeGroupKey *key)
+{
+  // Take the changes from the journal now, we skip it as a member.
+  foldUpdates();
+  {
+    AutoLock al(&m_encodeGroupLocker);
+    m_encodeGroup = group;
+    m_encodeGroupKey = *key;
+    m_catchUpGroup = true;
+  }
+  m_newUpdatesEvent.notify();
+}
+
+void UpdateSender::leaveEncodeGroup(bool restoreRequest)
+{
+  Rect clientRect;
+  {
+    AutoLock al(&m_viewPortMut);
+    clientRect = m_clientDim.getRect();
+  }
+  {
+    AutoLock al(&m_encodeGroupLocker);
+    m_encodeGroup = 0;
+    m_catchUpGroup = false;
+    m_leftEncodeGroupTime = DateTime::now();
+  }
+  // The client has got data from other encoders, so our zlib streams and
+  // our idea of what the client displays are not valid anymore.
+  refreshAll();
+  if (restoreRequest) {
+    AutoLock al(&m_reqRectLocMut);
+    m_requestedIncrReg.addRect(&clientRect);
+    m_incrUpdIsReq = true;
+  }
+  m_newUpdatesEvent.notify();
+}
+
+EncodeGroup *UpdateSender::getEncodeGroup()
+{
+  AutoLock al(&m_encodeGroupLocker);
+  return m_encodeGroup;
+}
+
+bool UpdateSender::queueGroupMessage(const std::vector<char> *message)
+{
+  if (m_output->isWriteQueueFull()) {
+    return false;
+  }
+  {
+    AutoLock al(&m_groupMessageLocker);
+    if (!m_groupMessage.empty()) {
+      return false;
+    }
+    m_groupMessage.assign(message->begin(), message->end());
+  }
+  m_newUpdatesEvent.notify();
+  return true;
+}
+
+void UpdateSender::writeGroupMessage()
+{
+  {
+    AutoLock al(&m_groupMessageLocker);
+    if (m_groupMessage.empty()) {
+      return;
+    }
+    m_groupMessageOut.swap(m_groupMessage);
+  }
+  // A message of the group always precedes our own updates, even if we
+  // have left the group in the meantime.
+  AutoLock l(m_output);
+  m_output->writeFully(&m_groupMessageOut.front(), m_groupMessageOut.size());
+  m_output->flush();
+  m_groupMessageOut.clear();
+}
+
+bool UpdateSender::hasUpdateRequest()
+{
+  AutoLock al(&m_reqRectLocMut);
+  return m_incrUpdIsReq || m_fullUpdIsReq;
+}
+
+bool UpdateSender::takeUpdateRequest(Region *incrReqReg, Region *fullReqReg,
+                                     DateTime *reqTimePoint)
+{
+  bool incrUpdIsReq, fullUpdIsReq;
+  return extractReqRegions(incrReqReg, fullReqReg,
+                           &incrUpdIsReq, &fullUpdIsReq, reqTimePoint);
+}
+
+void UpdateSender::addUpdateRequest(const Region *incrReqReg,
+                                    const Region *fullReqReg,
+                                    const DateTime *reqTimePoint)
+{
+  Region combinedReqRegions;
+  {
+    AutoLock al(&m_reqRectLocMut);
+    m_requestedIncrReg.add(incrReqReg);
+    m_incrUpdIsReq = true;
+    if (!fullReqReg->isEmpty()) {
+      m_requestedFullReg.add(fullReqReg);
+      m_fullUpdIsReq = true;
+    }
+    m_requestTimePoint = *reqTimePoint;
+    combinedReqRegions.add(&m_requestedIncrReg);
+    combinedReqRegions.add(&m_requestedFullReg);
+  }
+  foldUpdates();
+  if (m_updateKeeper->checkForUpdates(&combinedReqRegions)) {
+    m_newUpdatesEvent.notify();
+  }
+}
+
+void UpdateSender::setEncodeOptions(const EncodeOptions *encodeOptions)
+{
+  AutoLock lock(&m_newEncodeOptionsLocker);
+  m_newEncodeOptions = *encodeOptions;
+}
+
+void UpdateSender::refreshAll()
+{
+  {
+    AutoLock al(&m_encodeGroupLocker);
+    m_resetEncoders = true;
+  }
+  foldUpdates();
+  m_updateKeeper->dazzleChangedReg();
+  m_updateKeeper->setCursorShapeChanged();
+}
+
+void UpdateSender::resetEncoders()
+{
+  AutoLock al(&m_encodeGroupLocker);
+  m_resetEncoders = true;
+}
+
+void UpdateSender::addMissedUpdates(const UpdateContainer *missed)
+{
+  foldUpdates();
+  Region missedRegion = missed->changedRegion;
+  missedRegion.add(&missed->copiedRegion);
+  missedRegion.add(&missed->videoRegion);
+  AutoLock al(m_updateKeeper);
+  if (missed->screenSizeChanged) {
+    m_updateKeeper->dazzleChangedReg();
+  } else if (!missedRegion.isEmpty()) {
+    // Our pending moves may copy pixels the new member does not have.
+    UpdateContainer pending;
+    m_updateKeeper->getUpdateContainer(&pending);
+    missedRegion.add(&pending.copiedRegion);
+    m_updateKeeper->addChangedRegion(&missedRegion);
+  }
+  if (missed->cursorShapeChanged) {
+    m_updateKeeper->setCursorShapeChanged();
+  }
+}
+
+bool UpdateSender::checkEncodeGroupKey()
+{
+  EncodeGroupKey groupKey;
+  {
+    AutoLock al(&m_encodeGroupLocker);
+    groupKey = m_encodeGroupKey;
+  }
+
+  EncodeGroupKey key;
+  bool setColorMapEntr;
+  {
+    AutoLock lock(&m_newEncodeOptionsLocker);
+    key.encodeOptions = m_newEncodeOptions;
+  }
+  {
+    AutoLock lock(&m_newPixelFormatLocker);
+    key.pixelFormat = m_newPixelFormat;
+    setColorMapEntr = m_setColorMapEntr;
+  }
+  bool shareApp;
+  Region shareAppRegion;
+  m_senderControlInformation->onGetViewPort(&key.viewPort, &shareApp,
+                                            &shareAppRegion);
+  Dimension clientDim;
+  {
+    AutoLock al(&m_viewPortMut);
+    clientDim = m_clientDim;
+  }
+  return !shareApp && !setColorMapEntr &&
+         clientDim.isEqualTo(&Dimension(&key.viewPort)) &&
+         key.isEqualTo(&groupKey);
 }
 
 void UpdateSender::sendRectHeader(const Rect *rect, INT32 encodingType)
@@ -225,6 +464,7 @@ void UpdateSender::sendFbInClientDim(const EncodeOptions *encodeOptions,
 
   Region region(&dim->getRect());
   std::vector<Rect> rects;
+  m_enbox.getEncoder()->startUpdate();
   splitRegion(m_enbox.getEncoder(), &region, &rects, &blankFrameBuffer, encodeOptions);
 
   // Header
@@ -265,19 +505,19 @@ void UpdateSender::sendCursorPosUpdate()
   sendRectHeader(pos.x, pos.y, 0, 0, PseudoEncDefs::POINTER_POS);
 }
 
-void UpdateSender::sendCopyRect(const std::vector<Rect> *rects, const Point *source)
+void UpdateSender::sendCopyRect(const std::vector<Rect> *rects,
+                                const std::vector<Point> *sources)
 {
-  std::vector<Rect>::const_iterator iRect;
+  _ASSERT(rects->size() == sources->size());
 
-  for (iRect = rects->begin(); iRect != rects->end(); iRect++) {
-    const Rect *rect = &(*iRect);
+  for (size_t i = 0; i < rects->size(); i++) {
+    const Rect *rect = &(*rects)[i];
 
     sendRectHeader(rect, EncodingDefs::COPYRECT);
 
     // Send copyRect data
-    // FIXME: Each dest rect should have own source point
-    m_output->writeUInt16(source->x);
-    m_output->writeUInt16(source->y);
+    m_output->writeUInt16((*sources)[i].x);
+    m_output->writeUInt16((*sources)[i].y);
   }
 }
 
@@ -298,22 +538,100 @@ void UpdateSender::sendUpdate()
 {
   m_log->debug(_T("Entered to the sendUpdate() function"));
 
+  bool continuous;
+  Rect continuousArea;
+  bool sendEndOfContinuousUpdates;
+  {
+    AutoLock al(&m_reqRectLocMut);
+    continuous = m_continuousUpdates && m_flowControlSupported;
+    continuousArea = m_continuousArea;
+    sendEndOfContinuousUpdates = m_sendEndOfContinuousUpdates;
+    m_sendEndOfContinuousUpdates = false;
+  }
+  if (sendEndOfContinuousUpdates) {
+    m_log->debug(_T("Sending EndOfContinuousUpdates"));
+    m_fenceFlow.reset();
+    AutoLock al(m_output);
+    m_output->writeUInt8(ServerMsgDefs::END_OF_CONTINUOUS_UPDATES);
+    m_output->flush();
+  }
+
+  // Members of an encode group are served by the group.
+  m_lastUpdateGroupable = false;
+  if (getEncodeGroup() != 0) {
+    m_log->debug(_T("Client #%d is served by an encode group"), m_id);
+    bool catchUpGroup;
+    {
+      AutoLock al(&m_encodeGroupLocker);
+      catchUpGroup = m_catchUpGroup;
+      m_catchUpGroup = false;
+    }
+    if (catchUpGroup) {
+      UpdateContainer missed;
+      m_updateKeeper->extract(&missed);
+      if (!m_encodeGroups->catchUpSender(this, &missed)) {
+        // We have left the group meanwhile and send everything ourselves.
+        m_updateKeeper->addUpdateContainer(&missed);
+      }
+    }
+    // Updates are sent by the group, so our measurements get out of date.
+    m_linkEstimator.reset();
+    m_sentTiles.reset();
+    return;
+  }
+
 //  m_log->checkPoint(_T("1 sendUpdate() begins"));
 
+  // In the ContinuousUpdates mode, wait until the client has processed
+  // enough of the updates sent before.
+  if (continuous && !m_fenceFlow.canSend()) {
+    m_log->debug(_T("Client #%d has %u bytes in flight (window is %u bytes),")
+                 _T(" waiting for a fence response"), m_id,
+                 (unsigned int)m_fenceFlow.getBytesInFlight(),
+                 (unsigned int)m_fenceFlow.getCongestionWindow());
+    return;
+  }
+
+  // Let the network writer drain its queue before preparing a new update.
+  // Meanwhile, changes are accumulated in the update keeper and sent later
+  // as one update.
+  if (m_output->isWriteQueueFull()) {
+    m_log->debug(_T("Write queue of client #%d is full, waiting"), m_id);
+    while (m_output->isWriteQueueFull() && !isTerminating()) {
+      m_output->waitForWriteQueue(WRITE_QUEUE_WAIT_INTERVAL);
+    }
+    if (isTerminating()) {
+      return;
+    }
+  }
+
   // Check requested regions and immediately return if the client did not
-  // request anything.
+  // request anything and continuous updates are off.
   Region requestedFullReg, requestedIncrReg;
   bool incrUpdIsReq, fullUpdIsReq;
   DateTime reqTimePoint;
-  if (!extractReqRegions(&requestedIncrReg, &requestedFullReg,
-                         &incrUpdIsReq, &fullUpdIsReq,
-                         &reqTimePoint)) {
+  bool hasRequest = extractReqRegions(&requestedIncrReg, &requestedFullReg,
+                                      &incrUpdIsReq, &fullUpdIsReq,
+                                      &reqTimePoint);
+  if (!hasRequest && !continuous) {
     m_log->debug(_T("No request, exiting from the sendUpdate()"));
     return;
   }
   m_log->debug(_T("Time between request and a point after extractReqRegions (in milliseconds): %u"),
     (unsigned int)(DateTime::now() - reqTimePoint).getTime());
   m_log->debug(_T("A request has been made, continuing"));
+
+  bool adaptToLink = !m_isSharedPipeline &&
+    Configurator::getInstance()->getServerConfig()->isAdaptiveEncodingEnabled();
+  if (adaptToLink) {
+    // A fence response tells that the client has got our update the same
+    // way an update request does.
+    DateTime responseTime = continuous ? m_fenceFlow.getLastResponseTime()
+                                       : reqTimePoint;
+    m_linkEstimator.onUpdateRequest(&responseTime);
+  } else {
+    m_linkEstimator.reset();
+  }
   m_log->debug(_T("The incremental region has %d rectangles"),
              (int)requestedIncrReg.getCount());
   m_log->debug(_T("The full region has %d rectangles"),
@@ -330,6 +648,33 @@ void UpdateSender::sendUpdate()
     selectEncoder(&losslessEncodeOptions);
     losslessEncodeOptions.disableJpeg();
   }
+  if (adaptToLink) {
+    m_linkEstimator.adjustEncodeOptions(&encodeOptions);
+    m_linkEstimator.adjustEncodeOptions(&losslessEncodeOptions);
+    if (m_linkEstimator.hasEstimate()) {
+      m_log->debug(_T("Link estimate: %u bytes/s, round-trip time %u ms")
+                   _T(" (base %u ms), link class %d%s;")
+                   _T(" compression level %d, JPEG quality %d"),
+                   m_linkEstimator.getThroughput(),
+                   m_linkEstimator.getRoundTripTime(),
+                   m_linkEstimator.getBaseRoundTripTime(),
+                   m_linkEstimator.getLinkClass(),
+                   m_linkEstimator.isCongested() ? _T(", congested") : _T(""),
+                   encodeOptions.getCompressionLevel(),
+                   encodeOptions.getJpegQualityLevel());
+    }
+  }
+  bool resetEncoders;
+  {
+    AutoLock al(&m_encodeGroupLocker);
+    resetEncoders = m_resetEncoders;
+    m_resetEncoders = false;
+  }
+  if (resetEncoders) {
+    m_log->debug(_T("Resetting compression state of the encoders"));
+    m_enbox.resetCompression();
+    m_sentTiles.reset();
+  }
 
   // Viewport calculating
   Rect viewPort;
@@ -339,10 +684,18 @@ void UpdateSender::sendUpdate()
   bool viewPortChanged = updateViewPort(&viewPort, &shareOnlyApp, &prevShareAppRegion,
                                         &shareAppRegion);
 
-  updateFrameBuffer(&updCont, shareOnlyApp, &prevShareAppRegion, &shareAppRegion);
-  FrameBuffer *frameBuffer = &m_frameBuffer;
+  FrameBuffer *frameBuffer;
+  if (selectSharedFrame(&encodeOptions, &viewPort, shareOnlyApp, &updCont)) {
+    frameBuffer = &m_frameSnapshot;
+  } else {
+    updateFrameBuffer(&updCont, shareOnlyApp, &prevShareAppRegion, &shareAppRegion);
+    frameBuffer = &m_frameBuffer;
+  }
 
   AutoLock l(m_output);
+  UINT64 bytesBeforeUpdate = m_output->getBytesWritten();
+  UINT64 copiedBeforeUpdate = m_output->getBytesCopied();
+  DateTime updateStartTime = DateTime::now();
 
   Dimension clientDim, lastViewPortDim;
   {
@@ -365,7 +718,8 @@ void UpdateSender::sendUpdate()
     updCont.screenSizeChanged = true;
   }
   if (dimensionChanged || viewPortChanged) {
-    updCont.copiedRegion.clear();
+    updCont.clearCopies();
+    m_sentTiles.reset();
 
     AutoLock al(&m_viewPortMut);
     m_lastViewPortDim.setDim(&viewPort);
@@ -401,6 +755,21 @@ void UpdateSender::sendUpdate()
   }
   m_pixelConverter.setPixelFormats(&clientPixelFormat, &serverPixelFormat);
 
+  // Remember if this update could be produced by an encode group. ZRLE
+  // clients cannot be grouped because there is no way to reset their zlib
+  // stream.
+  if (m_encodeGroups != 0) {
+    m_lastUpdateKey.encodeOptions = encodeOptions;
+    m_lastUpdateKey.pixelFormat = clientPixelFormat;
+    m_lastUpdateKey.viewPort = viewPort;
+    m_lastUpdateGroupable =
+      !continuous && !shareOnlyApp && !setColorMapEntr &&
+      encodeOptions.getPreferredEncoding() != EncodingDefs::ZRLE &&
+      clientDim.isEqualTo(&Dimension(&viewPort)) &&
+      (DateTime::now() - m_leftEncodeGroupTime).getTime() >
+        ENCODE_GROUP_REJOIN_DELAY;
+  }
+
   // Send updates
   if (updCont.screenSizeChanged || (!requestedFullReg.isEmpty() &&
                                     !encodeOptions.desktopSizeEnabled())) {
@@ -431,13 +800,14 @@ void UpdateSender::sendUpdate()
 
     if (!encodeOptions.copyRectEnabled() || getVideoFrozen()) {
       m_log->debug(_T("CopyRect is disabled, converting to normal updates"));
-      updCont.changedRegion.add(&updCont.copiedRegion);
-      updCont.copiedRegion.clear();
+      updCont.convertCopiesToChanges();
     }
 
     updCont.changedRegion.add(&m_prevVideoRegion); // This line updates rid video places when
                                                    // video is frozen.
     updCont.videoRegion.subtract(&requestedFullReg);
+    // The client gets lossy pixels or nothing at all here.
+    Region videoArea = updCont.videoRegion;
     updCont.changedRegion.subtract(&updCont.videoRegion);
     m_prevVideoRegion = updCont.videoRegion;
     if (getVideoFrozen()) {
@@ -460,8 +830,52 @@ void UpdateSender::sendUpdate()
       updCont.videoRegion.clear();
     }
 
-    // Crop changed and video region by requested regions.
-    cropUpdContForReqRegions(&updCont, &requestedIncrReg, &requestedFullReg);
+    // Crop changed and video region by requested regions. The continuous
+    // updates area counts as requested incrementally.
+    Region incrReqReg = requestedIncrReg;
+    if (continuous) {
+      incrReqReg.addRect(&continuousArea);
+    }
+    cropUpdContForReqRegions(&updCont, &incrReqReg, &requestedFullReg);
+
+    // Do not send again the tiles whose content the client has already got.
+    // The shared pipeline of an encode group does not know what its members
+    // have.
+    bool trackTiles = m_usingSharedFrame && !m_isSharedPipeline;
+    if (trackTiles) {
+      Region keepRegion = requestedFullReg;
+      keepRegion.add(&updCont.copiedRegion);
+      size_t numSameTiles = m_sentTiles.filter(&m_frameSnapshot,
+                                               &updCont.changedRegion,
+                                               &keepRegion);
+      if (numSameTiles != 0) {
+        m_log->debug(_T("Skipping %d changed tiles the client already has"),
+                     (int)numSameTiles);
+      }
+    } else {
+      m_sentTiles.reset();
+    }
+
+    // Trade some unchanged pixels for fewer rectangles. The statistics of
+    // Tight encoder tell what a pixel costs when Tight is preferred.
+    if (Configurator::getInstance()->getServerConfig()->
+          isRegionCoarseningEnabled()) {
+      TightCostModel::Stats costStats;
+      bool haveStats =
+        encodeOptions.getPreferredEncoding() == EncodingDefs::TIGHT &&
+        m_enbox.getTightCostModelStats(&costStats);
+      m_regionCoarsener.setPixelCost(haveStats ? &costStats : 0,
+                                     clientPixelFormat.bitsPerPixel / 8);
+      RegionCoarsener::Stats coarseningStats;
+      m_regionCoarsener.coarsen(&updCont.changedRegion, &coarseningStats);
+      if (coarseningStats.numRectsAfter != coarseningStats.numRectsBefore) {
+        m_log->debug(_T("Coarsened the changed region from %d to %d")
+                     _T(" rectangles adding %d unchanged pixels"),
+                     (int)coarseningStats.numRectsBefore,
+                     (int)coarseningStats.numRectsAfter,
+                     coarseningStats.wastedPixels);
+      }
+    }
 
     Region videoRegion = updCont.videoRegion;
     Region changedRegion = updCont.changedRegion;
@@ -485,11 +899,14 @@ void UpdateSender::sendUpdate()
       m_losslessClean.subtract(&changedRegion);
     }
     // Add some lossless data to every update but no more than 1/100 part of framebuffer.
-    // So at 20 fps full screen will be sent in 5 sec.
+    // So at 20 fps full screen will be sent in 5 sec. Slower links get less
+    // and a congested link gets nothing until the queue drains.
     int screenArea = frameBufferRect.area();
-    Region losslessRegion = takePartFromRegion(&m_losslessClean, screenArea / 100);
+    int losslessArea = adaptToLink ? m_linkEstimator.getLosslessRefreshArea(screenArea)
+                                   : screenArea / 100;
+    Region losslessRegion = takePartFromRegion(&m_losslessClean, losslessArea);
     if (losslessEnabled) {
-      if (losslessRegion.isEmpty()) {
+      if (losslessRegion.isEmpty() && losslessArea > 0) {
         m_losslessClean.set(&m_losslessDirty);
         m_losslessDirty.clear();
       }
@@ -499,71 +916,139 @@ void UpdateSender::sendUpdate()
     // At this point, we've got final regions in changedRegion and videoRegion.
     //
 
-    // Convert changedRegion to the final list of rectangles.
-    m_log->debug(_T("Number of normal rectangles before splitting: %d"),
-               changedRegion.getCount());
-    std::vector<Rect> normalRects;
-    splitRegion(m_enbox.getEncoder(), &changedRegion, &normalRects,
-                frameBuffer, &encodeOptions);
+    // Clients supporting LastRect get streamed updates. The header does not
+    // carry the number of rectangles then, so each region is split right
+    // before encoding it, and encoded data is flushed as soon as it's ready.
+    // The shared pipeline of an encode group never streams since it delivers
+    // the update to the members on flush().
+    bool streamed = encodeOptions.lastRectEnabled() && !m_isSharedPipeline;
+    bool sendLossless = losslessEnabled && !losslessRegion.isEmpty();
 
-    // Convert losslessRegion to the final list of rectangles.
+    std::vector<Rect> normalRects;
     std::vector<Rect> losslessRects;
-    if (losslessEnabled && !losslessRegion.isEmpty()) {
-      m_log->debug(_T("Number of lossless rectangles before splitting: %d"),
-        losslessRegion.getCount());
-      splitRegion(m_enbox.getEncoder(), &losslessRegion, &losslessRects,
-        frameBuffer, &losslessEncodeOptions);
-    }
-    // Do the same for the videoRegion.
     std::vector<Rect> videoRects;
-    if (!videoRegion.isEmpty()) {
-      m_log->debug(_T("Video region is not empty"));
-      m_enbox.validateJpegEncoder(); // make sure JpegEncoder is allocated
-      splitRegion(m_enbox.getJpegEncoder(), &videoRegion, &videoRects,
+    m_enbox.getEncoder()->startUpdate();
+    if (!streamed) {
+      // Convert changedRegion to the final list of rectangles.
+      m_log->debug(_T("Number of normal rectangles before splitting: %d"),
+                 changedRegion.getCount());
+      splitRegion(m_enbox.getEncoder(), &changedRegion, &normalRects,
                   frameBuffer, &encodeOptions);
+
+      // Convert losslessRegion to the final list of rectangles.
+      if (sendLossless) {
+        m_log->debug(_T("Number of lossless rectangles before splitting: %d"),
+          losslessRegion.getCount());
+        splitRegion(m_enbox.getEncoder(), &losslessRegion, &losslessRects,
+          frameBuffer, &losslessEncodeOptions);
+      }
+      // Do the same for the videoRegion.
+      if (!videoRegion.isEmpty()) {
+        m_log->debug(_T("Video region is not empty"));
+        m_enbox.validateJpegEncoder(); // make sure JpegEncoder is allocated
+        splitRegion(m_enbox.getJpegEncoder(), &videoRegion, &videoRects,
+                    frameBuffer, &encodeOptions);
+      }
     }
 
-    // Get the final list of CopyRect rectangles.
+    // Get the final list of CopyRect rectangles. The client copies them
+    // one by one, so the moves go in their order and the rectangles of a
+    // move are ordered against the shift.
     std::vector<Rect> copyRects;
-    updCont.copiedRegion.getRectVector(&copyRects);
-
-    m_log->debug(_T("Number of normal rectangles: %d"), normalRects.size());
-    m_log->debug(_T("Number of lossless rectangles: %d"), losslessRects.size());
-    m_log->debug(_T("Number of video rectangles: %d"), videoRects.size());
-    m_log->debug(_T("Number of CopyRect rectangles: %d"), copyRects.size());
-
-    // calculate regions areas
-    if (m_log->isDebug()) {
-      m_log->debug(_T("Area of normal rectangles: %d"), calcAreas(normalRects));
-      m_log->debug(_T("Area of lossless rectangles: %d"), calcAreas(losslessRects));
-      m_log->debug(_T("Area of video rectangles: %d"), calcAreas(videoRects));
-      m_log->debug(_T("Area of CopyRect rectangles: %d"), calcAreas(copyRects));
+    std::vector<Point> copySources;
+    for (size_t i = 0; i < updCont.copyMoves.size(); i++) {
+      const Point *offset = &updCont.copyMoves[i].srcOffset;
+      std::vector<Rect> moveRects;
+      updCont.copyMoves[i].getRectsInCopyOrder(&moveRects);
+      for (size_t j = 0; j < moveRects.size(); j++) {
+        copyRects.push_back(moveRects[j]);
+        copySources.push_back(Point(moveRects[j].left + offset->x,
+                                    moveRects[j].top + offset->y));
+      }
     }
 
-    // Calculate the total number of rectangles and pseudo-rectangles.
-    size_t numTotalRects =
-      normalRects.size() + losslessRects.size() + videoRects.size() + copyRects.size();
-
+    // Calculate the total number of rectangles and pseudo-rectangles. For a
+    // streamed update, only those known before encoding are counted here.
+    size_t numPseudoRects = 0;
     if (updCont.cursorPosChanged) {
-      numTotalRects++;
+      numPseudoRects++;
       m_log->debug(_T("Adding a pseudo-rectangle for cursor position update"));
     }
     if (updCont.cursorShapeChanged) {
-      numTotalRects++;
+      numPseudoRects++;
       m_log->debug(_T("Adding a pseudo-rectangle for cursor shape update"));
     }
-    m_log->detail(_T("Total number of rectangles and pseudo-rectangles: %d"),
-               numTotalRects);
+    size_t numTotalRects = numPseudoRects +
+      normalRects.size() + losslessRects.size() + videoRects.size() + copyRects.size();
 
-    // FIXME: Handle this better, e.g. send first 65534 rectangles.
-    _ASSERT(numTotalRects <= 65534);
+    if (!streamed && numTotalRects > MAX_COUNTED_RECTS) {
+      // The client cannot take that many rectangles in one update. Send the
+      // bounding box of all regions as normal rectangles instead, the
+      // framebuffer already has the copied pixels at their new places. The
+      // box covers the lossless part, which goes back to the dirty region
+      // so it is not encoded twice.
+      m_log->info(_T("Too many rectangles in the update (%d), sending")
+                  _T(" the bounding box of the changed region instead"),
+                  (int)numTotalRects);
+      Region coarseRegion = changedRegion;
+      coarseRegion.add(&updCont.copiedRegion);
+      coarseRegion.add(&videoRegion);
+      if (sendLossless) {
+        coarseRegion.add(&losslessRegion);
+      }
+      coarseRegion = Region(coarseRegion.getBounds());
+      if (losslessEnabled) {
+        m_losslessDirty.add(&coarseRegion);
+        m_losslessClean.subtract(&coarseRegion);
+      }
+      sendLossless = false;
+      losslessRegion.clear();
+      videoRegion.clear();
+      normalRects.clear();
+      losslessRects.clear();
+      videoRects.clear();
+      copyRects.clear();
+      copySources.clear();
+      splitRegion(m_enbox.getEncoder(), &coarseRegion, &normalRects,
+                  frameBuffer, &encodeOptions);
+      numTotalRects = numPseudoRects + normalRects.size();
+      if (numTotalRects > MAX_COUNTED_RECTS) {
+        // Cannot happen with a sane maximum rectangle size of the encoder.
+        throw Exception(_T("Cannot fit the update into the maximum number")
+                        _T(" of rectangles"));
+      }
+    }
+
+    if (!streamed) {
+      m_log->debug(_T("Number of normal rectangles: %d"), normalRects.size());
+      m_log->debug(_T("Number of lossless rectangles: %d"), losslessRects.size());
+      m_log->debug(_T("Number of video rectangles: %d"), videoRects.size());
+      m_log->debug(_T("Number of CopyRect rectangles: %d"), copyRects.size());
+
+      // calculate regions areas
+      if (m_log->isDebug()) {
+        m_log->debug(_T("Area of normal rectangles: %d"), calcAreas(normalRects));
+        m_log->debug(_T("Area of lossless rectangles: %d"), calcAreas(losslessRects));
+        m_log->debug(_T("Area of video rectangles: %d"), calcAreas(videoRects));
+        m_log->debug(_T("Area of CopyRect rectangles: %d"), calcAreas(copyRects));
+      }
+      m_log->detail(_T("Total number of rectangles and pseudo-rectangles: %d"),
+                 numTotalRects);
+    }
+
+    bool hasData = numTotalRects != 0;
+    if (streamed) {
+      hasData = hasData || !changedRegion.isEmpty() ||
+                !videoRegion.isEmpty() || sendLossless;
+    }
 
-    if (numTotalRects != 0) {
+    if (hasData) {
       m_log->debug(_T("Sending FramebufferUpdate message header"));
       // FIXME: Use constant for FramebufferUpdate message type.
       m_output->writeUInt8(0); // message type
       m_output->writeUInt8(0); // padding
-      m_output->writeUInt16((UINT16)numTotalRects);
+      // 0xFFFF means that the update ends with a LastRect pseudo-rectangle.
+      m_output->writeUInt16(streamed ? 0xFFFF : (UINT16)numTotalRects);
 
       if (updCont.cursorPosChanged) {
         sendCursorPosUpdate();
@@ -575,20 +1060,48 @@ void UpdateSender::sendUpdate()
       }
       if (copyRects.size() > 0) {
         m_log->debug(_T("Sending CopyRect rectangles"));
-        sendCopyRect(&copyRects, &updCont.copySrc);
+        sendCopyRect(&copyRects, &copySources);
+      }
+      if (streamed) {
+        // Let the client apply the cheap part while we are encoding.
+        m_output->flush();
       }
 
       m_log->debug(_T("Time between request and a point before send and coding (in milliseconds): %u"),
                  (unsigned int)(DateTime::now() - reqTimePoint).getTime());
       m_log->debug(_T("Sending video rectangles"));
-      sendRectangles(m_enbox.getJpegEncoder(), &videoRects, frameBuffer, &encodeOptions);
+      if (streamed) {
+        if (!videoRegion.isEmpty()) {
+          m_enbox.validateJpegEncoder(); // make sure JpegEncoder is allocated
+          numTotalRects += streamRegion(m_enbox.getJpegEncoder(), &videoRegion,
+                                        frameBuffer, &encodeOptions);
+        }
+      } else {
+        sendRectangles(m_enbox.getJpegEncoder(), &videoRects, frameBuffer, &encodeOptions);
+      }
       m_log->debug(_T("Sending normal rectangles"));
-      double area = Rect::totalArea(normalRects) / 1000000.; //in millions of pixels
+      std::vector<Rect> changedRects;
+      if (streamed) {
+        changedRegion.getRectVector(&changedRects);
+      }
+      double area = Rect::totalArea(streamed ? changedRects : normalRects) / 1000000.; //in millions of pixels
       ProcessorTimes pt1 = m_log->checkPoint(_T("Before Sending normal rectangles"));
 
-      sendRectangles(m_enbox.getEncoder(), &normalRects, frameBuffer, &encodeOptions);
-
-      sendRectangles(m_enbox.getEncoder(), &losslessRects, frameBuffer, &losslessEncodeOptions);
+      if (streamed) {
+        numTotalRects += streamRegion(m_enbox.getEncoder(), &changedRegion,
+                                      frameBuffer, &encodeOptions);
+        if (sendLossless) {
+          numTotalRects += streamRegion(m_enbox.getEncoder(), &losslessRegion,
+                                        frameBuffer, &losslessEncodeOptions);
+        }
+        sendRectHeader(0, 0, 0, 0, PseudoEncDefs::LAST_RECT);
+        m_log->detail(_T("Streamed %d rectangles and pseudo-rectangles"),
+                      (int)numTotalRects);
+      } else {
+        sendRectangles(m_enbox.getEncoder(), &normalRects, frameBuffer, &encodeOptions);
+
+        sendRectangles(m_enbox.getEncoder(), &losslessRects, frameBuffer, &losslessEncodeOptions);
+      }
 
       ProcessorTimes pt2 = m_log->checkPoint(_T("After Sending normal rectangles"));
       m_log->debug(_T("Before Sending normal rectangles %f processor Mcycles, %f process time, %f kernel time, %f wall clock time"), 
@@ -600,7 +1113,28 @@ void UpdateSender::sendUpdate()
 
       m_log->info(_T("Time between request and answer is (in milliseconds): %u"),
                  (unsigned int)(DateTime::now() - reqTimePoint).getTime());
-    } else {
+      // Stays the same from update to update once the encoders have enough
+      // memory for the rectangles they get.
+      m_log->debug(_T("Heap allocations made by encoder scratch buffers: %u,")
+                   _T(" %u bytes held by them"),
+                   m_enbox.getNumScratchAllocations(),
+                   (unsigned int)m_enbox.getScratchMemory());
+      TightCostModel::Stats costStats;
+      if (m_enbox.getTightCostModelStats(&costStats) &&
+          costStats.numSelected != 0) {
+        m_log->debug(_T("Tight rectangles: %u solid, %u mono, %u indexed,")
+                     _T(" %u full color, %u JPEG; %u selected by cost model,")
+                     _T(" predicted %I64u bytes, sent %I64u bytes"),
+                     costStats.numRects[TightCostModel::SOLID],
+                     costStats.numRects[TightCostModel::MONO],
+                     costStats.numRects[TightCostModel::INDEXED],
+                     costStats.numRects[TightCostModel::FULL_COLOR],
+                     costStats.numRects[TightCostModel::JPEG],
+                     costStats.numSelected,
+                     costStats.predictedBytes,
+                     costStats.actualBytes);
+      }
+    } else if (hasRequest) {
       m_log->debug(_T("Nothing to send, restoring requested regions"));
       AutoLock al(&m_reqRectLocMut);
       m_requestedFullReg.add(&requestedFullReg);
@@ -608,14 +1142,58 @@ void UpdateSender::sendUpdate()
       m_incrUpdIsReq = incrUpdIsReq;
       m_fullUpdIsReq = fullUpdIsReq;
     }
-    m_cursorUpdates.restoreFrameBuffer(frameBuffer);
+    if (trackTiles) {
+      // Changes returned to the update keeper or arrived since extracting
+      // have not reached the client.
+      UpdateContainer pending;
+      foldUpdates();
+      m_updateKeeper->getUpdateContainer(&pending);
+      Region outOfSyncRegion = pending.changedRegion;
+      outOfSyncRegion.add(&pending.copiedRegion);
+      outOfSyncRegion.add(&pending.videoRegion);
+      outOfSyncRegion.add(&videoArea);
+      outOfSyncRegion.add(&updCont.copiedRegion);
+      Region sentRegion = changedRegion;
+      if (sendLossless) {
+        sentRegion.add(&losslessRegion);
+      }
+      m_sentTiles.onUpdateSent(&m_frameSnapshot,
+                               updCont.frameGeneration,
+                               &sentRegion, &outOfSyncRegion);
+    }
+    if (!m_usingSharedFrame) {
+      m_cursorUpdates.restoreFrameBuffer(frameBuffer);
+    }
+  }
+  // The encoded data has been passed to the output, let the desktop write
+  // the bands in place again.
+  m_frameSnapshot.release();
 
+  UINT64 updateSize = m_output->getBytesWritten() - bytesBeforeUpdate;
+  if (continuous && encodeOptions.fenceEnabled() && updateSize != 0) {
+    writeFlowControlFence(m_fenceFlow.onUpdateSent(updateSize));
   }
 
   m_log->debug(_T("Flushing output"));
 //  m_log->checkPoint(_T("4 before flush"));
   m_output->flush();
 //  m_log->checkPoint(_T("5 sendUpdate() end"));
+
+  if (adaptToLink && updateSize != 0) {
+    m_linkEstimator.onUpdateSent(updateSize, &updateStartTime);
+  }
+
+  m_log->debug(_T("Update of %I64u bytes, %I64u bytes copied on output"),
+               updateSize, m_output->getBytesCopied() - copiedBeforeUpdate);
+
+  AsyncOutputStream::Stats queueStats;
+  if (m_output->getWriteQueueStats(&queueStats)) {
+    m_log->debug(_T("Write queue: %u buffers (max %u), %u stalls for %I64u ms,")
+                 _T(" %I64u bytes queued, %I64u bytes sent"),
+                 queueStats.queueOccupancy, queueStats.maxQueueOccupancy,
+                 queueStats.numStalls, queueStats.stallTime,
+                 queueStats.bytesQueued, queueStats.bytesWritten);
+  }
 }
 
 void UpdateSender::paintBlack(FrameBuffer *frameBuffer, const Region *blackRegion)
@@ -635,6 +1213,10 @@ void UpdateSender::splitRegion(Encoder *encoder,
 {
   std::vector<Rect> baseRects;
   region->getRectVector(&baseRects);
+  // Rows are contiguous only within a band of the shared frame buffer.
+  if (frameBuffer == &m_frameSnapshot) {
+    m_frameSnapshot.cutAtBands(&baseRects);
+  }
   std::vector<Rect>::iterator i;
   for (i = baseRects.begin(); i != baseRects.end(); i++) {
     encoder->splitRectangle(&*i, rects, frameBuffer, encodeOptions);
@@ -646,11 +1228,30 @@ void UpdateSender::sendRectangles(Encoder *encoder,
                                   const FrameBuffer *frameBuffer,
                                   const EncodeOptions *encodeOptions)
 {
-  std::vector<Rect>::const_iterator i;
-  for (i = rects->begin(); i != rects->end(); i++) {
-    sendRectHeader(&*i, encoder->getCode());
-    encoder->sendRectangle(&*i, frameBuffer, encodeOptions);
+  encoder->sendRectangles(rects, frameBuffer, encodeOptions);
+}
+
+size_t UpdateSender::streamRegion(Encoder *encoder,
+                                  const Region *region,
+                                  const FrameBuffer *frameBuffer,
+                                  const EncodeOptions *encodeOptions)
+{
+  std::vector<Rect> rects;
+  splitRegion(encoder, region, &rects, frameBuffer, encodeOptions);
+
+  std::vector<Rect> batch;
+  int batchArea = 0;
+  for (size_t i = 0; i < rects.size(); i++) {
+    batch.push_back(rects[i]);
+    batchArea += rects[i].area();
+    if (batchArea >= STREAM_BATCH_AREA || i + 1 == rects.size()) {
+      encoder->sendRectangles(&batch, frameBuffer, encodeOptions);
+      m_output->flush();
+      batch.clear();
+      batchArea = 0;
+    }
   }
+  return rects.size();
 }
 
 void UpdateSender::execute()
@@ -663,10 +1264,14 @@ void UpdateSender::execute()
     m_log->debug(_T("Update sender thread of client #%d is awake"), m_id);
     if (!isTerminating()) {
       try {
+        writeGroupMessage();
         m_log->debug(_T("UpdateSender::Trying to call the sendUpdate() function"));
         sendUpdate();
         m_log->debug(_T("The sendUpdate() function has finished"));
         m_busy = false;
+        if (m_lastUpdateGroupable) {
+          m_encodeGroups->offerSender(this, m_desktop, &m_lastUpdateKey);
+        }
       } catch(Exception &e) {
         m_log->interror(_T("The update sender thread caught an error and will")
                    _T(" be terminated: %s"), e.getMessage());
@@ -709,6 +1314,13 @@ void UpdateSender::readUpdateRequest(RfbInputGate *io)
 
   _ASSERT(m_updReqListener != 0);
 
+  if (m_encodeGroups != 0 && getEncodeGroup() != 0) {
+    m_encodeGroups->onSenderRequest(this, checkEncodeGroupKey());
+    m_updReqListener->onUpdateRequest(&reqRect, incremental);
+    return;
+  }
+
+  foldUpdates();
   bool alreadyHasUpdates = m_updateKeeper->checkForUpdates(&combinedReqRegions);
   if (alreadyHasUpdates) {
     // We should initiaite send update to avoid it skipping on no updates from a desktop
@@ -784,8 +1396,168 @@ void UpdateSender::readSetEncodings(RfbInputGate *io)
     list.push_back(code);
   }
 
-  AutoLock lock(&m_newEncodeOptionsLocker);
-  m_newEncodeOptions.setEncodings(&list);
+  bool announceContinuousUpdates = false;
+  bool announceFence = false;
+  bool continuousUpdatesEnabled;
+  bool flowControlSupported;
+  {
+    AutoLock lock(&m_newEncodeOptionsLocker);
+    m_newEncodeOptions.setEncodings(&list);
+    continuousUpdatesEnabled = m_newEncodeOptions.continuousUpdatesEnabled();
+    flowControlSupported = continuousUpdatesEnabled &&
+                           m_newEncodeOptions.fenceEnabled();
+    if (m_newEncodeOptions.continuousUpdatesEnabled() &&
+        !m_continuousUpdatesAnnounced) {
+      announceContinuousUpdates = m_continuousUpdatesAnnounced = true;
+    }
+    if (m_newEncodeOptions.fenceEnabled() && !m_fenceAnnounced) {
+      announceFence = m_fenceAnnounced = true;
+    }
+  }
+
+  {
+    AutoLock al(&m_reqRectLocMut);
+    m_flowControlSupported = flowControlSupported;
+    // Stop continuous updates the client can no longer throttle.
+    if (m_continuousUpdates && !flowControlSupported) {
+      m_log->info(_T("Continuous updates disabled for client #%d, it no")
+                  _T(" longer supports fences"), m_id);
+      m_continuousUpdates = false;
+      m_sendEndOfContinuousUpdates = continuousUpdatesEnabled;
+    }
+  }
+
+  // The first SetEncodings with the Fence pseudo-encoding is answered with an
+  // empty fence request, and the first one with the ContinuousUpdates
+  // pseudo-encoding with EndOfContinuousUpdates. That's how the client
+  // learns that we support them.
+  if (announceFence) {
+    m_log->debug(_T("Client #%d supports fences"), m_id);
+    AutoLock al(m_output);
+    writeFence(FenceDefs::REQUEST, 0, 0);
+    m_output->flush();
+  }
+  if (announceContinuousUpdates) {
+    m_log->debug(_T("Client #%d supports continuous updates"), m_id);
+    {
+      AutoLock al(&m_reqRectLocMut);
+      m_sendEndOfContinuousUpdates = true;
+    }
+    m_newUpdatesEvent.notify();
+  }
+}
+
+void UpdateSender::readEnableContinuousUpdates(RfbInputGate *io)
+{
+  bool enable = io->readUInt8() != 0;
+  Rect area;
+  area.left = io->readUInt16();
+  area.top = io->readUInt16();
+  area.setWidth(io->readUInt16());
+  area.setHeight(io->readUInt16());
+
+  {
+    AutoLock al(&m_reqRectLocMut);
+    if (!m_flowControlSupported) {
+      // Without fences we could not limit the data in flight.
+      m_log->info(_T("Ignoring EnableContinuousUpdates from client #%d,")
+                  _T(" it has not set the ContinuousUpdates and Fence")
+                  _T(" encodings"), m_id);
+      return;
+    }
+    if (enable) {
+      m_continuousUpdates = true;
+      m_continuousArea = area;
+    } else {
+      m_continuousUpdates = false;
+      m_sendEndOfContinuousUpdates = true;
+    }
+  }
+  m_log->info(_T("Continuous updates %s (%d, %d, %dx%d) by client #%d"),
+              enable ? _T("enabled") : _T("disabled"),
+              area.left, area.top, area.getWidth(), area.getHeight(), m_id);
+
+  if (enable) {
+    // Encode groups serve update requests in rounds, continuous updates do
+    // not fit that.
+    if (m_encodeGroups != 0 && getEncodeGroup() != 0) {
+      m_encodeGroups->onSenderRequest(this, false);
+    }
+    // Make the desktop pass us the updates it has collected so far.
+    m_updReqListener->onUpdateRequest(&area, true);
+  }
+  m_newUpdatesEvent.notify();
+}
+
+void UpdateSender::readFence(RfbInputGate *io)
+{
+  io->readUInt8(); // padding
+  io->readUInt16(); // padding
+  UINT32 flags = io->readUInt32();
+  UINT8 length = io->readUInt8();
+  if (length > FenceDefs::MAX_PAYLOAD_LENGTH) {
+    throw Exception(_T("Fence payload is too long"));
+  }
+  UINT8 payload[FenceDefs::MAX_PAYLOAD_LENGTH];
+  if (length != 0) {
+    io->readFully(payload, length);
+  }
+
+  if ((flags & FenceDefs::REQUEST) != 0) {
+    // Client messages are handled in order by this thread, so everything
+    // before the fence has been processed and nothing after it will be
+    // processed until we respond. SyncNext is not supported, so the flag is
+    // cleared in the response.
+    AutoLock al(m_output);
+    writeFence(flags & (FenceDefs::BLOCK_BEFORE | FenceDefs::BLOCK_AFTER),
+               payload, length);
+    m_output->flush();
+    return;
+  }
+
+  // A response to our fence. Only flow control fences carry a payload.
+  if (length == 4) {
+    UINT32 id = ((UINT32)payload[0] << 24) | ((UINT32)payload[1] << 16) |
+                ((UINT32)payload[2] << 8) | (UINT32)payload[3];
+    if (m_fenceFlow.onFenceResponse(id)) {
+      Rect continuousArea;
+      bool continuous;
+      {
+        AutoLock al(&m_reqRectLocMut);
+        continuous = m_continuousUpdates;
+        continuousArea = m_continuousArea;
+      }
+      // The desktop does not pass updates to us while the window is full,
+      // so it may have collected some by now.
+      if (continuous) {
+        m_updReqListener->onUpdateRequest(&continuousArea, true);
+      }
+      m_newUpdatesEvent.notify();
+    }
+  }
+}
+
+void UpdateSender::writeFence(UINT32 flags, const UINT8 *payload, UINT8 length)
+{
+  m_output->writeUInt8(ServerMsgDefs::FENCE);
+  m_output->writeUInt8(0); // padding
+  m_output->writeUInt16(0); // padding
+  m_output->writeUInt32(flags);
+  m_output->writeUInt8(length);
+  if (length != 0) {
+    m_output->writeFully(payload, length);
+  }
+}
+
+void UpdateSender::writeFlowControlFence(UINT32 id)
+{
+  UINT8 payload[4];
+  payload[0] = (UINT8)(id >> 24);
+  payload[1] = (UINT8)(id >> 16);
+  payload[2] = (UINT8)(id >> 8);
+  payload[3] = (UINT8)id;
+  writeFence(FenceDefs::REQUEST | FenceDefs::BLOCK_BEFORE, payload,
+             sizeof(payload));
 }
 
 void UpdateSender::setVideoFrozen(bool value)
@@ -830,6 +1602,7 @@ bool UpdateSender::extractReqRegions(Region *incrReqReg,
 
 void UpdateSender::extractUpdates(UpdateContainer *updCont)
 {
+  foldUpdates();
   m_updateKeeper->extract(updCont);
 }
 
@@ -864,20 +1637,19 @@ void UpdateSender::inscribeCopiedRegionToReqRegion(UpdateContainer *updCont,
     dstCopiedRegion.subtract(requestRegion);
 
     bool copiedRegionFullyInscribed = dstCopiedRegion.isEmpty();
-    if (copiedRegionFullyInscribed) {
-      // Then see the same at source coordinates.
-      Region copiedRegion = updCont->copiedRegion;
-      Rect dstBounds = copiedRegion.getBounds();
-      int dx = updCont->copySrc.x - dstBounds.left;
-      int dy = updCont->copySrc.y - dstBounds.top;
-      copiedRegion.translate(dx, dy);
-      copiedRegion.subtract(requestRegion);
-      copiedRegionFullyInscribed = copiedRegion.isEmpty();
+    // Then see the same at source coordinates of every move. The moves
+    // depend on each other, so they are kept or declined together.
+    for (size_t i = 0; copiedRegionFullyInscribed &&
+                       i < updCont->copyMoves.size(); i++) {
+      const CopyMove *move = &updCont->copyMoves[i];
+      Region srcRegion = move->dstRegion;
+      srcRegion.translate(move->srcOffset.x, move->srcOffset.y);
+      srcRegion.subtract(requestRegion);
+      copiedRegionFullyInscribed = srcRegion.isEmpty();
     }
     if (!copiedRegionFullyInscribed) {
       // Convert copied region to changed region.
-      updCont->changedRegion.add(&updCont->copiedRegion);
-      updCont->copiedRegion.clear();
+      updCont->convertCopiesToChanges();
     }
   }
 }
@@ -903,8 +1675,7 @@ void UpdateSender::updateFrameBuffer(UpdateContainer *updCont,
 
   Region newOpeningPixels;
   if (shareOnlyApp) {
-    updCont->changedRegion.add(&updCont->copiedRegion);
-    updCont->copiedRegion.clear();
+    updCont->convertCopiesToChanges();
     m_appRegion = *shareAppRegion;
     newOpeningPixels = m_appRegion;
     newOpeningPixels.subtract(&m_prevAppRegion);
@@ -930,6 +1701,49 @@ void UpdateSender::updateFrameBuffer(UpdateContainer *updCont,
                                updCont->screenSizeChanged;
 }
 
+bool UpdateSender::selectSharedFrame(const EncodeOptions *encodeOptions,
+                                     const Rect *viewPort, bool shareOnlyApp,
+                                     UpdateContainer *updCont)
+{
+  bool useShared =
+    Configurator::getInstance()->getServerConfig()->isSharedFrameBufferEnabled() &&
+    encodeOptions->richCursorEnabled() && encodeOptions->pointerPosEnabled() &&
+    encodeOptions->desktopSizeEnabled() && !shareOnlyApp;
+  bool sameProperties = true;
+  if (useShared) {
+    sameProperties = m_desktop->acquireFrameSnapshot(&m_frameSnapshot);
+    Rect snapshotRect = m_frameSnapshot.getDimension().getRect();
+    useShared = !snapshotRect.isEmpty() && viewPort->isEqualTo(&snapshotRect);
+  }
+  if (!useShared) {
+    m_frameSnapshot.release();
+  }
+
+  if (useShared != m_usingSharedFrame) {
+    m_usingSharedFrame = useShared;
+    m_sentTiles.reset();
+    if (useShared) {
+      m_log->debug(_T("Switching to the shared frame buffer"));
+      Dimension noPixels;
+      m_frameBuffer.setDimension(&noPixels);
+    } else {
+      m_log->debug(_T("Switching to a private frame buffer"));
+      // Allocate the frame buffer, all its pixels are copied below as the
+      // whole view port is marked as changed.
+      Region noPixels;
+      m_desktop->updateExternalFrameBuffer(&m_frameBuffer, &noPixels, viewPort);
+    }
+    // The pixels the client has may differ from the new source, e.g. by the
+    // cursor drawn on them.
+    Rect viewPortRect = Dimension(viewPort).getRect();
+    updCont->changedRegion.addRect(&viewPortRect);
+  }
+  if (useShared && !sameProperties) {
+    updCont->screenSizeChanged = true;
+  }
+  return useShared;
+}
+
 bool UpdateSender::updateViewPort(Rect *outNewViewPort, bool *shareApp, Region *prevShareAppRegion,
                                   Region *newShareAppRegion)
 {
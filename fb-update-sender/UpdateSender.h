@@ -28,8 +28,10 @@
 #include "thread/AutoLock.h"
 #include "thread/Thread.h"
 #include "desktop/UpdateKeeper.h"
+#include "desktop/DamageJournal.h"
 #include "UpdateRequestListener.h"
 #include "rfb/FrameBuffer.h"
+#include "desktop/SharedFrameBuffer.h"
 #include "ViewPort.h"
 #include "network/RfbOutputGate.h"
 #include "network/RfbInputGate.h"
@@ -41,32 +43,48 @@
 #include "util/DateTime.h"
 #include "CursorUpdates.h"
 #include "SenderControlInformationInterface.h"
+#include "EncodeGroup.h"
+#include "LinkQualityEstimator.h"
+#include "FenceFlowControl.h"
+#include "SentTiles.h"
+#include "RegionCoarsener.h"
 #include "log-writer/LogWriter.h"
 
+class EncodeGroupManager;
+
 class UpdateSender : public Thread, public RfbDispatcherListener
 {
 public:
   // updReqListener - pointer to the out listener for retranslate
   // update reqest to out.
+  // codeRegtor may be 0 for a sender that has no RFB connection of its own
+  // (the shared pipeline of an EncodeGroup), no capabilities and message
+  // handlers are registered in that case.
+  // encodeGroups may be 0 if the sender should never be grouped with other
+  // senders.
+  // journal is the journal of the desktop updates to take the updates
+  // from.
+  // encoderPool is a thread pool for parallel encoding, may be 0.
   // FIXME: Document all the arguments properly.
   UpdateSender(RfbCodeRegistrator *codeRegtor,
                UpdateRequestListener *updReqListener,
                SenderControlInformationInterface *senderControlInformation,
                RfbOutputGate *output,
-               int id, Desktop *desktop, LogWriter *log);
+               int id, Desktop *desktop,
+               DamageJournal *journal,
+               EncodeGroupManager *encodeGroups,
+               ThreadPool *encoderPool,
+               LogWriter *log);
   virtual ~UpdateSender();
 
   // The sendServerInit() function sends first rfb init message to a client
   // FIXME: The comment does not seem to be relevant.
   void init(const Dimension *viewPortDimension, const PixelFormat *pf);
 
-  // The triggerUpdate() function adds updateContainer to the UpdateKeeper,
-  // gives new frame buffer properties if needed.
-  // Also, if client is ready by now (m_reqRect is not empty), triggerUpdate()
-  // notifies to thread.
-  // FIXME: The comment does not seem to be relevant.
-  void newUpdates(const UpdateContainer *updateContainer,
-                  const CursorShape *cursorShape);
+  // The newUpdates() function tells that new updates have been appended to
+  // the journal and wakes up the sender thread. The updates are taken from
+  // the journal when the sender is about to send them.
+  void newUpdates(const CursorShape *cursorShape);
 
   // Block cursor pos sending by this connection to a client. Unblocking will
   // be automaticly for a time.
@@ -79,6 +97,54 @@ public:
   // Return true if the client is ready, false otherwise.
   bool clientIsReady();
 
+  int getId() const;
+  RfbOutputGate *getOutput();
+
+  //
+  // Encode group support (see EncodeGroup).
+  //
+
+  // Called by EncodeGroup when this sender becomes its member. Since then,
+  // the group encodes updates for our client and writes them to our output,
+  // the sender does not send framebuffer updates itself. The changes not
+  // sent yet are passed to the group by the sender thread.
+  void enterEncodeGroup(EncodeGroup *group, const EncodeGroupKey *key);
+  // Called by EncodeGroup when this sender leaves the group. The sender
+  // resets its encoders and sends the whole view port on the next update.
+  // If restoreRequest is true, an update request taken by the group but not
+  // answered yet is restored as an incremental request for the whole view
+  // port.
+  void leaveEncodeGroup(bool restoreRequest);
+  // Returns the group this sender belongs to or 0.
+  EncodeGroup *getEncodeGroup();
+  // Called by EncodeGroup to pass an encoded message to our client. The
+  // message is copied and written later by the sender thread, the function
+  // never blocks. Returns false if the previous message has not been written
+  // yet or the write queue of the output is full.
+  bool queueGroupMessage(const std::vector<char> *message);
+
+  // Returns true if the client has requested an update which has not been
+  // taken yet.
+  bool hasUpdateRequest();
+  // Takes pending update requests like sendUpdate() does. Returns false if
+  // there were no requests.
+  bool takeUpdateRequest(Region *incrReqReg, Region *fullReqReg,
+                         DateTime *reqTimePoint);
+  // Adds update requests as if they were received from the client.
+  void addUpdateRequest(const Region *incrReqReg, const Region *fullReqReg,
+                        const DateTime *reqTimePoint);
+  // Replaces the encode options as if SetEncodings was received from the
+  // client.
+  void setEncodeOptions(const EncodeOptions *encodeOptions);
+  // Forces sending the whole view port and the cursor shape on the next
+  // update. Compression state of the encoders is reset before that.
+  void refreshAll();
+  // Makes the next update reset the compression state of the encoders.
+  void resetEncoders();
+  // Adds the changes a new member of our encode group has not got to the
+  // changes of the shared pipeline.
+  void addMissedUpdates(const UpdateContainer *missed);
+
 protected:
   // Listener function which implements RfbDispatcherListener. It will be
   // called on receiving client messages if we registered as a handler for
@@ -90,11 +156,20 @@ protected:
   void readSetPixelFormat(RfbInputGate *io);
   void readSetEncodings(RfbInputGate *io);
   void readVideoFreeze(RfbInputGate *io);
-
-  // The addUpdateContainer() function adds all updates from the first
-  // updateContainer parameter to the own UpdateContainer object.
+  void readEnableContinuousUpdates(RfbInputGate *io);
+  void readFence(RfbInputGate *io);
+
+  // Writes a Fence message. The caller must lock and flush m_output.
+  void writeFence(UINT32 flags, const UINT8 *payload, UINT8 length);
+  // Writes a fence request carrying the identifier of the update just
+  // written, for FenceFlowControl.
+  void writeFlowControlFence(UINT32 id);
+
+  // The foldUpdates() function adds the updates appended to the journal
+  // since the last call to the own UpdateKeeper, in the view port
+  // coordinates.
   // This function may asynchronously be called from any threads.
-  void addUpdateContainer(const UpdateContainer *updateContainer);
+  void foldUpdates();
 
   // The sender thread.
   virtual void execute();
@@ -113,6 +188,8 @@ protected:
   // Access to a FrameBuffer data passes through the frameBuffer pointer
   // of the function parameter.
   void sendUpdate();
+  // Writes the message passed by the encode group, if any.
+  void writeGroupMessage();
 
   // sendUpdate() auxiliary functions.
   // Returns true if an update has been requested.
@@ -134,6 +211,15 @@ protected:
   void updateFrameBuffer(UpdateContainer *updCont,
                          bool shareOnlyApp, const Region *prevSharedRegion,
                          const Region *shareAppRegion);
+  // Decides if the update can be encoded from the frame buffer shared by
+  // all senders and acquires m_frameSnapshot if so. That's possible only if
+  // the client gets the desktop pixels as is: the cursor is not drawn on
+  // them, nothing is painted black, and the view port is the whole desktop.
+  // Returns true if the shared frame buffer should be used, otherwise the
+  // private m_frameBuffer must be updated and used.
+  bool selectSharedFrame(const EncodeOptions *encodeOptions,
+                         const Rect *viewPort, bool shareOnlyApp,
+                         UpdateContainer *updCont);
   // Updates internal view port rectangle.
   // Returns true if view port has been changed during the operation.
   bool updateViewPort(Rect *outNewViewPort, bool *shareApp, Region *prevShareAppRegion,
@@ -159,13 +245,23 @@ protected:
   void sendCursorShapeUpdate(const PixelFormat *fmt,
                              const CursorShape *cursorShape);
   void sendCursorPosUpdate();
-  void sendCopyRect(const std::vector<Rect> *rects, const Point *source);
+  // Sends CopyRect rectangles in the given order, each one with its own
+  // source point.
+  void sendCopyRect(const std::vector<Rect> *rects,
+                    const std::vector<Point> *sources);
 
   // Encode and send a list of rectangles via the specified encoder.
   void sendRectangles(Encoder *encoder,
                       const std::vector<Rect> *rects,
                       const FrameBuffer *frameBuffer,
                       const EncodeOptions *encodeOptions);
+  // Split the region by the encoder, then encode and send the rectangles in
+  // batches of STREAM_BATCH_AREA pixels, flushing the output after each
+  // batch. Used for streamed updates. Returns the number of rectangles sent.
+  size_t streamRegion(Encoder *encoder,
+                      const Region *region,
+                      const FrameBuffer *frameBuffer,
+                      const EncodeOptions *encodeOptions);
 
   // This function paints black region in framebuffer.
   void paintBlack(FrameBuffer *frameBuffer, const Region *blackRegion);
@@ -180,6 +276,10 @@ protected:
                    const FrameBuffer *frameBuffer,
                    const EncodeOptions *encodeOptions);
 
+  // Returns true if the current settings of the client still match the key
+  // of the encode group this sender belongs to.
+  bool checkEncodeGroupKey();
+
   // Returns part of region with total area not much more than area
   // and removes this part form source reg
   Region takePartFromRegion(Region *reg, int area);
@@ -198,8 +298,28 @@ protected:
   bool m_busy;
   // Property for perfomance measurements. It uses with the regions mutex.
   DateTime m_requestTimePoint;
+  // ContinuousUpdates state, protected by the regions mutex as well. While
+  // m_continuousUpdates is true, m_continuousArea works as a standing
+  // incremental request. EndOfContinuousUpdates is sent by the sender thread
+  // when m_sendEndOfContinuousUpdates is set, so it can never be followed by
+  // a continuous update prepared before. m_flowControlSupported is true
+  // while the current encodings include both the ContinuousUpdates and the
+  // Fence pseudo-encodings. Without fences the updates could not be
+  // throttled, so continuous updates are turned on only with it.
+  bool m_flowControlSupported;
+  bool m_continuousUpdates;
+  Rect m_continuousArea;
+  bool m_sendEndOfContinuousUpdates;
   LocalMutex m_reqRectLocMut;
 
+  // Set when we have told the client that we support ContinuousUpdates and
+  // Fence. Used only by the thread reading client messages.
+  bool m_continuousUpdatesAnnounced;
+  bool m_fenceAnnounced;
+
+  // Limits the data in flight in the ContinuousUpdates mode.
+  FenceFlowControl m_fenceFlow;
+
   SenderControlInformationInterface *m_senderControlInformation;
 
   Rect m_viewPort;
@@ -211,8 +331,21 @@ protected:
   LocalMutex m_viewPortMut;
 
   UpdateKeeper *m_updateKeeper;
+  DamageJournal *m_journal;
+  // Sequence number of the first journal entry not folded yet, changed
+  // only by the journal.
+  UINT64 m_journalCursor;
 
+  // Private copy of the desktop pixels, allocated only while the client
+  // cannot be served from the shared frame buffer.
   FrameBuffer m_frameBuffer;
+  // Bands of the shared frame buffer referenced while encoding an update.
+  FrameSnapshot m_frameSnapshot;
+  bool m_usingSharedFrame;
+  // Content of the shared frame buffer tiles the client has.
+  SentTiles m_sentTiles;
+  // Merges rectangles of the changed region before splitting it.
+  RegionCoarsener m_regionCoarsener;
   Desktop *m_desktop;
 
   CursorUpdates m_cursorUpdates;
@@ -264,6 +397,54 @@ protected:
   // should be used only by the sender thread.
   EncoderStore m_enbox;
 
+  // Encode groups. m_encodeGroups is the manager to offer this sender to,
+  // may be 0. m_encodeGroup is the group we belong to (0 if the sender works
+  // on its own), m_encodeGroupKey is the key of that group.
+  // m_lastUpdateKey and m_lastUpdateGroupable describe the most recent
+  // update sent by this sender itself, they are used only by the sender
+  // thread.
+  EncodeGroupManager *m_encodeGroups;
+  EncodeGroup *m_encodeGroup;
+  EncodeGroupKey m_encodeGroupKey;
+  DateTime m_leftEncodeGroupTime;
+  EncodeGroupKey m_lastUpdateKey;
+  bool m_lastUpdateGroupable;
+  // Set by enterEncodeGroup(), makes the sender thread pass the changes not
+  // sent yet to the group.
+  bool m_catchUpGroup;
+  // Set by refreshAll(), makes sendUpdate() reset the compression state of
+  // all encoders.
+  bool m_resetEncoders;
+  LocalMutex m_encodeGroupLocker;
+  // Message passed by the encode group and not written yet, protected by
+  // m_groupMessageLocker. m_groupMessageOut is the message being written,
+  // used only by the sender thread.
+  std::vector<char> m_groupMessage;
+  std::vector<char> m_groupMessageOut;
+  LocalMutex m_groupMessageLocker;
+
+  // Do not join encode groups during this time (in milliseconds) after
+  // leaving one, to avoid switching back and forth for a slow client.
+  static const unsigned int ENCODE_GROUP_REJOIN_DELAY = 10000;
+
+  // True for the shared pipeline of an encode group. It has no link of its
+  // own and must deliver each update as a whole on flush().
+  bool m_isSharedPipeline;
+
+  // Measures the link to the client and limits the encode options when the
+  // AdaptiveEncoding option is on. Used only by the sender thread.
+  LinkQualityEstimator m_linkEstimator;
+
+  // Streamed updates are flushed each time the encoded rectangles reach this
+  // area (in pixels).
+  static const int STREAM_BATCH_AREA = 256 * 1024;
+  // Without LastRect, the number of rectangles in an update must fit in 16
+  // bits, and 0xFFFF is reserved as the LastRect marker.
+  static const size_t MAX_COUNTED_RECTS = 65534;
+  // While the write queue is full, the sender thread checks for termination
+  // at least this often (in milliseconds).
+  static const DWORD WRITE_QUEUE_WAIT_INTERVAL = 100;
+
   // Information
   // FIXME: Document this properly.
   int m_id;
@@ -25,7 +25,9 @@
 #include "BufferedOutputStream.h"
 
 BufferedOutputStream::BufferedOutputStream(OutputStream *output)
-: m_dataLength(0)
+: m_dataLength(0),
+  m_totalWritten(0),
+  m_totalCopied(0)
 {
   m_output = new DataOutputStream(output);
 }
@@ -42,22 +44,99 @@ BufferedOutputStream::~BufferedOutputStream()
 
 size_t BufferedOutputStream::write(const void *buffer, size_t len)
 {
-  if (m_dataLength + len >= sizeof(m_buffer)) {
-    flush();
+  if (len >= MIN_DIRECT_WRITE || m_dataLength + len >= sizeof(m_buffer)) {
+    // Send the buffered data and the chunk at once.
+    OutputSegment segments[2] = { { &m_buffer[0], m_dataLength },
+                                  { buffer, len } };
+    m_output->writeVectorFully(segments, 2);
 
-    m_output->writeFully(buffer, len);
+    m_dataLength = 0;
   } else {
     memcpy(&m_buffer[m_dataLength], buffer, len);
 
     m_dataLength += len;
+    m_totalCopied += len;
   }
+  m_totalWritten += len;
 
   return len;
 }
 
+size_t BufferedOutputStream::writeVector(const OutputSegment *segments,
+                                         size_t count)
+{
+  // The segments to write: the buffered data and new small segments are
+  // referenced in the buffer, large segments are referenced in place.
+  // Nothing is written if all the new segments fit in the buffer.
+  std::vector<OutputSegment> *pending = &m_pending;
+  pending->clear();
+  bool hasDirect = false;
+  size_t totalLength = 0;
+  if (m_dataLength != 0) {
+    OutputSegment buffered = { &m_buffer[0], m_dataLength };
+    pending->push_back(buffered);
+  }
+  for (size_t i = 0; i < count; i++) {
+    const OutputSegment *segment = &segments[i];
+    totalLength += segment->length;
+    if (segment->length >= MIN_DIRECT_WRITE) {
+      pending->push_back(*segment);
+      hasDirect = true;
+    } else if (segment->length != 0) {
+      if (m_dataLength + segment->length >= sizeof(m_buffer)) {
+        writeSegments(pending);
+        hasDirect = false;
+      }
+      copyToBuffer(segment->data, segment->length, pending);
+    }
+  }
+  if (hasDirect) {
+    writeSegments(pending);
+  }
+  m_totalWritten += totalLength;
+
+  return totalLength;
+}
+
 void BufferedOutputStream::flush()
 {
   m_output->writeFully(&m_buffer[0], m_dataLength);
 
   m_dataLength = 0;
 }
+
+UINT64 BufferedOutputStream::getTotalWritten() const
+{
+  return m_totalWritten;
+}
+
+UINT64 BufferedOutputStream::getTotalCopied() const
+{
+  return m_totalCopied;
+}
+
+void BufferedOutputStream::copyToBuffer(const void *buffer, size_t len,
+                                        std::vector<OutputSegment> *segments)
+{
+  char *dst = &m_buffer[m_dataLength];
+  memcpy(dst, buffer, len);
+  m_dataLength += len;
+  m_totalCopied += len;
+
+  if (!segments->empty() &&
+      (char *)segments->back().data + segments->back().length == dst) {
+    segments->back().length += len;
+  } else {
+    OutputSegment copied = { dst, len };
+    segments->push_back(copied);
+  }
+}
+
+void BufferedOutputStream::writeSegments(std::vector<OutputSegment> *segments)
+{
+  if (!segments->empty()) {
+    m_output->writeVectorFully(&segments->front(), segments->size());
+    segments->clear();
+  }
+  m_dataLength = 0;
+}
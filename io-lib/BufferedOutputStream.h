@@ -27,11 +27,17 @@
 
 #include "OutputStream.h"
 #include "DataOutputStream.h"
+#include "util/inttypes.h"
+
+#include <vector>
 
 /**
  * Buffered output stream class (decorator pattern).
  * Adds bufferization feature to output stream.
  * @remark size of buffer now is fixed and equals to 1400 bytes.
+ * @remark chunks and segments of MIN_DIRECT_WRITE bytes and more are not
+ * copied to the buffer, they are written to real output stream together with
+ * the buffered data by a single vectored write.
  */
 class BufferedOutputStream : public OutputStream
 {
@@ -52,6 +58,15 @@ public:
    */
   virtual size_t write(const void *buffer, size_t len) throw(IOException);
 
+  /**
+   * Writes segments to output stream (with buffering). Small segments are
+   * copied to inner buffer, large ones are written with the buffered data
+   * without copying.
+   * @throw IOException on error.
+   */
+  virtual size_t writeVector(const OutputSegment *segments, size_t count)
+    throw(IOException);
+
   /**
    * Writes content of inner buffer to real output stream.
    * @throws IOException on error.
@@ -59,12 +74,52 @@ public:
    */
   void flush() throw(IOException);
 
+  /**
+   * Returns total number of bytes passed to write() since creation.
+   */
+  UINT64 getTotalWritten() const;
+
+  /**
+   * Returns total number of bytes copied to inner buffer since creation.
+   */
+  UINT64 getTotalCopied() const;
+
+  /**
+   * Chunks passed to write() and segments passed to writeVector() of this
+   * size and larger are written without copying. Each write() of such a
+   * chunk costs a call to real output stream, so writers of many large
+   * chunks (like TightEncoder) should gather them by writeVector().
+   */
+  static const size_t MIN_DIRECT_WRITE = 2048;
+
 protected:
+  /**
+   * Copies data to the buffer, adding a segment for the copied data to
+   * segments if the data is not adjacent to the last buffered segment.
+   */
+  void copyToBuffer(const void *buffer, size_t len,
+                    std::vector<OutputSegment> *segments);
+
+  /**
+   * Writes segments (which may point to the buffer) to real output stream
+   * and empties the buffer.
+   */
+  void writeSegments(std::vector<OutputSegment> *segments);
+
   DataOutputStream *m_output;
 
   char m_buffer[100000];
 
   size_t m_dataLength;
+
+  /**
+   * Segments to write by writeVector(), reused between calls.
+   */
+  std::vector<OutputSegment> m_pending;
+
+  UINT64 m_totalWritten;
+
+  UINT64 m_totalCopied;
 };
 
 #endif
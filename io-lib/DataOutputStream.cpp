@@ -42,6 +42,46 @@ size_t DataOutputStream::write(const void *buffer, size_t len)
   return m_outStream->write(buffer, len);
 }
 
+size_t DataOutputStream::writeVector(const OutputSegment *segments,
+                                     size_t count)
+{
+  return m_outStream->writeVector(segments, count);
+}
+
+void DataOutputStream::writeVectorFully(const OutputSegment *segments,
+                                        size_t count)
+{
+  size_t left = 0;
+  for (size_t i = 0; i < count; i++) {
+    left += segments[i].length;
+  }
+  if (left == 0) {
+    return;
+  }
+  size_t written = m_outStream->writeVector(segments, count);
+  if (written == left) {
+    return;
+  }
+
+  // Partial write, continue with a copy of the segment list that can be
+  // advanced.
+  std::vector<OutputSegment> rest(segments, segments + count);
+  size_t first = 0;
+  for (;;) {
+    left -= written;
+    if (left == 0) {
+      break;
+    }
+    while (written >= rest[first].length) {
+      written -= rest[first].length;
+      first++;
+    }
+    rest[first].data = (const char *)rest[first].data + written;
+    rest[first].length -= written;
+    written = m_outStream->writeVector(&rest[first], count - first);
+  }
+}
+
 void DataOutputStream::writeFully(const void *buffer, size_t len)
 {
   char *typedBuffer = (char *)buffer;
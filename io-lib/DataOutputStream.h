@@ -49,6 +49,13 @@ public:
    */
   virtual size_t write(const void *buffer, size_t len) throw(IOException);
 
+  /**
+   * Inherited from superclass.
+   * @remark just delegates call to real output stream.
+   */
+  virtual size_t writeVector(const OutputSegment *segments, size_t count)
+    throw(IOException);
+
   /**
    * Writes exacly specified count of bytes to stream.
    * @param buffer source buffer.
@@ -59,6 +66,15 @@ public:
    */
   void writeFully(const void *buffer, size_t len) throw(IOException);
 
+  /**
+   * Writes all the segments to stream.
+   * @param segments pieces of data to write, in order.
+   * @param count count of segments.
+   * @throws IOException on error.
+   */
+  void writeVectorFully(const OutputSegment *segments, size_t count)
+    throw(IOException);
+
   void writeUInt8(UINT8 x) throw(IOException);
   void writeUInt16(UINT16 x) throw(IOException);
   void writeUInt32(UINT32 x) throw(IOException);
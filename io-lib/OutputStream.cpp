@@ -28,6 +28,22 @@ OutputStream::~OutputStream()
 {
 }
 
+size_t OutputStream::writeVector(const OutputSegment *segments, size_t count)
+{
+  size_t totalWritten = 0;
+  for (size_t i = 0; i < count; i++) {
+    if (segments[i].length == 0) {
+      continue;
+    }
+    size_t written = write(segments[i].data, segments[i].length);
+    totalWritten += written;
+    if (written < segments[i].length) {
+      break;
+    }
+  }
+  return totalWritten;
+}
+
 void OutputStream::flush()
 {
 }
@@ -27,6 +27,15 @@
 
 #include "IOException.h"
 
+/**
+ * Piece of data for vectored output (see OutputStream::writeVector()).
+ */
+struct OutputSegment
+{
+  const void *data;
+  size_t length;
+};
+
 /**
  * Output stream interface (abstract class).
  */
@@ -44,6 +53,19 @@ public:
    */
   virtual size_t write(const void *buffer, size_t len) = 0;
 
+  /**
+   * Writes several pieces of data to stream (scatter-gather output).
+   * @param segments pieces of data to write, in order.
+   * @param count count of segments.
+   * @return count of written bytes, can be less than total length of the
+   * segments.
+   * @throws any kind of exception (depends on implementation).
+   *
+   * writeVector method of OutputStream writes segments one by one, it can be
+   * override by subclasses which can write them at once or without copying.
+   */
+  virtual size_t writeVector(const OutputSegment *segments, size_t count);
+
   /**
    * Flushes inner buffer to real output stream.
    *
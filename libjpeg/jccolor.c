@@ -12,6 +12,11 @@
 #include "jinclude.h"
 #include "jpeglib.h"
 
+#if defined(JSIMD_SSE2_SUPPORTED) && BITS_IN_JSAMPLE == 8
+#include <emmintrin.h>
+#define USE_SSE2_CONVERSION
+#endif
+
 
 /* Private subobject */
 
@@ -20,6 +25,13 @@ typedef struct {
 
   /* Private state for RGB->YCC conversion */
   INT32 * rgb_ycc_tab;		/* => table for RGB to YCbCr conversion */
+
+  /* Layout of a pixel for the extended RGB input spaces */
+  int rgb_red;			/* offset of red */
+  int rgb_green;		/* offset of green */
+  int rgb_blue;			/* offset of blue */
+  int rgb_pixelsize;		/* JSAMPLEs per pixel */
+  boolean use_sse2;		/* TRUE to convert 4-byte pixels with SSE2 */
 } my_color_converter;
 
 typedef my_color_converter * my_cconvert_ptr;
@@ -172,6 +184,166 @@ rgb_ycc_convert (j_compress_ptr cinfo,
 }
 
 
+/**************** Extended RGB -> YCbCr conversion **************/
+
+/*
+ * The extended input spaces (JCS_EXT_RGB ... JCS_EXT_XRGB) let the
+ * application pass pixels in the layout it already has, e.g. 32-bit
+ * frame buffer rows, without converting them to packed RGB first.
+ * The results are exactly the same as with the table-driven code above.
+ *
+ * The tables below are indexed by (in_color_space - JCS_EXT_RGB).
+ */
+
+static const int ext_rgb_red[6] =       { 0, 0, 2, 2, 3, 1 };
+static const int ext_rgb_green[6] =     { 1, 1, 1, 1, 2, 2 };
+static const int ext_rgb_blue[6] =      { 2, 2, 0, 0, 1, 3 };
+static const int ext_rgb_pixelsize[6] = { 3, 4, 3, 4, 4, 4 };
+
+#define IS_EXT_RGB(space)  ((space) >= JCS_EXT_RGB && (space) <= JCS_EXT_XRGB)
+
+
+#ifdef USE_SSE2_CONVERSION
+
+/*
+ * Convert num_cols pixels of 4 bytes (num_cols must be a multiple of 8).
+ * The constants are the same as in rgb_ycc_start.  Coefficients which do
+ * not fit into 16 bits are split: 0.58700 = 0.33700 + 0.25000 for Y,
+ * and 0.50000 is applied by shifting left by 15.
+ */
+
+LOCAL(void)
+ext_rgbx_ycc_convert_sse2 (JSAMPROW inptr, JSAMPROW outptr0,
+			   JSAMPROW outptr1, JSAMPROW outptr2,
+			   JDIMENSION num_cols, int red, int green, int blue)
+{
+  const __m128i mask = _mm_set1_epi32(0xFF);
+  const __m128i rshift = _mm_cvtsi32_si128(red * 8);
+  const __m128i gshift = _mm_cvtsi32_si128(green * 8);
+  const __m128i bshift = _mm_cvtsi32_si128(blue * 8);
+  /* Pairs of 16-bit coefficients, the first one is for the low half */
+  const __m128i y_rg = _mm_set_epi16(
+    (short) FIX(0.33700), (short) FIX(0.29900),
+    (short) FIX(0.33700), (short) FIX(0.29900),
+    (short) FIX(0.33700), (short) FIX(0.29900),
+    (short) FIX(0.33700), (short) FIX(0.29900));
+  const __m128i y_bg = _mm_set_epi16(
+    (short) FIX(0.25000), (short) FIX(0.11400),
+    (short) FIX(0.25000), (short) FIX(0.11400),
+    (short) FIX(0.25000), (short) FIX(0.11400),
+    (short) FIX(0.25000), (short) FIX(0.11400));
+  const __m128i cb_rg = _mm_set_epi16(
+    (short) -FIX(0.33126), (short) -FIX(0.16874),
+    (short) -FIX(0.33126), (short) -FIX(0.16874),
+    (short) -FIX(0.33126), (short) -FIX(0.16874),
+    (short) -FIX(0.33126), (short) -FIX(0.16874));
+  const __m128i cr_gb = _mm_set_epi16(
+    (short) -FIX(0.08131), (short) -FIX(0.41869),
+    (short) -FIX(0.08131), (short) -FIX(0.41869),
+    (short) -FIX(0.08131), (short) -FIX(0.41869),
+    (short) -FIX(0.08131), (short) -FIX(0.41869));
+  const __m128i y_offset = _mm_set1_epi32(ONE_HALF);
+  const __m128i cbcr_offset = _mm_set1_epi32(CBCR_OFFSET + ONE_HALF - 1);
+  __m128i p, r, g, b, rg, bg, gb, y[2], cb[2], cr[2];
+  JDIMENSION col;
+  int half;
+
+  for (col = 0; col < num_cols; col += 8) {
+    for (half = 0; half < 2; half++) {
+      p = _mm_loadu_si128((const __m128i *) inptr);
+      inptr += 16;
+      r = _mm_and_si128(_mm_srl_epi32(p, rshift), mask);
+      g = _mm_and_si128(_mm_srl_epi32(p, gshift), mask);
+      b = _mm_and_si128(_mm_srl_epi32(p, bshift), mask);
+      rg = _mm_or_si128(r, _mm_slli_epi32(g, 16));
+      bg = _mm_or_si128(b, _mm_slli_epi32(g, 16));
+      gb = _mm_or_si128(g, _mm_slli_epi32(b, 16));
+
+      y[half] = _mm_add_epi32(_mm_madd_epi16(rg, y_rg),
+			      _mm_madd_epi16(bg, y_bg));
+      y[half] = _mm_srai_epi32(_mm_add_epi32(y[half], y_offset), SCALEBITS);
+
+      cb[half] = _mm_add_epi32(_mm_madd_epi16(rg, cb_rg),
+			       _mm_slli_epi32(b, 15));
+      cb[half] = _mm_srai_epi32(_mm_add_epi32(cb[half], cbcr_offset),
+				SCALEBITS);
+
+      cr[half] = _mm_add_epi32(_mm_slli_epi32(r, 15),
+			       _mm_madd_epi16(gb, cr_gb));
+      cr[half] = _mm_srai_epi32(_mm_add_epi32(cr[half], cbcr_offset),
+				SCALEBITS);
+    }
+    p = _mm_packs_epi32(y[0], y[1]);
+    _mm_storel_epi64((__m128i *) (outptr0 + col), _mm_packus_epi16(p, p));
+    p = _mm_packs_epi32(cb[0], cb[1]);
+    _mm_storel_epi64((__m128i *) (outptr1 + col), _mm_packus_epi16(p, p));
+    p = _mm_packs_epi32(cr[0], cr[1]);
+    _mm_storel_epi64((__m128i *) (outptr2 + col), _mm_packus_epi16(p, p));
+  }
+}
+
+#endif /* USE_SSE2_CONVERSION */
+
+
+/*
+ * Convert some rows of samples to the JPEG colorspace.
+ * This version handles the extended RGB input spaces.
+ */
+
+METHODDEF(void)
+ext_rgb_ycc_convert (j_compress_ptr cinfo,
+		     JSAMPARRAY input_buf, JSAMPIMAGE output_buf,
+		     JDIMENSION output_row, int num_rows)
+{
+  my_cconvert_ptr cconvert = (my_cconvert_ptr) cinfo->cconvert;
+  register int r, g, b;
+  register INT32 * ctab = cconvert->rgb_ycc_tab;
+  register JSAMPROW inptr;
+  register JSAMPROW outptr0, outptr1, outptr2;
+  register JDIMENSION col;
+  JDIMENSION num_cols = cinfo->image_width;
+  int red = cconvert->rgb_red;
+  int green = cconvert->rgb_green;
+  int blue = cconvert->rgb_blue;
+  int pixelsize = cconvert->rgb_pixelsize;
+
+  while (--num_rows >= 0) {
+    inptr = *input_buf++;
+    outptr0 = output_buf[0][output_row];
+    outptr1 = output_buf[1][output_row];
+    outptr2 = output_buf[2][output_row];
+    output_row++;
+    col = 0;
+#ifdef USE_SSE2_CONVERSION
+    if (cconvert->use_sse2) {
+      col = num_cols & ~((JDIMENSION) 7);
+      ext_rgbx_ycc_convert_sse2(inptr, outptr0, outptr1, outptr2, col,
+				red, green, blue);
+      inptr += col * 4;
+    }
+#endif
+    for (; col < num_cols; col++) {
+      r = GETJSAMPLE(inptr[red]);
+      g = GETJSAMPLE(inptr[green]);
+      b = GETJSAMPLE(inptr[blue]);
+      inptr += pixelsize;
+      /* Y */
+      outptr0[col] = (JSAMPLE)
+		((ctab[r+R_Y_OFF] + ctab[g+G_Y_OFF] + ctab[b+B_Y_OFF])
+		 >> SCALEBITS);
+      /* Cb */
+      outptr1[col] = (JSAMPLE)
+		((ctab[r+R_CB_OFF] + ctab[g+G_CB_OFF] + ctab[b+B_CB_OFF])
+		 >> SCALEBITS);
+      /* Cr */
+      outptr2[col] = (JSAMPLE)
+		((ctab[r+R_CR_OFF] + ctab[g+G_CR_OFF] + ctab[b+B_CR_OFF])
+		 >> SCALEBITS);
+    }
+  }
+}
+
+
 /**************** Cases other than RGB -> YCbCr **************/
 
 
@@ -385,6 +557,28 @@ jinit_color_converter (j_compress_ptr cinfo)
       ERREXIT(cinfo, JERR_BAD_IN_COLORSPACE);
     break;
 
+  case JCS_EXT_RGB:
+  case JCS_EXT_RGBX:
+  case JCS_EXT_BGR:
+  case JCS_EXT_BGRX:
+  case JCS_EXT_XBGR:
+  case JCS_EXT_XRGB:
+    {
+      int i = cinfo->in_color_space - JCS_EXT_RGB;
+      if (cinfo->input_components != ext_rgb_pixelsize[i])
+	ERREXIT(cinfo, JERR_BAD_IN_COLORSPACE);
+      cconvert->rgb_red = ext_rgb_red[i];
+      cconvert->rgb_green = ext_rgb_green[i];
+      cconvert->rgb_blue = ext_rgb_blue[i];
+      cconvert->rgb_pixelsize = ext_rgb_pixelsize[i];
+      cconvert->use_sse2 = FALSE;
+#ifdef USE_SSE2_CONVERSION
+      if (cconvert->rgb_pixelsize == 4 && jsimd_have_sse2())
+	cconvert->use_sse2 = TRUE;
+#endif
+    }
+    break;
+
   default:			/* JCS_UNKNOWN can be anything */
     if (cinfo->input_components < 1)
       ERREXIT(cinfo, JERR_BAD_IN_COLORSPACE);
@@ -422,6 +616,9 @@ jinit_color_converter (j_compress_ptr cinfo)
     if (cinfo->in_color_space == JCS_RGB) {
       cconvert->pub.start_pass = rgb_ycc_start;
       cconvert->pub.color_convert = rgb_ycc_convert;
+    } else if (IS_EXT_RGB(cinfo->in_color_space)) {
+      cconvert->pub.start_pass = rgb_ycc_start;
+      cconvert->pub.color_convert = ext_rgb_ycc_convert;
     } else if (cinfo->in_color_space == JCS_YCbCr)
       cconvert->pub.color_convert = null_convert;
     else
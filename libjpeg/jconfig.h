@@ -31,6 +31,13 @@ typedef unsigned char boolean;
 
 #undef RIGHT_SHIFT_IS_UNSIGNED
 
+/* Use SSE2 for color conversion and downsampling in the compressor when
+ * the processor supports it (checked at run time by jsimd_have_sse2).
+ */
+#if defined(_M_IX86) || defined(_M_X64)
+#define JSIMD_SSE2_SUPPORTED
+#endif
+
 #endif /* JPEG_INTERNALS */
 
 #ifdef JPEG_CJPEG_DJPEG
@@ -324,6 +324,7 @@ struct jpeg_color_quantizer {
 #define jcopy_sample_rows	jCopySamples
 #define jcopy_block_row		jCopyBlocks
 #define jzero_far		jZeroFar
+#define jsimd_have_sse2		jSimdSSE2
 #define jpeg_zigzag_order	jZIGTable
 #define jpeg_natural_order	jZAGTable
 #define jpeg_natural_order7	jZAGTable7
@@ -382,6 +383,9 @@ EXTERN(void) jcopy_sample_rows JPP((JSAMPARRAY input_array, int source_row,
 EXTERN(void) jcopy_block_row JPP((JBLOCKROW input_row, JBLOCKROW output_row,
 				  JDIMENSION num_blocks));
 EXTERN(void) jzero_far JPP((void FAR * target, size_t bytestozero));
+#ifdef JSIMD_SSE2_SUPPORTED
+EXTERN(boolean) jsimd_have_sse2 JPP((void));
+#endif
 /* Constant tables in jutils.c */
 #if 0				/* This table is not actually needed in v6a */
 extern const int jpeg_zigzag_order[]; /* natural coef order to zigzag order */
@@ -229,3 +229,20 @@ jzero_far (void FAR * target, size_t bytestozero)
   }
 #endif
 }
+
+
+#ifdef JSIMD_SSE2_SUPPORTED
+
+GLOBAL(boolean)
+jsimd_have_sse2 (void)
+/* Check if the processor (and the OS) support SSE2 instructions. */
+{
+#ifdef _M_X64
+  return TRUE;			/* always present on x64 */
+#else
+  return IsProcessorFeaturePresent(PF_XMMI64_INSTRUCTIONS_AVAILABLE) ?
+	 TRUE : FALSE;
+#endif
+}
+
+#endif /* JSIMD_SSE2_SUPPORTED */
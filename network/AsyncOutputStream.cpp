@@ -0,0 +1,245 @@
+// Copyright (C) 2012 GlavSoft LLC.
+// All rights reserved.
+//
+//-------------------------------------------------------------------------
+// This file is part of the TightVNC software.  Please visit our Web site:
+//
+//                       http://www.tightvnc.com/
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+//-------------------------------------------------------------------------
+//
+
+#include "AsyncOutputStream.h"
+
+#include "thread/AutoLock.h"
+#include "util/DateTime.h"
+#include "util/Exception.h"
+
+#include <crtdbg.h>
+
+AsyncOutputStream::AsyncOutputStream(OutputStream *output,
+                                     unsigned int queueDepth,
+                                     unsigned int highWaterMark)
+: m_queueDepth(queueDepth),
+  m_highWaterMark(highWaterMark),
+  m_queued(0),
+  m_written(0),
+  m_failed(false)
+{
+  _ASSERT(queueDepth > 0);
+  _ASSERT(highWaterMark <= queueDepth);
+
+  m_output = new DataOutputStream(output);
+
+  m_buffers = new Buffer[m_queueDepth];
+  for (unsigned int i = 0; i < m_queueDepth; i++) {
+    m_buffers[i].data = 0;
+    m_buffers[i].length = 0;
+  }
+
+  memset(&m_stats, 0, sizeof(m_stats));
+
+  resume();
+}
+
+AsyncOutputStream::~AsyncOutputStream()
+{
+  try {
+    flush();
+  } catch (...) {
+  } // try / catch.
+
+  terminate();
+  wait();
+
+  for (unsigned int i = 0; i < m_queueDepth; i++) {
+    delete[] m_buffers[i].data;
+  }
+  delete[] m_buffers;
+  for (size_t i = 0; i < m_spareBuffers.size(); i++) {
+    delete[] m_spareBuffers[i];
+  }
+  delete m_output;
+}
+
+size_t AsyncOutputStream::write(const void *buffer, size_t len)
+{
+  checkWriterError();
+
+  const char *src = (const char *)buffer;
+  size_t left = len;
+  while (left > 0) {
+    Buffer *dst = getFreeBuffer();
+    size_t portion = min(left, BUFFER_SIZE - dst->length);
+    memcpy(dst->data + dst->length, src, portion);
+    dst->length += portion;
+    src += portion;
+    left -= portion;
+    if (dst->length == BUFFER_SIZE) {
+      queueBuffer();
+    }
+  }
+
+  AutoLock al(&m_statsLock);
+  m_stats.bytesQueued += len;
+
+  return len;
+}
+
+void AsyncOutputStream::flush()
+{
+  checkWriterError();
+
+  if (getQueueOccupancy() < m_queueDepth &&
+      m_buffers[m_queued % m_queueDepth].length != 0) {
+    queueBuffer();
+  }
+}
+
+bool AsyncOutputStream::isAboveHighWaterMark() const
+{
+  return getQueueOccupancy() >= m_highWaterMark;
+}
+
+void AsyncOutputStream::waitForDrain(DWORD milliseconds)
+{
+  m_drainEvent.waitForEvent(milliseconds);
+}
+
+void AsyncOutputStream::getStats(Stats *stats) const
+{
+  AutoLock al(&m_statsLock);
+  *stats = m_stats;
+  stats->queueOccupancy = getQueueOccupancy();
+}
+
+AsyncOutputStream::Buffer *AsyncOutputStream::getFreeBuffer()
+{
+  if (getQueueOccupancy() == m_queueDepth) {
+    DateTime stallStart = DateTime::now();
+    while (getQueueOccupancy() == m_queueDepth) {
+      m_bufferWritten.waitForEvent();
+      checkWriterError();
+    }
+    UINT64 stallTime = (DateTime::now() - stallStart).getTime();
+
+    AutoLock al(&m_statsLock);
+    m_stats.numStalls++;
+    m_stats.stallTime += stallTime;
+  }
+  Buffer *buffer = &m_buffers[m_queued % m_queueDepth];
+  if (buffer->data == 0) {
+    buffer->data = takeSpareBuffer();
+  }
+  return buffer;
+}
+
+char *AsyncOutputStream::takeSpareBuffer()
+{
+  {
+    AutoLock al(&m_spareLock);
+    if (!m_spareBuffers.empty()) {
+      char *data = m_spareBuffers.back();
+      m_spareBuffers.pop_back();
+      return data;
+    }
+  }
+  return new char[BUFFER_SIZE];
+}
+
+void AsyncOutputStream::releaseBuffer(char *data)
+{
+  {
+    AutoLock al(&m_spareLock);
+    if (m_spareBuffers.size() < m_highWaterMark) {
+      m_spareBuffers.push_back(data);
+      return;
+    }
+  }
+  delete[] data;
+}
+
+void AsyncOutputStream::queueBuffer()
+{
+  // The interlocked operation is a full memory barrier, so the writer thread
+  // sees the buffer contents as soon as it sees the new counter.
+  InterlockedIncrement(&m_queued);
+  m_bufferQueued.notify();
+
+  unsigned int occupancy = getQueueOccupancy();
+  AutoLock al(&m_statsLock);
+  if (occupancy > m_stats.maxQueueOccupancy) {
+    m_stats.maxQueueOccupancy = occupancy;
+  }
+}
+
+unsigned int AsyncOutputStream::getQueueOccupancy() const
+{
+  return (unsigned int)(m_queued - m_written);
+}
+
+void AsyncOutputStream::checkWriterError()
+{
+  if (m_failed) {
+    AutoLock al(&m_errorLock);
+    throw IOException(m_errorMessage.getString());
+  }
+}
+
+void AsyncOutputStream::execute()
+{
+  // Queued buffers are written even after terminate() to not lose the tail
+  // of the data, the loop ends when the queue is empty.
+  while (true) {
+    if (getQueueOccupancy() == 0) {
+      if (isTerminating()) {
+        break;
+      }
+      m_bufferQueued.waitForEvent();
+      continue;
+    }
+
+    Buffer *buffer = &m_buffers[m_written % m_queueDepth];
+    try {
+      m_output->writeFully(buffer->data, buffer->length);
+    } catch (Exception &e) {
+      {
+        AutoLock al(&m_errorLock);
+        m_errorMessage.setString(e.getMessage());
+      }
+      m_failed = true;
+      // Wake up the producer if it waits for a free buffer.
+      m_bufferWritten.notify();
+      m_drainEvent.notify();
+      break;
+    }
+    size_t length = buffer->length;
+    buffer->length = 0;
+    releaseBuffer(buffer->data);
+    buffer->data = 0;
+    InterlockedIncrement(&m_written);
+    m_bufferWritten.notify();
+    m_drainEvent.notify();
+
+    AutoLock al(&m_statsLock);
+    m_stats.bytesWritten += length;
+  }
+}
+
+void AsyncOutputStream::onTerminate()
+{
+  m_bufferQueued.notify();
+}
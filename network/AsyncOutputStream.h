@@ -0,0 +1,204 @@
+// Copyright (C) 2012 GlavSoft LLC.
+// All rights reserved.
+//
+//-------------------------------------------------------------------------
+// This file is part of the TightVNC software.  Please visit our Web site:
+//
+//                       http://www.tightvnc.com/
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+//-------------------------------------------------------------------------
+//
+
+#ifndef _ASYNC_OUTPUT_STREAM_H_
+#define _ASYNC_OUTPUT_STREAM_H_
+
+#include "io-lib/OutputStream.h"
+#include "io-lib/DataOutputStream.h"
+#include "thread/Thread.h"
+#include "thread/LocalMutex.h"
+#include "win-system/WindowsEvent.h"
+#include "util/StringStorage.h"
+#include "util/inttypes.h"
+
+#include <vector>
+
+/**
+ * Output stream that writes data to the real output stream in its own thread
+ * (decorator pattern).
+ *
+ * Data passed to write() is copied to a ring of buffers. A full buffer, or a
+ * partially filled one on flush(), is handed over to the writer thread which
+ * drains the ring to the real output stream. So the caller does not block in
+ * a slow send() until the ring is full.
+ *
+ * The ring is a single producer / single consumer queue synchronized by
+ * interlocked counters only. Memory of the buffers is allocated when the
+ * producer starts filling a buffer, and a written buffer is kept for reuse
+ * only while there are fewer spare ones than the high water mark. So an
+ * idle connection or one kept below the high water mark holds only a few
+ * buffers, not the whole ring.
+ * @remark write() and flush() must not be called by several threads at a
+ * time (RfbOutputGate serializes them by its lock).
+ * @remark errors of the writer thread are rethrown as IOException by the
+ * next call to write() or flush().
+ */
+class AsyncOutputStream : public OutputStream, private Thread
+{
+public:
+  /**
+   * Counters of the queue.
+   */
+  struct Stats
+  {
+    // Number of bytes passed to write().
+    UINT64 bytesQueued;
+    // Number of bytes written to the real output stream.
+    UINT64 bytesWritten;
+    // Number of buffers waiting for the writer thread now and at most.
+    unsigned int queueOccupancy;
+    unsigned int maxQueueOccupancy;
+    // Number of times write() waited for a free buffer and the total time
+    // of the waits, in milliseconds.
+    unsigned int numStalls;
+    UINT64 stallTime;
+  };
+
+  /**
+   * Creates new asynchronous output stream and starts the writer thread.
+   * @param output real output stream.
+   * @param queueDepth number of buffers in the ring.
+   * @param highWaterMark number of queued buffers starting from which
+   * isAboveHighWaterMark() returns true.
+   */
+  AsyncOutputStream(OutputStream *output,
+                    unsigned int queueDepth = DEFAULT_QUEUE_DEPTH,
+                    unsigned int highWaterMark = DEFAULT_HIGH_WATER_MARK);
+  /**
+   * Passes the rest of data to the writer thread, waits until it is written
+   * or the writer thread fails, and stops the thread.
+   */
+  virtual ~AsyncOutputStream();
+
+  /**
+   * Copies data to the queue. Blocks only if all the buffers are queued.
+   * @throws IOException if the writer thread has failed.
+   */
+  virtual size_t write(const void *buffer, size_t len) throw(IOException);
+
+  /**
+   * Passes the partially filled buffer to the writer thread. Does not wait
+   * until the data is written.
+   * @throws IOException if the writer thread has failed.
+   */
+  virtual void flush() throw(IOException);
+
+  /**
+   * Returns true if the number of queued buffers is at or above the high
+   * water mark, so the producer should not prepare new data yet.
+   * @remark thread-safe.
+   */
+  bool isAboveHighWaterMark() const;
+
+  /**
+   * Waits until the writer thread finishes writing of a buffer or the
+   * timeout elapses.
+   * @remark thread-safe.
+   */
+  void waitForDrain(DWORD milliseconds);
+
+  /**
+   * Returns the counters of the queue.
+   * @remark thread-safe.
+   */
+  void getStats(Stats *stats) const;
+
+  static const unsigned int BUFFER_SIZE = 64 * 1024;
+  static const unsigned int DEFAULT_QUEUE_DEPTH = 32;
+  static const unsigned int DEFAULT_HIGH_WATER_MARK = 8;
+
+protected:
+  virtual void execute();
+  virtual void onTerminate();
+
+private:
+  struct Buffer
+  {
+    char *data;
+    size_t length;
+  };
+
+  /**
+   * Returns the buffer being filled by the producer, waits while all the
+   * buffers are queued.
+   */
+  Buffer *getFreeBuffer();
+  /**
+   * Returns memory for a buffer, a spare one if any.
+   */
+  char *takeSpareBuffer();
+  /**
+   * Keeps memory of a written buffer for reuse or frees it.
+   */
+  void releaseBuffer(char *data);
+  /**
+   * Hands over the buffer being filled to the writer thread.
+   */
+  void queueBuffer();
+  /**
+   * Returns number of buffers handed over to but not written by the writer
+   * thread.
+   */
+  unsigned int getQueueOccupancy() const;
+  /**
+   * Throws IOException if the writer thread has failed.
+   */
+  void checkWriterError() throw(IOException);
+
+  DataOutputStream *m_output;
+
+  // The ring. Memory of a buffer is 0 while it is not being filled or
+  // written.
+  Buffer *m_buffers;
+  unsigned int m_queueDepth;
+  unsigned int m_highWaterMark;
+
+  // Memory of written buffers kept for reuse, at most m_highWaterMark.
+  std::vector<char *> m_spareBuffers;
+  LocalMutex m_spareLock;
+
+  // Number of buffers queued by the producer and written by the writer
+  // thread. Buffers are used in a ring, so the buffer with index
+  // m_queued % m_queueDepth is being filled by the producer.
+  volatile LONG m_queued;
+  volatile LONG m_written;
+
+  // Notified by the producer when a buffer is queued.
+  WindowsEvent m_bufferQueued;
+  // Notified by the writer thread when a buffer is written.
+  WindowsEvent m_bufferWritten;
+  // Notified by the writer thread when a buffer is written, for the waiters
+  // of waitForDrain().
+  WindowsEvent m_drainEvent;
+
+  volatile bool m_failed;
+  StringStorage m_errorMessage;
+  LocalMutex m_errorLock;
+
+  Stats m_stats;
+  mutable LocalMutex m_statsLock;
+};
+
+#endif
@@ -26,9 +26,14 @@
 
 #include <exception>
 
-RfbOutputGate::RfbOutputGate(OutputStream *stream)
-: DataOutputStream(0)
+RfbOutputGate::RfbOutputGate(OutputStream *stream, bool asyncWrites)
+: DataOutputStream(0),
+  m_asyncOutput(0)
 {
+  if (asyncWrites) {
+    m_asyncOutput = new AsyncOutputStream(stream);
+    stream = m_asyncOutput;
+  }
   m_tunnel = new BufferedOutputStream(stream);
 
   // Change real output stream for data output stream to our tunnel.
@@ -37,10 +42,55 @@ RfbOutputGate::RfbOutputGate(OutputStream *stream)
 
 RfbOutputGate::~RfbOutputGate()
 {
+  // The tunnel flushes its buffer on deletion, so the asynchronous writer
+  // must be deleted after it.
   delete m_tunnel;
+  if (m_asyncOutput != 0) {
+    delete m_asyncOutput;
+  }
 }
 
 void RfbOutputGate::flush()
 {
   m_tunnel->flush();
+  if (m_asyncOutput != 0) {
+    m_asyncOutput->flush();
+  }
+}
+
+UINT64 RfbOutputGate::getBytesWritten() const
+{
+  return m_tunnel->getTotalWritten();
+}
+
+UINT64 RfbOutputGate::getBytesCopied() const
+{
+  UINT64 bytesCopied = m_tunnel->getTotalCopied();
+  if (m_asyncOutput != 0) {
+    AsyncOutputStream::Stats stats;
+    m_asyncOutput->getStats(&stats);
+    bytesCopied += stats.bytesQueued;
+  }
+  return bytesCopied;
+}
+
+bool RfbOutputGate::isWriteQueueFull() const
+{
+  return m_asyncOutput != 0 && m_asyncOutput->isAboveHighWaterMark();
+}
+
+void RfbOutputGate::waitForWriteQueue(DWORD milliseconds)
+{
+  if (m_asyncOutput != 0) {
+    m_asyncOutput->waitForDrain(milliseconds);
+  }
+}
+
+bool RfbOutputGate::getWriteQueueStats(AsyncOutputStream::Stats *stats) const
+{
+  if (m_asyncOutput == 0) {
+    return false;
+  }
+  m_asyncOutput->getStats(stats);
+  return true;
 }
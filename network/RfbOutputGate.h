@@ -27,6 +27,7 @@
 
 #include "io-lib/DataOutputStream.h"
 #include "io-lib/BufferedOutputStream.h"
+#include "AsyncOutputStream.h"
 
 #include "thread/LocalMutex.h"
 
@@ -46,8 +47,11 @@ public:
   /**
    * Creates new rfb output gate.
    * @param stream real output stream.
+   * @param asyncWrites if true, data is written to the real output stream
+   * by a separate thread (see AsyncOutputStream), so flush() does not wait
+   * for the network.
    */
-  RfbOutputGate(OutputStream *stream);
+  RfbOutputGate(OutputStream *stream, bool asyncWrites = false);
   /**
    * Deletes rfb output gate.
    */
@@ -59,11 +63,49 @@ public:
    */
   virtual void flush() throw(IOException);
 
+  /**
+   * Returns total number of bytes written to the gate, including the bytes
+   * that still wait in the buffer.
+   */
+  UINT64 getBytesWritten() const;
+
+  /**
+   * Returns total number of bytes the gate has copied on their way to the
+   * real output stream (to its buffer and to the write queue).
+   */
+  UINT64 getBytesCopied() const;
+
+  /**
+   * Returns true if the gate writes asynchronously and the write queue is
+   * filled up to its high water mark.
+   * @remark thread-safe.
+   */
+  bool isWriteQueueFull() const;
+
+  /**
+   * Waits until the write queue becomes shorter or the timeout elapses.
+   * Returns immediately if the gate writes synchronously.
+   * @remark thread-safe, the gate does not need to be locked.
+   */
+  void waitForWriteQueue(DWORD milliseconds);
+
+  /**
+   * Fills stats with the counters of the write queue.
+   * @return false if the gate writes synchronously.
+   */
+  bool getWriteQueueStats(AsyncOutputStream::Stats *stats) const;
+
 private:
   /**
    * Tunnel that adds buffering.
    */
   BufferedOutputStream *m_tunnel;
+
+  /**
+   * Asynchronous writer between the tunnel and the real output stream,
+   * 0 if the gate writes synchronously.
+   */
+  AsyncOutputStream *m_asyncOutput;
 };
 
 #endif
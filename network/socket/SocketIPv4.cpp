@@ -247,6 +247,17 @@ int SocketIPv4::send(const char *data, int size, int flags)
   return result;
 }
 
+int SocketIPv4::sendVector(WSABUF *buffers, DWORD count)
+{
+  DWORD sent = 0;
+
+  if (WSASend(m_socket, buffers, count, &sent, 0, 0, 0) == SOCKET_ERROR) {
+    throw IOException(_T("Failed to send data to socket."));
+  }
+
+  return (int)sent;
+}
+
 int SocketIPv4::recv(char *buffer, int size, int flags)
 {
   int result;
@@ -118,6 +118,15 @@ public:
    * @throw IOException on error.
    */
   int send(const char *data, int size, int flags = 0) throw(IOException);
+  /**
+   * Sends several buffers to socket by a single call (gather output).
+   *
+   * @param buffers buffers to send.
+   * @param count count of buffers.
+   * @return count of sent bytes.
+   * @throw IOException on error.
+   */
+  int sendVector(WSABUF *buffers, DWORD count) throw(IOException);
   /**
    * Receives data from socket.
    *
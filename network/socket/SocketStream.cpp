@@ -57,6 +57,35 @@ size_t SocketStream::write(const void *buf, size_t size)
   return (size_t)m_socket->send((char *)buf, (int)size);
 }
 
+size_t SocketStream::writeVector(const OutputSegment *segments, size_t count)
+{
+  WSABUF buffers[MAX_SEND_SEGMENTS];
+  DWORD numBuffers = 0;
+  size_t totalLength = 0;
+  for (size_t i = 0; i < count && numBuffers < MAX_SEND_SEGMENTS; i++) {
+    if (segments[i].length == 0) {
+      continue;
+    }
+    if ((int)segments[i].length < 0 ||
+        (int)(totalLength + segments[i].length) < 0) {
+      // Let the rest be sent by the next call.
+      if (numBuffers == 0) {
+        throw IOException(_T("Size of buffer is too big."));
+      }
+      break;
+    }
+    buffers[numBuffers].buf = (char *)segments[i].data;
+    buffers[numBuffers].len = (ULONG)segments[i].length;
+    numBuffers++;
+    totalLength += segments[i].length;
+  }
+  if (numBuffers == 0) {
+    return 0;
+  }
+
+  return (size_t)m_socket->sendVector(buffers, numBuffers);
+}
+
 void SocketStream::close()
 {
   try {
@@ -47,12 +47,19 @@ public:
 
   virtual size_t write(const void *, size_t) throw(IOException);
 
+  // Sends the segments by vectored sends, at most MAX_SEND_SEGMENTS
+  // segments at a time.
+  virtual size_t writeVector(const OutputSegment *segments, size_t count)
+    throw(IOException);
+
   // Closes connection and break all blocked operation.
   // @throw Exception on error.
   virtual void close();
 
   virtual size_t available();
 
+  static const size_t MAX_SEND_SEGMENTS = 1024;
+
 protected:
   SocketIPv4 *m_socket;
 
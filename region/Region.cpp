@@ -24,45 +24,102 @@
 
 #include "Region.h"
 
+#include <algorithm>
+#include <limits.h>
+
+static bool isTopLess(const Rect &a, const Rect &b)
+{
+  return a.top < b.top;
+}
+
+static bool isLeftLess(const Rect &a, const Rect &b)
+{
+  return a.left < b.left;
+}
+
+static bool isTopAbove(const Rect &rect, int y)
+{
+  return rect.top < y;
+}
+
+static bool isBottomBelow(int y, const Rect &rect)
+{
+  return y < rect.bottom;
+}
+
+static bool overlaps(const Rect *a, const Rect *b)
+{
+  return a->left < b->right && b->left < a->right &&
+         a->top < b->bottom && b->top < a->bottom;
+}
+
+static bool contains(const Rect *outer, const Rect *inner)
+{
+  return outer->left <= inner->left && outer->right >= inner->right &&
+         outer->top <= inner->top && outer->bottom >= inner->bottom;
+}
+
 Region::Region()
+: m_rects(m_inlineRects),
+  m_numRects(0),
+  m_capacity(INLINE_CAPACITY)
 {
-  miRegionInit(&m_reg, NullBox, 0);
 }
 
-// FIXME: Make BoxRec and Rect identical to get rid of conversions.
 Region::Region(const Rect &rect)
+: m_rects(m_inlineRects),
+  m_numRects(0),
+  m_capacity(INLINE_CAPACITY)
 {
   if (!rect.isEmpty()) {
-    BoxRec box;
-    box.x1 = rect.left;
-    box.x2 = rect.right;
-    box.y1 = rect.top;
-    box.y2 = rect.bottom;
-    miRegionInit(&m_reg, &box, 0);
-  } else {
-    miRegionInit(&m_reg, NullBox, 0);
+    m_rects[0] = rect;
+    m_numRects = 1;
+    m_bounds = rect;
   }
 }
 
 Region::Region(const Region &src)
+: m_rects(m_inlineRects),
+  m_numRects(0),
+  m_capacity(INLINE_CAPACITY)
 {
-  miRegionInit(&m_reg, NullBox, 0);
   set(&src);
 }
 
+#ifdef REGION_MOVE_SEMANTICS
+Region::Region(Region &&src)
+: m_rects(m_inlineRects),
+  m_numRects(0),
+  m_capacity(INLINE_CAPACITY)
+{
+  swap(&src);
+}
+#endif
+
 Region::~Region()
 {
-  miRegionUninit(&m_reg);
+  if (m_rects != m_inlineRects) {
+    delete[] m_rects;
+  }
 }
 
 void Region::clear()
 {
-  miRegionEmpty(&m_reg);
+  // The allocated array is kept for the next use of the region.
+  m_numRects = 0;
+  m_bounds.clear();
 }
 
 void Region::set(const Region *src)
 {
-  miRegionCopy(&m_reg, (RegionPtr)&src->m_reg);
+  if (src == this) {
+    return;
+  }
+  m_numRects = 0;
+  reserve(src->m_numRects);
+  std::copy(src->m_rects, src->m_rects + src->m_numRects, m_rects);
+  m_numRects = src->m_numRects;
+  m_bounds = src->m_bounds;
 }
 
 Region & Region::operator=(const Region &src)
@@ -71,37 +128,174 @@ Region & Region::operator=(const Region &src)
   return *this;
 }
 
+#ifdef REGION_MOVE_SEMANTICS
+Region & Region::operator=(Region &&src)
+{
+  if (&src != this) {
+    clear();
+    swap(&src);
+  }
+  return *this;
+}
+#endif
+
+void Region::swap(Region *other)
+{
+  if (other == this) {
+    return;
+  }
+  std::swap_ranges(m_inlineRects, m_inlineRects + INLINE_CAPACITY,
+                   other->m_inlineRects);
+  std::swap(m_rects, other->m_rects);
+  if (m_rects == other->m_inlineRects) {
+    m_rects = m_inlineRects;
+  }
+  if (other->m_rects == m_inlineRects) {
+    other->m_rects = other->m_inlineRects;
+  }
+  std::swap(m_numRects, other->m_numRects);
+  std::swap(m_capacity, other->m_capacity);
+  std::swap(m_bounds, other->m_bounds);
+}
+
 void Region::addRect(const Rect *rect)
 {
   if (!rect->isEmpty()) {
-    Region temp(rect);
-    add(&temp);
+    if (m_numRects == 0) {
+      m_rects[0] = *rect;
+      m_numRects = 1;
+      m_bounds = *rect;
+    } else if (m_numRects != 1 || !contains(&m_rects[0], rect)) {
+      Region temp(rect);
+      add(&temp);
+    }
+  }
+}
+
+void Region::addRects(const std::vector<Rect> *rects)
+{
+  std::vector<Rect> sorted;
+  sorted.reserve(rects->size());
+  std::vector<int> edges;
+  edges.reserve(rects->size() * 2);
+  for (size_t i = 0; i < rects->size(); i++) {
+    const Rect *r = &(*rects)[i];
+    if (!r->isEmpty()) {
+      sorted.push_back(*r);
+      edges.push_back(r->top);
+      edges.push_back(r->bottom);
+    }
+  }
+  if (sorted.size() <= 1) {
+    if (!sorted.empty()) {
+      addRect(&sorted.front());
+    }
+    return;
+  }
+  std::sort(sorted.begin(), sorted.end(), isTopLess);
+  std::sort(edges.begin(), edges.end());
+  edges.erase(std::unique(edges.begin(), edges.end()), edges.end());
+
+  // Sweep from top to bottom, the rectangles crossing a slice between two
+  // consecutive edges make one band.
+  Region result;
+  result.reserve(sorted.size());
+  std::vector<Rect> active;
+  size_t prevBandStart = 0;
+  size_t next = 0;
+  for (size_t i = 0; i + 1 < edges.size(); i++) {
+    int top = edges[i];
+    int bottom = edges[i + 1];
+    size_t numActive = 0;
+    for (size_t j = 0; j < active.size(); j++) {
+      if (active[j].bottom > top) {
+        active[numActive++] = active[j];
+      }
+    }
+    active.resize(numActive);
+    for (; next < sorted.size() && sorted[next].top == top; next++) {
+      active.push_back(sorted[next]);
+    }
+    if (active.empty()) {
+      continue;
+    }
+    std::sort(active.begin(), active.end(), isLeftLess);
+    size_t bandStart = result.m_numRects;
+    for (size_t j = 0; j < active.size(); j++) {
+      result.appendSpan(bandStart, active[j].left, active[j].right,
+                        top, bottom);
+    }
+    result.coalesceBand(&prevBandStart, bandStart);
+  }
+  result.updateBounds();
+
+  if (m_numRects == 0) {
+    swap(&result);
+  } else {
+    add(&result);
   }
 }
 
 void Region::translate(int dx, int dy)
 {
-  miTranslateRegion(&m_reg, dx, dy);
+  for (size_t i = 0; i < m_numRects; i++) {
+    m_rects[i].move(dx, dy);
+  }
+  if (m_numRects != 0) {
+    m_bounds.move(dx, dy);
+  }
 }
 
 void Region::add(const Region *other)
 {
-  miUnion(&m_reg, &m_reg, (RegionPtr)&other->m_reg);
+  if (other == this || other->m_numRects == 0) {
+    return;
+  }
+  if (m_numRects == 0) {
+    set(other);
+  } else if (other->m_numRects == 1 &&
+             contains(&other->m_rects[0], &m_bounds)) {
+    set(other);
+  } else if (m_numRects != 1 || !contains(&m_rects[0], &other->m_bounds)) {
+    if (!append(other)) {
+      combine(other, UNION);
+    }
+  }
 }
 
 void Region::add(const Region &other)
 {
-  miUnion(&m_reg, &m_reg, (RegionPtr)&other.m_reg);
+  add(&other);
 }
 
 void Region::subtract(const Region *other)
 {
-  miSubtract(&m_reg, &m_reg, (RegionPtr)&other->m_reg);
+  if (m_numRects == 0 || other->m_numRects == 0 ||
+      !overlaps(&m_bounds, &other->m_bounds)) {
+    return;
+  }
+  if (other == this ||
+      (other->m_numRects == 1 && contains(&other->m_rects[0], &m_bounds))) {
+    clear();
+  } else {
+    combine(other, DIFFERENCE);
+  }
 }
 
 void Region::intersect(const Region *other)
 {
-  miIntersect(&m_reg, &m_reg, (RegionPtr)&other->m_reg);
+  if (other == this || m_numRects == 0) {
+    return;
+  }
+  if (other->m_numRects == 0 || !overlaps(&m_bounds, &other->m_bounds)) {
+    clear();
+  } else if (m_numRects == 1 && other->m_numRects == 1) {
+    m_rects[0] = m_rects[0].intersection(&other->m_rects[0]);
+    m_bounds = m_rects[0];
+  } else if (other->m_numRects != 1 ||
+             !contains(&other->m_rects[0], &m_bounds)) {
+    combine(other, INTERSECTION);
+  }
 }
 
 void Region::crop(const Rect *rect)
@@ -112,61 +306,367 @@ void Region::crop(const Rect *rect)
 
 bool Region::isEmpty() const
 {
-  return (miRegionNotEmpty((RegionPtr)&m_reg) == FALSE);
+  return m_numRects == 0;
 }
 
 bool Region::isPointInside(int x, int y) const
 {
-  BoxRec stubBox; // Ignore returning rect.
-  return !!miPointInRegion((RegionPtr)&m_reg, x, y, &stubBox);
+  if (m_numRects == 0 ||
+      x < m_bounds.left || x >= m_bounds.right ||
+      y < m_bounds.top || y >= m_bounds.bottom) {
+    return false;
+  }
+  for (size_t i = 0; i < m_numRects && m_rects[i].top <= y; i++) {
+    const Rect *r = &m_rects[i];
+    if (y < r->bottom && x >= r->left && x < r->right) {
+      return true;
+    }
+  }
+  return false;
 }
 
 bool Region::equals(const Region *other) const
 {
-  // Handle a special case when both regions are empty.
-  // Such regions may be considered different by miRegionsEqual().
-  if (this->isEmpty() && other->isEmpty()) {
-    return true;
+  // The banded form is unique, so equal regions have equal rectangles.
+  if (m_numRects != other->m_numRects) {
+    return false;
   }
-
-  return (miRegionsEqual((RegionPtr)&m_reg,
-                         (RegionPtr)&other->m_reg) == TRUE);
+  for (size_t i = 0; i < m_numRects; i++) {
+    if (!m_rects[i].isEqualTo(&other->m_rects[i])) {
+      return false;
+    }
+  }
+  return true;
 }
 
-// FIXME: Optimize, make BoxRec and Rect identical to get rid of conversions.
 void Region::getRectVector(std::vector<Rect> *dst) const
 {
-  dst->clear();
+  dst->assign(m_rects, m_rects + m_numRects);
+}
 
-  const BoxRec *boxPtr = REGION_RECTS(&m_reg);
-  long numRects = REGION_NUM_RECTS(&m_reg);
-  dst->reserve((size_t)numRects);
-  for (long i = 0; i < numRects; i++) {
-    Rect rect(boxPtr[i].x1, boxPtr[i].y1, boxPtr[i].x2, boxPtr[i].y2);
-    dst->push_back(rect);
+void Region::getRectList(std::list<Rect> *dst) const
+{
+  dst->assign(m_rects, m_rects + m_numRects);
+}
+
+size_t Region::getCount() const
+{
+  return m_numRects;
+}
+
+Rect Region::getBounds() const
+{
+  return m_bounds;
+}
+
+void Region::combine(const Region *other, Operation operation)
+{
+  // Only the bands crossing the other region may change. The bands next to
+  // them are walked too because a changed band may merge with them.
+  const Rect *begin = m_rects;
+  const Rect *end = m_rects + m_numRects;
+  const Rect *a = getBandRunEnd(begin, end, other->m_bounds.top);
+  const Rect *aEnd = std::lower_bound(a, end, other->m_bounds.bottom,
+                                      isTopAbove);
+  if (operation != INTERSECTION) {
+    if (a != begin) {
+      a = begin + getBandStart(a - begin - 1);
+    }
+    aEnd = getBandEnd(aEnd, end);
+  }
+
+  size_t start = a - begin;
+  size_t stop = aEnd - begin;
+
+  Region result;
+  result.reserve((aEnd - a) + other->m_numRects);
+  const Rect *aBandEnd = getBandEnd(a, aEnd);
+  const Rect *b = other->m_rects;
+  const Rect *bEnd = other->m_rects + other->m_numRects;
+  const Rect *bBandEnd = getBandEnd(b, bEnd);
+
+  // Walk the slices where both regions have the same spans. A slice ends
+  // where a band of either region starts or ends.
+  size_t prevBandStart = 0;
+  int y = INT_MIN;
+  while (a != aEnd || b != bEnd) {
+    if ((operation == INTERSECTION && (a == aEnd || b == bEnd)) ||
+        (operation == DIFFERENCE && a == aEnd)) {
+      break;
+    }
+    int aTop = a != aEnd ? max(a->top, y) : INT_MAX;
+    int bTop = b != bEnd ? max(b->top, y) : INT_MAX;
+    // Whole bands of one region above the next band of the other region
+    // are copied as they are.
+    if (operation != INTERSECTION && a != aEnd && a->top >= y) {
+      const Rect *run = getBandRunEnd(a, aEnd, bTop);
+      if (run != a) {
+        result.appendBands(a, run, &prevBandStart);
+        y = run[-1].bottom;
+        a = run;
+        aBandEnd = getBandEnd(a, aEnd);
+        continue;
+      }
+    }
+    if (operation == UNION && b != bEnd && b->top >= y) {
+      const Rect *run = getBandRunEnd(b, bEnd, aTop);
+      if (run != b) {
+        result.appendBands(b, run, &prevBandStart);
+        y = run[-1].bottom;
+        b = run;
+        bBandEnd = getBandEnd(b, bEnd);
+        continue;
+      }
+    }
+    int top = min(aTop, bTop);
+    bool inA = a != aEnd && aTop == top;
+    bool inB = b != bEnd && bTop == top;
+    int bottom = min(inA ? a->bottom : aTop, inB ? b->bottom : bTop);
+
+    size_t bandStart = result.m_numRects;
+    result.appendBand(operation,
+                      inA ? a : 0, inA ? aBandEnd : 0,
+                      inB ? b : 0, inB ? bBandEnd : 0,
+                      top, bottom);
+    result.coalesceBand(&prevBandStart, bandStart);
+
+    y = bottom;
+    if (inA && a->bottom == bottom) {
+      a = aBandEnd;
+      aBandEnd = getBandEnd(a, aEnd);
+    }
+    if (inB && b->bottom == bottom) {
+      b = bBandEnd;
+      bBandEnd = getBandEnd(b, bEnd);
+    }
+  }
+  if (operation == INTERSECTION) {
+    result.updateBounds();
+    swap(&result);
+    return;
+  }
+
+  // Put the result in place of the walked bands.
+  size_t tailRects = m_numRects - stop;
+  size_t numRects = start + result.m_numRects + tailRects;
+  reserve(numRects);
+  if (numRects > m_numRects) {
+    std::copy_backward(m_rects + stop, m_rects + m_numRects,
+                       m_rects + numRects);
+  } else {
+    std::copy(m_rects + stop, m_rects + m_numRects,
+              m_rects + start + result.m_numRects);
+  }
+  std::copy(result.m_rects, result.m_rects + result.m_numRects,
+            m_rects + start);
+  m_numRects = numRects;
+  if (operation == UNION) {
+    m_bounds.setRect(min(m_bounds.left, other->m_bounds.left),
+                     min(m_bounds.top, other->m_bounds.top),
+                     max(m_bounds.right, other->m_bounds.right),
+                     max(m_bounds.bottom, other->m_bounds.bottom));
+  } else {
+    updateBounds();
   }
 }
 
-// FIXME: Optimize, make BoxRec and Rect identical to get rid of conversions.
-void Region::getRectList(std::list<Rect> *dst) const
+bool Region::append(const Region *other)
 {
-  dst->clear();
+  size_t lastBandStart = getBandStart(m_numRects - 1);
+  const Rect *first = other->m_rects;
+  const Rect *end = other->m_rects + other->m_numRects;
+  if (getBandEnd(first, end) == end &&
+      first->top == m_rects[lastBandStart].top &&
+      first->bottom == m_rects[lastBandStart].bottom &&
+      first->left >= m_rects[m_numRects - 1].left) {
+    // The other region continues the last band to the right, that's what
+    // happens when tiles are added row by row.
+    for (const Rect *span = first; span != end; span++) {
+      appendSpan(lastBandStart, span->left, span->right,
+                 span->top, span->bottom);
+    }
+    if (lastBandStart != 0) {
+      size_t prevBandStart = getBandStart(lastBandStart - 1);
+      coalesceBand(&prevBandStart, lastBandStart);
+    }
+  } else if (first->top >= m_bounds.bottom) {
+    // The other region lies below this one, only its first band may merge
+    // with the last band of this region.
+    appendBands(first, end, &lastBandStart);
+  } else {
+    return false;
+  }
+  m_bounds.setRect(min(m_bounds.left, other->m_bounds.left), m_bounds.top,
+                   max(m_bounds.right, other->m_bounds.right),
+                   max(m_bounds.bottom, other->m_bounds.bottom));
+  return true;
+}
 
-  const BoxRec *boxPtr = REGION_RECTS(&m_reg);
-  long numRects = REGION_NUM_RECTS(&m_reg);
-  for (long i = 0; i < numRects; i++) {
-    Rect rect(boxPtr[i].x1, boxPtr[i].y1, boxPtr[i].x2, boxPtr[i].y2);
-    dst->push_back(rect);
+void Region::appendBand(Operation operation,
+                        const Rect *a, const Rect *aEnd,
+                        const Rect *b, const Rect *bEnd,
+                        int top, int bottom)
+{
+  size_t bandStart = m_numRects;
+  switch (operation) {
+  case UNION:
+    while (a != aEnd || b != bEnd) {
+      const Rect *span;
+      if (b == bEnd || (a != aEnd && a->left < b->left)) {
+        span = a++;
+      } else {
+        span = b++;
+      }
+      appendSpan(bandStart, span->left, span->right, top, bottom);
+    }
+    break;
+  case INTERSECTION:
+    while (a != aEnd && b != bEnd) {
+      int left = max(a->left, b->left);
+      int right = min(a->right, b->right);
+      if (left < right) {
+        pushRect(left, top, right, bottom);
+      }
+      if (a->right < b->right) {
+        a++;
+      } else {
+        b++;
+      }
+    }
+    break;
+  case DIFFERENCE:
+    for (; a != aEnd; a++) {
+      int left = a->left;
+      while (b != bEnd && b->right <= left) {
+        b++;
+      }
+      // A span of the other band may cut several spans of this band.
+      for (const Rect *cut = b;
+           cut != bEnd && cut->left < a->right && left < a->right; cut++) {
+        if (cut->left > left) {
+          pushRect(left, top, cut->left, bottom);
+        }
+        left = cut->right;
+      }
+      if (left < a->right) {
+        pushRect(left, top, a->right, bottom);
+      }
+    }
+    break;
   }
 }
 
-size_t Region::getCount() const
+void Region::appendBands(const Rect *begin, const Rect *end,
+                         size_t *prevBandStart)
 {
-  return REGION_NUM_RECTS(&m_reg);
+  reserve(m_numRects + (end - begin));
+  const Rect *firstBandEnd = getBandEnd(begin, end);
+  size_t bandStart = m_numRects;
+  std::copy(begin, firstBandEnd, m_rects + m_numRects);
+  m_numRects += firstBandEnd - begin;
+  coalesceBand(prevBandStart, bandStart);
+  if (firstBandEnd != end) {
+    std::copy(firstBandEnd, end, m_rects + m_numRects);
+    m_numRects += end - firstBandEnd;
+    *prevBandStart = getBandStart(m_numRects - 1);
+  }
 }
 
-Rect Region::getBounds() const
+void Region::appendSpan(size_t bandStart, int left, int right,
+                        int top, int bottom)
+{
+  if (m_numRects > bandStart && m_rects[m_numRects - 1].right >= left) {
+    Rect *last = &m_rects[m_numRects - 1];
+    last->right = max(last->right, right);
+  } else {
+    pushRect(left, top, right, bottom);
+  }
+}
+
+void Region::coalesceBand(size_t *prevBandStart, size_t bandStart)
+{
+  size_t numRects = m_numRects - bandStart;
+  if (numRects == 0) {
+    return;
+  }
+  if (bandStart != 0 && bandStart - *prevBandStart == numRects) {
+    Rect *prev = &m_rects[*prevBandStart];
+    Rect *band = &m_rects[bandStart];
+    if (prev->bottom == band->top) {
+      size_t i = 0;
+      while (i < numRects && prev[i].left == band[i].left &&
+             prev[i].right == band[i].right) {
+        i++;
+      }
+      if (i == numRects) {
+        for (i = 0; i < numRects; i++) {
+          prev[i].bottom = band->bottom;
+        }
+        m_numRects = bandStart;
+        return;
+      }
+    }
+  }
+  *prevBandStart = bandStart;
+}
+
+size_t Region::getBandStart(size_t index) const
+{
+  while (index != 0 && m_rects[index - 1].top == m_rects[index].top) {
+    index--;
+  }
+  return index;
+}
+
+const Rect *Region::getBandEnd(const Rect *rect, const Rect *end)
 {
-  const BoxRec *boxPtr = REGION_EXTENTS(&m_reg);
-  return Rect(boxPtr->x1, boxPtr->y1, boxPtr->x2, boxPtr->y2);
+  const Rect *bandEnd = rect;
+  while (bandEnd != end && bandEnd->top == rect->top) {
+    bandEnd++;
+  }
+  return bandEnd;
+}
+
+const Rect *Region::getBandRunEnd(const Rect *rect, const Rect *end,
+                                  int bottom)
+{
+  // Bottoms of the rectangles never decrease.
+  return std::upper_bound(rect, end, bottom, isBottomBelow);
+}
+
+void Region::pushRect(int left, int top, int right, int bottom)
+{
+  if (m_numRects == m_capacity) {
+    reserve(m_numRects + 1);
+  }
+  m_rects[m_numRects++].setRect(left, top, right, bottom);
+}
+
+void Region::reserve(size_t numRects)
+{
+  if (numRects <= m_capacity) {
+    return;
+  }
+  size_t capacity = max(numRects, m_capacity * 2);
+  Rect *rects = new Rect[capacity];
+  std::copy(m_rects, m_rects + m_numRects, rects);
+  if (m_rects != m_inlineRects) {
+    delete[] m_rects;
+  }
+  m_rects = rects;
+  m_capacity = capacity;
+}
+
+void Region::updateBounds()
+{
+  if (m_numRects == 0) {
+    m_bounds.clear();
+    return;
+  }
+  m_bounds.setRect(m_rects[0].left, m_rects[0].top,
+                   m_rects[0].right, m_rects[m_numRects - 1].bottom);
+  for (size_t i = 1; i < m_numRects; i++) {
+    m_bounds.left = min(m_bounds.left, m_rects[i].left);
+    m_bounds.right = max(m_bounds.right, m_rects[i].right);
+  }
 }
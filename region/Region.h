@@ -30,9 +30,10 @@
 
 #include "Rect.h"
 
-extern "C" {
-#include "x11region.h"
-}
+// Move constructor and move assignment need Visual C++ 2010 or C++11.
+#if (defined(_MSC_VER) && _MSC_VER >= 1600) || __cplusplus >= 201103L
+#define REGION_MOVE_SEMANTICS
+#endif
 
 /**
  * A Region is an area which can be represented by a set of rectangles with
@@ -42,6 +43,13 @@ extern "C" {
  * rectangle will not necessarily increment the number of rectangles by one.
  * On such addition, the underlying list of rectangles may change dramatically
  * and its length may increase, decrease or remain the same.
+ *
+ * The rectangles are kept in a contiguous array in the y-x banded form:
+ * they are sorted by top and then by left edges, rectangles of a band have
+ * the same top and bottom, touching rectangles of a band are merged and
+ * touching bands with the same horizontal spans are merged too. This form
+ * is unique for each area, it's the same form x11region produced. Small
+ * regions are stored inside the object without heap allocations.
  */
 class Region {
 public:
@@ -59,6 +67,13 @@ public:
    * @param rect a reference to the source region.
    */
   Region(const Region &src);
+#ifdef REGION_MOVE_SEMANTICS
+  /**
+   * Takes rectangles of another region leaving that region empty.
+   * @param src a reference to the source region.
+   */
+  Region(Region &&src);
+#endif
   /**
    * The destructor.
    */
@@ -79,12 +94,33 @@ public:
    * @param src a reference to the source region.
    */
   Region & operator=(const Region &src);
+#ifdef REGION_MOVE_SEMANTICS
+  /**
+   * Move assignment operator. Replaces this region with rectangles of
+   * another region leaving that region empty.
+   * @param src a reference to the source region.
+   */
+  Region & operator=(Region &&src);
+#endif
+  /**
+   * Exchanges contents of this region and another region without copying
+   * heap allocated rectangles.
+   * @param other a pointer to the region to swap with.
+   */
+  void swap(Region *other);
 
   /**
    * Adds a rectangle to this region.
    * @param rect rectangle to add.
    */
   void addRect(const Rect *rect);
+  /**
+   * Adds a number of rectangles to this region at once. That's much faster
+   * than adding them one by one when there are many rectangles: they are
+   * sorted and merged into bands in one pass.
+   * @param rects rectangles to add, they may overlap each other.
+   */
+  void addRects(const std::vector<Rect> *rects);
   /**
    * Adds offset to all rectangles in region.
    * @param dx horizontal offset to add.
@@ -152,10 +188,79 @@ public:
   Rect getBounds() const;
 
 private:
+  enum Operation {
+    UNION,
+    INTERSECTION,
+    DIFFERENCE
+  };
+
+  /**
+   * Replaces this region with the result of the operation on this region
+   * and another region, it walks the bands of both regions once.
+   */
+  void combine(const Region *other, Operation operation);
+  /**
+   * Adds another region when it continues the last band or lies below this
+   * region, that doesn't need walking all bands.
+   * @return false if the other region doesn't fit that cases.
+   */
+  bool append(const Region *other);
+  /**
+   * Appends a band made of the operation on the spans of two bands. A band
+   * is passed as a range of rectangles, an empty range stands for no band.
+   */
+  void appendBand(Operation operation,
+                  const Rect *a, const Rect *aEnd,
+                  const Rect *b, const Rect *bEnd,
+                  int top, int bottom);
+  /**
+   * Appends whole bands of another region, only the first of them may merge
+   * with the last band of this region.
+   */
+  void appendBands(const Rect *begin, const Rect *end,
+                   size_t *prevBandStart);
+  /**
+   * Appends a span to the band starting at bandStart, merging it with the
+   * last span of the band if they touch. Spans must come sorted by left.
+   */
+  void appendSpan(size_t bandStart, int left, int right, int top, int bottom);
+  /**
+   * Merges the band starting at bandStart with the previous band when they
+   * touch and have equal spans, otherwise makes it the previous band.
+   */
+  void coalesceBand(size_t *prevBandStart, size_t bandStart);
+  /**
+   * Returns the index of the first rectangle of the band that contains the
+   * rectangle at index.
+   */
+  size_t getBandStart(size_t index) const;
+  /**
+   * Returns the end of the band starting at rect.
+   */
+  static const Rect *getBandEnd(const Rect *rect, const Rect *end);
+  /**
+   * Returns the end of the bands starting at rect that end above bottom.
+   */
+  static const Rect *getBandRunEnd(const Rect *rect, const Rect *end,
+                                   int bottom);
+
+  void pushRect(int left, int top, int right, int bottom);
+  /**
+   * Makes room for the number of rectangles keeping the existing ones.
+   */
+  void reserve(size_t numRects);
+  void updateBounds();
+
+  static const size_t INLINE_CAPACITY = 4;
+
   /**
-   * The underlying X11 region structure.
+   * Points to m_inlineRects or to a heap allocated array.
    */
-  RegionRec m_reg;
+  Rect *m_rects;
+  size_t m_numRects;
+  size_t m_capacity;
+  Rect m_bounds;
+  Rect m_inlineRects[INLINE_CAPACITY];
 };
 
 #endif // __REGION_REGION_H_INCLUDED__
@@ -0,0 +1,70 @@
+// Copyright (C) 2012 GlavSoft LLC.
+// All rights reserved.
+//
+//-------------------------------------------------------------------------
+// This file is part of the TightVNC software.  Please visit our Web site:
+//
+//                       http://www.tightvnc.com/
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+//-------------------------------------------------------------------------
+//
+
+
+#ifndef __RFB_CONVERSION_BUFFER_H_INCLUDED__
+#define __RFB_CONVERSION_BUFFER_H_INCLUDED__
+
+#include "rfb/PixelConverter.h"
+#include "rfb/RectFrameBuffer.h"
+#include "ScratchArena.h"
+
+//
+// ConversionBuffer holds the pixels of one rectangle converted to the
+// client's pixel format. Encoders convert each rectangle into such a buffer
+// right before encoding it, so the memory needed for conversion is limited
+// by the largest rectangle instead of the whole screen. The memory is reused
+// from rectangle to rectangle and counted by the scratch arena.
+//
+// One object may be used by one thread at a time, encoders working in
+// parallel keep one buffer per task.
+//
+
+class ConversionBuffer
+{
+public:
+  ConversionBuffer();
+
+  // Attach the memory of the buffer to the arena, see ScratchArena.
+  void setArena(ScratchArena *arena);
+
+  // Convert the pixels of `rect' from `serverFb' with `conv' and return a
+  // frame buffer holding them, valid until the next call. Pixels must be
+  // read from the result with getBufferPtr() using the coordinates of
+  // serverFb, and rows are getBytesPerRow() bytes apart. If no conversion is
+  // needed, serverFb itself is returned and nothing is copied.
+  const FrameBuffer *convert(const PixelConverter *conv, const Rect *rect,
+                             const FrameBuffer *serverFb);
+
+protected:
+  ScratchBuffer m_memory;
+  RectFrameBuffer m_frameBuffer;
+
+private:
+  // Do not allow copying objects.
+  ConversionBuffer(const ConversionBuffer &other);
+  ConversionBuffer &operator=(const ConversionBuffer &other);
+};
+
+#endif // __RFB_CONVERSION_BUFFER_H_INCLUDED__
@@ -50,6 +50,9 @@ void EncodeOptions::reset()
   m_enableRichCursor = false;
   m_enablePointerPos = false;
   m_enableDesktopSize = false;
+  m_enableLastRect = false;
+  m_enableFence = false;
+  m_enableContinuousUpdates = false;
 }
 
 void EncodeOptions::setEncodings(std::vector<int> *list)
@@ -81,6 +84,12 @@ void EncodeOptions::setEncodings(std::vector<int> *list)
       m_enablePointerPos = true;
     } else if (code == PseudoEncDefs::DESKTOP_SIZE) {
       m_enableDesktopSize = true;
+    } else if (code == PseudoEncDefs::LAST_RECT) {
+      m_enableLastRect = true;
+    } else if (code == PseudoEncDefs::FENCE) {
+      m_enableFence = true;
+    } else if (code == PseudoEncDefs::CONTINUOUS_UPDATES) {
+      m_enableContinuousUpdates = true;
     } else if (code >= PseudoEncDefs::COMPR_LEVEL_0 &&
                code <= PseudoEncDefs::COMPR_LEVEL_9) {
       int level = code - PseudoEncDefs::COMPR_LEVEL_0;
@@ -136,6 +145,20 @@ void EncodeOptions::disableJpeg()
   m_jpegQualityLevel = EO_DEFAULT;
 }
 
+void EncodeOptions::limitJpegQualityLevel(int maxLevel)
+{
+  if (jpegEnabled() && m_jpegQualityLevel > maxLevel) {
+    m_jpegQualityLevel = maxLevel;
+  }
+}
+
+void EncodeOptions::raiseCompressionLevel(int minLevel)
+{
+  if (m_compressionLevel != EO_DEFAULT && m_compressionLevel < minLevel) {
+    m_compressionLevel = minLevel;
+  }
+}
+
 bool EncodeOptions::copyRectEnabled() const
 {
   return m_enableCopyRect;
@@ -156,6 +179,39 @@ bool EncodeOptions::desktopSizeEnabled() const
   return m_enableDesktopSize;
 }
 
+bool EncodeOptions::lastRectEnabled() const
+{
+  return m_enableLastRect;
+}
+
+bool EncodeOptions::fenceEnabled() const
+{
+  return m_enableFence;
+}
+
+bool EncodeOptions::continuousUpdatesEnabled() const
+{
+  return m_enableContinuousUpdates;
+}
+
+bool EncodeOptions::isEqualTo(const EncodeOptions *other) const
+{
+  return m_preferredEncoding == other->m_preferredEncoding &&
+         m_enableRRE == other->m_enableRRE &&
+         m_enableHextile == other->m_enableHextile &&
+         m_enableZrle == other->m_enableZrle &&
+         m_enableTight == other->m_enableTight &&
+         m_compressionLevel == other->m_compressionLevel &&
+         m_jpegQualityLevel == other->m_jpegQualityLevel &&
+         m_enableCopyRect == other->m_enableCopyRect &&
+         m_enableRichCursor == other->m_enableRichCursor &&
+         m_enablePointerPos == other->m_enablePointerPos &&
+         m_enableDesktopSize == other->m_enableDesktopSize &&
+         m_enableLastRect == other->m_enableLastRect &&
+         m_enableFence == other->m_enableFence &&
+         m_enableContinuousUpdates == other->m_enableContinuousUpdates;
+}
+
 bool EncodeOptions::normalEncoding(int code)
 {
   return (code == EncodingDefs::RAW ||
@@ -73,6 +73,15 @@ public:
   // Disable JPEG for lossless compression
   void disableJpeg();
 
+  // Lower the JPEG quality level to maxLevel if it's higher than that. Does
+  // nothing if JPEG is not enabled, so the result never exceeds the level
+  // requested by the client.
+  void limitJpegQualityLevel(int maxLevel);
+
+  // Raise the compression level to minLevel if it's lower than that. Does
+  // nothing if the client did not set a compression level.
+  void raiseCompressionLevel(int minLevel);
+
   //
   // Accessor functions to boolean values.
   //
@@ -81,6 +90,14 @@ public:
   bool richCursorEnabled() const;
   bool pointerPosEnabled() const;
   bool desktopSizeEnabled() const;
+  bool lastRectEnabled() const;
+  bool fenceEnabled() const;
+  bool continuousUpdatesEnabled() const;
+
+  // Return true if the other object describes exactly the same encodings,
+  // pseudo-encodings and levels, so that any encoder configured with one of
+  // the objects would produce the same data with the other one.
+  bool isEqualTo(const EncodeOptions *other) const;
 
 protected:
 
@@ -107,6 +124,9 @@ protected:
   bool m_enableRichCursor;
   bool m_enablePointerPos;
   bool m_enableDesktopSize;
+  bool m_enableLastRect;
+  bool m_enableFence;
+  bool m_enableContinuousUpdates;
 };
 
 #endif // __RFB_ENCODE_OPTIONS_H_INCLUDED__
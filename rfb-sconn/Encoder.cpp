@@ -51,19 +51,67 @@ void Encoder::sendRectangle(const Rect *rect,
                             const FrameBuffer *serverFb,
                             const EncodeOptions *options)
 {
-  const FrameBuffer *fb = m_pixelConverter->convert(rect, serverFb);
+  const FrameBuffer *fb = m_conversion.convert(m_pixelConverter, rect,
+                                               serverFb);
   int pixelSize = (int)fb->getBytesPerPixel();
   _ASSERT(pixelSize == fb->getBytesPerPixel());
 
-  UINT8 *buffer = (UINT8 *)fb->getBuffer();
   int lineWidth = rect->getWidth();
-  int fbWidth = fb->getDimension().width;
   int lineSizeInBytes = lineWidth * pixelSize;
-  int stride = fbWidth * pixelSize;
-  UINT8 *lineP = &buffer[(rect->top * fbWidth + rect->left) * pixelSize];
+  int stride = fb->getBytesPerRow();
+  UINT8 *lineP = (UINT8 *)fb->getBufferPtr(rect->left, rect->top);
 
-  // Send the rectangle as is, line by line.
-  for (int i = rect->top; i < rect->bottom; i++, lineP += stride) {
-    m_output->writeFully((char *)lineP, lineSizeInBytes);
+  // Send the rectangle as is, directly from the lines of the frame buffer
+  // (the server one if no pixel conversion is needed, otherwise the
+  // converted rectangle whose lines follow each other).
+  size_t numLines = lineSizeInBytes == stride ? 1 : rect->getHeight();
+  if (numLines == 0) {
+    return;
   }
+  m_lineSegments.resize(numLines * sizeof(OutputSegment));
+  OutputSegment *lines = (OutputSegment *)m_lineSegments.getBuffer();
+  if (lineSizeInBytes == stride) {
+    lines[0].data = lineP;
+    lines[0].length = (size_t)lineSizeInBytes * rect->getHeight();
+  } else {
+    for (size_t i = 0; i < numLines; i++, lineP += stride) {
+      lines[i].data = lineP;
+      lines[i].length = (size_t)lineSizeInBytes;
+    }
+  }
+  m_output->writeVectorFully(lines, numLines);
+}
+
+void Encoder::sendRectangles(const std::vector<Rect> *rects,
+                             const FrameBuffer *serverFb,
+                             const EncodeOptions *options)
+{
+  std::vector<Rect>::const_iterator i;
+  for (i = rects->begin(); i != rects->end(); i++) {
+    sendRectHeader(&*i);
+    sendRectangle(&*i, serverFb, options);
+  }
+}
+
+void Encoder::resetCompression()
+{
+}
+
+void Encoder::startUpdate()
+{
+}
+
+void Encoder::setScratchArena(ScratchArena *arena)
+{
+  m_conversion.setArena(arena);
+  m_lineSegments.setArena(arena);
+}
+
+void Encoder::sendRectHeader(const Rect *rect)
+{
+  m_output->writeUInt16(rect->left);
+  m_output->writeUInt16(rect->top);
+  m_output->writeUInt16(rect->getWidth());
+  m_output->writeUInt16(rect->getHeight());
+  m_output->writeInt32(getCode());
 }
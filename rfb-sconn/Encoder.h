@@ -33,6 +33,8 @@
 #include "rfb/EncodingDefs.h"
 #include "EncodeOptions.h"
 #include "rfb/PixelConverter.h"
+#include "ScratchArena.h"
+#include "ConversionBuffer.h"
 
 //
 // Encoder is the base class for all RFB encoders.
@@ -91,13 +93,49 @@ public:
   // buffer that can be in arbitrary pixel format natively used by the RFB
   // server. To get relevant pixels in the destination format (client format),
   // encoders must convert the data from *serverFb explicitly, e.g. by calling
-  // m_pixelConverter->convert().
+  // m_conversion.convert().
   virtual void sendRectangle(const Rect *rect,
                              const FrameBuffer *serverFb,
                              const EncodeOptions *options) throw(IOException);
 
+  // Encode and send a list of rectangles produced by splitRectangle(), each
+  // one preceded by its rectangle header. The default implementation just
+  // calls sendRectHeader() and sendRectangle() for each rectangle in turn.
+  // Encoders able to encode a number of rectangles in parallel may override
+  // this function, but they should send exactly the same data.
+  virtual void sendRectangles(const std::vector<Rect> *rects,
+                              const FrameBuffer *serverFb,
+                              const EncodeOptions *options) throw(IOException);
+
+  // Forget any compression state kept between rectangles, so that the data
+  // produced after this call does not depend on the data sent before it.
+  // Encoders which maintain such state must also make sure the decoder
+  // resets its own state before decoding the next rectangle. This is used
+  // when the same RFB connection starts (or stops) receiving data produced
+  // by another set of encoders. The base Encoder class keeps no state so its
+  // implementation does nothing.
+  virtual void resetCompression();
+
+  // Called before splitting the rectangles of each update. The framebuffer
+  // may have changed since the previous update, so encoders remembering
+  // what splitRectangle() has found about the pixels must forget it here,
+  // including the results for rectangles that have never been sent. The
+  // base Encoder class remembers nothing so its implementation does
+  // nothing.
+  virtual void startUpdate();
+
+  // Attach the temporary buffers of this encoder to the specified arena, so
+  // that their heap allocations are counted there. Encoders overriding this
+  // function must call the base implementation which attaches m_conversion
+  // and m_lineSegments.
+  virtual void setScratchArena(ScratchArena *arena);
+
 protected:
 
+  // Send the rectangle header (coordinates, dimensions and the encoding type
+  // returned by getCode()).
+  void sendRectHeader(const Rect *rect) throw(IOException);
+
   // PixelConverter is used for converting pixels from the given framebuffer
   // to some other pixel format (typically, the pixel format using by an RFB
   // client). Encoders may assume it will be properly configured at the moment
@@ -107,6 +145,14 @@ protected:
   // and the corresponding calls to sendRectangle().
   PixelConverter *m_pixelConverter;
 
+  // Buffer for the pixels of the rectangle being encoded, converted to the
+  // client's pixel format.
+  ConversionBuffer m_conversion;
+
+  // Segments pointing to the lines of a Raw rectangle, reused between
+  // rectangles.
+  ScratchBuffer m_lineSegments;
+
   // The output stream to write the encoded data to.
   DataOutputStream *m_output;
 
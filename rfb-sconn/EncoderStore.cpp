@@ -28,12 +28,16 @@
 #include "HextileEncoder.h"
 #include "ZrleEncoder.h"
 #include "TightEncoder.h"
+#include "server-config-lib/Configurator.h"
 
-EncoderStore::EncoderStore(PixelConverter *pixelConverter, DataOutputStream *output)
+EncoderStore::EncoderStore(PixelConverter *pixelConverter, DataOutputStream *output,
+                           ThreadPool *threadPool)
 : m_encoder(0),
   m_jpegEncoder(0),
   m_pixelConverter(pixelConverter),
-  m_output(output)
+  m_output(output),
+  m_threadPool(threadPool),
+  m_resetNewEncoders(false)
 {
 }
 
@@ -73,6 +77,35 @@ void EncoderStore::validateJpegEncoder()
   }
 }
 
+void EncoderStore::resetCompression()
+{
+  std::map<int, Encoder *>::iterator it;
+  for (it = m_map.begin(); it != m_map.end(); it++) {
+    it->second->resetCompression();
+  }
+  m_resetNewEncoders = true;
+}
+
+unsigned int EncoderStore::getNumScratchAllocations() const
+{
+  return m_scratchArena.getNumAllocations();
+}
+
+size_t EncoderStore::getScratchMemory() const
+{
+  return m_scratchArena.getNumBytes();
+}
+
+bool EncoderStore::getTightCostModelStats(TightCostModel::Stats *stats) const
+{
+  std::map<int, Encoder *>::const_iterator it = m_map.find(EncodingDefs::TIGHT);
+  if (it == m_map.end()) {
+    return false;
+  }
+  ((const TightEncoder *)it->second)->getCostModelStats(stats);
+  return true;
+}
+
 //---------------------------- Internal methods ----------------------------//
 
 Encoder *EncoderStore::validateEncoder(int encType)
@@ -88,6 +121,10 @@ Encoder *EncoderStore::validateEncoder(int encType)
   }
   // Otherwise, allocate it, store it in m_map and return the pointer to it.
   Encoder *newEncoder = allocateEncoder(encType);
+  newEncoder->setScratchArena(&m_scratchArena);
+  if (m_resetNewEncoders) {
+    newEncoder->resetCompression();
+  }
   try {
     m_map[encType] = newEncoder;
   } catch (...) {
@@ -115,9 +152,20 @@ Encoder *EncoderStore::allocateEncoder(int encType) const
 {
   switch (encType) {
   case EncodingDefs::TIGHT:
-    return new TightEncoder(m_pixelConverter, m_output);
+    {
+      TightEncoder *tight = new TightEncoder(m_pixelConverter, m_output);
+      tight->setThreadPool(m_threadPool);
+      ServerConfig *config = Configurator::getInstance()->getServerConfig();
+      tight->setAutoPolicy(config->isAutoEncodingPolicyEnabled(),
+                           config->getAutoEncodingCpuWeight());
+      return tight;
+    }
   case EncodingDefs::ZRLE:
-    return new ZrleEncoder(m_pixelConverter, m_output);
+    {
+      ZrleEncoder *zrle = new ZrleEncoder(m_pixelConverter, m_output);
+      zrle->setThreadPool(m_threadPool);
+      return zrle;
+    }
   case EncodingDefs::HEXTILE:
     return new HextileEncoder(m_pixelConverter, m_output);
   case EncodingDefs::RRE:
@@ -29,6 +29,7 @@
 
 #include "Encoder.h"
 #include "JpegEncoder.h"
+#include "TightCostModel.h"
 
 // EncoderStore is an object which allocates encoders on demand and serves
 // callers with a pointer to currectly selected encoder. The goal of
@@ -50,7 +51,10 @@ public:
   // will return 0 if called right after the object creation. The caller must
   // call selectEncoder() explicitly to allocate encoders, even if that's Raw
   // encoder (implemented in the base Encoder class).
-  EncoderStore(PixelConverter *pixelConverter, DataOutputStream *output);
+  // threadPool is passed to encoders supporting parallel encoding, it may be
+  // 0 to encode everything on the calling thread.
+  EncoderStore(PixelConverter *pixelConverter, DataOutputStream *output,
+               ThreadPool *threadPool);
   ~EncoderStore();
 
   // Get current (preferred) encoder if it was previously allocated by
@@ -63,6 +67,27 @@ public:
   void selectEncoder(int encType);
   void validateJpegEncoder();
 
+  // Reset compression state of all allocated encoders, see
+  // Encoder::resetCompression(). JpegEncoder shares its state with Tight
+  // encoder so it's covered as well. Encoders allocated after this call will
+  // be reset too, as the decoder may keep the state of their previous
+  // incarnation.
+  void resetCompression();
+
+  // Return the number of heap allocations made by the temporary buffers of
+  // all allocated encoders so far. It stops growing once the encoders have
+  // enough memory for the rectangles they get, see ScratchArena.
+  unsigned int getNumScratchAllocations() const;
+
+  // Return the number of bytes held by the temporary buffers of all
+  // allocated encoders, including the buffers for converted pixels. This is
+  // the memory used by the encoders of one client.
+  size_t getScratchMemory() const;
+
+  // Get the subencoding decisions of Tight encoder (see TightCostModel).
+  // Returns false if Tight encoder has not been allocated.
+  bool getTightCostModelStats(TightCostModel::Stats *stats) const;
+
 protected:
   // This function makes sure the specified encoder is allocated and stored in
   // m_map. If it's already there, this function returns a pointer to the
@@ -101,6 +126,15 @@ protected:
   PixelConverter *m_pixelConverter;
   // This pointer to DataOutputStream will be used to construct encoders.
   DataOutputStream *m_output;
+  // Thread pool for parallel encoding, may be 0.
+  ThreadPool *m_threadPool;
+
+  // Counts allocations of the temporary buffers used by the encoders.
+  ScratchArena m_scratchArena;
+
+  // Set by resetCompression(), makes new encoders reset their compression
+  // state right after allocation.
+  bool m_resetNewEncoders;
 
 private:
   // Do not allow copying objects.
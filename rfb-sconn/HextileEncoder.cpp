@@ -53,7 +53,8 @@ void HextileEncoder::sendRectangle(const Rect *rect,
                                    const FrameBuffer *serverFb,
                                    const EncodeOptions *options)
 {
-  const FrameBuffer *fb = m_pixelConverter->convert(rect, serverFb);
+  const FrameBuffer *fb = m_conversion.convert(m_pixelConverter, rect,
+                                               serverFb);
 
   size_t bpp = fb->getBitsPerPixel();
   if (bpp == 8) {
@@ -72,8 +73,9 @@ void HextileEncoder::hextileFunction(const Rect &r,
                                      const FrameBuffer *frameBuffer)
 {
   Rect t;
-  PIXEL_T *buf;
-  FrameBuffer fb;
+  // Pixels of the current tile without gaps between rows.
+  PIXEL_T buf[16 * 16];
+  const int fbWidth = frameBuffer->getBytesPerRow() / sizeof(PIXEL_T);
   PIXEL_T oldBg = 0, oldFg = 0;
   bool oldBgValid = false;
   bool oldFgValid = false;
@@ -89,9 +91,13 @@ void HextileEncoder::hextileFunction(const Rect &r,
 
       t.right = min(r.right, t.left + 16);
 
-      fb.setProperties(&t, &frameBuffer->getPixelFormat());
-      fb.copyFrom(frameBuffer, t.left, t.top);
-      buf = (PIXEL_T *)fb.getBuffer();
+      const int tileWidth = t.getWidth();
+      const PIXEL_T *src =
+        (const PIXEL_T *)frameBuffer->getBufferPtr(t.left, t.top);
+      for (int y = 0; y < t.getHeight(); y++) {
+        memcpy(&buf[y * tileWidth], src, tileWidth * sizeof(PIXEL_T));
+        src += fbWidth;
+      }
 
       tile.newTile(buf, t.getWidth(), t.getHeight());
       int tileType = tile.getFlags();
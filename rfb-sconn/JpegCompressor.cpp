@@ -73,8 +73,6 @@ term_destination (j_compress_ptr cinfo)
 StandardJpegCompressor::StandardJpegCompressor()
   : m_quality(-1), // make sure (m_quality != n_newQuality)
     m_newQuality(DEFAULT_JPEG_QUALITY),
-    m_outputBuffer(0),
-    m_numBytesAllocated(0),
     m_numBytesReady(0)
 {
   // Initialize JPEG compression structure.
@@ -104,10 +102,6 @@ StandardJpegCompressor::StandardJpegCompressor()
 
 StandardJpegCompressor::~StandardJpegCompressor()
 {
-  // Free compressed data buffer.
-  if (m_outputBuffer)
-    free(m_outputBuffer);
-
   // Clean up the destination manager.
   delete m_jpeg.cinfo.dest;
   m_jpeg.cinfo.dest = NULL;
@@ -148,28 +142,28 @@ void StandardJpegCompressor::outputMessage(j_common_ptr cinfo)
 void
 StandardJpegCompressor::initDestination()
 {
-  if (!m_outputBuffer) {
-    size_t newSize = ALLOC_CHUNK_SIZE;
-    m_outputBuffer = (unsigned char *)malloc(newSize);
-    m_numBytesAllocated = newSize;
-  }
+  // The buffer keeps its memory between images. For the first images, start
+  // with a guess of a quarter of a byte per pixel to make growing rare.
+  size_t expectedSize = (size_t)m_jpeg.cinfo.image_width *
+                        m_jpeg.cinfo.image_height / 4;
+  m_outputBuffer.clear();
+  m_outputBuffer.reserve(max(expectedSize, (size_t)ALLOC_CHUNK_SIZE));
 
   m_numBytesReady = 0;
-  m_jpeg.cinfo.dest->next_output_byte = m_outputBuffer;
-  m_jpeg.cinfo.dest->free_in_buffer =  m_numBytesAllocated;
+  m_jpeg.cinfo.dest->next_output_byte = m_outputBuffer.getBuffer();
+  m_jpeg.cinfo.dest->free_in_buffer = m_outputBuffer.getCapacity();
 }
 
 bool
 StandardJpegCompressor::emptyOutputBuffer()
 {
-  size_t oldSize = m_numBytesAllocated;
-  size_t newSize = oldSize + ALLOC_CHUNK_SIZE;
+  // The whole buffer is filled, keep its contents while growing.
+  size_t oldSize = m_outputBuffer.getCapacity();
+  m_outputBuffer.resize(oldSize);
+  m_outputBuffer.reserve(oldSize + ALLOC_CHUNK_SIZE);
 
-  m_outputBuffer = (unsigned char *)realloc(m_outputBuffer, newSize);
-  m_numBytesAllocated = newSize;
-
-  m_jpeg.cinfo.dest->next_output_byte = &m_outputBuffer[oldSize];
-  m_jpeg.cinfo.dest->free_in_buffer = newSize - oldSize;
+  m_jpeg.cinfo.dest->next_output_byte = m_outputBuffer.getBuffer() + oldSize;
+  m_jpeg.cinfo.dest->free_in_buffer = m_outputBuffer.getCapacity() - oldSize;
 
   return true;
 }
@@ -177,7 +171,8 @@ StandardJpegCompressor::emptyOutputBuffer()
 void
 StandardJpegCompressor::termDestination()
 {
-  m_numBytesReady = m_numBytesAllocated - m_jpeg.cinfo.dest->free_in_buffer;
+  m_numBytesReady = m_outputBuffer.getCapacity() -
+                    m_jpeg.cinfo.dest->free_in_buffer;
 }
 
 //
@@ -214,6 +209,19 @@ StandardJpegCompressor::compress(const void *buf,
     (fmt->bitsPerPixel == 32 && fmt->colorDepth == 24 &&
      fmt->redMax == 255 && fmt->greenMax == 255 && fmt->blueMax == 255);
 
+  // Pass the rows to the library as is if it knows their layout.
+  J_COLOR_SPACE colorSpace = JCS_RGB;
+  if (useQuickConversion) {
+    colorSpace = getDirectColorSpace(fmt);
+  }
+  bool useDirectInput = colorSpace != JCS_RGB;
+  if (colorSpace != m_jpeg.cinfo.in_color_space) {
+    m_jpeg.cinfo.in_color_space = colorSpace;
+    m_jpeg.cinfo.input_components = useDirectInput ? 4 : 3;
+    // Does not touch quality settings.
+    jpeg_default_colorspace(&m_jpeg.cinfo);
+  }
+
   m_jpeg.cinfo.image_width = w;
   m_jpeg.cinfo.image_height = h;
 
@@ -227,10 +235,13 @@ StandardJpegCompressor::compress(const void *buf,
   const char *src = (const char *)buf;
 
   // We'll pass up to 8 rows to jpeg_write_scanlines().
-  JSAMPLE *rgb = new JSAMPLE[w * 3 * 8];
   JSAMPROW rowPointer[8];
-  for (int i = 0; i < 8; i++)
-    rowPointer[i] = &rgb[w * 3 * i];
+  if (!useDirectInput) {
+    m_rowBuffer.reserve(w * 3 * 8 * sizeof(JSAMPLE));
+    JSAMPLE *rgb = (JSAMPLE *)m_rowBuffer.getBuffer();
+    for (int i = 0; i < 8; i++)
+      rowPointer[i] = &rgb[w * 3 * i];
+  }
 
   // Feed the pixels to the JPEG library.
   while (m_jpeg.cinfo.next_scanline < m_jpeg.cinfo.image_height) {
@@ -239,7 +250,10 @@ StandardJpegCompressor::compress(const void *buf,
       maxRows = 8;
     }
     for (int dy = 0; dy < maxRows; dy++) {
-      if (useQuickConversion) {
+      if (useDirectInput) {
+        // The library does not modify its input.
+        rowPointer[dy] = (JSAMPROW)src;
+      } else if (useQuickConversion) {
         convertRow24(rowPointer[dy], src, fmt, w);
       } else {
         convertRow(rowPointer[dy], src, fmt, w);
@@ -249,8 +263,6 @@ StandardJpegCompressor::compress(const void *buf,
     jpeg_write_scanlines(&m_jpeg.cinfo, rowPointer, maxRows);
   }
 
-  delete[] rgb;
-
   jpeg_finish_compress(&m_jpeg.cinfo);
 }
 
@@ -261,7 +273,37 @@ size_t StandardJpegCompressor::getOutputLength()
 
 const char *StandardJpegCompressor::getOutputData()
 {
-  return (const char *)m_outputBuffer;
+  return (const char *)m_outputBuffer.getBuffer();
+}
+
+void StandardJpegCompressor::setScratchArena(ScratchArena *arena)
+{
+  m_outputBuffer.setArena(arena);
+  m_rowBuffer.setArena(arena);
+}
+
+J_COLOR_SPACE
+StandardJpegCompressor::getDirectColorSpace(const PixelFormat *fmt)
+{
+  if (fmt->redShift % 8 != 0 ||
+      fmt->greenShift % 8 != 0 ||
+      fmt->blueShift % 8 != 0) {
+    return JCS_RGB;
+  }
+  // Byte offsets of the color components (the byte order is native).
+  int r = fmt->redShift / 8;
+  int g = fmt->greenShift / 8;
+  int b = fmt->blueShift / 8;
+  if (r == 0 && g == 1 && b == 2) {
+    return JCS_EXT_RGBX;
+  } else if (r == 2 && g == 1 && b == 0) {
+    return JCS_EXT_BGRX;
+  } else if (r == 3 && g == 2 && b == 1) {
+    return JCS_EXT_XBGR;
+  } else if (r == 1 && g == 2 && b == 3) {
+    return JCS_EXT_XRGB;
+  }
+  return JCS_RGB;
 }
 
 void
@@ -29,6 +29,7 @@
 
 #include "util/CommonHeader.h"
 #include "rfb/PixelFormat.h"
+#include "ScratchArena.h"
 
 // For Windows platforms only.
 // For using libjpeg for encoding go to Property Pages of tvnserver -> Linker -> Input -> Additional Dependencies
@@ -95,6 +96,9 @@ public:
   virtual size_t getOutputLength();
   virtual const char *getOutputData();
 
+  // Attach the internal buffers to the arena, see ScratchArena.
+  void setScratchArena(ScratchArena *arena);
+
 public:
   // Our implementation of JPEG destination manager. These three
   // functions should never be called directly. They are made public
@@ -111,10 +115,19 @@ protected:
   int m_quality;
   int m_newQuality;
 
-  unsigned char *m_outputBuffer;
-  size_t m_numBytesAllocated;
+  // Compressed data, all allocated bytes are available to the library.
+  ScratchBuffer m_outputBuffer;
   size_t m_numBytesReady;
 
+  // Up to 8 rows converted for the library, reused between calls.
+  ScratchBuffer m_rowBuffer;
+
+  // Return the extended input color space of the JPEG library matching the
+  // layout of 32-bit pixels in the specified format with 8-bit color
+  // components, or JCS_RGB if there is no such color space. In the former
+  // case, rows of pixels can be given to the library without conversion.
+  static J_COLOR_SPACE getDirectColorSpace(const PixelFormat *fmt);
+
   // Convert one row (scanline) from the specified pixel format to the format
   // supported by the IJG JPEG library (one byte per one color component).
   void convertRow(JSAMPLE *dst, const void *src,
@@ -54,14 +54,23 @@ void JpegEncoder::splitRectangle(const Rect *rect,
 void JpegEncoder::sendRectangle(const Rect *rect,
                                 const FrameBuffer *serverFb,
                                 const EncodeOptions *options)
+{
+  m_tightEncoder->sendRect(rect, serverFb, options, shouldForceJpeg(options));
+}
+
+void JpegEncoder::sendRectangles(const std::vector<Rect> *rects,
+                                 const FrameBuffer *serverFb,
+                                 const EncodeOptions *options)
+{
+  m_tightEncoder->sendRects(rects, serverFb, options,
+                            shouldForceJpeg(options));
+}
+
+bool JpegEncoder::shouldForceJpeg(const EncodeOptions *options) const
 {
   size_t bppServer = m_pixelConverter->getSrcBitsPerPixel();
   size_t bppClient = m_pixelConverter->getDstBitsPerPixel();
   bool goodColorResolution = (bppServer >= 16 && bppClient >= 16);
 
-  if (options->jpegEnabled() && goodColorResolution) {
-    m_tightEncoder->sendJpegRect(rect, serverFb, options);
-  } else {
-    m_tightEncoder->sendRectangle(rect, serverFb, options);
-  }
+  return options->jpegEnabled() && goodColorResolution;
 }
@@ -53,7 +53,16 @@ public:
                              const FrameBuffer *serverFb,
                              const EncodeOptions *options);
 
+  // Same as above for a list of rectangles, may use parallel encoding of
+  // the TightEncoder (see TightEncoder::sendRectangles()).
+  virtual void sendRectangles(const std::vector<Rect> *rects,
+                              const FrameBuffer *serverFb,
+                              const EncodeOptions *options);
+
 protected:
+  // Return true if JPEG sub-encoding should be forced (see sendRectangle()).
+  bool shouldForceJpeg(const EncodeOptions *options) const;
+
   TightEncoder *m_tightEncoder;
 };
 
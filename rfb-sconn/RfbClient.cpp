@@ -40,6 +40,9 @@ RfbClient::RfbClient(NewConnectionEvents *newConnectionEvents,
                      const ViewPortState *constViewPort,
                      const ViewPortState *dynViewPort,
                      int idleTimeout,
+                     DamageJournal *journal,
+                     EncodeGroupManager *encodeGroups,
+                     ThreadPool *encoderPool,
                      LogWriter *log)
 : m_socket(socket), // now we own the socket
   m_newConnectionEvents(newConnectionEvents),
@@ -59,6 +62,9 @@ RfbClient::RfbClient(NewConnectionEvents *newConnectionEvents,
   m_constViewPort(constViewPort, log),
   m_dynamicViewPort(dynViewPort, log),
   m_idleTimer(idleTimeout), m_idleTimeout(idleTimeout),
+  m_journal(journal),
+  m_encodeGroups(encodeGroups),
+  m_encoderPool(encoderPool),
   m_log(log)
 {
   resume();
@@ -180,7 +186,7 @@ void RfbClient::execute()
 
   SocketStream sockStream(m_socket);
 
-  RfbOutputGate output(&sockStream);
+  RfbOutputGate output(&sockStream, config->isAsyncNetworkWritesEnabled());
   BufferedInputStream bufInput(&sockStream);
   RfbInputGate input(&bufInput);
 
@@ -225,7 +231,9 @@ void RfbClient::execute()
     // Init modules
     // UpdateSender initialization
     m_updateSender = new UpdateSender(&codeRegtor, m_desktop, this,
-                                      &output, m_id, m_desktop, m_log);
+                                      &output, m_id, m_desktop, m_journal,
+                                      m_encodeGroups, m_encoderPool,
+                                      m_log);
     m_log->debug(_T("UpdateSender has been created for client #%d"), m_id);
     PixelFormat pf;
     Dimension fbDim;
@@ -291,10 +299,9 @@ void RfbClient::execute()
   notifyAbStateChanging(IN_READY_TO_REMOVE);
 }
 
-void RfbClient::sendUpdate(const UpdateContainer *updateContainer,
-                           const CursorShape *cursorShape)
+void RfbClient::sendUpdate(const CursorShape *cursorShape)
 {
-  m_updateSender->newUpdates(updateContainer, cursorShape);
+  m_updateSender->newUpdates(cursorShape);
 
   if (m_idleTimeout != 0  && m_idleTimer.isElapsed()) {
     m_log->error(_T("Connection will be closed due to client inactivity. IdleTimeout = %d ms"), m_idleTimeout);
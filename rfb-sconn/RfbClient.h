@@ -32,6 +32,7 @@
 #include "network/RfbOutputGate.h"
 #include "desktop/Desktop.h"
 #include "fb-update-sender/UpdateSender.h"
+#include "fb-update-sender/EncodeGroupManager.h"
 #include "log-writer/LogWriter.h"
 
 #include "RfbDispatcher.h"
@@ -65,6 +66,9 @@ public:
             const ViewPortState *constViewPort,
             const ViewPortState *dynViewPort,
             int idleTimeout,
+            DamageJournal *journal,
+            EncodeGroupManager *encodeGroups,
+            ThreadPool *encoderPool,
             LogWriter *log);
   virtual ~RfbClient();
 
@@ -90,8 +94,8 @@ public:
   void changeDynViewPort(const ViewPortState *dynViewPort);
 
   bool clientIsReady() const { return m_updateSender->clientIsReady(); }
-  void sendUpdate(const UpdateContainer *updateContainer,
-                  const CursorShape *cursorShape);
+  // Tells the client about new updates in the journal.
+  void sendUpdate(const CursorShape *cursorShape);
   void sendClipboard(const StringStorage *newClipboard);
 
 protected:
@@ -152,6 +156,13 @@ private:
   // and resets on mouse or keyboard event
   DemandTimer m_idleTimer;
   int m_idleTimeout;
+
+  // Journal of the desktop updates shared by all clients.
+  DamageJournal *m_journal;
+  // Shared encoder pipelines, may be 0 if encode groups are disabled.
+  EncodeGroupManager *m_encodeGroups;
+  // Thread pool for parallel encoding, may be 0.
+  ThreadPool *m_encoderPool;
 };
 
 #endif // __RFBCLIENT_H__
@@ -0,0 +1,119 @@
+// Copyright (C) 2012 GlavSoft LLC.
+// All rights reserved.
+//
+//-------------------------------------------------------------------------
+// This file is part of the TightVNC software.  Please visit our Web site:
+//
+//                       http://www.tightvnc.com/
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+//-------------------------------------------------------------------------
+//
+
+#include "ScratchArena.h"
+
+#include <string.h>
+
+ScratchArena::ScratchArena()
+: m_numAllocations(0),
+  m_numBytes(0)
+{
+}
+
+unsigned int ScratchArena::getNumAllocations() const
+{
+  return (unsigned int)m_numAllocations;
+}
+
+size_t ScratchArena::getNumBytes() const
+{
+  return (size_t)m_numBytes;
+}
+
+void ScratchArena::countAllocation()
+{
+  InterlockedIncrement(&m_numAllocations);
+}
+
+void ScratchArena::addBytes(LONG delta)
+{
+  InterlockedExchangeAdd(&m_numBytes, delta);
+}
+
+//--------------------------------------------------------------------------//
+
+ScratchBuffer::ScratchBuffer()
+: m_buffer(0),
+  m_size(0),
+  m_capacity(0),
+  m_arena(0)
+{
+}
+
+ScratchBuffer::~ScratchBuffer()
+{
+  if (m_arena != 0) {
+    m_arena->addBytes(-(LONG)m_capacity);
+  }
+  delete[] m_buffer;
+}
+
+void ScratchBuffer::setArena(ScratchArena *arena)
+{
+  // Move the memory already allocated to the new arena.
+  if (m_arena != 0) {
+    m_arena->addBytes(-(LONG)m_capacity);
+  }
+  m_arena = arena;
+  if (m_arena != 0) {
+    m_arena->addBytes((LONG)m_capacity);
+  }
+}
+
+void ScratchBuffer::reserve(size_t capacity)
+{
+  if (capacity > m_capacity) {
+    grow(capacity);
+  }
+}
+
+void ScratchBuffer::append(const void *data, size_t length)
+{
+  size_t oldSize = m_size;
+  resize(m_size + length);
+  memcpy(m_buffer + oldSize, data, length);
+}
+
+void ScratchBuffer::grow(size_t minCapacity)
+{
+  // Grow at least twice to keep the number of reallocations small when the
+  // buffer is filled byte by byte.
+  size_t newCapacity = max(minCapacity, m_capacity * 2);
+  if (newCapacity < 256) {
+    newCapacity = 256;
+  }
+  UINT8 *newBuffer = new UINT8[newCapacity];
+  if (m_size != 0) {
+    memcpy(newBuffer, m_buffer, m_size);
+  }
+  delete[] m_buffer;
+  m_buffer = newBuffer;
+
+  if (m_arena != 0) {
+    m_arena->countAllocation();
+    m_arena->addBytes((LONG)(newCapacity - m_capacity));
+  }
+  m_capacity = newCapacity;
+}
@@ -0,0 +1,149 @@
+// Copyright (C) 2012 GlavSoft LLC.
+// All rights reserved.
+//
+//-------------------------------------------------------------------------
+// This file is part of the TightVNC software.  Please visit our Web site:
+//
+//                       http://www.tightvnc.com/
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+//-------------------------------------------------------------------------
+//
+
+#ifndef __RFB_SCRATCH_ARENA_H_INCLUDED__
+#define __RFB_SCRATCH_ARENA_H_INCLUDED__
+
+#include "util/CommonHeader.h"
+
+//
+// ScratchArena keeps track of the temporary memory used by the encoders of
+// one client. The memory itself is held by ScratchBuffer objects attached to
+// the arena. A buffer grows when a request does not fit into its memory and
+// never shrinks, so as soon as the encoders have seen the largest rectangles
+// no more heap allocations happen while encoding. Each growth of an
+// attached buffer is counted by the arena, which makes it easy to check that
+// encoding has reached such a steady state. The arena also sums up the
+// memory held by the attached buffers, which is the memory used by the
+// encoders of the client on top of the shared server frame buffer.
+//
+// Buffers may be used from different threads, the counters are updated
+// atomically.
+//
+
+class ScratchArena
+{
+public:
+  ScratchArena();
+
+  // Return the number of heap allocations made by all attached buffers
+  // since the arena was created.
+  unsigned int getNumAllocations() const;
+
+  // Return the number of bytes currently allocated by all attached buffers.
+  size_t getNumBytes() const;
+
+protected:
+  friend class ScratchBuffer;
+
+  void countAllocation();
+  void addBytes(LONG delta);
+
+  volatile LONG m_numAllocations;
+  volatile LONG m_numBytes;
+};
+
+//
+// ScratchBuffer is a growable byte array reused between rectangles. It has
+// a size (the number of bytes in use) and a capacity (the number of bytes
+// allocated). Clearing or shrinking the buffer only changes its size.
+//
+
+class ScratchBuffer
+{
+public:
+  ScratchBuffer();
+  ~ScratchBuffer();
+
+  // Attach the buffer to an arena which will count its allocations and
+  // memory, may be 0 to stop counting.
+  void setArena(ScratchArena *arena);
+
+  // Make sure at least capacity bytes are allocated. The bytes in use are
+  // preserved.
+  void reserve(size_t capacity);
+
+  // Change the number of bytes in use, growing the memory if needed. The
+  // bytes in use are preserved, new bytes are not initialized.
+  inline void resize(size_t size) {
+    if (size > m_capacity) {
+      grow(size);
+    }
+    m_size = size;
+  }
+
+  // Append one byte.
+  inline void append(UINT8 value) {
+    if (m_size == m_capacity) {
+      grow(m_size + 1);
+    }
+    m_buffer[m_size++] = value;
+  }
+
+  // Append length bytes copied from data.
+  void append(const void *data, size_t length);
+
+  inline void clear() {
+    m_size = 0;
+  }
+
+  inline size_t getSize() const {
+    return m_size;
+  }
+
+  inline bool isEmpty() const {
+    return m_size == 0;
+  }
+
+  // Return the number of bytes allocated.
+  inline size_t getCapacity() const {
+    return m_capacity;
+  }
+
+  // Return a pointer to the memory, it may change on growth.
+  inline UINT8 *getBuffer() const {
+    return m_buffer;
+  }
+
+  inline UINT8 &operator[](size_t i) {
+    return m_buffer[i];
+  }
+
+protected:
+  // Reallocate the memory so that it can hold at least minCapacity bytes.
+  void grow(size_t minCapacity);
+
+  UINT8 *m_buffer;
+  size_t m_size;
+  size_t m_capacity;
+
+  ScratchArena *m_arena;
+
+private:
+  // Do not allow copying objects.
+  ScratchBuffer(const ScratchBuffer &other);
+  ScratchBuffer &operator=(const ScratchBuffer &other);
+};
+
+#endif // __RFB_SCRATCH_ARENA_H_INCLUDED__
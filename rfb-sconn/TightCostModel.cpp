@@ -0,0 +1,179 @@
+// Copyright (C) 2012 GlavSoft LLC.
+// All rights reserved.
+//
+//-------------------------------------------------------------------------
+// This file is part of the TightVNC software.  Please visit our Web site:
+//
+//                       http://www.tightvnc.com/
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+//-------------------------------------------------------------------------
+//
+
+
+#include "TightCostModel.h"
+#include "thread/AutoLock.h"
+
+const double TightCostModel::LEARNING_RATE = 0.125;
+
+TightRectFeatures::TightRectFeatures()
+: numSamples(0),
+  numRuns(0),
+  gradientEnergy(0)
+{
+}
+
+TightCostModel::Stats::Stats()
+: numSelected(0),
+  predictedBytes(0),
+  actualBytes(0),
+  selectedPixels(0)
+{
+  for (int i = 0; i < NUM_CANDIDATES; i++) {
+    numRects[i] = 0;
+  }
+}
+
+TightCostModel::TightCostModel()
+: m_cpuWeight(50)
+{
+  // Initial estimates. The compressed size of zlib data grows with the
+  // density of runs (class c covers densities around 2^c / 256), JPEG data
+  // grows with the gradient energy.
+  for (int c = 0; c < NUM_CLASSES; c++) {
+    double runDensity = (double)(1 << c) / 256.0;
+    m_ratio[INDEXED][c] = min(1.0, 0.02 + 2.0 * runDensity);
+    m_ratio[FULL_COLOR][c] = min(1.0, 0.02 + 0.8 * runDensity);
+    m_ratio[JPEG][c] = 0.02 * (c + 1);
+    m_ratio[SOLID][c] = 0.0;
+    m_ratio[MONO][c] = 0.0;
+  }
+  m_timePerPixel[SOLID] = 0.0;
+  m_timePerPixel[MONO] = 0.002;
+  m_timePerPixel[INDEXED] = 0.004;
+  m_timePerPixel[FULL_COLOR] = 0.012;
+  m_timePerPixel[JPEG] = 0.02;
+}
+
+TightCostModel::~TightCostModel()
+{
+}
+
+void TightCostModel::setCpuWeight(unsigned int cpuWeight)
+{
+  AutoLock al(&m_lock);
+  m_cpuWeight = min(cpuWeight, 100U);
+}
+
+TightCostModel::Candidate
+TightCostModel::choose(const TightRectFeatures *features,
+                       const bool allowed[NUM_CANDIDATES],
+                       const size_t rawSizes[NUM_CANDIDATES],
+                       int area,
+                       size_t *predictedSize) const
+{
+  AutoLock al(&m_lock);
+
+  Candidate best = FULL_COLOR;
+  double bestCost = 0.0;
+  bool found = false;
+  for (int i = INDEXED; i < NUM_CANDIDATES; i++) {
+    if (!allowed[i]) {
+      continue;
+    }
+    Candidate candidate = (Candidate)i;
+    double size = rawSizes[i] * m_ratio[i][getClass(candidate, features)];
+    double time = m_timePerPixel[i] * area;
+    double cost = (100 - m_cpuWeight) * size +
+                  m_cpuWeight * time * BYTES_PER_MICROSECOND;
+    if (!found || cost < bestCost) {
+      found = true;
+      best = candidate;
+      bestCost = cost;
+      *predictedSize = (size_t)size;
+    }
+  }
+  return best;
+}
+
+void TightCostModel::learn(Candidate candidate,
+                           const TightRectFeatures *features,
+                           size_t rawSize, size_t predictedSize,
+                           size_t actualSize, double time, int area)
+{
+  if (rawSize == 0 || area <= 0) {
+    return;
+  }
+
+  AutoLock al(&m_lock);
+
+  double *ratio = &m_ratio[candidate][getClass(candidate, features)];
+  *ratio += ((double)actualSize / rawSize - *ratio) * LEARNING_RATE;
+  if (time > 0.0) {
+    double *timePerPixel = &m_timePerPixel[candidate];
+    *timePerPixel += (time / area - *timePerPixel) * LEARNING_RATE;
+  }
+
+  m_stats.numSelected++;
+  m_stats.predictedBytes += predictedSize;
+  m_stats.actualBytes += actualSize;
+  m_stats.selectedPixels += area;
+}
+
+void TightCostModel::countRect(Candidate candidate)
+{
+  AutoLock al(&m_lock);
+  m_stats.numRects[candidate]++;
+}
+
+void TightCostModel::getStats(Stats *stats) const
+{
+  AutoLock al(&m_lock);
+  *stats = m_stats;
+}
+
+double TightCostModel::getTimeStamp()
+{
+  LARGE_INTEGER frequency;
+  LARGE_INTEGER counter;
+  if (!QueryPerformanceFrequency(&frequency) ||
+      !QueryPerformanceCounter(&counter)) {
+    return 0.0;
+  }
+  return (double)counter.QuadPart * 1000000.0 / (double)frequency.QuadPart;
+}
+
+int TightCostModel::getClass(Candidate candidate,
+                             const TightRectFeatures *features)
+{
+  if (features->numSamples == 0) {
+    return NUM_CLASSES - 1;
+  }
+  // Both measures are mapped to classes logarithmically.
+  UINT32 value;
+  if (candidate == JPEG) {
+    // Average gradient per pixel, 0..765.
+    value = features->gradientEnergy / features->numSamples;
+  } else {
+    // Run density scaled to 0..256.
+    value = (UINT32)(((UINT64)features->numRuns << 8) / features->numSamples);
+  }
+  int c = 0;
+  while (value > 1 && c < NUM_CLASSES - 1) {
+    value >>= 1;
+    c++;
+  }
+  return c;
+}
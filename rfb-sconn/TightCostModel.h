@@ -0,0 +1,155 @@
+// Copyright (C) 2012 GlavSoft LLC.
+// All rights reserved.
+//
+//-------------------------------------------------------------------------
+// This file is part of the TightVNC software.  Please visit our Web site:
+//
+//                       http://www.tightvnc.com/
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+//-------------------------------------------------------------------------
+//
+
+
+#ifndef __RFB_TIGHT_COST_MODEL_H_INCLUDED__
+#define __RFB_TIGHT_COST_MODEL_H_INCLUDED__
+
+#include "util/CommonHeader.h"
+#include "util/inttypes.h"
+#include "thread/LocalMutex.h"
+
+//
+// Cheap statistics of rectangle pixels used to estimate how well different
+// Tight subencodings would compress the rectangle. Only every few rows are
+// sampled.
+//
+
+struct TightRectFeatures
+{
+  TightRectFeatures();
+
+  // The number of sampled pixels.
+  int numSamples;
+  // The number of runs of equal pixels among the sampled pixels.
+  int numRuns;
+  // Sum of absolute differences of color components (scaled to 0..255)
+  // between neighbouring sampled pixels.
+  UINT32 gradientEnergy;
+};
+
+//
+// TightCostModel selects a Tight subencoding for a rectangle that can be
+// encoded in several ways. For each candidate it estimates the size of the
+// encoded data and the time needed to encode it, and picks the one with the
+// lowest weighted cost. The weight of the CPU time relative to the output
+// size is configurable.
+//
+// Estimates start from built-in defaults and are learned online from the
+// actual results: the compression ratio is kept per candidate and per class
+// of rectangle complexity (run density for zlib, gradient energy for JPEG),
+// the time is kept per candidate and per pixel.
+//
+// All functions are thread-safe.
+//
+
+class TightCostModel
+{
+public:
+  // Subencodings known to the model. Only INDEXED, FULL_COLOR and JPEG are
+  // selected by the model, the others are counted in statistics.
+  enum Candidate {
+    SOLID,
+    MONO,
+    INDEXED,
+    FULL_COLOR,
+    JPEG,
+    NUM_CANDIDATES
+  };
+
+  struct Stats
+  {
+    Stats();
+
+    // The number of rectangles sent with each subencoding.
+    unsigned int numRects[NUM_CANDIDATES];
+    // The number of rectangles where the subencoding was selected by the
+    // model, and the sums of the predicted and actual sizes of their data.
+    unsigned int numSelected;
+    UINT64 predictedBytes;
+    UINT64 actualBytes;
+    // The number of pixels in the rectangles selected by the model.
+    UINT64 selectedPixels;
+  };
+
+  TightCostModel();
+  virtual ~TightCostModel();
+
+  // Set the weight of the CPU time in percents. Zero means the smallest
+  // output is selected regardless of time, 100 means the fastest encoding is
+  // selected regardless of size.
+  void setCpuWeight(unsigned int cpuWeight);
+
+  // Choose the cheapest of the allowed candidates for a rectangle of the
+  // given area. rawSizes contains the size of the data of each candidate
+  // before compression. The estimated size of the compressed data is stored
+  // in *predictedSize.
+  Candidate choose(const TightRectFeatures *features,
+                   const bool allowed[NUM_CANDIDATES],
+                   const size_t rawSizes[NUM_CANDIDATES],
+                   int area,
+                   size_t *predictedSize) const;
+
+  // Update the estimates with the actual result of encoding a rectangle
+  // selected by choose(). time is in microseconds.
+  void learn(Candidate candidate, const TightRectFeatures *features,
+             size_t rawSize, size_t predictedSize, size_t actualSize,
+             double time, int area);
+
+  // Count a rectangle sent with the given subencoding.
+  void countRect(Candidate candidate);
+
+  void getStats(Stats *stats) const;
+
+  // Return a time stamp in microseconds for measuring intervals.
+  static double getTimeStamp();
+
+protected:
+  // Return the index of the complexity class of the rectangle for the
+  // candidate.
+  static int getClass(Candidate candidate, const TightRectFeatures *features);
+
+  static const int NUM_CLASSES = 8;
+
+  // CPU time of one microsecond is considered equal to that many bytes of
+  // output when both weights are equal.
+  static const int BYTES_PER_MICROSECOND = 10;
+
+  // Estimates are exponential moving averages with this weight of a new
+  // value.
+  static const double LEARNING_RATE;
+
+  // Compressed size divided by raw size.
+  double m_ratio[NUM_CANDIDATES][NUM_CLASSES];
+  // Encoding time per pixel, in microseconds.
+  double m_timePerPixel[NUM_CANDIDATES];
+
+  unsigned int m_cpuWeight;
+
+  Stats m_stats;
+
+  mutable LocalMutex m_lock;
+};
+
+#endif // __RFB_TIGHT_COST_MODEL_H_INCLUDED__
@@ -23,11 +23,51 @@
 //
 
 #include "TightEncoder.h"
+#include "TightSimd.h"
+
+TightEncoder::RectTask::RectTask(TightEncoder *encoder)
+: serverFb(0),
+  options(0),
+  forceJpeg(false),
+  knownSolid(false),
+  clientFb(0),
+  control(0),
+  zlibStreamId(-1),
+  zlibLevel(0),
+  costSelected(false),
+  rawSize(0),
+  predictedSize(0),
+  prepareTime(0.0),
+  outputReferenced(false),
+  m_encoder(encoder)
+{
+}
+
+TightEncoder::RectTask::~RectTask()
+{
+}
 
-#include "io-lib/ByteArrayOutputStream.h"
+void TightEncoder::RectTask::run()
+{
+  m_encoder->prepareRect(this);
+}
+
+void TightEncoder::RectTask::setScratchArena(ScratchArena *arena)
+{
+  header.setArena(arena);
+  zlibData.setArena(arena);
+  conversion.setArena(arena);
+  compressor.setScratchArena(arena);
+}
 
 TightEncoder::TightEncoder(PixelConverter *conv, DataOutputStream *output)
-: Encoder(conv, output)
+: Encoder(conv, output),
+  m_streamsToReset(0),
+  m_serialTask(this),
+  m_threadPool(0),
+  m_autoPolicy(false),
+  m_gatheredSize(0),
+  m_scratchArena(0)
 {
   for (int i = 0; i < NUM_ZLIB_STREAMS; i++) {
     m_zsActive[i] = false;
@@ -41,6 +81,9 @@ TightEncoder::~TightEncoder()
       deflateEnd(&m_zsStruct[i]);
     }
   }
+  for (size_t i = 0; i < m_tasks.size(); i++) {
+    delete m_tasks[i];
+  }
 }
 
 int TightEncoder::getCode() const
@@ -52,6 +95,87 @@ void TightEncoder::splitRectangle(const Rect *rect,
                                   std::vector<Rect> *rectList,
                                   const FrameBuffer *serverFb,
                                   const EncodeOptions *options)
+{
+  if (rect->area() >= MIN_SPLIT_RECT_SIZE) {
+    switch (serverFb->getBitsPerPixel()) {
+    case 8:
+      splitWithSolidArea<UINT8>(rect, rectList, serverFb, options);
+      return;
+    case 16:
+      splitWithSolidArea<UINT16>(rect, rectList, serverFb, options);
+      return;
+    case 32:
+      splitWithSolidArea<UINT32>(rect, rectList, serverFb, options);
+      return;
+    }
+  }
+  splitRectangleSimple(rect, rectList, options);
+}
+
+void TightEncoder::sendRectangle(const Rect *rect,
+                                 const FrameBuffer *serverFb,
+                                 const EncodeOptions *options)
+{
+  sendRect(rect, serverFb, options, false);
+}
+
+void TightEncoder::sendRectangles(const std::vector<Rect> *rects,
+                                  const FrameBuffer *serverFb,
+                                  const EncodeOptions *options)
+{
+  sendRects(rects, serverFb, options, false);
+}
+
+void TightEncoder::startUpdate()
+{
+  m_solidRects.clear();
+}
+
+void TightEncoder::resetCompression()
+{
+  for (int i = 0; i < NUM_ZLIB_STREAMS; i++) {
+    if (m_zsActive[i]) {
+      deflateEnd(&m_zsStruct[i]);
+      m_zsActive[i] = false;
+    }
+    // The decoder may have used a stream we have never initialized, so ask
+    // it to reset all of them.
+    m_streamsToReset |= 1 << i;
+  }
+}
+
+void TightEncoder::setThreadPool(ThreadPool *threadPool)
+{
+  m_threadPool = threadPool;
+}
+
+void TightEncoder::setScratchArena(ScratchArena *arena)
+{
+  Encoder::setScratchArena(arena);
+  m_scratchArena = arena;
+  m_gathered.setArena(arena);
+  m_serialTask.setScratchArena(arena);
+  for (size_t i = 0; i < m_tasks.size(); i++) {
+    m_tasks[i]->setScratchArena(arena);
+  }
+}
+
+void TightEncoder::setAutoPolicy(bool enabled, unsigned int cpuWeight)
+{
+  m_autoPolicy = enabled;
+  m_costModel.setCpuWeight(cpuWeight);
+}
+
+void TightEncoder::getCostModelStats(TightCostModel::Stats *stats) const
+{
+  m_costModel.getStats(stats);
+}
+
+//--------------------------------------------------------------------------//
+
+void TightEncoder::splitRectangleSimple(const Rect *rect,
+                                        std::vector<Rect> *rectList,
+                                        const EncodeOptions *options)
 {
   int maxSize = getConf(options).maxRectSize;
   int rectWidth = rect->getWidth();
@@ -79,42 +203,422 @@ void TightEncoder::splitRectangle(const Rect *rect,
   }
 }
 
-void TightEncoder::sendRectangle(const Rect *rect,
-                                 const FrameBuffer *serverFb,
-                                 const EncodeOptions *options)
+template <class PIXEL_T>
+void TightEncoder::splitWithSolidArea(const Rect *rect,
+                                      std::vector<Rect> *rectList,
+                                      const FrameBuffer *serverFb,
+                                      const EncodeOptions *options)
 {
-  // First, convert pixels to client format.
-  const FrameBuffer *clientFb = m_pixelConverter->convert(rect, serverFb);
+  const int x = rect->left;
+  const int w = rect->getWidth();
+  int y = rect->top;
+  int h = rect->getHeight();
+
+  // The height of the tiles made by splitRectangleSimple().
+  int maxWidth = min(getConf(options).maxRectWidth, w);
+  int maxHeight = getConf(options).maxRectSize / maxWidth;
+
+  for (int dy = y; dy < y + h; dy += MAX_SPLIT_TILE_SIZE) {
+    // If the part scanned without success becomes too large, split off as
+    // many whole tiles as possible. The last tile row is kept: a solid area
+    // found below may extend into it (but not further, otherwise a tile of
+    // that row would be solid).
+    int scannedRows = dy - MAX_SPLIT_TILE_SIZE - y;
+    if (scannedRows >= maxHeight) {
+      int upperHeight = scannedRows - scannedRows % maxHeight;
+      Rect upper(x, y, x + w, y + upperHeight);
+      splitRectangleSimple(&upper, rectList, options);
+      h -= upperHeight;
+      y += upperHeight;
+    }
+
+    int dh = min(MAX_SPLIT_TILE_SIZE, y + h - dy);
+    for (int dx = x; dx < x + w; dx += MAX_SPLIT_TILE_SIZE) {
+      int dw = min(MAX_SPLIT_TILE_SIZE, x + w - dx);
+
+      UINT32 color;
+      Rect tile(dx, dy, dx + dw, dy + dh);
+      if (!checkSolidTile<PIXEL_T>(&tile, serverFb, &color, false)) {
+        continue;
+      }
+
+      // Get dimensions of the solid-color area, make sure it's large enough
+      // (or it's the whole rectangle).
+      Rect best;
+      Rect searchBounds(dx, dy, x + w, y + h);
+      findBestSolidArea<PIXEL_T>(&searchBounds, serverFb, color, &best);
+      if (best.area() != w * h && best.area() < MIN_SOLID_SUBRECT_SIZE) {
+        continue;
+      }
+
+      // Extend the area to the maximum size.
+      Rect bounds(x, y, x + w, y + h);
+      extendSolidArea<PIXEL_T>(&bounds, serverFb, color, &best);
+
+      // Split the rest around the solid-color area: the top part is known
+      // to have no big solid areas, others are searched recursively.
+      if (best.top != y) {
+        Rect top(x, y, x + w, best.top);
+        splitRectangleSimple(&top, rectList, options);
+      }
+      if (best.left != x) {
+        Rect left(x, best.top, best.left, best.bottom);
+        splitRectangle(&left, rectList, serverFb, options);
+      }
+      rectList->push_back(best);
+      m_solidRects.push_back(best);
+      if (best.right != x + w) {
+        Rect right(best.right, best.top, x + w, best.bottom);
+        splitRectangle(&right, rectList, serverFb, options);
+      }
+      if (best.bottom != y + h) {
+        Rect bottom(x, best.bottom, x + w, y + h);
+        splitRectangle(&bottom, rectList, serverFb, options);
+      }
+      return;
+    }
+  }
+
+  // No suitable solid-color areas found.
+  Rect rest(x, y, x + w, y + h);
+  splitRectangleSimple(&rest, rectList, options);
+}
+
+template <class PIXEL_T>
+bool TightEncoder::checkSolidTile(const Rect *r, const FrameBuffer *fb,
+                                  UINT32 *color, bool needSameColor)
+{
+  const PIXEL_T *row = (const PIXEL_T *)fb->getBufferPtr(r->left, r->top);
+  const int stride = fb->getDimension().width;
+  const int w = r->getWidth();
+  const int h = r->getHeight();
+
+  const PIXEL_T colorValue = needSameColor ? (PIXEL_T)*color : row[0];
+  for (int y = 0; y < h; y++, row += stride) {
+    for (int x = 0; x < w; x++) {
+      if (row[x] != colorValue) {
+        return false;
+      }
+    }
+  }
+  *color = colorValue;
+  return true;
+}
+
+template <class PIXEL_T>
+void TightEncoder::findBestSolidArea(const Rect *bounds, const FrameBuffer *fb,
+                                     UINT32 color, Rect *best)
+{
+  const int x = bounds->left;
+  const int y = bounds->top;
+  const int w = bounds->getWidth();
+  const int h = bounds->getHeight();
+
+  int wPrev = w;
+  int wBest = 0;
+  int hBest = 0;
+
+  for (int dy = y; dy < y + h; dy += MAX_SPLIT_TILE_SIZE) {
+    int dh = min(MAX_SPLIT_TILE_SIZE, y + h - dy);
+    int dw = min(MAX_SPLIT_TILE_SIZE, wPrev);
+
+    Rect tile(x, dy, x + dw, dy + dh);
+    if (!checkSolidTile<PIXEL_T>(&tile, fb, &color, true)) {
+      break;
+    }
+
+    int dx;
+    for (dx = x + dw; dx < x + wPrev; dx += dw) {
+      dw = min(MAX_SPLIT_TILE_SIZE, x + wPrev - dx);
+      tile.setRect(dx, dy, dx + dw, dy + dh);
+      if (!checkSolidTile<PIXEL_T>(&tile, fb, &color, true)) {
+        break;
+      }
+    }
+
+    wPrev = dx - x;
+    if (wPrev * (dy + dh - y) > wBest * hBest) {
+      wBest = wPrev;
+      hBest = dy + dh - y;
+    }
+  }
+
+  best->setRect(x, y, x + wBest, y + hBest);
+}
+
+template <class PIXEL_T>
+void TightEncoder::extendSolidArea(const Rect *bounds, const FrameBuffer *fb,
+                                   UINT32 color, Rect *best)
+{
+  Rect line;
+
+  // Try to extend the area upwards.
+  for (line.setRect(best->left, best->top - 1, best->right, best->top);
+       line.top >= bounds->top &&
+       checkSolidTile<PIXEL_T>(&line, fb, &color, true);
+       line.setRect(line.left, line.top - 1, line.right, line.top)) {
+    best->top = line.top;
+  }
+  // ... downwards.
+  for (line.setRect(best->left, best->bottom, best->right, best->bottom + 1);
+       line.bottom <= bounds->bottom &&
+       checkSolidTile<PIXEL_T>(&line, fb, &color, true);
+       line.setRect(line.left, line.bottom, line.right, line.bottom + 1)) {
+    best->bottom = line.bottom;
+  }
+  // ... to the left.
+  for (line.setRect(best->left - 1, best->top, best->left, best->bottom);
+       line.left >= bounds->left &&
+       checkSolidTile<PIXEL_T>(&line, fb, &color, true);
+       line.setRect(line.left - 1, line.top, line.left, line.bottom)) {
+    best->left = line.left;
+  }
+  // ... to the right.
+  for (line.setRect(best->right, best->top, best->right + 1, best->bottom);
+       line.right <= bounds->right &&
+       checkSolidTile<PIXEL_T>(&line, fb, &color, true);
+       line.setRect(line.right, line.top, line.right + 1, line.bottom)) {
+    best->right = line.right;
+  }
+}
+
+bool TightEncoder::takeSolidRect(const Rect *rect)
+{
+  // Rectangles produced by splitting do not intersect, so it's enough to
+  // compare the upper left corners.
+  for (size_t i = 0; i < m_solidRects.size(); i++) {
+    const Rect *solid = &m_solidRects[i];
+    if (solid->left == rect->left && solid->top == rect->top) {
+      bool isSolid = solid->isEqualTo(rect);
+      m_solidRects[i] = m_solidRects.back();
+      m_solidRects.pop_back();
+      return isSolid;
+    }
+  }
+  return false;
+}
+
+void TightEncoder::sendRect(const Rect *rect,
+                            const FrameBuffer *serverFb,
+                            const EncodeOptions *options,
+                            bool forceJpeg)
+{
+  try {
+    gatherRect(rect, serverFb, options, forceJpeg);
+    flushGathered();
+  } catch (...) {
+    discardGathered();
+    throw;
+  }
+}
+
+void TightEncoder::gatherRect(const Rect *rect,
+                              const FrameBuffer *serverFb,
+                              const EncodeOptions *options,
+                              bool forceJpeg)
+{
+  RectTask *task = &m_serialTask;
+  if (task->outputReferenced) {
+    flushGathered();
+  }
+  task->rect = *rect;
+  task->serverFb = serverFb;
+  task->knownSolid = takeSolidRect(rect) && !forceJpeg;
+  task->options = options;
+  task->forceJpeg = forceJpeg;
+
+  prepareRect(task);
+  sendPreparedRect(task);
+}
+
+void TightEncoder::sendRects(const std::vector<Rect> *rects,
+                             const FrameBuffer *serverFb,
+                             const EncodeOptions *options,
+                             bool forceJpeg)
+{
+  if (!shouldEncodeInParallel(rects)) {
+    try {
+      std::vector<Rect>::const_iterator i;
+      for (i = rects->begin(); i != rects->end(); i++) {
+        gatherRectHeader(&*i);
+        gatherRect(&*i, serverFb, options, forceJpeg);
+        if (m_gatheredSize >= MAX_GATHERED_SIZE) {
+          flushGathered();
+        }
+      }
+      flushGathered();
+    } catch (...) {
+      discardGathered();
+      throw;
+    }
+    return;
+  }
+
+  size_t numTasks = m_threadPool->getNumThreads() * TASKS_PER_THREAD;
+  while (m_tasks.size() < numTasks) {
+    RectTask *task = new RectTask(this);
+    task->setScratchArena(m_scratchArena);
+    m_tasks.push_back(task);
+  }
+
+  // Rectangles are prepared by the pool in advance, and sent here in the
+  // original order. The task for rectangle i is m_tasks[i % numTasks].
+  size_t numRects = rects->size();
+  size_t numQueued = 0;
+  size_t numSent = 0;
+  try {
+    for (; numSent < numRects; numSent++) {
+      for (; numQueued < numRects && numQueued < numSent + numTasks;
+           numQueued++) {
+        RectTask *task = m_tasks[numQueued % numTasks];
+        if (task->outputReferenced) {
+          flushGathered();
+        }
+        task->rect = (*rects)[numQueued];
+        task->serverFb = serverFb;
+        task->options = options;
+        task->forceJpeg = forceJpeg;
+        task->knownSolid = takeSolidRect(&task->rect) && !forceJpeg;
+        m_threadPool->addTask(task);
+      }
+
+      RectTask *task = m_tasks[numSent % numTasks];
+      m_threadPool->waitForTask(task);
+      gatherRectHeader(&task->rect);
+      sendPreparedRect(task);
+      if (m_gatheredSize >= MAX_GATHERED_SIZE) {
+        flushGathered();
+      }
+    }
+    flushGathered();
+  } catch (...) {
+    discardGathered();
+    // The queued tasks refer to the data of the caller.
+    for (; numSent < numQueued; numSent++) {
+      try {
+        m_threadPool->waitForTask(m_tasks[numSent % numTasks]);
+      } catch (...) {
+      }
+    }
+    throw;
+  }
+}
+
+bool TightEncoder::shouldEncodeInParallel(const std::vector<Rect> *rects) const
+{
+  return m_threadPool != 0 && m_threadPool->getNumThreads() > 1 &&
+         rects->size() > 1;
+}
+
+void TightEncoder::prepareRect(RectTask *task) const
+{
+  double startTime = m_autoPolicy ? TightCostModel::getTimeStamp() : 0.0;
+  task->header.clear();
+  task->zlibStreamId = -1;
+  task->costSelected = false;
+
+  if (task->forceJpeg) {
+    prepareJpegRect(task);
+    return;
+  }
+
+  // JPEG compressor takes pixels in the server format, all other
+  // subencodings need them in the client format. For solid rectangles,
+  // only the first pixel matters.
+  if (task->knownSolid) {
+    Rect firstPixel(task->rect.left, task->rect.top,
+                    task->rect.left + 1, task->rect.top + 1);
+    task->clientFb = task->conversion.convert(m_pixelConverter, &firstPixel,
+                                              task->serverFb);
+    prepareSolidRect(task);
+    return;
+  }
+
+  // First, convert pixels of the rectangle to client format.
+  task->clientFb = task->conversion.convert(m_pixelConverter, &task->rect,
+                                            task->serverFb);
 
   // Now call an encoder function corresponding to the client's pixel size.
-  size_t bpp = clientFb->getBitsPerPixel();
+  size_t bpp = task->clientFb->getBitsPerPixel();
   switch (bpp) {
   case 8:
-    sendAnyRect<UINT8>(rect, serverFb, clientFb, options);
+    prepareAnyRect<UINT8>(task);
     break;
   case 16:
-    sendAnyRect<UINT16>(rect, serverFb, clientFb, options);
+    prepareAnyRect<UINT16>(task);
     break;
   case 32:
-    sendAnyRect<UINT32>(rect, serverFb, clientFb, options);
+    prepareAnyRect<UINT32>(task);
     break;
   default:
     _ASSERT(0);
   }
+
+  if (task->costSelected) {
+    task->prepareTime = TightCostModel::getTimeStamp() - startTime;
+  }
 }
 
-//--------------------------------------------------------------------------//
+void TightEncoder::sendPreparedRect(RectTask *task)
+{
+  sendCompressionControl(task->control);
+  if (!task->header.isEmpty()) {
+    gather(task->header.getBuffer(), task->header.getSize());
+  }
+  TightCostModel::Candidate candidate = TightCostModel::SOLID;
+  size_t dataLength = 0;
+  double compressTime = 0.0;
+  if (task->control == SUBENCODING_JPEG) {
+    candidate = TightCostModel::JPEG;
+    dataLength = task->compressor.getOutputLength();
+    sendCompactLength(dataLength);
+    gatherInPlace(task->compressor.getOutputData(), dataLength);
+    task->outputReferenced = true;
+  } else if (task->zlibStreamId >= 0) {
+    switch (task->zlibStreamId) {
+    case ZLIB_STREAM_MONO:
+      candidate = TightCostModel::MONO;
+      break;
+    case ZLIB_STREAM_IDX:
+      candidate = TightCostModel::INDEXED;
+      break;
+    default:
+      candidate = TightCostModel::FULL_COLOR;
+    }
+    double startTime = task->costSelected ? TightCostModel::getTimeStamp()
+                                          : 0.0;
+    // FIXME: Get rid of explicit conversions between chars and bytes.
+    dataLength = sendCompressed((const char *)task->zlibData.getBuffer(),
+                                task->zlibData.getSize(),
+                                task->zlibStreamId, task->zlibLevel);
+    if (task->costSelected) {
+      compressTime = TightCostModel::getTimeStamp() - startTime;
+    }
+  }
+
+  if (m_autoPolicy) {
+    m_costModel.countRect(candidate);
+    if (task->costSelected) {
+      m_costModel.learn(candidate, &task->features, task->rawSize,
+                        task->predictedSize, dataLength,
+                        task->prepareTime + compressTime,
+                        task->rect.area());
+    }
+  }
+}
 
-// FIXME: Is it really necessary to pass both frame buffers in arguments?
 // FIXME: Make a special version for the case when PIXEL_T is UINT8.
 template <class PIXEL_T>
-void TightEncoder::sendAnyRect(const Rect *rect,
-                               const FrameBuffer *serverFb,
-                               const FrameBuffer *clientFb,
-                               const EncodeOptions *options)
+void TightEncoder::prepareAnyRect(RectTask *task) const
 {
-  // Compute maximum number of colors to be allowed in the palette.
-  int maxColors = rect->area() / getConf(options).idxMaxColorsDivisor;
+  const Rect *rect = &task->rect;
+  const EncodeOptions *options = task->options;
+
+  // Compute maximum number of colors to be allowed in the palette. In the
+  // "auto" mode, the cost model decides if bigger palettes pay off.
+  int maxColorsDivisor = m_autoPolicy ? AUTO_IDX_MAX_COLORS_DIVISOR
+                                      : getConf(options).idxMaxColorsDivisor;
+  int maxColors = rect->area() / maxColorsDivisor;
   if (maxColors < 2) {
     if (rect->area() >= getConf(options).monoMinRectSize) {
       maxColors = 2;
@@ -124,31 +628,80 @@ void TightEncoder::sendAnyRect(const Rect *rect,
     }
   }
 
-  // Fill in the palette (m_pal).
-  fillPalette<PIXEL_T>(rect, clientFb, maxColors);
+  // Fill in the palette.
+  fillPalette<PIXEL_T>(rect, task->clientFb, maxColors, &task->pal);
 
   // If that was a solid-color rectangle, sent it.
-  int numColors = m_pal.getNumColors();
+  int numColors = task->pal.getNumColors();
   if (numColors == 1) {
-    sendSolidRect(rect, clientFb);
+    prepareSolidRect(task);
   } else if (numColors == 2) {
-    sendMonoRect<PIXEL_T>(rect, clientFb, options);
+    prepareMonoRect<PIXEL_T>(task);
+  } else if (sizeof(PIXEL_T) > 1 && m_autoPolicy) {
+    prepareAutoRect<PIXEL_T>(task);
   } else if (sizeof(PIXEL_T) > 1 && numColors != 0) {
-    sendIndexedRect<PIXEL_T>(rect, clientFb, options);
-  } else if (sizeof(PIXEL_T) > 1 &&
-             options->jpegEnabled() &&
-             serverFb->getBitsPerPixel() >= 16 &&
-             rect->area() >= JPEG_MIN_RECT_SIZE &&
-             rect->getWidth() >= JPEG_MIN_RECT_WIDTH &&
-             rect->getHeight() >= JPEG_MIN_RECT_HEIGHT) {
-    sendJpegRect(rect, serverFb, options);
+    prepareIndexedRect<PIXEL_T>(task);
+  } else if (sizeof(PIXEL_T) > 1 && isJpegAllowed(task)) {
+    prepareJpegRect(task);
   } else {
-    sendFullColorRect<PIXEL_T>(rect, clientFb, options);
+    prepareFullColorRect<PIXEL_T>(task);
+  }
+}
+
+template <class PIXEL_T>
+void TightEncoder::prepareAutoRect(RectTask *task) const
+{
+  const Rect *rect = &task->rect;
+  int numColors = task->pal.getNumColors();
+  collectFeatures<PIXEL_T>(rect, task->clientFb, &task->features);
+
+  PixelFormat pf = task->clientFb->getPixelFormat();
+  size_t pixelSize = shouldPackPixels(&pf) ? 3 : sizeof(PIXEL_T);
+  size_t area = rect->area();
+
+  // Candidates and the size of their data passed to zlib or JPEG.
+  bool allowed[TightCostModel::NUM_CANDIDATES] = { false };
+  size_t rawSizes[TightCostModel::NUM_CANDIDATES] = { 0 };
+  allowed[TightCostModel::INDEXED] = numColors != 0;
+  rawSizes[TightCostModel::INDEXED] = area;
+  allowed[TightCostModel::FULL_COLOR] = true;
+  rawSizes[TightCostModel::FULL_COLOR] = area * pixelSize;
+  allowed[TightCostModel::JPEG] = isJpegAllowed(task) &&
+                                  (numColors == 0 ||
+                                   numColors >= AUTO_JPEG_MIN_COLORS);
+  rawSizes[TightCostModel::JPEG] = area * 3;
+
+  TightCostModel::Candidate candidate =
+    m_costModel.choose(&task->features, allowed, rawSizes, rect->area(),
+                       &task->predictedSize);
+  switch (candidate) {
+  case TightCostModel::INDEXED:
+    prepareIndexedRect<PIXEL_T>(task);
+    break;
+  case TightCostModel::JPEG:
+    prepareJpegRect(task);
+    break;
+  default:
+    prepareFullColorRect<PIXEL_T>(task);
   }
+  task->costSelected = true;
+  task->rawSize = rawSizes[candidate];
 }
 
-void TightEncoder::sendSolidRect(const Rect *r, const FrameBuffer *fb)
+bool TightEncoder::isJpegAllowed(const RectTask *task) const
 {
+  const Rect *rect = &task->rect;
+  return task->options->jpegEnabled() &&
+         task->serverFb->getBitsPerPixel() >= 16 &&
+         rect->area() >= JPEG_MIN_RECT_SIZE &&
+         rect->getWidth() >= JPEG_MIN_RECT_WIDTH &&
+         rect->getHeight() >= JPEG_MIN_RECT_HEIGHT;
+}
+
+void TightEncoder::prepareSolidRect(RectTask *task) const
+{
+  const Rect *r = &task->rect;
+  const FrameBuffer *fb = task->clientFb;
   PixelFormat pf = fb->getPixelFormat();
   size_t pixelSize = pf.bitsPerPixel / 8;
 
@@ -161,133 +714,94 @@ void TightEncoder::sendSolidRect(const Rect *r, const FrameBuffer *fb)
     pixelSize = 3;
   }
 
-  m_output->writeUInt8(SUBENCODING_FILL);
-  m_output->writeFully(buf, pixelSize);
+  task->control = SUBENCODING_FILL;
+  task->header.clear();
+  task->header.append(buf, pixelSize);
 }
 
 template <class PIXEL_T>
-void TightEncoder::sendMonoRect(const Rect *rect,
-                                const FrameBuffer *fb,
-                                const EncodeOptions *options)
+void TightEncoder::prepareMonoRect(RectTask *task) const
 {
-  // Send control info.
+  const Rect *rect = &task->rect;
+
+  // Control info.
   const int zlibStreamId = ZLIB_STREAM_MONO;
-  m_output->writeUInt8(EXPLICIT_FILTER | zlibStreamId << 4);
-  m_output->writeUInt8(FILTER_PALETTE);
-  m_output->writeUInt8(1); // the number of colors minus 1
+  task->control = EXPLICIT_FILTER | zlibStreamId << 4;
+  task->header.append(FILTER_PALETTE);
+  task->header.append(1); // the number of colors minus 1
+  appendPalette<PIXEL_T>(task);
 
-  // Prepare output buffer.
+  // Convert image to indexed colors.
   int dataLen = (rect->getWidth() + 7) / 8;
   dataLen *= rect->getHeight();
-  // FIXME: Optimize, use char[] instead of ByteArrayOutputStream.
-  ByteArrayOutputStream encoded(dataLen);
-  DataOutputStream encodedData(&encoded);
-
-  // Send the palette.
-  PIXEL_T palette[2] = {
-    (PIXEL_T)m_pal.getEntry(0),
-    (PIXEL_T)m_pal.getEntry(1)
-  };
-  PixelFormat pf = fb->getPixelFormat();
-  size_t pixelSize = sizeof(PIXEL_T);
-  if (shouldPackPixels(&pf)) {
-    packPixels((UINT8 *)palette, 2, &pf);
-    pixelSize = 3;
-  }
-  m_output->writeFully(palette, pixelSize * 2);
+  task->zlibData.resize(dataLen);
+  encodeMonoRect<PIXEL_T>(rect, task->clientFb, &task->pal,
+                          task->zlibData.getBuffer());
 
-  // Convert image to indexed colors.
-  encodeMonoRect<PIXEL_T>(rect, fb, &encodedData);
-  _ASSERT(encoded.size() == dataLen);
-
-  // Compress and send.
-  int zlibLevel = getConf(options).monoZlibLevel;
-  sendCompressed(encoded.toByteArray(), dataLen, zlibStreamId, zlibLevel);
+  task->zlibStreamId = zlibStreamId;
+  task->zlibLevel = getConf(task->options).monoZlibLevel;
 }
 
 template <class PIXEL_T>
-void TightEncoder::sendIndexedRect(const Rect *rect,
-                                   const FrameBuffer *fb,
-                                   const EncodeOptions *options)
+void TightEncoder::prepareIndexedRect(RectTask *task) const
 {
-  // Send control info.
-  const int zlibStreamId = ZLIB_STREAM_IDX;
-  m_output->writeUInt8(EXPLICIT_FILTER | zlibStreamId << 4);
-  m_output->writeUInt8(FILTER_PALETTE);
-  int numColors = m_pal.getNumColors();
-  m_output->writeUInt8((UINT8)(numColors - 1));
+  const Rect *rect = &task->rect;
 
-  // Prepare output buffer.
-  int dataLen = rect->getWidth() * rect->getHeight();
-  // FIXME: Optimize, use char[] instead of ByteArrayOutputStream.
-  ByteArrayOutputStream encoded(dataLen);
-  DataOutputStream encodedData(&encoded);
-
-  // Send the palette.
-  PIXEL_T palette[256];
-  for (int i = 0; i < numColors; i++) {
-    palette[i] = (PIXEL_T)m_pal.getEntry(i);
-  }
-  PixelFormat pf = fb->getPixelFormat();
-  size_t pixelSize = sizeof(PIXEL_T);
-  if (shouldPackPixels(&pf)) {
-    packPixels((UINT8 *)palette, numColors, &pf);
-    pixelSize = 3;
-  }
-  m_output->writeFully(palette, pixelSize * numColors);
+  // Control info.
+  const int zlibStreamId = ZLIB_STREAM_IDX;
+  task->control = EXPLICIT_FILTER | zlibStreamId << 4;
+  task->header.append(FILTER_PALETTE);
+  int numColors = task->pal.getNumColors();
+  task->header.append((UINT8)(numColors - 1));
+  appendPalette<PIXEL_T>(task);
 
   // Convert image to indexed colors.
-  encodeIndexedRect<PIXEL_T>(rect, fb, &encodedData);
-  _ASSERT(encoded.size() == dataLen);
+  int dataLen = rect->getWidth() * rect->getHeight();
+  task->zlibData.resize(dataLen);
+  encodeIndexedRect<PIXEL_T>(rect, task->clientFb, &task->pal,
+                             task->zlibData.getBuffer());
 
-  // Compress and send.
-  int zlibLevel = getConf(options).idxZlibLevel;
-  sendCompressed(encoded.toByteArray(), dataLen, zlibStreamId, zlibLevel);
+  task->zlibStreamId = zlibStreamId;
+  task->zlibLevel = getConf(task->options).idxZlibLevel;
 }
 
 template <class PIXEL_T>
-void TightEncoder::sendFullColorRect(const Rect *rect,
-                                     const FrameBuffer *fb,
-                                     const EncodeOptions *options)
+void TightEncoder::prepareFullColorRect(RectTask *task) const
 {
-  // Send control info.
-  const int zlibStreamId = ZLIB_STREAM_RAW;
-  m_output->writeUInt8(zlibStreamId << 4);
+  const Rect *rect = &task->rect;
+  const FrameBuffer *fb = task->clientFb;
 
-  // Prepare output buffer.
-  int dataLen = rect->area() * sizeof(PIXEL_T);
-  // FIXME: Use char[] instead?
-  std::vector<UINT8> rgbData(dataLen);
+  // Control info.
+  const int zlibStreamId = ZLIB_STREAM_RAW;
+  task->control = zlibStreamId << 4;
 
   // Get pixels from the frame buffer.
-  copyPixels<PIXEL_T>(rect, fb, &rgbData.front());
-  _ASSERT(rgbData.size() == dataLen);
+  ScratchBuffer &rgbData = task->zlibData;
+  rgbData.resize(rect->area() * sizeof(PIXEL_T));
+  copyPixels<PIXEL_T>(rect, fb, rgbData.getBuffer());
 
   // Pack pixels into 24-bit samples if necessary.
   PixelFormat pf = fb->getPixelFormat();
   if (shouldPackPixels(&pf)) {
-    packPixels(&rgbData.front(), rect->area(), &pf);
+    packPixels(rgbData.getBuffer(), rect->area(), &pf);
     rgbData.resize(rect->area() * 3);
   }
 
-  // Compress and send.
-  int zlibLevel = getConf(options).rawZlibLevel;
-  // FIXME: Get rid of explicit conversions between chars and bytes.
-  sendCompressed((const char *)&rgbData.front(), rgbData.size(),
-                 zlibStreamId, zlibLevel);
+  task->zlibStreamId = zlibStreamId;
+  task->zlibLevel = getConf(task->options).rawZlibLevel;
 }
 
-void TightEncoder::sendJpegRect(const Rect *rect,
-                                const FrameBuffer *serverFb,
-                                const EncodeOptions *options)
+void TightEncoder::prepareJpegRect(RectTask *task) const
 {
-  _ASSERT(options->jpegEnabled());
+  const Rect *rect = &task->rect;
+  const FrameBuffer *serverFb = task->serverFb;
+  _ASSERT(task->options->jpegEnabled());
 
   // Set proper JPEG quality level in the compressor. The default value 6
   // below does not mean anything, it will not be used because we assume
   // valid JPEG quality level was set in the options object.
-  int quality = options->getJpegQualityLevel(6);
-  m_compressor.setQuality(quality * 10 + 5);
+  int quality = task->options->getJpegQualityLevel(6);
+  task->compressor.setQuality(quality * 10 + 5);
 
   // Shortcuts.
   const void *ptr = serverFb->getBufferPtr(rect->left, rect->top);
@@ -296,14 +810,27 @@ void TightEncoder::sendJpegRect(const Rect *rect,
   int height = rect->getHeight();
   int stride = serverFb->getBytesPerRow();
 
-  // Compress pixels.
-  m_compressor.compress(ptr, &fmt, width, height, stride);
-  size_t dataLength = m_compressor.getOutputLength();
+  // Compress pixels, the data will be sent from the compressor.
+  task->compressor.compress(ptr, &fmt, width, height, stride);
+  task->control = SUBENCODING_JPEG;
+}
 
-  // Actually send the encoded data.
-  m_output->writeUInt8(SUBENCODING_JPEG);
-  sendCompactLength(dataLength);
-  m_output->writeFully(m_compressor.getOutputData(), dataLength);
+template <class PIXEL_T>
+void TightEncoder::appendPalette(RectTask *task) const
+{
+  int numColors = task->pal.getNumColors();
+  PIXEL_T palette[256];
+  for (int i = 0; i < numColors; i++) {
+    palette[i] = (PIXEL_T)task->pal.getEntry(i);
+  }
+  PixelFormat pf = task->clientFb->getPixelFormat();
+  size_t pixelSize = sizeof(PIXEL_T);
+  if (shouldPackPixels(&pf)) {
+    packPixels((UINT8 *)palette, numColors, &pf);
+    pixelSize = 3;
+  }
+  const UINT8 *paletteData = (const UINT8 *)palette;
+  task->header.append(paletteData, pixelSize * numColors);
 }
 
 //--------------------------------------------------------------------------//
@@ -319,60 +846,103 @@ bool TightEncoder::shouldPackPixels(const PixelFormat *pf) const
 
 void TightEncoder::packPixels(UINT8 *buf, int count, const PixelFormat *pf)
 {
-  UINT8 *dst = buf;
-  UINT32 pix;
+  TightSimd::packPixels(buf, count, pf);
+}
 
-  while (count--) {
-    if (!pf->bigEndian) {
-      pix = (UINT32)buf[3] << 24 |
-            (UINT32)buf[2] << 16 |
-            (UINT32)buf[1] << 8 |
-            (UINT32)buf[0];
-    } else {
-      pix = (UINT32)buf[0] << 24 |
-            (UINT32)buf[1] << 16 |
-            (UINT32)buf[2] << 8 |
-            (UINT32)buf[3];
-    }
-    buf += 4;
-    *dst++ = (UINT8)(pix >> pf->redShift);
-    *dst++ = (UINT8)(pix >> pf->greenShift);
-    *dst++ = (UINT8)(pix >> pf->blueShift);
+template <class PIXEL_T>
+int TightEncoder::findRunEnd(const PIXEL_T *pixels, int count, PIXEL_T value)
+{
+  int i = 0;
+  while (i < count && pixels[i] == value) {
+    i++;
   }
+  return i;
+}
+
+int TightEncoder::findRunEnd(const UINT32 *pixels, int count, UINT32 value)
+{
+  return TightSimd::findRunEnd(pixels, count, value);
 }
 
 template <class PIXEL_T>
-void TightEncoder::fillPalette(const Rect *r, const FrameBuffer *fb, int maxColors)
+void TightEncoder::fillPalette(const Rect *r, const FrameBuffer *fb,
+                               int maxColors, TightPalette *pal)
 {
   // Clear the palette.
-  m_pal.reset();
-  m_pal.setMaxColors(maxColors);
+  pal->reset();
+  pal->setMaxColors(maxColors);
 
   // Shortcuts.
-  const PIXEL_T *pixels = (const PIXEL_T *)fb->getBuffer();
-  int stride = fb->getDimension().width;
-  UINT32 pixel = pixels[r->top * stride + r->left];
-  UINT32 oldPixel = 0;
-  UINT32 runLength = 0;
-
-  for (int y = r->top; y < r->bottom; y++) {
-    for (int x = r->left; x < r->right; x++) {
-      pixel = pixels[y * stride + x];
-
-      if (oldPixel != pixel) {
-        if (m_pal.insert(oldPixel, runLength) == 0) {
+  const PIXEL_T *row = (const PIXEL_T *)fb->getBufferPtr(r->left, r->top);
+  const int stride = fb->getDimension().width;
+  const int w = r->getWidth();
+  const int h = r->getHeight();
+
+  // Runs of equal pixels are counted at once and may continue on the next
+  // row.
+  PIXEL_T runColor = row[0];
+  int runLength = 0;
+
+  for (int y = 0; y < h; y++, row += stride) {
+    int x = 0;
+    while (x < w) {
+      int n = findRunEnd(row + x, w - x, runColor);
+      runLength += n;
+      x += n;
+      if (x < w) {
+        if (pal->insert(runColor, runLength) == 0) {
           return;
         }
-        oldPixel = pixel;
-        runLength = 1;
-      } else {
-        runLength++;
+        runColor = row[x];
+        runLength = 0;
+      }
+    }
+  }
+  pal->insert(runColor, runLength);
+}
+
+template <class PIXEL_T>
+void TightEncoder::collectFeatures(const Rect *r, const FrameBuffer *fb,
+                                   TightRectFeatures *features)
+{
+  features->numSamples = 0;
+  features->numRuns = 0;
+  features->gradientEnergy = 0;
+
+  // Scale factors bringing color components to 0..255, in 1/256 units.
+  PixelFormat pf = fb->getPixelFormat();
+  UINT32 redScale = (255 << 8) / max(pf.redMax, (UINT16)1);
+  UINT32 greenScale = (255 << 8) / max(pf.greenMax, (UINT16)1);
+  UINT32 blueScale = (255 << 8) / max(pf.blueMax, (UINT16)1);
+
+  const PIXEL_T *row = (const PIXEL_T *)fb->getBufferPtr(r->left, r->top);
+  const int stride = fb->getDimension().width;
+  const int w = r->getWidth();
+  const int h = r->getHeight();
+
+  // Equal pixels do not add to the gradient, so the neighbours are compared
+  // only at the run boundaries.
+  for (int y = 0; y < h; y += FEATURE_ROW_STEP, row += stride * FEATURE_ROW_STEP) {
+    int x = 0;
+    while (x < w) {
+      PIXEL_T px = row[x];
+      x += findRunEnd(row + x, w - x, px);
+      features->numRuns++;
+      if (x < w) {
+        PIXEL_T next = row[x];
+        int dr = (int)(next >> pf.redShift & pf.redMax) -
+                 (int)(px >> pf.redShift & pf.redMax);
+        int dg = (int)(next >> pf.greenShift & pf.greenMax) -
+                 (int)(px >> pf.greenShift & pf.greenMax);
+        int db = (int)(next >> pf.blueShift & pf.blueMax) -
+                 (int)(px >> pf.blueShift & pf.blueMax);
+        features->gradientEnergy += (abs(dr) * redScale +
+                                     abs(dg) * greenScale +
+                                     abs(db) * blueScale) >> 8;
       }
     }
+    features->numSamples += w;
   }
-  if (m_pal.insert(oldPixel, runLength) == 0) {
-			return;
-	}
 }
 
 template <class PIXEL_T>
@@ -394,84 +964,105 @@ void TightEncoder::copyPixels(const Rect *rect, const FrameBuffer *fb,
 }
 
 template <class PIXEL_T>
-void TightEncoder::encodeMonoRect(const Rect *rect, const FrameBuffer *fb,
-                                  DataOutputStream *out)
+void TightEncoder::encodeMonoRow(const PIXEL_T *src, int w, PIXEL_T bg,
+                                 UINT8 *dst)
 {
-  const PIXEL_T *src = (const PIXEL_T *)fb->getBufferPtr(rect->left, rect->top);
-  const int w = rect->getWidth();
-  const int h = rect->getHeight();
-  const PIXEL_T bg = (PIXEL_T)m_pal.getEntry(0);
-
   unsigned int value, mask;
-  int x, y, bits;
+  int x, bits;
   const int alignedWidth = w - w % 8;
-  const int skipPixels = fb->getDimension().width - w;
 
-  for (y = 0; y < h; y++) {
-    for (x = 0; x < alignedWidth; x += 8) {
-      for (bits = 0; bits < 8; bits++) {
-        if (*src++ != bg)
-          break;
-      }
-      if (bits == 8) {
-        out->writeUInt8(0);
-        continue;
-      }
-      mask = 0x80 >> bits;
-      value = mask;
-      for (bits++; bits < 8; bits++) {
-        mask >>= 1;
-        if (*src++ != bg) {
-          value |= mask;
-        }
-      }
-      out->writeUInt8((UINT8)value);
+  for (x = 0; x < alignedWidth; x += 8) {
+    for (bits = 0; bits < 8; bits++) {
+      if (*src++ != bg)
+        break;
     }
-    if (x < w) {
-      mask = 0x80;
-      value = 0;
-      do {
-        if (*src++ != bg) {
-          value |= mask;
-        }
-        mask >>= 1;
-      } while (++x < w);
-      out->writeUInt8((UINT8)value);
+    if (bits == 8) {
+      *dst++ = 0;
+      continue;
+    }
+    mask = 0x80 >> bits;
+    value = mask;
+    for (bits++; bits < 8; bits++) {
+      mask >>= 1;
+      if (*src++ != bg) {
+        value |= mask;
+      }
     }
-    src += skipPixels;
+    *dst++ = (UINT8)value;
+  }
+  if (x < w) {
+    mask = 0x80;
+    value = 0;
+    do {
+      if (*src++ != bg) {
+        value |= mask;
+      }
+      mask >>= 1;
+    } while (++x < w);
+    *dst++ = (UINT8)value;
+  }
+}
+
+void TightEncoder::encodeMonoRow(const UINT32 *src, int w, UINT32 bg,
+                                 UINT8 *dst)
+{
+  TightSimd::encodeMonoRow(src, w, bg, dst);
+}
+
+template <class PIXEL_T>
+void TightEncoder::encodeMonoRect(const Rect *rect, const FrameBuffer *fb,
+                                  const TightPalette *pal, UINT8 *dst)
+{
+  const PIXEL_T *src = (const PIXEL_T *)fb->getBufferPtr(rect->left, rect->top);
+  const int w = rect->getWidth();
+  const int h = rect->getHeight();
+  const PIXEL_T bg = (PIXEL_T)pal->getEntry(0);
+  const int stride = fb->getDimension().width;
+  const int bytesPerRow = (w + 7) / 8;
+
+  for (int y = 0; y < h; y++) {
+    encodeMonoRow(src, w, bg, dst);
+    src += stride;
+    dst += bytesPerRow;
   }
 }
 
 template <class PIXEL_T>
 void TightEncoder::encodeIndexedRect(const Rect *rect, const FrameBuffer *fb,
-                                     DataOutputStream *out)
+                                     const TightPalette *pal, UINT8 *dst)
 {
   const PIXEL_T *src = (const PIXEL_T *)fb->getBufferPtr(rect->left, rect->top);
   const int w = rect->getWidth();
   const int h = rect->getHeight();
-  const int skipPixels = fb->getDimension().width - w;
+  const int stride = fb->getDimension().width;
 
-  UINT8 index = m_pal.getIndex(*src);
-  PIXEL_T oldColor = 0;
+  // Look up the index once per run of equal pixels.
   for (int y = 0; y < h; y++) {
-    for (int x = 0; x < w; x++) {
-      if (oldColor != *src) {
-        index = m_pal.getIndex(*src);
-        oldColor = *src;
-      }
-      *src++;
-      out->writeUInt8(index);
+    int x = 0;
+    while (x < w) {
+      PIXEL_T color = src[x];
+      int n = findRunEnd(src + x, w - x, color);
+      memset(dst, pal->getIndex(color), n);
+      dst += n;
+      x += n;
     }
-    src += skipPixels;
+    src += stride;
   }
 }
 
-void TightEncoder::sendCompressed(const char *data, size_t dataLen,
-                                  int streamId, int zlibLevel)
+void TightEncoder::sendCompressionControl(UINT8 code)
+{
+  UINT8 control = code | m_streamsToReset;
+  gather(&control, 1);
+  m_streamsToReset = 0;
+}
+
+size_t TightEncoder::sendCompressed(const char *data, size_t dataLen,
+                                    int streamId, int zlibLevel)
 {
   if (dataLen < TIGHT_MIN_TO_COMPRESS) {
-    m_output->writeFully(data, dataLen);
-    return;
+    gather(data, dataLen);
+    return dataLen;
   }
 
   z_streamp pz = &m_zsStruct[streamId];
@@ -492,11 +1083,13 @@ void TightEncoder::sendCompressed(const char *data, size_t dataLen,
     m_zsLevel[streamId] = zlibLevel;
   }
 
-  // Prepare buffers.
+  // Prepare buffers. The data is compressed right into the gathered output,
+  // leaving room for its compact length in front.
   size_t compressedBufferSize = dataLen + dataLen / 100 + 16;
 
-  std::vector<char> charBuff(compressedBufferSize);
-  char *compressedData = &charBuff.front();
+  size_t dataOffset = m_gathered.getSize() + MAX_COMPACT_LENGTH_SIZE;
+  m_gathered.resize(dataOffset + compressedBufferSize);
+  char *compressedData = (char *)m_gathered.getBuffer() + dataOffset;
 
   _ASSERT((unsigned int)dataLen == dataLen);
   _ASSERT((unsigned int)compressedBufferSize == compressedBufferSize);
@@ -520,20 +1113,30 @@ void TightEncoder::sendCompressed(const char *data, size_t dataLen,
       throw IOException(_T("Zlib compression failed in Tight encoder"));
   }
 
-  try {
-    size_t compressedLength = compressedBufferSize - pz->avail_out;
-    sendCompactLength(compressedLength);
-    m_output->writeFully(compressedData, compressedLength);
-  } catch (...) {
-    throw;
-  }
+  size_t compressedLength = compressedBufferSize - pz->avail_out;
+  m_gathered.resize(dataOffset + compressedLength);
+
+  // Put the length right before the data, unused bytes in front of it are
+  // skipped.
+  UINT8 length[MAX_COMPACT_LENGTH_SIZE];
+  size_t numBytes = encodeCompactLength(compressedLength, length);
+  size_t lengthOffset = dataOffset - numBytes;
+  memcpy(m_gathered.getBuffer() + lengthOffset, length, numBytes);
+  addGatheredRange(lengthOffset, numBytes + compressedLength);
+  return compressedLength;
 }
 
 void TightEncoder::sendCompactLength(size_t dataLen)
+{
+  UINT8 buffer[MAX_COMPACT_LENGTH_SIZE];
+  size_t numBytes = encodeCompactLength(dataLen, buffer);
+  gather(buffer, numBytes);
+}
+
+size_t TightEncoder::encodeCompactLength(size_t dataLen, UINT8 *buffer)
 {
   _ASSERT(dataLen <= 0x3FFFFF);
 
-  UINT8 buffer[4];
   size_t numBytes = 0;
 
   buffer[numBytes++] = dataLen & 0x7F;
@@ -545,8 +1148,87 @@ void TightEncoder::sendCompactLength(size_t dataLen)
       buffer[numBytes++] = dataLen >> 14 & 0xFF;
     }
   }
+  return numBytes;
+}
+
+void TightEncoder::gatherRectHeader(const Rect *rect)
+{
+  // The same fields as written by Encoder::sendRectHeader(), in network
+  // byte order.
+  UINT16 fields[4] = { (UINT16)rect->left, (UINT16)rect->top,
+                       (UINT16)rect->getWidth(), (UINT16)rect->getHeight() };
+  UINT32 code = (UINT32)getCode();
+  UINT8 header[12];
+  for (int i = 0; i < 4; i++) {
+    header[i * 2] = (UINT8)(fields[i] >> 8);
+    header[i * 2 + 1] = (UINT8)fields[i];
+  }
+  for (int i = 0; i < 4; i++) {
+    header[8 + i] = (UINT8)(code >> (24 - i * 8));
+  }
+  gather(header, sizeof(header));
+}
+
+void TightEncoder::gather(const void *data, size_t length)
+{
+  size_t offset = m_gathered.getSize();
+  m_gathered.append(data, length);
+  addGatheredRange(offset, length);
+}
 
-  m_output->writeFully(buffer, numBytes);
+void TightEncoder::gatherInPlace(const void *data, size_t length)
+{
+  GatheredSegment segment = { data, 0, length };
+  m_gatheredSegments.push_back(segment);
+  m_gatheredSize += length;
+}
+
+void TightEncoder::addGatheredRange(size_t offset, size_t length)
+{
+  if (length == 0) {
+    return;
+  }
+  if (!m_gatheredSegments.empty()) {
+    GatheredSegment *last = &m_gatheredSegments.back();
+    if (last->data == 0 && last->offset + last->length == offset) {
+      last->length += length;
+      m_gatheredSize += length;
+      return;
+    }
+  }
+  GatheredSegment segment = { 0, offset, length };
+  m_gatheredSegments.push_back(segment);
+  m_gatheredSize += length;
+}
+
+void TightEncoder::flushGathered()
+{
+  if (!m_gatheredSegments.empty()) {
+    // m_gathered does not grow any more, so pointers to it are stable.
+    m_outputSegments.clear();
+    std::vector<GatheredSegment>::const_iterator i;
+    for (i = m_gatheredSegments.begin(); i != m_gatheredSegments.end(); i++) {
+      OutputSegment segment = { i->data, i->length };
+      if (segment.data == 0) {
+        segment.data = m_gathered.getBuffer() + i->offset;
+      }
+      m_outputSegments.push_back(segment);
+    }
+    m_output->writeVectorFully(&m_outputSegments.front(),
+                               m_outputSegments.size());
+  }
+  discardGathered();
+}
+
+void TightEncoder::discardGathered()
+{
+  m_gathered.clear();
+  m_gatheredSegments.clear();
+  m_gatheredSize = 0;
+  m_serialTask.outputReferenced = false;
+  for (size_t i = 0; i < m_tasks.size(); i++) {
+    m_tasks[i]->outputReferenced = false;
+  }
 }
 
 // FIXME: Values for maxRectSize and maxRectWidth should be determined after
@@ -31,6 +31,8 @@
 #include "Encoder.h"
 #include "TightPalette.h"
 #include "JpegCompressor.h"
+#include "TightCostModel.h"
+#include "thread/ThreadPool.h"
 
 class TightEncoder : public Encoder
 {
@@ -43,7 +45,9 @@ public:
   virtual int getCode() const;
 
   // Splits big rectangles according to the configuration setings (m_conf)
-  // corresponding to the compression level set in EncodeOptions.
+  // corresponding to the compression level set in EncodeOptions. Big
+  // solid-color areas are found first and passed as separate rectangles,
+  // they are sent as solid fills without further analysis.
   virtual void splitRectangle(const Rect *rect,
                               std::vector<Rect> *rectList,
                               const FrameBuffer *serverFb,
@@ -53,39 +57,207 @@ public:
                              const FrameBuffer *serverFb,
                              const EncodeOptions *options) throw(IOException);
 
+  // If a thread pool is set, everything except zlib compression (palette
+  // analysis, pixel conversion, packing and JPEG compression) is done on the
+  // pool threads for a number of rectangles at once. Zlib streams are still
+  // fed on the calling thread in the original order of rectangles, so the
+  // output is the same as in the sequential mode.
+  virtual void sendRectangles(const std::vector<Rect> *rects,
+                              const FrameBuffer *serverFb,
+                              const EncodeOptions *options) throw(IOException);
+
+  // Discards all zlib streams. The next rectangle will request the decoder
+  // to reset its streams in the compression control byte.
+  virtual void resetCompression();
+
+  // Forgets the solid-color rectangles found by splitRectangle() in the
+  // previous update.
+  virtual void startUpdate();
+
+  // Sets the thread pool for parallel encoding in sendRectangles(). Zero
+  // pointer (the default) or a pool with a single thread turn parallel
+  // encoding off. The pool should exist during the whole life cycle of the
+  // encoder.
+  void setThreadPool(ThreadPool *threadPool);
+
+  // Attaches the buffers of all tasks (including the ones created later) to
+  // the arena.
+  virtual void setScratchArena(ScratchArena *arena);
+
+  // Turns the "auto" encoding policy on or off. With the policy on, the
+  // subencoding of rectangles having more than two colors is selected by
+  // TightCostModel, cpuWeight (0..100) sets the importance of encoding time
+  // relative to the output size. Otherwise, the choice depends on the
+  // number of colors only.
+  void setAutoPolicy(bool enabled, unsigned int cpuWeight);
+
+  // Returns the decisions made since the encoder was created.
+  void getCostModelStats(TightCostModel::Stats *stats) const;
+
 protected:
-  // An implementation of sendRectangle() for the given pixel size.
+  // A rectangle passing two stages of encoding. The first stage,
+  // prepareRect(), is stateless and fills in all the data to be sent except
+  // zlib compression. It depends only on the fields of this object so it
+  // can be executed on any thread. The second stage, sendPreparedRect(),
+  // feeds the data to the zlib streams and adds the result to the gathered
+  // output (see flushGathered()).
+  class RectTask : public ThreadPoolTask
+  {
+  public:
+    RectTask(TightEncoder *encoder);
+    virtual ~RectTask();
+
+    // Implementation of ThreadPoolTask, calls prepareRect().
+    virtual void run() throw(Exception);
+
+    // Attach all buffers of the task to the arena.
+    void setScratchArena(ScratchArena *arena);
+
+    // Input data.
+    Rect rect;
+    const FrameBuffer *serverFb;
+    const EncodeOptions *options;
+    // If true, JPEG compression is used unconditionally (see JpegEncoder).
+    bool forceJpeg;
+    // If true, the rectangle is known to be of a single color, so only its
+    // first pixel is converted and no palette analysis is done.
+    bool knownSolid;
+
+    // Data used by prepareRect().
+    // Pixels of the rectangle in the client's pixel format, clientFb is set
+    // by prepareRect() and may be equal to serverFb.
+    ConversionBuffer conversion;
+    const FrameBuffer *clientFb;
+    TightPalette pal;
+    StandardJpegCompressor compressor;
+
+    // The result of prepareRect(). The compression control byte (without
+    // stream reset flags) and the data following it. If zlibStreamId is not
+    // negative, zlibData should be compressed by that stream. JPEG data is
+    // kept in the compressor.
+    UINT8 control;
+    ScratchBuffer header;
+    ScratchBuffer zlibData;
+    int zlibStreamId;
+    int zlibLevel;
+
+    // Data for learning the cost model if the subencoding was selected by
+    // it: pixel statistics, the size of data before compression and the
+    // predicted size after it, time spent in prepareRect() in microseconds.
+    bool costSelected;
+    TightRectFeatures features;
+    size_t rawSize;
+    size_t predictedSize;
+    double prepareTime;
+
+    // True if the gathered output refers to the JPEG data of the task, so
+    // the output should be flushed before the task is reused.
+    bool outputReferenced;
+
+  private:
+    TightEncoder *m_encoder;
+  };
+
+  // Encode and send one rectangle on the calling thread via m_serialTask.
+  void sendRect(const Rect *rect,
+                const FrameBuffer *serverFb,
+                const EncodeOptions *options,
+                bool forceJpeg) throw(IOException);
+
+  // Encode one rectangle on the calling thread via m_serialTask and add it
+  // to the gathered output.
+  void gatherRect(const Rect *rect,
+                  const FrameBuffer *serverFb,
+                  const EncodeOptions *options,
+                  bool forceJpeg) throw(IOException);
+
+  // Implementation of sendRectangles(), forceJpeg is used by JpegEncoder.
+  void sendRects(const std::vector<Rect> *rects,
+                 const FrameBuffer *serverFb,
+                 const EncodeOptions *options,
+                 bool forceJpeg) throw(IOException);
+
+  // Split the rectangle into tiles according to m_conf, without looking at
+  // the pixels.
+  void splitRectangleSimple(const Rect *rect,
+                            std::vector<Rect> *rectList,
+                            const EncodeOptions *options);
+
+  // An implementation of splitRectangle() for the given pixel size of the
+  // server frame buffer. Finds a big solid-color area, passes it as a
+  // separate rectangle and splits the rest around it.
   template <class PIXEL_T>
-    void sendAnyRect(const Rect *rect,
-                     const FrameBuffer *serverFb,
-                     const FrameBuffer *clientFb,
-                     const EncodeOptions *options) throw(IOException);
+    void splitWithSolidArea(const Rect *rect,
+                            std::vector<Rect> *rectList,
+                            const FrameBuffer *serverFb,
+                            const EncodeOptions *options);
+
+  // Return true if all pixels of the rectangle are of the same color. If
+  // needSameColor is true, that color must be equal to *color, otherwise
+  // the color is stored in *color.
+  template <class PIXEL_T>
+    static bool checkSolidTile(const Rect *r, const FrameBuffer *fb,
+                               UINT32 *color, bool needSameColor);
 
-  // Send a solid-color rectangle.
-  void sendSolidRect(const Rect *r, const FrameBuffer *fb) throw(IOException);
+  // Find the solid-color area of the biggest size which has the upper left
+  // corner in the upper left corner of the bounds rectangle, and fits into
+  // that rectangle. The area is stored in *best.
+  template <class PIXEL_T>
+    static void findBestSolidArea(const Rect *bounds, const FrameBuffer *fb,
+                                  UINT32 color, Rect *best);
 
-  // Send a two-color rectangle (1 bit per pixel).
+  // Extend the solid-color area *best in all four directions as long as it
+  // remains solid and fits into the bounds rectangle.
   template <class PIXEL_T>
-    void sendMonoRect(const Rect *rect,
-                      const FrameBuffer *fb,
-                      const EncodeOptions *options) throw(IOException);
+    static void extendSolidArea(const Rect *bounds, const FrameBuffer *fb,
+                                UINT32 color, Rect *best);
 
-  // Send an indexed-color rectangle (1 byte per pixel).
+  // Return true if the rectangle was found solid by splitRectangle(), and
+  // forget about it.
+  bool takeSolidRect(const Rect *rect);
+
+  // Return true if the rectangles should be encoded on the thread pool.
+  bool shouldEncodeInParallel(const std::vector<Rect> *rects) const;
+
+  // The first (stateless) stage of encoding, see RectTask.
+  void prepareRect(RectTask *task) const;
+
+  // The second stage of encoding, see RectTask.
+  void sendPreparedRect(RectTask *task) throw(IOException);
+
+  // An implementation of prepareRect() for the given pixel size.
   template <class PIXEL_T>
-    void sendIndexedRect(const Rect *rect,
-                         const FrameBuffer *fb,
-                         const EncodeOptions *options) throw(IOException);
+    void prepareAnyRect(RectTask *task) const;
 
-  // Send a true color rectangle.
+  // Select the subencoding of a rectangle with more than two colors (or
+  // too many colors for the palette) by the cost model and prepare it.
   template <class PIXEL_T>
-    void sendFullColorRect(const Rect *rect,
-                           const FrameBuffer *fb,
-                           const EncodeOptions *options) throw(IOException);
+    void prepareAutoRect(RectTask *task) const;
+
+  // Return true if JPEG compression may be used for the rectangle.
+  bool isJpegAllowed(const RectTask *task) const;
 
-  // Send a rectangle encoded with JPEG.
-  void sendJpegRect(const Rect *rect,
-                    const FrameBuffer *serverFb,
-                    const EncodeOptions *options) throw(IOException);
+  // Prepare a solid-color rectangle.
+  void prepareSolidRect(RectTask *task) const;
+
+  // Prepare a two-color rectangle (1 bit per pixel).
+  template <class PIXEL_T>
+    void prepareMonoRect(RectTask *task) const;
+
+  // Prepare an indexed-color rectangle (1 byte per pixel).
+  template <class PIXEL_T>
+    void prepareIndexedRect(RectTask *task) const;
+
+  // Prepare a true color rectangle.
+  template <class PIXEL_T>
+    void prepareFullColorRect(RectTask *task) const;
+
+  // Prepare a rectangle encoded with JPEG.
+  void prepareJpegRect(RectTask *task) const;
+
+  // Append the palette of the task (task->pal) to task->header.
+  template <class PIXEL_T>
+    void appendPalette(RectTask *task) const;
 
   // Return true if 32-bit pixels should be packed into 24-bit representation,
   // false otherwise. This function should be given the client's pixel format.
@@ -96,39 +268,82 @@ protected:
   // and blueMax are all 255.
   static void packPixels(UINT8 *buf, int count, const PixelFormat *pf);
 
-  // Fill in the palette (m_pal) assuming that pixels have the type PIXEL_T
+  // Return the number of leading pixels equal to value (at most count). The
+  // UINT32 version uses vector instructions if available.
+  template <class PIXEL_T>
+    static int findRunEnd(const PIXEL_T *pixels, int count, PIXEL_T value);
+  static int findRunEnd(const UINT32 *pixels, int count, UINT32 value);
+
+  // Fill in the palette (pal) assuming that pixels have the type PIXEL_T
   // (where PIXEL_T can be UINT8, UINT16 or UINT32). Do not allow more than
   // maxColors in the palette, reset the palette size to 0 if actual number of
   // colors exceeds this limitation.
   template <class PIXEL_T>
-    void fillPalette(const Rect *r, const FrameBuffer *fb, int maxColors);
+    static void fillPalette(const Rect *r, const FrameBuffer *fb,
+                            int maxColors, TightPalette *pal);
+
+  // Gather statistics of the rectangle pixels for the cost model, every
+  // FEATURE_ROW_STEP-th row is sampled.
+  template <class PIXEL_T>
+    static void collectFeatures(const Rect *r, const FrameBuffer *fb,
+                                TightRectFeatures *features);
 
   // Copy pixel data from the frame buffer to a byte array.
   template <class PIXEL_T>
-    void copyPixels(const Rect *rect, const FrameBuffer *fb, UINT8 *dst);
+    static void copyPixels(const Rect *rect, const FrameBuffer *fb,
+                           UINT8 *dst);
 
-  // Encode a two-color rectangle using m_pal as a palette, produce a bitmap
+  // Produce the bitmap for one row of a two-color rectangle, setting bits
+  // for the pixels not equal to bg.
+  template <class PIXEL_T>
+    static void encodeMonoRow(const PIXEL_T *src, int w, PIXEL_T bg,
+                              UINT8 *dst);
+  static void encodeMonoRow(const UINT32 *src, int w, UINT32 bg, UINT8 *dst);
+
+  // Encode a two-color rectangle using pal as a palette, produce a bitmap
   // where one pixel is represented by one bit. Each line is padded with
   // zeroes to the byte boundary.
-  // FIXME: Do not use DataOutputStream, do not throw IOException.
   template <class PIXEL_T>
-    void encodeMonoRect(const Rect *rect, const FrameBuffer *fb,
-                        DataOutputStream *out) throw(IOException);
+    static void encodeMonoRect(const Rect *rect, const FrameBuffer *fb,
+                               const TightPalette *pal, UINT8 *dst);
 
-  // Encode a rectangle using m_pal as a palette, produce a pixmap where one
+  // Encode a rectangle using pal as a palette, produce a pixmap where one
   // pixel is represented by one byte which is its index in the palette.
-  // FIXME: Do not use DataOutputStream, do not throw IOException.
   template <class PIXEL_T>
-    void encodeIndexedRect(const Rect *rect, const FrameBuffer *fb,
-                           DataOutputStream *out) throw(IOException);
+    static void encodeIndexedRect(const Rect *rect, const FrameBuffer *fb,
+                                  const TightPalette *pal, UINT8 *dst);
+
+  // Send the compression control byte. Stream reset flags requested by
+  // resetCompression() are added to the given code and then cleared.
+  void sendCompressionControl(UINT8 code);
 
+  // Compresses the data right into the gathered output, preceded by its
+  // compact length. Returns the number of bytes written.
   // FIXME: Throw ZlibException instead.
-  void sendCompressed(const char *data, size_t dataLen,
-                      int streamId, int zlibLevel) throw(IOException);
+  size_t sendCompressed(const char *data, size_t dataLen,
+                        int streamId, int zlibLevel) throw(IOException);
 
   // Send the number of the compressed bytes following. The number (dataLen)
   // is represented by a variable-length code (1..3 bytes).
-  void sendCompactLength(size_t dataLen) throw(IOException);
+  void sendCompactLength(size_t dataLen);
+
+  // Store the compact representation of dataLen in the buffer, return the
+  // number of bytes used.
+  static size_t encodeCompactLength(size_t dataLen, UINT8 *buffer);
+
+  // The output of sendRect() and sendRects() is gathered and written by
+  // one vectored write per MAX_GATHERED_SIZE bytes, so every big zlib or
+  // JPEG payload does not cost a separate write. Small pieces (rectangle
+  // headers, control bytes, lengths) are copied to m_gathered, zlib
+  // compresses right into it, JPEG data is referenced in place.
+  void gatherRectHeader(const Rect *rect);
+  void gather(const void *data, size_t length);
+  void gatherInPlace(const void *data, size_t length);
+  void addGatheredRange(size_t offset, size_t length);
+  // Write the gathered output and forget it.
+  void flushGathered() throw(IOException);
+  // Forget the gathered output without writing it.
+  void discardGathered();
 
   // Configuration table of the Tight encoder. Do not access this table
   // directly, use getConf() method instead.
@@ -161,6 +376,32 @@ protected:
   static const int JPEG_MIN_RECT_WIDTH = 8;
   static const int JPEG_MIN_RECT_HEIGHT = 8;
 
+  // Parameters of the "auto" policy. Palettes are limited to area / divisor
+  // colors; JPEG is considered for rectangles with at least the given
+  // number of colors; every FEATURE_ROW_STEP-th row is sampled for the cost
+  // model statistics.
+  static const int AUTO_IDX_MAX_COLORS_DIVISOR = 4;
+  static const int AUTO_JPEG_MIN_COLORS = 32;
+  static const int FEATURE_ROW_STEP = 4;
+
+  // Parameters of solid-color area detection in splitRectangle(). Smaller
+  // rectangles are not searched for solid areas; smaller solid areas are
+  // not extracted (unless they cover the whole rectangle); tiles of the
+  // given size are checked during the search.
+  static const int MIN_SPLIT_RECT_SIZE = 4096;
+  static const int MIN_SOLID_SUBRECT_SIZE = 2048;
+  static const int MAX_SPLIT_TILE_SIZE = 16;
+
+  // The number of rectangles prepared in advance per pool thread in the
+  // parallel mode. Limits the memory used for prepared data.
+  static const size_t TASKS_PER_THREAD = 2;
+
+  // The gathered output is written when it grows to this size.
+  static const size_t MAX_GATHERED_SIZE = 64 * 1024;
+
+  // The maximum size of a compact length.
+  static const size_t MAX_COMPACT_LENGTH_SIZE = 3;
+
   // The number of zlib streams used by TightEncoder (it cannot exceed 4).
   static const int NUM_ZLIB_STREAMS = 3;
 
@@ -177,12 +418,43 @@ protected:
   bool m_zsActive[NUM_ZLIB_STREAMS];
   int m_zsLevel[NUM_ZLIB_STREAMS];
 
-  // Color palette which maps color samples to color indexes and keeps track
-  // of the number of colors allocated.
-  TightPalette m_pal;
-
-  // JPEG compressor working via the IJG JPEG library.
-  StandardJpegCompressor m_compressor;
+  // Bit mask of zlib streams the decoder should reset before decoding the
+  // next rectangle (bit N corresponds to stream N), see resetCompression().
+  UINT8 m_streamsToReset;
+
+  // Solid-color rectangles produced by splitRectangle() in this update and
+  // not sent yet. The vector keeps its memory between updates.
+  std::vector<Rect> m_solidRects;
+
+  // Task used for encoding rectangles on the calling thread.
+  RectTask m_serialTask;
+
+  // Thread pool for parallel encoding, may be 0.
+  ThreadPool *m_threadPool;
+  // Tasks used for parallel encoding, allocated on demand and reused
+  // between updates.
+  std::vector<RectTask *> m_tasks;
+
+  // "Auto" encoding policy, see setAutoPolicy().
+  bool m_autoPolicy;
+  TightCostModel m_costModel;
+
+  // The gathered output. A segment is a range of m_gathered if its data is
+  // 0, otherwise it refers to the data in place. m_gatheredSize is the
+  // total length of the segments. m_outputSegments is used to write them.
+  struct GatheredSegment
+  {
+    const void *data;
+    size_t offset;
+    size_t length;
+  };
+  ScratchBuffer m_gathered;
+  std::vector<GatheredSegment> m_gatheredSegments;
+  size_t m_gatheredSize;
+  std::vector<OutputSegment> m_outputSegments;
+
+  // Arena set by setScratchArena(), may be 0.
+  ScratchArena *m_scratchArena;
 };
 
 #endif // __RFB_TIGHT_ENCODER_H_INCLUDED__
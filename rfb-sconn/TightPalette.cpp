@@ -37,7 +37,7 @@ TightPalette::TightPalette(int maxColors)
 void TightPalette::reset()
 {
   m_numColors = 0;
-  memset(m_hash, 0, 256 * sizeof(TightColorList *));
+  memset(m_hash, 0, sizeof(m_hash));
 }
 
 void TightPalette::setMaxColors(int maxColors)
@@ -52,35 +52,23 @@ void TightPalette::setMaxColors(int maxColors)
 
 int TightPalette::insert(UINT32 rgb, int numPixels)
 {
-  TightColorList *pnode;
-  TightColorList *prev_pnode = NULL;
-  int hash_key, idx, new_idx, count;
+  int slot = findSlot(rgb);
+  int idx;
 
-  hash_key = hashFunc(rgb);
-
-  pnode = m_hash[hash_key];
-
-  while (pnode != NULL) {
-    if (pnode->rgb == rgb) {
-      // Such palette entry already exists.
-      new_idx = idx = pnode->idx;
-      count = m_entry[idx].numPixels + numPixels;
-      if (new_idx && m_entry[new_idx-1].numPixels < count) {
-        do {
-          m_entry[new_idx] = m_entry[new_idx-1];
-          m_entry[new_idx].listNode->idx = new_idx;
-          new_idx--;
-        }
-        while (new_idx && m_entry[new_idx-1].numPixels < count);
-
-        m_entry[new_idx].listNode = pnode;
-        pnode->idx = new_idx;
-      }
-      m_entry[new_idx].numPixels = count;
-      return m_numColors;
+  if (m_hash[slot] != 0) {
+    // Such palette entry already exists.
+    idx = m_hash[slot] - 1;
+    int count = m_entry[idx].numPixels + numPixels;
+    // Keep the list sorted by moving more frequent colors to the front.
+    for ( ; idx > 0 && m_entry[idx-1].numPixels < count; idx--) {
+      m_entry[idx] = m_entry[idx-1];
+      m_hash[m_entry[idx].slot] = (UINT16)(idx + 1);
     }
-    prev_pnode = pnode;
-    pnode = pnode->next;
+    m_entry[idx].rgb = rgb;
+    m_entry[idx].numPixels = count;
+    m_entry[idx].slot = slot;
+    m_hash[slot] = (UINT16)(idx + 1);
+    return m_numColors;
   }
 
   // Check if the palette is full.
@@ -94,21 +82,14 @@ int TightPalette::insert(UINT32 rgb, int numPixels)
         idx > 0 && m_entry[idx-1].numPixels < numPixels;
         idx-- ) {
     m_entry[idx] = m_entry[idx-1];
-    m_entry[idx].listNode->idx = idx;
+    m_hash[m_entry[idx].slot] = (UINT16)(idx + 1);
   }
 
   // Add new palette entry into the freed slot.
-  pnode = &m_list[m_numColors];
-  if (prev_pnode != NULL) {
-    prev_pnode->next = pnode;
-  } else {
-    m_hash[hash_key] = pnode;
-  }
-  pnode->next = NULL;
-  pnode->idx = idx;
-  pnode->rgb = rgb;
-  m_entry[idx].listNode = pnode;
+  m_entry[idx].rgb = rgb;
   m_entry[idx].numPixels = numPixels;
+  m_entry[idx].slot = slot;
+  m_hash[slot] = (UINT16)(idx + 1);
 
   return ++m_numColors;
 }
@@ -28,6 +28,10 @@
 // is a list where colors are always sorted by these counts (more
 // frequent first).
 //
+// The hash uses open addressing with linear probing in a table twice as
+// large as the maximum number of colors, so lookups touch one or two
+// adjacent slots in most cases and no memory is allocated.
+//
 
 #ifndef __RFB_TIGHTPALETTE_H_INCLUDED__
 #define __RFB_TIGHTPALETTE_H_INCLUDED__
@@ -35,24 +39,34 @@
 #include <string.h>
 #include "util/inttypes.h"
 
-struct TightColorList {
-  TightColorList *next;
-  int idx;
-  UINT32 rgb;
-};
-
 struct TightPaletteEntry {
-  TightColorList *listNode;
+  UINT32 rgb;
   int numPixels;
+  // Position of this entry in the hash table.
+  int slot;
 };
 
 class TightPalette {
 
 protected:
 
-  // FIXME: Bigger hash table? Better hash function?
+  static const int HASH_BITS = 9;
+  static const int HASH_SIZE = 1 << HASH_BITS;
+
   inline static int hashFunc(UINT32 rgb) {
-    return (rgb ^ (rgb >> 13)) & 0xFF;
+    return (int)((rgb * 2654435761U) >> (32 - HASH_BITS));
+  }
+
+  //
+  // Return the hash slot holding the specified color, or the empty slot
+  // where it should be inserted.
+  //
+  inline int findSlot(UINT32 rgb) const {
+    int slot = hashFunc(rgb);
+    while (m_hash[slot] != 0 && m_entry[m_hash[slot] - 1].rgb != rgb) {
+      slot = (slot + 1) & (HASH_SIZE - 1);
+    }
+    return slot;
   }
 
 public:
@@ -92,7 +106,7 @@ public:
   // Return the color specified by its index in the palette.
   //
   inline UINT32 getEntry(int i) const {
-    return (i < m_numColors) ? m_entry[i].listNode->rgb : (UINT32)-1;
+    return (i < m_numColors) ? m_entry[i].rgb : (UINT32)-1;
   }
 
   //
@@ -106,14 +120,11 @@ public:
   // Return the index of a specified color.
   //
   inline UINT8 getIndex(UINT32 rgb) const {
-    TightColorList *pnode = m_hash[hashFunc(rgb)];
-    while (pnode != NULL) {
-      if (pnode->rgb == rgb) {
-        return (UINT8)pnode->idx;
-      }
-      pnode = pnode->next;
+    if (m_numColors == 0) {
+      return 0xFF;
     }
-    return 0xFF;  // no such color
+    int idx = m_hash[findSlot(rgb)];
+    return (idx != 0) ? (UINT8)(idx - 1) : 0xFF;  // 0xFF: no such color
   }
 
 protected:
@@ -122,8 +133,8 @@ protected:
   int m_numColors;
 
   TightPaletteEntry m_entry[256];
-  TightColorList *m_hash[256];
-  TightColorList m_list[256];
+  // Indices into m_entry plus one, zero marks an empty slot.
+  UINT16 m_hash[HASH_SIZE];
 
 };
 
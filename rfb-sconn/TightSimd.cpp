@@ -0,0 +1,285 @@
+// Copyright (C) 2012 GlavSoft LLC.
+// All rights reserved.
+//
+//-------------------------------------------------------------------------
+// This file is part of the TightVNC software.  Please visit our Web site:
+//
+//                       http://www.tightvnc.com/
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+//-------------------------------------------------------------------------
+//
+
+#include "TightSimd.h"
+#include "util/CpuFeatures.h"
+
+#include <string.h>
+#include <intrin.h>
+#include <emmintrin.h>
+#include <tmmintrin.h>
+#if _MSC_VER >= 1800
+#include <immintrin.h>
+#endif
+
+const UINT8 TightSimd::m_reversedNibbles[16] = {
+  0x0, 0x8, 0x4, 0xC, 0x2, 0xA, 0x6, 0xE,
+  0x1, 0x9, 0x5, 0xD, 0x3, 0xB, 0x7, 0xF
+};
+
+const TightSimd::FindRunEndFunc TightSimd::m_findRunEnd =
+  TightSimd::selectFindRunEnd();
+const TightSimd::EncodeMonoRowFunc TightSimd::m_encodeMonoRow =
+  TightSimd::selectEncodeMonoRow();
+
+int TightSimd::findRunEnd(const UINT32 *pixels, int count, UINT32 value)
+{
+  return m_findRunEnd(pixels, count, value);
+}
+
+void TightSimd::encodeMonoRow(const UINT32 *pixels, int width, UINT32 bg,
+                              UINT8 *dst)
+{
+  m_encodeMonoRow(pixels, width, bg, dst);
+}
+
+void TightSimd::packPixels(UINT8 *buf, int count, const PixelFormat *pf)
+{
+  if (CpuFeatures::hasSsse3() &&
+      pf->redShift % 8 == 0 &&
+      pf->greenShift % 8 == 0 &&
+      pf->blueShift % 8 == 0) {
+#ifdef _DEBUG
+    // Short buffers are packed by the tail loop alone, check them against
+    // the plain code.
+    UINT8 expected[7 * 4];
+    bool check = count <= 7;
+    if (check) {
+      memcpy(expected, buf, count * 4);
+      packPixelsScalar(expected, count, pf);
+    }
+#endif
+    packPixelsSsse3(buf, count, pf);
+#ifdef _DEBUG
+    _ASSERT(!check || memcmp(expected, buf, count * 3) == 0);
+#endif
+  } else {
+    packPixelsScalar(buf, count, pf);
+  }
+}
+
+//--------------------------------------------------------------------------//
+
+TightSimd::FindRunEndFunc TightSimd::selectFindRunEnd()
+{
+#if _MSC_VER >= 1800
+  if (CpuFeatures::hasAvx2()) {
+    return findRunEndAvx2;
+  }
+#endif
+  if (CpuFeatures::hasSse2()) {
+    return findRunEndSse2;
+  }
+  return findRunEndScalar;
+}
+
+TightSimd::EncodeMonoRowFunc TightSimd::selectEncodeMonoRow()
+{
+  if (CpuFeatures::hasSse2()) {
+    return encodeMonoRowSse2;
+  }
+  return encodeMonoRowScalar;
+}
+
+int TightSimd::findRunEndScalar(const UINT32 *pixels, int count, UINT32 value)
+{
+  int i = 0;
+  while (i < count && pixels[i] == value) {
+    i++;
+  }
+  return i;
+}
+
+int TightSimd::findRunEndSse2(const UINT32 *pixels, int count, UINT32 value)
+{
+  const __m128i v = _mm_set1_epi32((int)value);
+  int i = 0;
+  for (; i + 4 <= count; i += 4) {
+    __m128i p = _mm_loadu_si128((const __m128i *)(pixels + i));
+    int mask = _mm_movemask_epi8(_mm_cmpeq_epi32(p, v));
+    if (mask != 0xFFFF) {
+      // Each pixel is represented by four bits of the mask.
+      unsigned long firstDiff;
+      _BitScanForward(&firstDiff, ~mask & 0xFFFF);
+      return i + (int)firstDiff / 4;
+    }
+  }
+  return i + findRunEndScalar(pixels + i, count - i, value);
+}
+
+#if _MSC_VER >= 1800
+int TightSimd::findRunEndAvx2(const UINT32 *pixels, int count, UINT32 value)
+{
+  const __m256i v = _mm256_set1_epi32((int)value);
+  int i = 0;
+  for (; i + 8 <= count; i += 8) {
+    __m256i p = _mm256_loadu_si256((const __m256i *)(pixels + i));
+    unsigned int mask = (unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi32(p, v));
+    if (mask != 0xFFFFFFFF) {
+      unsigned long firstDiff;
+      _BitScanForward(&firstDiff, ~mask);
+      // Leave the upper half of the registers clean for SSE code.
+      _mm256_zeroupper();
+      return i + (int)firstDiff / 4;
+    }
+  }
+  _mm256_zeroupper();
+  return i + findRunEndSse2(pixels + i, count - i, value);
+}
+#else
+int TightSimd::findRunEndAvx2(const UINT32 *pixels, int count, UINT32 value)
+{
+  return findRunEndSse2(pixels, count, value);
+}
+#endif
+
+void TightSimd::encodeMonoRowScalar(const UINT32 *pixels, int width,
+                                    UINT32 bg, UINT8 *dst)
+{
+  const UINT32 *src = pixels;
+  unsigned int value, mask;
+  int x, bits;
+  const int alignedWidth = width - width % 8;
+
+  for (x = 0; x < alignedWidth; x += 8) {
+    for (bits = 0; bits < 8; bits++) {
+      if (*src++ != bg)
+        break;
+    }
+    if (bits == 8) {
+      *dst++ = 0;
+      continue;
+    }
+    mask = 0x80 >> bits;
+    value = mask;
+    for (bits++; bits < 8; bits++) {
+      mask >>= 1;
+      if (*src++ != bg) {
+        value |= mask;
+      }
+    }
+    *dst++ = (UINT8)value;
+  }
+  if (x < width) {
+    mask = 0x80;
+    value = 0;
+    do {
+      if (*src++ != bg) {
+        value |= mask;
+      }
+      mask >>= 1;
+    } while (++x < width);
+    *dst++ = (UINT8)value;
+  }
+}
+
+void TightSimd::encodeMonoRowSse2(const UINT32 *pixels, int width,
+                                  UINT32 bg, UINT8 *dst)
+{
+  const __m128i v = _mm_set1_epi32((int)bg);
+  int x = 0;
+  for (; x + 8 <= width; x += 8) {
+    __m128i p0 = _mm_loadu_si128((const __m128i *)(pixels + x));
+    __m128i p1 = _mm_loadu_si128((const __m128i *)(pixels + x + 4));
+    int lo = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(p0, v)));
+    int hi = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(p1, v)));
+    // Bit N is set if pixel N is equal to bg, the bitmap needs the opposite
+    // with the first pixel in the most significant bit.
+    int bits = ~(lo | hi << 4) & 0xFF;
+    *dst++ = (UINT8)(m_reversedNibbles[bits & 0xF] << 4 |
+                     m_reversedNibbles[bits >> 4]);
+  }
+  if (x < width) {
+    encodeMonoRowScalar(pixels + x, width - x, bg, dst);
+  }
+}
+
+void TightSimd::packPixelsScalar(UINT8 *buf, int count, const PixelFormat *pf)
+{
+  UINT8 *dst = buf;
+  UINT32 pix;
+
+  while (count--) {
+    if (!pf->bigEndian) {
+      pix = (UINT32)buf[3] << 24 |
+            (UINT32)buf[2] << 16 |
+            (UINT32)buf[1] << 8 |
+            (UINT32)buf[0];
+    } else {
+      pix = (UINT32)buf[0] << 24 |
+            (UINT32)buf[1] << 16 |
+            (UINT32)buf[2] << 8 |
+            (UINT32)buf[3];
+    }
+    buf += 4;
+    *dst++ = (UINT8)(pix >> pf->redShift);
+    *dst++ = (UINT8)(pix >> pf->greenShift);
+    *dst++ = (UINT8)(pix >> pf->blueShift);
+  }
+}
+
+void TightSimd::packPixelsSsse3(UINT8 *buf, int count, const PixelFormat *pf)
+{
+  // Byte offsets of the color components within a pixel.
+  int redPos = pf->redShift / 8;
+  int grnPos = pf->greenShift / 8;
+  int bluPos = pf->blueShift / 8;
+  if (pf->bigEndian) {
+    redPos = 3 - redPos;
+    grnPos = 3 - grnPos;
+    bluPos = 3 - bluPos;
+  }
+
+  // Shuffle four pixels (16 bytes) into 12 bytes, zero the last four.
+  char shuffle[16];
+  for (int i = 0; i < 4; i++) {
+    shuffle[i * 3] = (char)(i * 4 + redPos);
+    shuffle[i * 3 + 1] = (char)(i * 4 + grnPos);
+    shuffle[i * 3 + 2] = (char)(i * 4 + bluPos);
+    shuffle[12 + i] = (char)0x80;
+  }
+  const __m128i mask = _mm_loadu_si128((const __m128i *)shuffle);
+
+  // Each store covers 16 bytes starting at 12 * block, which never reaches
+  // the source pixels of the following blocks.
+  int numBlocks = count / 4;
+  for (int block = 0; block < numBlocks; block++) {
+    __m128i p = _mm_loadu_si128((const __m128i *)(buf + block * 16));
+    _mm_storeu_si128((__m128i *)(buf + block * 12), _mm_shuffle_epi8(p, mask));
+  }
+
+  // The rest of pixels. With no full blocks dst starts at src, so all the
+  // components are read before writing.
+  int done = numBlocks * 4;
+  const UINT8 *src = buf + done * 4;
+  UINT8 *dst = buf + done * 3;
+  for (int i = done; i < count; i++, src += 4) {
+    UINT8 red = src[redPos];
+    UINT8 grn = src[grnPos];
+    UINT8 blu = src[bluPos];
+    *dst++ = red;
+    *dst++ = grn;
+    *dst++ = blu;
+  }
+}
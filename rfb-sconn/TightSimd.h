@@ -0,0 +1,83 @@
+// Copyright (C) 2012 GlavSoft LLC.
+// All rights reserved.
+//
+//-------------------------------------------------------------------------
+// This file is part of the TightVNC software.  Please visit our Web site:
+//
+//                       http://www.tightvnc.com/
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+//-------------------------------------------------------------------------
+//
+
+#ifndef __RFB_TIGHT_SIMD_H_INCLUDED__
+#define __RFB_TIGHT_SIMD_H_INCLUDED__
+
+#include "util/inttypes.h"
+#include "rfb/PixelFormat.h"
+
+//
+// TightSimd contains vectorized versions of the per-pixel loops used by the
+// Tight encoder for 32-bit pixels. The best implementation supported by the
+// processor (AVX2, SSSE3 or SSE2) is selected at run time, plain C++ code is
+// used if none of them is available. All functions are thread-safe.
+//
+
+class TightSimd
+{
+public:
+  // Return the number of leading pixels equal to value (at most count).
+  static int findRunEnd(const UINT32 *pixels, int count, UINT32 value);
+
+  // Produce a bitmap for a row of two-color pixels, one bit per pixel, the
+  // first pixel in the most significant bit. Bits are set for pixels not
+  // equal to bg. Writes (width + 7) / 8 bytes to dst.
+  static void encodeMonoRow(const UINT32 *pixels, int width, UINT32 bg,
+                            UINT8 *dst);
+
+  // Convert 32-bit pixels into 24-bit sequences (red, green, blue), in place.
+  // The pixel format must have color depth of 24 with all maximums equal to
+  // 255.
+  static void packPixels(UINT8 *buf, int count, const PixelFormat *pf);
+
+protected:
+  typedef int (*FindRunEndFunc)(const UINT32 *, int, UINT32);
+  typedef void (*EncodeMonoRowFunc)(const UINT32 *, int, UINT32, UINT8 *);
+
+  static int findRunEndScalar(const UINT32 *pixels, int count, UINT32 value);
+  static int findRunEndSse2(const UINT32 *pixels, int count, UINT32 value);
+  static int findRunEndAvx2(const UINT32 *pixels, int count, UINT32 value);
+
+  static void encodeMonoRowScalar(const UINT32 *pixels, int width,
+                                  UINT32 bg, UINT8 *dst);
+  static void encodeMonoRowSse2(const UINT32 *pixels, int width,
+                                UINT32 bg, UINT8 *dst);
+
+  static void packPixelsScalar(UINT8 *buf, int count, const PixelFormat *pf);
+  // Works only if each color component occupies a whole byte of a pixel.
+  static void packPixelsSsse3(UINT8 *buf, int count, const PixelFormat *pf);
+
+  static FindRunEndFunc selectFindRunEnd();
+  static EncodeMonoRowFunc selectEncodeMonoRow();
+
+  // Implementations selected at startup.
+  static const FindRunEndFunc m_findRunEnd;
+  static const EncodeMonoRowFunc m_encodeMonoRow;
+
+  // Bit-reversed values of all 4-bit numbers.
+  static const UINT8 m_reversedNibbles[16];
+};
+
+#endif // __RFB_TIGHT_SIMD_H_INCLUDED__
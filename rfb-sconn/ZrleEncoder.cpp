@@ -23,6 +23,34 @@
 //
 
 #include "ZrleEncoder.h"
+#include "TightSimd.h"
+
+ZrleEncoder::TileTask::TileTask(ZrleEncoder *encoder)
+: serverFb(0),
+  clientFb(0),
+  paletteFull(false),
+  rlePixel(0),
+  rleLength(0),
+  paletteRleTileSize(0),
+  m_encoder(encoder)
+{
+}
+
+ZrleEncoder::TileTask::~TileTask()
+{
+}
+
+void ZrleEncoder::TileTask::run()
+{
+  m_encoder->encodeTiles(this);
+}
+
+void ZrleEncoder::TileTask::setScratchArena(ScratchArena *arena)
+{
+  conversion.setArena(arena);
+  plainRleTile.setArena(arena);
+  data.setArena(arena);
+}
 
 ZrleEncoder::ZrleEncoder(PixelConverter *conv, DataOutputStream *output)
 : Encoder(conv, output),
@@ -33,12 +61,18 @@ ZrleEncoder::ZrleEncoder(PixelConverter *conv, DataOutputStream *output)
   m_monoZlibLevel(ZLIB_MONO_LEVEL_DEFAULT),
   m_rawZlibLevel(ZLIB_RAW_LEVEL_DEFAULT),
   m_bytesPerPixel(0),
-  m_numberFirstByte(0)
+  m_numberFirstByte(0),
+  m_serialTask(this),
+  m_threadPool(0),
+  m_scratchArena(0)
 {
 }
 
 ZrleEncoder::~ZrleEncoder()
 {
+  for (size_t i = 0; i < m_tasks.size(); i++) {
+    delete m_tasks[i];
+  }
 }
 
 int ZrleEncoder::getCode() const
@@ -64,9 +98,9 @@ void ZrleEncoder::sendRectangle(const Rect *rect,
   // Used for futher work with CPIXELs.
   m_bytesPerPixel = 0;
   m_numberFirstByte = 0;
-  const FrameBuffer *clientFb = m_pixelConverter->convert(rect, serverFb);
+  // The pixels are converted band by band in encodeTiles().
   //client pixel format
-  m_pxFormat = clientFb->getPixelFormat();
+  m_pxFormat = m_pixelConverter->getDstPixelFormat();
   //server pixel format
   PixelFormat serverPxFormat = serverFb->getPixelFormat();
   bool bigEndianDiffs = m_pxFormat.bigEndian != serverPxFormat.bigEndian;
@@ -94,34 +128,139 @@ void ZrleEncoder::sendRectangle(const Rect *rect,
       m_numberFirstByte = 0;
     }
   }
- 
-  // Reserve data once for potentional transmitting of whole frame buffer
+
+  if (shouldEncodeInParallel(rect)) {
+    sendRectInParallel(rect, serverFb);
+    return;
+  }
+
+  TileTask *task = &m_serialTask;
+  task->rect = *rect;
+  task->serverFb = serverFb;
+  // Reserve data once for potentional transmitting of whole rectangle
   // in raw encoding with CPIXELs.
-  // If vector will be small it will be resized automatically.
+  // If the buffer will be small it will be resized automatically.
+  task->data.reserve(rect->area() * 3);
+
+  encodeTiles(task);
+  sendTileData(&task->data);
+}
+
+void ZrleEncoder::setScratchArena(ScratchArena *arena)
+{
+  Encoder::setScratchArena(arena);
+  m_scratchArena = arena;
+  m_rgbData.setArena(arena);
+  m_serialTask.setScratchArena(arena);
+  for (size_t i = 0; i < m_tasks.size(); i++) {
+    m_tasks[i]->setScratchArena(arena);
+  }
+}
+
+void ZrleEncoder::setThreadPool(ThreadPool *threadPool)
+{
+  m_threadPool = threadPool;
+}
+
+bool ZrleEncoder::shouldEncodeInParallel(const Rect *rect) const
+{
+  if (m_threadPool == 0 || m_threadPool->getNumThreads() <= 1 ||
+      rect->getHeight() <= TILE_SIZE) {
+    return false;
+  }
+  int tilesX = (rect->getWidth() + TILE_SIZE - 1) / TILE_SIZE;
+  int tilesY = (rect->getHeight() + TILE_SIZE - 1) / TILE_SIZE;
+  return tilesX * tilesY >= MIN_PARALLEL_TILES;
+}
+
+void ZrleEncoder::sendRectInParallel(const Rect *rect,
+                                     const FrameBuffer *serverFb)
+{
+  size_t numTasks = m_threadPool->getNumThreads() * TASKS_PER_THREAD;
+  while (m_tasks.size() < numTasks) {
+    TileTask *task = new TileTask(this);
+    task->setScratchArena(m_scratchArena);
+    m_tasks.push_back(task);
+  }
+
+  // Bands are encoded by the pool in advance and appended to the zlib input
+  // here in the original order. The task for band i is m_tasks[i % numTasks].
+  m_rgbData.clear();
   m_rgbData.reserve(rect->area() * 3);
+  size_t numBands = (rect->getHeight() + TILE_SIZE - 1) / TILE_SIZE;
+  size_t numQueued = 0;
+  size_t numDone = 0;
+  try {
+    for (; numDone < numBands; numDone++) {
+      for (; numQueued < numBands && numQueued < numDone + numTasks;
+           numQueued++) {
+        TileTask *task = m_tasks[numQueued % numTasks];
+        int top = rect->top + (int)numQueued * TILE_SIZE;
+        task->rect.setRect(rect->left, top,
+                           rect->right, min(top + TILE_SIZE, rect->bottom));
+        task->serverFb = serverFb;
+        m_threadPool->addTask(task);
+      }
+
+      TileTask *task = m_tasks[numDone % numTasks];
+      m_threadPool->waitForTask(task);
+      m_rgbData.append(task->data.getBuffer(), task->data.getSize());
+    }
+  } catch (...) {
+    // The queued tasks refer to the data of the caller.
+    for (; numDone < numQueued; numDone++) {
+      try {
+        m_threadPool->waitForTask(m_tasks[numDone % numTasks]);
+      } catch (...) {
+      }
+    }
+    throw;
+  }
+
+  sendTileData(&m_rgbData);
+}
+
+void ZrleEncoder::sendTileData(const ScratchBuffer *data)
+{
+  // If area of rect == 0, send length of zlib data == 0.
+  if (data->isEmpty()) {
+    m_output->writeUInt32(0);
+  } else {
+    m_deflater.setInput(reinterpret_cast<const char *>(data->getBuffer()),
+                        data->getSize());
+    m_deflater.deflate();
   
-  m_fbWidth = clientFb->getDimension().width;
-  size_t bpp = clientFb->getBitsPerPixel();
+    m_output->writeUInt32(m_deflater.getOutputSize());
+    m_output->writeFully(m_deflater.getOutput(),
+                         m_deflater.getOutputSize());
+  }
+}
+
+void ZrleEncoder::encodeTiles(TileTask *task) const
+{
+  task->data.clear();
+
+  // Each task converts its band into its own buffer, so the pool threads
+  // do not share any memory for the converted pixels.
+  task->clientFb = task->conversion.convert(m_pixelConverter, &task->rect,
+                                            task->serverFb);
+
+  size_t bpp = task->clientFb->getBitsPerPixel();
   if (bpp == 8) {
-    sendRect<UINT8>(rect, serverFb, clientFb, options);
+    encodeTiles<UINT8>(task);
   } else if (bpp == 16) {
-    sendRect<UINT16>(rect, serverFb, clientFb, options);
+    encodeTiles<UINT16>(task);
   } else if (bpp == 32) {
-    sendRect<UINT32>(rect, serverFb, clientFb, options);
+    encodeTiles<UINT32>(task);
   } else {
     _ASSERT(0);
   }
 }
 
 template <class PIXEL_T>
-void ZrleEncoder::sendRect(const Rect *rect,
-                           const FrameBuffer *serverFb,
-                           const FrameBuffer *clientFb,
-                           const EncodeOptions *options)
+void ZrleEncoder::encodeTiles(TileTask *task) const
 {
-  m_rgbData.resize(0);
-  const PIXEL_T *buffer = static_cast<const PIXEL_T *>(clientFb->getBuffer());
-  
+  const Rect *rect = &task->rect;
   Rect tileRect;
   for (tileRect.top = rect->top; tileRect.top < rect->bottom; tileRect.top += TILE_SIZE) {
 
@@ -131,190 +270,184 @@ void ZrleEncoder::sendRect(const Rect *rect,
 
       tileRect.right = min(rect->right, tileRect.left + TILE_SIZE);
 
-      // Clear sizes and vector with plain RLE tile.
-      m_rawTileSize = 0;
-      m_paletteTileSize = 0;
-      m_paletteRleTileSize = 0;
-      m_plainRleTile.clear();
-
-      fillPalette<PIXEL_T>(&tileRect, clientFb);
-      int numColors = m_pal.getNumColors();
-      m_oldSize = m_rgbData.size();
-      
-      // If number of colors is 1 the tile with minimal size is solid.
-      if (numColors == 1) {
-        writeSolidTile();
-      // Else calculate sizes of tile with other encodings
-      // and choose encoding type when size is the minimal.
-      } else {
-        // Calculate size of packed pixels in palette.
-        if (numColors == 2) {
-          m_mSize = ((tileRect.getWidth() + 7) / 8) * tileRect.getHeight();
-        } else if (numColors == 3 || numColors == 4) {
-          m_mSize = ((tileRect.getWidth() + 3) / 4) * tileRect.getHeight();
-        } else {
-          m_mSize = ((tileRect.getWidth() + 1) / 2) * tileRect.getHeight();
-        }
-        
-        //TODO: Test this code
-        // Size of raw tile is (1 + width * height * pixelSize).
-        m_rawTileSize = 1 + tileRect.area() * m_bytesPerPixel;
-        // Size of palette tile.
-        if (numColors > 1 && numColors <= 16) {
-          m_paletteTileSize = 1 + numColors * m_bytesPerPixel + m_mSize;
-        } else {
-          m_paletteTileSize = THIS_TYPE_OF_TILE_IS_NOT_POSSIBLE;
-        }
-        // Size of palette RLE tile.
-        if (numColors > 16 && numColors <= 127) {
-          m_paletteRleTileSize += numColors * m_bytesPerPixel;
-        } else {
-          m_paletteRleTileSize = THIS_TYPE_OF_TILE_IS_NOT_POSSIBLE;
-        }
-        // Choose the size of the min tile.
-        size_t minSizeOfTile = m_rawTileSize;
-        if (m_paletteTileSize < minSizeOfTile) {
-          minSizeOfTile = m_paletteTileSize;
-        }
-        if (m_plainRleTile.size() < minSizeOfTile) {
-          minSizeOfTile = m_plainRleTile.size();
-        }
-        if (m_paletteRleTileSize < minSizeOfTile) {
-          minSizeOfTile = m_paletteRleTileSize;
-        }
-
-        // Write the tile with the min size.
-        if (minSizeOfTile == m_rawTileSize) {
-          writeRawTile<PIXEL_T>(&tileRect, clientFb);
-        } else if (minSizeOfTile == m_paletteTileSize) {
-          writePackedPaletteTile<PIXEL_T>(&tileRect, clientFb);
-        } else if (minSizeOfTile == m_plainRleTile.size()) {
-          m_rgbData.resize(m_oldSize + m_plainRleTile.size());
-          memcpy(&m_rgbData[m_oldSize],
-                 &m_plainRleTile.front(),
-                 m_plainRleTile.size());
-        } else if (minSizeOfTile == m_paletteRleTileSize) {
-          writePaletteRleTile<PIXEL_T>(&tileRect, clientFb);
-        }
-      }
+      encodeTile<PIXEL_T>(&tileRect, task);
     }
   }
+}
 
-  // If area of rect == 0, send length of zlib data == 0.
-  if (m_rgbData.empty()) {
-    m_output->writeUInt32(0);
+template <class PIXEL_T>
+void ZrleEncoder::encodeTile(const Rect *tileRect, TileTask *task) const
+{
+  const FrameBuffer *fb = task->clientFb;
+  fillPalette<PIXEL_T>(tileRect, fb, task);
+  int numColors = task->pal.getNumColors();
+
+  // If number of colors is 1 the tile with minimal size is solid.
+  if (numColors == 1) {
+    writeSolidTile(task->pal.getEntry(0), &task->data);
+    return;
+  }
+
+  // Else calculate sizes of tile with other encodings
+  // and choose encoding type when size is the minimal.
+
+  // Calculate size of packed pixels in palette.
+  size_t packedSize;
+  if (numColors == 2) {
+    packedSize = ((tileRect->getWidth() + 7) / 8) * tileRect->getHeight();
+  } else if (numColors == 3 || numColors == 4) {
+    packedSize = ((tileRect->getWidth() + 3) / 4) * tileRect->getHeight();
   } else {
-    m_deflater.setInput(reinterpret_cast<const char *>(&m_rgbData.front()),
-                        m_rgbData.size());
-    m_deflater.deflate();
-  
-    m_output->writeUInt32(m_deflater.getOutputSize());
-    m_output->writeFully(m_deflater.getOutput(),
-                         m_deflater.getOutputSize());
+    packedSize = ((tileRect->getWidth() + 1) / 2) * tileRect->getHeight();
+  }
+
+  // Size of raw tile is (1 + width * height * pixelSize).
+  size_t rawTileSize = 1 + tileRect->area() * m_bytesPerPixel;
+  // Size of palette tile.
+  size_t paletteTileSize;
+  if (numColors > 1 && numColors <= 16) {
+    paletteTileSize = 1 + numColors * m_bytesPerPixel + packedSize;
+  } else {
+    paletteTileSize = THIS_TYPE_OF_TILE_IS_NOT_POSSIBLE;
+  }
+  // Size of palette RLE tile.
+  size_t paletteRleTileSize;
+  if (numColors > 16 && numColors <= 127) {
+    paletteRleTileSize = task->paletteRleTileSize + numColors * m_bytesPerPixel;
+  } else {
+    paletteRleTileSize = THIS_TYPE_OF_TILE_IS_NOT_POSSIBLE;
+  }
+  size_t plainRleTileSize = task->plainRleTile.getSize();
+
+  // Choose the size of the min tile.
+  size_t minSizeOfTile = rawTileSize;
+  if (paletteTileSize < minSizeOfTile) {
+    minSizeOfTile = paletteTileSize;
+  }
+  if (plainRleTileSize < minSizeOfTile) {
+    minSizeOfTile = plainRleTileSize;
+  }
+  if (paletteRleTileSize < minSizeOfTile) {
+    minSizeOfTile = paletteRleTileSize;
+  }
+
+  // Write the tile with the min size.
+  if (minSizeOfTile == rawTileSize) {
+    writeRawTile<PIXEL_T>(tileRect, fb, &task->data);
+  } else if (minSizeOfTile == paletteTileSize) {
+    writePackedPaletteTile<PIXEL_T>(tileRect, fb, &task->pal, packedSize,
+                                    &task->data);
+  } else if (minSizeOfTile == plainRleTileSize) {
+    task->data.append(task->plainRleTile.getBuffer(), plainRleTileSize);
+  } else if (minSizeOfTile == paletteRleTileSize) {
+    writePaletteRleTile<PIXEL_T>(tileRect, fb, &task->pal, &task->data);
   }
 }
 
 template <class PIXEL_T>
 void ZrleEncoder::writeRawTile(const Rect *tileRect,
-                               const FrameBuffer *fb)
+                               const FrameBuffer *fb,
+                               ScratchBuffer *dst) const
 {
-  m_oldSize = m_rgbData.size();
-  m_rgbData.resize(m_oldSize + tileRect->area() * m_bytesPerPixel + 1);
-  m_rgbData[m_oldSize] = 0;
+  size_t oldSize = dst->getSize();
+  dst->resize(oldSize + tileRect->area() * m_bytesPerPixel + 1);
+  (*dst)[oldSize] = 0;
   if (m_bytesPerPixel == 3) {
-    copyCPixels(tileRect, fb, &m_rgbData[m_oldSize + 1]);
+    copyCPixels(tileRect, fb, &(*dst)[oldSize + 1]);
   } else {
-    copyPixels<PIXEL_T>(tileRect, fb, &m_rgbData[m_oldSize + 1]);
+    copyPixels<PIXEL_T>(tileRect, fb, &(*dst)[oldSize + 1]);
   }
 }
 
-void ZrleEncoder::writeSolidTile() throw(IOException)
+void ZrleEncoder::writeSolidTile(UINT32 color, ScratchBuffer *dst) const
 {
-  m_oldSize = m_rgbData.size();
-  UINT32 colorPixel = m_pal.getEntry(0);
-  m_rgbData.resize(m_oldSize + m_bytesPerPixel + 1);
-  m_rgbData[m_oldSize] = 1;
-  memcpy(&m_rgbData[m_oldSize + 1], &colorPixel + m_numberFirstByte, m_bytesPerPixel);
+  size_t oldSize = dst->getSize();
+  dst->resize(oldSize + m_bytesPerPixel + 1);
+  (*dst)[oldSize] = 1;
+  memcpy(&(*dst)[oldSize + 1], (UINT8 *)&color + m_numberFirstByte,
+         m_bytesPerPixel);
+}
+
+void ZrleEncoder::writePalette(const TightPalette *pal, UINT8 *dst) const
+{
+  int numColors = pal->getNumColors();
+  for (int i = 0; i < numColors; i++) {
+    UINT32 buf = pal->getEntry(i);
+    memcpy(dst + i * m_bytesPerPixel,
+           (UINT8 *)&buf + m_numberFirstByte,
+           m_bytesPerPixel);
+  }
 }
 
 template <class PIXEL_T>
 void ZrleEncoder::writePackedPaletteTile(const Rect *tileRect,
-                                         const FrameBuffer *fb)
+                                         const FrameBuffer *fb,
+                                         const TightPalette *pal,
+                                         size_t packedSize,
+                                         ScratchBuffer *dst) const
 {
-  int numColors = m_pal.getNumColors();
-  m_oldSize = m_rgbData.size();
-  UINT8 deltaOffset;
+  int numColors = pal->getNumColors();
+  size_t oldSize = dst->getSize();
+  int bitsPerIndex;
   if (numColors == 2) {
-    deltaOffset = 1;
+    bitsPerIndex = 1;
   } else if (numColors == 3 || numColors == 4) {
-    deltaOffset = 2;
+    bitsPerIndex = 2;
   } else {
-    deltaOffset = 4;
+    bitsPerIndex = 4;
   }
 
-  // Resize of m_rgbData for a new chunk of data.
-  // m_oldSize + sizeof(subencodingByte + palette + packedPixels)
-  m_rgbData.resize(m_oldSize + 1 + numColors * m_bytesPerPixel + m_mSize);
+  // Resize the buffer for a new chunk of data.
+  // oldSize + sizeof(subencodingByte + palette + packedPixels)
+  dst->resize(oldSize + 1 + numColors * m_bytesPerPixel + packedSize);
 
   // Write type of subencoding.
-  m_rgbData[m_oldSize] = numColors;
+  (*dst)[oldSize] = numColors;
 
   // Write palette.
-  for (int i = 0; i < numColors; i++) {
-    UINT32 buf = m_pal.getEntry(i);
-    memcpy(&m_rgbData[m_oldSize + 1 + i * m_bytesPerPixel],
-             &buf + m_numberFirstByte,
-             m_bytesPerPixel);
-  }
-
-  // Pack pixels.
-  const PIXEL_T *buffer = static_cast<const PIXEL_T *>(fb->getBuffer());
-  UINT8 packedByte = 0;
-  int indexOfM = 0;
-  int offset = 8;
-
-  Rect rect;
-  for (rect.top = tileRect->top; rect.top < tileRect->bottom; rect.top++) {
-    for (rect.left = tileRect->left; rect.left < tileRect->right; rect.left++) {
-      PIXEL_T px = buffer[rect.top * m_fbWidth + rect.left];
-      UINT8 indexOfColor = m_pal.getIndex(px);
-      if (offset != 0) {
-        packedByte = packedByte << deltaOffset;
-        packedByte = packedByte | indexOfColor;
-        offset -= deltaOffset;
-      }
-      else {
-        // Write next packed byte.
-        m_rgbData[m_oldSize + 1 + numColors * m_bytesPerPixel + indexOfM] = packedByte;
-        indexOfM++;
-        packedByte = 0;
-        offset = 8;
-
-        packedByte = packedByte << deltaOffset;
-        packedByte = packedByte | indexOfColor;
-        offset -= deltaOffset;
+  writePalette(pal, &(*dst)[oldSize + 1]);
+
+  // Pack pixels, each row starts from a new byte. Runs of equal pixels
+  // are looked up in the palette at once.
+  UINT8 *packed = &(*dst)[oldSize + 1 + numColors * m_bytesPerPixel];
+  const PIXEL_T *row = (const PIXEL_T *)fb->getBufferPtr(tileRect->left,
+                                                          tileRect->top);
+  const int stride = fb->getDimension().width;
+  const int w = tileRect->getWidth();
+  const int h = tileRect->getHeight();
+  for (int y = 0; y < h; y++, row += stride) {
+    UINT8 packedByte = 0;
+    int freeBits = 8;
+    int x = 0;
+    while (x < w) {
+      PIXEL_T px = row[x];
+      int n = findRunEnd(row + x, w - x, px);
+      UINT8 indexOfColor = pal->getIndex(px);
+      x += n;
+      for (; n > 0; n--) {
+        packedByte = (UINT8)((packedByte << bitsPerIndex) | indexOfColor);
+        freeBits -= bitsPerIndex;
+        if (freeBits == 0) {
+          *packed++ = packedByte;
+          packedByte = 0;
+          freeBits = 8;
+        }
       }
     }
-    while (offset != 0) {
-      packedByte = packedByte << deltaOffset;
-      offset -= deltaOffset;
+    if (freeBits != 8) {
+      *packed++ = (UINT8)(packedByte << freeBits);
     }
-    // Write next packed byte.
-    m_rgbData[m_oldSize + 1 + numColors * m_bytesPerPixel + indexOfM] = packedByte;
-    indexOfM++;
-    packedByte = 0;
-    offset = 8;
   }
 }
 
 void ZrleEncoder::pushRunLengthPaletteRle(int runLength,
-                                          std::vector<UINT8> *paletteRleData)
+                                          ScratchBuffer *paletteRleData)
 {
   do {
     if (runLength > 255) {
-      paletteRleData->push_back(255); 
+      paletteRleData->append(255); 
     } else {
-      paletteRleData->push_back(runLength);
+      paletteRleData->append(runLength);
     }
     runLength -= 255;
   } while (runLength >= 0);
@@ -322,100 +455,105 @@ void ZrleEncoder::pushRunLengthPaletteRle(int runLength,
 
 template <class PIXEL_T>
 void ZrleEncoder::writePaletteRleTile(const Rect *tileRect,
-                                      const FrameBuffer *fb)
+                                      const FrameBuffer *fb,
+                                      const TightPalette *pal,
+                                      ScratchBuffer *dst) const
 {
-  int numColors = m_pal.getNumColors();
-  std::vector<UINT8> paletteRleData;
-  paletteRleData.resize(1 + numColors * m_bytesPerPixel);
+  int numColors = pal->getNumColors();
+  size_t oldSize = dst->getSize();
+  dst->resize(oldSize + 1 + numColors * m_bytesPerPixel);
 
   // Write type of subencoding.
-  paletteRleData[0] = numColors + 128;
+  (*dst)[oldSize] = numColors + 128;
 
   // Write palette.
-  for (int i = 0; i < numColors; i++) {
-    UINT32 buf = m_pal.getEntry(i);
-    memcpy(&paletteRleData[1 + i * m_bytesPerPixel],
-             &buf + m_numberFirstByte,
-             m_bytesPerPixel);
-  }
-
-  const PIXEL_T *buffer = static_cast<const PIXEL_T *>(fb->getBuffer());
-  PixelFormat pxFormat = fb->getPixelFormat();
+  writePalette(pal, &(*dst)[oldSize + 1]);
 
-  // There is the first iteration of loop below.
-  PIXEL_T px = buffer[tileRect->top * m_fbWidth + tileRect->left];
-  UINT8 indexOfColor = m_pal.getIndex(px);
+  // Runs of equal pixels are found row by row, a run of an index may
+  // continue on the next row or consist of several pixel runs.
+  const PIXEL_T *row = (const PIXEL_T *)fb->getBufferPtr(tileRect->left,
+                                                          tileRect->top);
+  const int stride = fb->getDimension().width;
+  const int w = tileRect->getWidth();
+  const int h = tileRect->getHeight();
 
-  // Processing of the first pixel.
-  paletteRleData.push_back(indexOfColor);
-  UINT8 previousIndexOfColor = indexOfColor;
-  
+  UINT8 runIndex = pal->getIndex(row[0]);
   int runLength = 0;
-  for (int i = 1; i < tileRect->area(); ++i) {
-    // FIXME: This variant may be not the most optimal.
-    // One of the possible variant is double for loops.
-    int x = tileRect->left + i % tileRect->getWidth();
-    int y = tileRect->top + i / tileRect->getWidth();
-
-    px = buffer[y * m_fbWidth + x];
-
-    indexOfColor = m_pal.getIndex(px);
-    if (indexOfColor != previousIndexOfColor) {
-      if (runLength > 0) {
-        pushRunLengthPaletteRle(runLength, &paletteRleData);
+  for (int y = 0; y < h; y++, row += stride) {
+    int x = 0;
+    while (x < w) {
+      PIXEL_T px = row[x];
+      int n = findRunEnd(row + x, w - x, px);
+      UINT8 indexOfColor = pal->getIndex(px);
+      x += n;
+      if (indexOfColor != runIndex) {
+        if (runLength > 1) {
+          dst->append(runIndex | 0x80);
+          pushRunLengthPaletteRle(runLength - 1, dst);
+        } else {
+          dst->append(runIndex);
+        }
+        runIndex = indexOfColor;
         runLength = 0;
       }
-      paletteRleData.push_back(indexOfColor);
-      previousIndexOfColor = indexOfColor;
-    } else {
-      runLength++;
-      paletteRleData.back() |= 0x80;
+      runLength += n;
     }
   }
-  if (runLength > 0) {
-    pushRunLengthPaletteRle(runLength, &paletteRleData);
+  if (runLength > 1) {
+    dst->append(runIndex | 0x80);
+    pushRunLengthPaletteRle(runLength - 1, dst);
+  } else {
+    dst->append(runIndex);
   }
-
-  m_oldSize = m_rgbData.size();
-  m_rgbData.resize(m_oldSize + paletteRleData.size());
-  memcpy(&m_rgbData[m_oldSize], &paletteRleData[0], paletteRleData.size());
 }
 
-void ZrleEncoder::pushRunLengthRle(int runLength)
+void ZrleEncoder::pushRunLengthRle(int runLength, TileTask *task) const
 {
   do {
     if (runLength > 255) {
-      m_plainRleTile.push_back(255);
+      task->plainRleTile.append(255);
     } else {
-      m_plainRleTile.push_back(runLength);
+      task->plainRleTile.append(runLength);
     }
     // Increase the size of palette RLE tile.
-    m_paletteRleTileSize++;
+    task->paletteRleTileSize++;
     runLength -= 255;
   } while (runLength >= 0);
 }
 
 template <class PIXEL_T>
 void ZrleEncoder::writePixelToPlainRleTile(const PIXEL_T px,
-                                           PIXEL_T *previousPx)
+                                           TileTask *task) const
 {
-  m_plainRleTile.resize(m_plainRleTile.size() + m_bytesPerPixel);
-  memcpy(&m_plainRleTile[m_plainRleTile.size() - m_bytesPerPixel],
-          &px + m_numberFirstByte,
-          m_bytesPerPixel);
-  *previousPx = px;
+  task->plainRleTile.append((const UINT8 *)&px + m_numberFirstByte,
+                            m_bytesPerPixel);
+}
+
+template <class PIXEL_T>
+int ZrleEncoder::findRunEnd(const PIXEL_T *pixels, int count, PIXEL_T value)
+{
+  int i = 0;
+  while (i < count && pixels[i] == value) {
+    i++;
+  }
+  return i;
+}
+
+int ZrleEncoder::findRunEnd(const UINT32 *pixels, int count, UINT32 value)
+{
+  return TightSimd::findRunEnd(pixels, count, value);
 }
 
 template <class PIXEL_T>
 void ZrleEncoder::fillPalette(const Rect *tileRect,
-                              const FrameBuffer *fb)
+                              const FrameBuffer *fb,
+                              TileTask *task) const
 {
   // Clear the palette.
-  m_pal.reset();
-  m_pal.setMaxColors(MAX_NUMBER_OF_COLORS_IN_PALETTE);
-  int tryInsertPx = 1;
+  task->pal.reset();
+  task->pal.setMaxColors(MAX_NUMBER_OF_COLORS_IN_PALETTE);
+  task->paletteFull = false;
 
-  const PIXEL_T *buffer = (const PIXEL_T *)fb->getBuffer();
   PixelFormat pxFormat = fb->getPixelFormat();
 
   // Mask for cutting rubbish bits.
@@ -423,68 +561,69 @@ void ZrleEncoder::fillPalette(const Rect *tileRect,
                  pxFormat.greenMax << pxFormat.greenShift |
                  pxFormat.blueMax << pxFormat.blueShift;
 
-  // There is the first iteration of loop below.
-  // Pixel for adding to plainRleTile
-  PIXEL_T previousPx;
-  PIXEL_T px = buffer[tileRect->top * m_fbWidth + tileRect->left];
+  const PIXEL_T *row = (const PIXEL_T *)fb->getBufferPtr(tileRect->left,
+                                                          tileRect->top);
+  const int stride = fb->getDimension().width;
+  const int w = tileRect->getWidth();
+  const int h = tileRect->getHeight();
 
-  // Pixel for adding to palette
-  PIXEL_T oldPixel = px;
-  int palLength = 1;
-  
-  // Fill RLE tile vector.
-  px &= mask;
-  // Write type of subencoding.
-  m_plainRleTile.push_back(128);
+  // Write type of subencoding and the first pixel of plain RLE tile.
+  task->plainRleTile.clear();
+  task->plainRleTile.append(128);
+  task->rlePixel = row[0] & mask;
+  task->rleLength = 0;
+  writePixelToPlainRleTile<PIXEL_T>((PIXEL_T)task->rlePixel, task);
 
   // Calculate size of palette RLE tile.
-  m_paletteRleTileSize = 1;
-  writePixelToPlainRleTile<PIXEL_T>(px, &previousPx);
-
-  // Increase the size of palette RLE tile.
-  m_paletteRleTileSize++;
+  task->paletteRleTileSize = 2;
 
+  // Runs of equal pixels are counted at once and may continue on the next
+  // row.
+  PIXEL_T runColor = row[0];
   int runLength = 0;
-  for (int i = 1; i < tileRect->area(); ++i) {
-    // FIXME: This variant may be not the most optimal.
-    // One of the possible variant is double for loops.
-    int x = tileRect->left + i % tileRect->getWidth();
-    int y = tileRect->top + i / tileRect->getWidth();
-
-    px = buffer[y * m_fbWidth + x];
-    
-    // Fill palette
-    if (tryInsertPx && oldPixel != px) {
-      tryInsertPx = m_pal.insert(oldPixel, palLength);
-      oldPixel = px;
-      palLength = 1;
-    } else {
-      palLength++;
-    }
-    
-    // Fill RLE tile vector.
-    px &= mask;
-    if (px != previousPx) {
-      pushRunLengthRle(runLength);
-      runLength = 0;
-      writePixelToPlainRleTile<PIXEL_T>(px, &previousPx);
-    } else {
-      runLength++;
+  for (int y = 0; y < h; y++, row += stride) {
+    int x = 0;
+    while (x < w) {
+      int n = findRunEnd(row + x, w - x, runColor);
+      runLength += n;
+      x += n;
+      if (x < w) {
+        addPixelRun<PIXEL_T>(runColor, runLength, mask, task);
+        runColor = row[x];
+        runLength = 0;
+      }
     }
   }
-  if (tryInsertPx) {
-    m_pal.insert(oldPixel, palLength);
+  addPixelRun<PIXEL_T>(runColor, runLength, mask, task);
+  pushRunLengthRle(task->rleLength - 1, task);
+}
+
+template <class PIXEL_T>
+void ZrleEncoder::addPixelRun(PIXEL_T px, int runLength, PIXEL_T mask,
+                              TileTask *task) const
+{
+  if (!task->paletteFull) {
+    task->paletteFull = task->pal.insert(px, runLength) == 0;
   }
-  pushRunLengthRle(runLength);
+
+  // Pixels of plain RLE tile are compared without rubbish bits, so
+  // adjacent runs may merge.
+  px &= mask;
+  if (px != (PIXEL_T)task->rlePixel) {
+    pushRunLengthRle(task->rleLength - 1, task);
+    writePixelToPlainRleTile<PIXEL_T>(px, task);
+    task->rlePixel = px;
+    task->rleLength = 0;
+  }
+  task->rleLength += runLength;
 }
 
 template <class PIXEL_T>
 void ZrleEncoder::copyPixels(const Rect *rect,
                              const FrameBuffer *fb,
-                             UINT8 *dst)
+                             UINT8 *dst) const
 {
   const int rectHeight = rect->getHeight();
-  const int rectWidth = rect->getWidth();
   const PIXEL_T *src = static_cast<const PIXEL_T *>(fb->getBufferPtr(rect->left, rect->top));
   const int fbStride = fb->getDimension().width;
   const size_t bytesPerRow = rect->getWidth() * m_bytesPerPixel;
@@ -498,7 +637,7 @@ void ZrleEncoder::copyPixels(const Rect *rect,
 
 void ZrleEncoder::copyCPixels(const Rect *rect,
                               const FrameBuffer *fb,
-                              UINT8 *dst)
+                              UINT8 *dst) const
 {
   const int rectHeight = rect->getHeight();
   const int rectWidth = rect->getWidth();
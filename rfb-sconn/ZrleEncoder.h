@@ -28,6 +28,7 @@
 #include "Encoder.h"
 #include "TightPalette.h"
 #include "util/Deflater.h"
+#include "thread/ThreadPool.h"
 
 class ZrleEncoder : public Encoder
 {
@@ -47,71 +48,149 @@ public:
                              const FrameBuffer *serverFb,
                              const EncodeOptions *options) throw(IOException);
 
-private:
-  // Determine the class of rectangle and call necessary function for this type.
+  virtual void setScratchArena(ScratchArena *arena);
+
+  // Set the pool used to analyse tiles of large rectangles in parallel. If
+  // the pool is 0 or has a single thread, all tiles are encoded by the
+  // calling thread.
+  void setThreadPool(ThreadPool *threadPool);
+
+protected:
+  // A band of the rectangle being sent, one row of tiles high. The tiles of
+  // the band are analysed and serialized into the data buffer by
+  // encodeTiles(). It only reads the encoder fields describing the pixel
+  // format, so bands can be encoded on any thread. Only the deflate of the
+  // concatenated bands is sequential.
+  class TileTask : public ThreadPoolTask
+  {
+  public:
+    TileTask(ZrleEncoder *encoder);
+    virtual ~TileTask();
+
+    // Implementation of ThreadPoolTask, calls encodeTiles().
+    virtual void run() throw(Exception);
+
+    // Attach all buffers of the task to the arena.
+    void setScratchArena(ScratchArena *arena);
+
+    // Input data.
+    Rect rect;
+    const FrameBuffer *serverFb;
+
+    // Pixels of the band in the client's pixel format, clientFb is set by
+    // encodeTiles() and may be equal to serverFb.
+    ConversionBuffer conversion;
+    const FrameBuffer *clientFb;
+
+    // Data used while encoding a tile.
+    TightPalette pal;
+    // True if the tile has more colors than the palette can hold.
+    bool paletteFull;
+    // Plain RLE tile data.
+    ScratchBuffer plainRleTile;
+    // The last pixel written to the plain RLE tile and the length of its
+    // run so far.
+    UINT32 rlePixel;
+    int rleLength;
+    // Estimated size of palette RLE tile.
+    size_t paletteRleTileSize;
+
+    // The result, serialized tiles of the band.
+    ScratchBuffer data;
+
+  private:
+    ZrleEncoder *m_encoder;
+  };
+
+  // Encode all tiles of task->rect into task->data.
+  void encodeTiles(TileTask *task) const;
+
   template <class PIXEL_T>
-    void sendRect(const Rect *rect,
-                  const FrameBuffer *serverFb,
-                  const FrameBuffer *clientFb,
-                  const EncodeOptions *options) throw(IOException);
+    void encodeTiles(TileTask *task) const;
+
+  // Analyse one tile and append it to task->data using the subencoding
+  // giving the smallest size.
+  template <class PIXEL_T>
+    void encodeTile(const Rect *tileRect, TileTask *task) const;
+
+  // Send the rectangle splitted to bands by the thread pool.
+  void sendRectInParallel(const Rect *rect,
+                          const FrameBuffer *serverFb) throw(IOException);
+
+  bool shouldEncodeInParallel(const Rect *rect) const;
+
+  // Compress the serialized tiles and send them.
+  void sendTileData(const ScratchBuffer *data) throw(IOException);
 
   // Send raw tile.
   template <class PIXEL_T>
     void writeRawTile(const Rect *tileRect,
-                      const FrameBuffer *fb) throw(IOException);
+                      const FrameBuffer *fb,
+                      ScratchBuffer *dst) const;
 
   // Send a solid-color tile.
-    void writeSolidTile() throw(IOException);
+  void writeSolidTile(UINT32 color, ScratchBuffer *dst) const;
   
   // Send packed palette tile.
   template <class PIXEL_T>
     void writePackedPaletteTile(const Rect *tileRect,
-                                const FrameBuffer *fb) throw(IOException);
+                                const FrameBuffer *fb,
+                                const TightPalette *pal,
+                                size_t packedSize,
+                                ScratchBuffer *dst) const;
 
   // Send palette RLE tile.
   template <class PIXEL_T>
     void writePaletteRleTile(const Rect *tileRect,
-                             const FrameBuffer *fb) throw(IOException);
+                             const FrameBuffer *fb,
+                             const TightPalette *pal,
+                             ScratchBuffer *dst) const;
+
+  // Write palette entries in the CPIXEL format.
+  void writePalette(const TightPalette *pal, UINT8 *dst) const;
 
   // Write data from runLength (used in plain Rle encoding).
-  void pushRunLengthRle(int runLength);
+  void pushRunLengthRle(int runLength, TileTask *task) const;
 
   // Write data from runLength (used in palette Rle encoding).
-  void pushRunLengthPaletteRle(int runLength,
-                                 std::vector<UINT8> *paletteRleData);
+  static void pushRunLengthPaletteRle(int runLength,
+                                      ScratchBuffer *paletteRleData);
 
-  // Write pixel to the plainRleTile.
+  // Account a run of equal pixels in the palette and the plain RLE tile.
   template <class PIXEL_T>
-    void writePixelToPlainRleTile(const PIXEL_T px,
-                                  PIXEL_T *previousPx);
+    void addPixelRun(PIXEL_T px, int runLength, PIXEL_T mask,
+                     TileTask *task) const;
 
-  // Fill palette (m_pal), create m_plainRleTile vector and calculate size of data in palette RLE tile.
+  // Write pixel to the plain RLE tile.
+  template <class PIXEL_T>
+    void writePixelToPlainRleTile(const PIXEL_T px, TileTask *task) const;
+
+  // Fill palette (task->pal), create the plain RLE tile and calculate size
+  // of data in palette RLE tile.
   template <class PIXEL_T>
     void fillPalette(const Rect *tileRect,
-                     const FrameBuffer *fb);
+                     const FrameBuffer *fb,
+                     TileTask *task) const;
+
+  // Return the number of leading pixels equal to value (at most count).
+  template <class PIXEL_T>
+    static int findRunEnd(const PIXEL_T *pixels, int count, PIXEL_T value);
+  static int findRunEnd(const UINT32 *pixels, int count, UINT32 value);
 
   // Copy ordinary PIXELs.
   template <class PIXEL_T>
     void copyPixels(const Rect *rect,
                     const FrameBuffer *fb,
-                    UINT8 *dst);
+                    UINT8 *dst) const;
   
   // Copy CPIXELs.
   void copyCPixels(const Rect *rect,
                    const FrameBuffer *fb,
-                   UINT8 *dst);
-
-  // Vector for storing all tiles for the future zlib compression.
-  std::vector<UINT8> m_rgbData;
-  // Size of m_rgbData before writing information in it.
-  size_t m_oldSize;
+                   UINT8 *dst) const;
 
-  // Size of stride.
-  int m_fbWidth;
+  // Buffer for concatenating tiles of all bands for the zlib compression.
+  ScratchBuffer m_rgbData;
 
-  // Size of packed pixels in palette.
-  int m_mSize;
-  
   // The only pixel format type for whole rectangle.
   PixelFormat m_pxFormat;
 
@@ -124,22 +203,26 @@ private:
   int m_idxZlibLevel;
   int m_monoZlibLevel;
   int m_rawZlibLevel;
-  
-  // Color palette.
-  TightPalette m_pal;
 
-  // Variables for storing size of all tiles.
-  size_t m_rawTileSize;
-  size_t m_paletteTileSize;
-  size_t m_paletteRleTileSize;
+  // Task used when tiles are encoded by the calling thread.
+  TileTask m_serialTask;
 
-  // vector for storing plain RLE tile data
-  std::vector<UINT8> m_plainRleTile;
+  // Thread pool for parallel encoding, may be 0.
+  ThreadPool *m_threadPool;
+  // Tasks used for parallel encoding, the number of tasks is proportional
+  // to the number of threads in the pool.
+  std::vector<TileTask *> m_tasks;
+
+  ScratchArena *m_scratchArena;
 
 private:
   // Tile size in ZRLE encoding by default.
   static const int TILE_SIZE = 64;
 
+  // Rectangles with fewer tiles are always encoded serially.
+  static const int MIN_PARALLEL_TILES = 8;
+  static const size_t TASKS_PER_THREAD = 2;
+
   // Default values for zlib settings.
   static const int ZLIB_IDX_LEVEL_DEFAULT = 7;
   static const int ZLIB_MONO_LEVEL_DEFAULT = 7;
@@ -83,6 +83,9 @@ public:
   static const int QUALITY_LEVEL_8 = -24;
   static const int QUALITY_LEVEL_9 = -23;
 
+  static const int FENCE = -312;
+  static const int CONTINUOUS_UPDATES = -313;
+
   static const char *const SIG_COMPR_LEVEL;
   static const char *const SIG_X_CURSOR;
   static const char *const SIG_RICH_CURSOR;
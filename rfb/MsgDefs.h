@@ -37,6 +37,8 @@ public:
   static const UINT32 KEYBOARD_EVENT = 4;
   static const UINT32 POINTER_EVENT = 5;
   static const UINT32 CLIENT_CUT_TEXT = 6;
+  static const UINT32 ENABLE_CONTINUOUS_UPDATES = 150;
+  static const UINT32 FENCE = 248;
 };
 
 class ServerMsgDefs
@@ -46,6 +48,24 @@ public:
   static const UINT32 SET_COLOR_MAP_ENTRIES = 1;
   static const UINT32 BELL = 2;
   static const UINT32 SERVER_CUT_TEXT = 3;
+  static const UINT32 END_OF_CONTINUOUS_UPDATES = 150;
+  static const UINT32 FENCE = 248;
+};
+
+// Flags and limits of the Fence message (the same in both directions).
+class FenceDefs
+{
+public:
+  // All messages before the fence must be processed before responding.
+  static const UINT32 BLOCK_BEFORE = 0x00000001;
+  // Messages after the fence must not be processed before responding.
+  static const UINT32 BLOCK_AFTER = 0x00000002;
+  // The message following the response must be processed synchronously.
+  static const UINT32 SYNC_NEXT = 0x00000004;
+  // Set in a fence request, cleared in the response.
+  static const UINT32 REQUEST = 0x80000000;
+
+  static const UINT8 MAX_PAYLOAD_LENGTH = 64;
 };
 
 #endif // __RFB_MSG_DEFS_H_INCLUDED__
@@ -25,42 +25,56 @@
 #include "PixelConverter.h"
 #include "util/inttypes.h"
 #include <crtdbg.h>
+#include <string.h>
 
 PixelConverter::PixelConverter(void)
 : m_convertMode(NO_CONVERT),
-  m_dstFrameBuffer(0)
+  m_hasSimdKernel(false)
 {
 }
 
 PixelConverter::~PixelConverter(void)
 {
-  reset();
 }
 
 void PixelConverter::convert(const Rect *rect, FrameBuffer *dstFb,
                              const FrameBuffer *srcFb) const
 {
-  if (m_convertMode == NO_CONVERT) {
-    dstFb->copyFrom(rect, srcFb, rect->left, rect->top);
-  } else {
-    int rectHeight = rect->getHeight();
-    int rectWidth = rect->getWidth();
-    int fbWidth = dstFb->getDimension().width;
-    PixelFormat dstPf = dstFb->getPixelFormat();
-    PixelFormat srcPf = srcFb->getPixelFormat();
+  int rectHeight = rect->getHeight();
+  int rectWidth = rect->getWidth();
+  if (rectHeight <= 0 || rectWidth <= 0) {
+    return;
+  }
+  PixelFormat dstPf = dstFb->getPixelFormat();
+  PixelFormat srcPf = srcFb->getPixelFormat();
 
-    UINT32 dstPixelSize = dstPf.bitsPerPixel / 8;
-    UINT32 srcPixelSize = srcPf.bitsPerPixel / 8;
+  UINT32 dstPixelSize = dstPf.bitsPerPixel / 8;
+  UINT32 srcPixelSize = srcPf.bitsPerPixel / 8;
 
-    // FIXME: Make FrameBuffer do the math.
-    UINT8 *dstPixP = (UINT8 *)dstFb->getBuffer() +
-                     (fbWidth * rect->top + rect->left) * dstPixelSize;
-    UINT8 *srcPixP = (UINT8 *)srcFb->getBuffer() +
-                     (fbWidth * rect->top + rect->left) * srcPixelSize;
-    if (m_convertMode == CONVERT_FROM_16) {
+  // The frame buffers may be of different widths, so each one is walked
+  // with its own stride.
+  int dstStride = dstFb->getBytesPerRow();
+  int srcStride = srcFb->getBytesPerRow();
+  UINT8 *dstPixP = (UINT8 *)dstFb->getBufferPtr(rect->left, rect->top);
+  UINT8 *srcPixP = (UINT8 *)srcFb->getBufferPtr(rect->left, rect->top);
+
+  if (m_convertMode == NO_CONVERT) {
+    size_t lineSize = rectWidth * srcPixelSize;
+    for (int i = 0; i < rectHeight; i++,
+         dstPixP += dstStride, srcPixP += srcStride) {
+      memcpy(dstPixP, srcPixP, lineSize);
+    }
+  } else {
+    if (m_hasSimdKernel) {
+      for (int i = 0; i < rectHeight; i++,
+           dstPixP += dstStride, srcPixP += srcStride) {
+        PixelConverterSimd::convertRow(&m_simdKernel, srcPixP, dstPixP,
+                                       rectWidth);
+      }
+    } else if (m_convertMode == CONVERT_FROM_16) {
       for (int i = 0; i < rectHeight; i++,
-           dstPixP += (fbWidth - rectWidth) * dstPixelSize,
-           srcPixP += (fbWidth - rectWidth) * srcPixelSize) {
+           dstPixP += dstStride - rectWidth * dstPixelSize,
+           srcPixP += srcStride - rectWidth * srcPixelSize) {
         for (int j = 0; j < rectWidth; j++,
                                        dstPixP += dstPixelSize,
                                        srcPixP += srcPixelSize) {
@@ -81,8 +95,8 @@ void PixelConverter::convert(const Rect *rect, FrameBuffer *dstFb,
       UINT32 srcBluMax = srcPf.blueMax;
 
       for (int i = 0; i < rectHeight; i++,
-           dstPixP += (fbWidth - rectWidth) * dstPixelSize,
-           srcPixP += (fbWidth - rectWidth) * srcPixelSize) {
+           dstPixP += dstStride - rectWidth * dstPixelSize,
+           srcPixP += srcStride - rectWidth * srcPixelSize) {
         for (int j = 0; j < rectWidth; j++,
                                        dstPixP += dstPixelSize,
                                        srcPixP += srcPixelSize) {
@@ -114,47 +128,15 @@ void PixelConverter::convert(const Rect *rect, FrameBuffer *dstFb,
   }
 }
 
-const FrameBuffer *
-PixelConverter::convert(const Rect *rect, const FrameBuffer *srcFb)
+bool PixelConverter::needsConversion() const
 {
-  if (m_convertMode == NO_CONVERT) {
-    return srcFb;
-  }
-
-  const Dimension fbSize = srcFb->getDimension();
-  if (m_dstFrameBuffer == 0) {
-    // No frame buffer allocated - construct new one from the scratch.
-    m_dstFrameBuffer = new FrameBuffer;
-    m_dstFrameBuffer->setProperties(&fbSize, &m_dstFormat);
-  } else if (!m_dstFrameBuffer->getDimension().isEqualTo(&fbSize)) {
-    // Frame buffer is allocated but its size it wrong - just resize it.
-    // Note that if the frame buffer is allocated, its pixel format is
-    // guaranteed to be relevant, because setPixelFormats() always calls
-    // reset() if at least one pixel format has been changed.
-    m_dstFrameBuffer->setDimension(&fbSize);
-  }
-
-  // Finally, convert pixels.
-  convert(rect, m_dstFrameBuffer, srcFb);
-  return m_dstFrameBuffer;
-}
-
-void PixelConverter::reset()
-{
-  // Deallocate the framebuffer.
-  if (m_dstFrameBuffer != 0) {
-    delete m_dstFrameBuffer;
-    m_dstFrameBuffer = 0;
-  }
+  return m_convertMode != NO_CONVERT;
 }
 
 void PixelConverter::setPixelFormats(const PixelFormat *dstPf,
                                      const PixelFormat *srcPf)
 {
   if (!srcPf->isEqualTo(&m_srcFormat) || !dstPf->isEqualTo(&m_dstFormat)) {
-    // Reset both translation tables and the internal frame buffer.
-    reset();
-
     if (srcPf->isEqualTo(dstPf)) {
       m_convertMode = NO_CONVERT;
     } else if (srcPf->bitsPerPixel == 16) { // 16 bit -> N
@@ -165,6 +147,12 @@ void PixelConverter::setPixelFormats(const PixelFormat *dstPf,
       fill32BitsTable(dstPf, srcPf);
     }
 
+    // Use a vectorized kernel if there is one for the formats. The tables
+    // remain the reference for it (see PixelConverterTest in
+    // server-core-test).
+    m_hasSimdKernel = m_convertMode != NO_CONVERT &&
+                      PixelConverterSimd::prepare(dstPf, srcPf, &m_simdKernel);
+
     m_srcFormat = *srcPf;
     m_dstFormat = *dstPf;
   }
@@ -180,6 +168,11 @@ size_t PixelConverter::getDstBitsPerPixel() const
   return m_dstFormat.bitsPerPixel;
 }
 
+PixelFormat PixelConverter::getDstPixelFormat() const
+{
+  return m_dstFormat;
+}
+
 void PixelConverter::fillHexBitsTable(const PixelFormat *dstPf,
                                       const PixelFormat *srcPf)
 {
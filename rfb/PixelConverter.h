@@ -26,6 +26,7 @@
 #define __RFB_PIXEL_CONVERTER_H_INCLUDED__
 
 #include "FrameBuffer.h"
+#include "PixelConverterSimd.h"
 #include "region/Point.h"
 
 class PixelConverter
@@ -36,25 +37,17 @@ public:
 
   // Convert pixels for the specified `rect' from `srcFb' to `dstFb'.
   // The pixel formats of `srcFb' and `dstFb' must be identical to the formats
-  // set by the most recent setPixelFormats() call. The source and destination
-  // framebuffers must be of the same size. The entire rectangle referenced by
-  // `rect' must be within the frame buffer boundaries.
+  // set by the most recent setPixelFormats() call. The entire rectangle
+  // referenced by `rect' must be within the boundaries of both frame buffers
+  // as seen by their getBufferPtr() functions. The frame buffers may have
+  // different sizes, e.g. `dstFb' may be a RectFrameBuffer holding only the
+  // pixels of `rect'.
   virtual void convert(const Rect *rect, FrameBuffer *dstFb,
                        const FrameBuffer *srcFb) const;
 
-  // Convert pixels for the specified `rect' from `srcFb' to the internal
-  // PixelConverter's frame buffer and return a pointer to that frame buffer.
-  // If the source and destination formats are the same, then no translation
-  // will happen and srcFb will be returned.
-  // The pixel format of `srcFb' must be identical to the source format set by
-  // the most recent setPixelFormats() call. The entire rectangle referenced
-  // by `rect' must be within the frame buffer boundaries.
-  // This function will work efficiently only if the frame buffer size does
-  // not vary from call to call. It checks if the frame buffer size has
-  // changed since the previous call and reallocates the frame buffer if
-  // necessary.
-  virtual const FrameBuffer *convert(const Rect *rect,
-                                     const FrameBuffer *srcFb);
+  // Return true if the destination pixel format differs from the source one,
+  // i.e. if pixels must be converted before they can be sent.
+  virtual bool needsConversion() const;
 
   // FIXME: Review the argument order for each function of PixelConverter.
   // FIXME: Review the argument names for each function of PixelConverter.
@@ -67,9 +60,10 @@ public:
   // Return the number of bits per pixel from the destination pixel format.
   virtual size_t getDstBitsPerPixel() const;
 
-protected:
-  void reset();
+  // Return the destination pixel format.
+  virtual PixelFormat getDstPixelFormat() const;
 
+protected:
   void fillHexBitsTable(const PixelFormat *dstPf, const PixelFormat *srcPf);
   void fill32BitsTable(const PixelFormat *dstPf, const PixelFormat *srcPf);
   UINT32 rotateUint32(UINT32 value) const;
@@ -87,12 +81,13 @@ protected:
   std::vector<UINT32> m_grnTable;
   std::vector<UINT32> m_bluTable;
 
+  // Vectorized conversion used instead of the tables if m_hasSimdKernel is
+  // true.
+  PixelConverterSimd::Kernel m_simdKernel;
+  bool m_hasSimdKernel;
+
   PixelFormat m_srcFormat;
   PixelFormat m_dstFormat;
-
-  // An internally maintained frame buffer used by the two-argument version of
-  // the convert() function.
-  FrameBuffer *m_dstFrameBuffer;
 };
 
 #endif // __RFB_PIXEL_CONVERTER_H_INCLUDED__
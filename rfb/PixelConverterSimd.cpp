@@ -0,0 +1,498 @@
+// Copyright (C) 2012 GlavSoft LLC.
+// All rights reserved.
+//
+//-------------------------------------------------------------------------
+// This file is part of the TightVNC software.  Please visit our Web site:
+//
+//                       http://www.tightvnc.com/
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+//-------------------------------------------------------------------------
+//
+
+#include "PixelConverterSimd.h"
+#include "util/CpuFeatures.h"
+
+#include <emmintrin.h>
+#include <tmmintrin.h>
+#if _MSC_VER >= 1800
+#include <immintrin.h>
+#endif
+
+// Kernel parameters of the color components loaded into SSE2 registers.
+struct ComponentsSse2
+{
+  __m128i srcShift[3];
+  __m128i srcMax[3];
+  __m128i dstMax[3];
+  __m128i round[3];
+  __m128i divMul[3];
+  __m128i divShift[3];
+  __m128i dstShift[3];
+};
+
+static inline void loadComponentsSse2(const PixelConverterSimd::Kernel *kernel,
+                                      ComponentsSse2 *comp)
+{
+  for (int c = 0; c < 3; c++) {
+    comp->srcShift[c] = _mm_cvtsi32_si128((int)kernel->srcShift[c]);
+    comp->srcMax[c] = _mm_set1_epi32((int)kernel->srcMax[c]);
+    comp->dstMax[c] = _mm_set1_epi32((int)kernel->dstMax[c]);
+    comp->round[c] = _mm_set1_epi32((int)kernel->round[c]);
+    comp->divMul[c] = _mm_set1_epi32((int)kernel->divMul[c]);
+    comp->divShift[c] = _mm_cvtsi32_si128((int)kernel->divShift[c]);
+    comp->dstShift[c] = _mm_cvtsi32_si128((int)kernel->dstShift[c]);
+  }
+}
+
+// Convert four pixels held in 32-bit lanes. All the intermediate values fit
+// in the lower 16 bits of the lanes, so 16-bit multiplications are enough.
+static inline __m128i convertPixelsSse2(__m128i pixels,
+                                        const ComponentsSse2 *comp)
+{
+  __m128i result = _mm_setzero_si128();
+  for (int c = 0; c < 3; c++) {
+    __m128i v = _mm_and_si128(_mm_srl_epi32(pixels, comp->srcShift[c]),
+                              comp->srcMax[c]);
+    v = _mm_add_epi32(_mm_mullo_epi16(v, comp->dstMax[c]), comp->round[c]);
+    v = _mm_srl_epi32(_mm_mulhi_epu16(v, comp->divMul[c]),
+                      comp->divShift[c]);
+    result = _mm_or_si128(result, _mm_sll_epi32(v, comp->dstShift[c]));
+  }
+  return result;
+}
+
+static inline __m128i swapBytes32Sse2(__m128i v)
+{
+  const __m128i byte1 = _mm_set1_epi32(0x0000FF00);
+  const __m128i byte2 = _mm_set1_epi32(0x00FF0000);
+  return _mm_or_si128(_mm_or_si128(_mm_slli_epi32(v, 24),
+                                   _mm_srli_epi32(v, 24)),
+                      _mm_or_si128(_mm_and_si128(_mm_slli_epi32(v, 8), byte2),
+                                   _mm_and_si128(_mm_srli_epi32(v, 8), byte1)));
+}
+
+static inline __m128i swapBytes16Sse2(__m128i v)
+{
+  const __m128i byte0 = _mm_set1_epi32(0x000000FF);
+  const __m128i byte1 = _mm_set1_epi32(0x0000FF00);
+  return _mm_or_si128(_mm_and_si128(_mm_slli_epi32(v, 8), byte1),
+                      _mm_and_si128(_mm_srli_epi32(v, 8), byte0));
+}
+
+// Make the lower 16 bits of the lanes survive the signed saturation of
+// _mm_packs_epi32().
+static inline __m128i signExtend16Sse2(__m128i v)
+{
+  return _mm_srai_epi32(_mm_slli_epi32(v, 16), 16);
+}
+
+#if _MSC_VER >= 1800
+// The same for AVX2.
+struct ComponentsAvx2
+{
+  __m128i srcShift[3];
+  __m256i srcMax[3];
+  __m256i dstMax[3];
+  __m256i round[3];
+  __m256i divMul[3];
+  __m128i divShift[3];
+  __m128i dstShift[3];
+};
+
+static inline void loadComponentsAvx2(const PixelConverterSimd::Kernel *kernel,
+                                      ComponentsAvx2 *comp)
+{
+  for (int c = 0; c < 3; c++) {
+    comp->srcShift[c] = _mm_cvtsi32_si128((int)kernel->srcShift[c]);
+    comp->srcMax[c] = _mm256_set1_epi32((int)kernel->srcMax[c]);
+    comp->dstMax[c] = _mm256_set1_epi32((int)kernel->dstMax[c]);
+    comp->round[c] = _mm256_set1_epi32((int)kernel->round[c]);
+    comp->divMul[c] = _mm256_set1_epi32((int)kernel->divMul[c]);
+    comp->divShift[c] = _mm_cvtsi32_si128((int)kernel->divShift[c]);
+    comp->dstShift[c] = _mm_cvtsi32_si128((int)kernel->dstShift[c]);
+  }
+}
+
+static inline __m256i convertPixelsAvx2(__m256i pixels,
+                                        const ComponentsAvx2 *comp)
+{
+  __m256i result = _mm256_setzero_si256();
+  for (int c = 0; c < 3; c++) {
+    __m256i v = _mm256_and_si256(_mm256_srl_epi32(pixels, comp->srcShift[c]),
+                                 comp->srcMax[c]);
+    v = _mm256_add_epi32(_mm256_mullo_epi16(v, comp->dstMax[c]),
+                         comp->round[c]);
+    v = _mm256_srl_epi32(_mm256_mulhi_epu16(v, comp->divMul[c]),
+                         comp->divShift[c]);
+    result = _mm256_or_si256(result, _mm256_sll_epi32(v, comp->dstShift[c]));
+  }
+  return result;
+}
+
+static inline __m256i swapBytes32Avx2(__m256i v)
+{
+  const __m256i byte1 = _mm256_set1_epi32(0x0000FF00);
+  const __m256i byte2 = _mm256_set1_epi32(0x00FF0000);
+  return _mm256_or_si256(
+    _mm256_or_si256(_mm256_slli_epi32(v, 24), _mm256_srli_epi32(v, 24)),
+    _mm256_or_si256(_mm256_and_si256(_mm256_slli_epi32(v, 8), byte2),
+                    _mm256_and_si256(_mm256_srli_epi32(v, 8), byte1)));
+}
+
+static inline __m256i swapBytes16Avx2(__m256i v)
+{
+  const __m256i byte0 = _mm256_set1_epi32(0x000000FF);
+  const __m256i byte1 = _mm256_set1_epi32(0x0000FF00);
+  return _mm256_or_si256(_mm256_and_si256(_mm256_slli_epi32(v, 8), byte1),
+                         _mm256_and_si256(_mm256_srli_epi32(v, 8), byte0));
+}
+
+static inline __m256i signExtend16Avx2(__m256i v)
+{
+  return _mm256_srai_epi32(_mm256_slli_epi32(v, 16), 16);
+}
+#endif
+
+//--------------------------------------------------------------------------//
+
+bool PixelConverterSimd::prepare(const PixelFormat *dstPf,
+                                 const PixelFormat *srcPf,
+                                 Kernel *kernel)
+{
+  if (!CpuFeatures::hasSse2()) {
+    return false;
+  }
+  if (srcPf->bitsPerPixel != 32 && srcPf->bitsPerPixel != 16) {
+    return false;
+  }
+  if (dstPf->bitsPerPixel != 32 && dstPf->bitsPerPixel != 16 &&
+      dstPf->bitsPerPixel != 8) {
+    return false;
+  }
+  kernel->srcPixelSize = srcPf->bitsPerPixel / 8;
+  kernel->dstPixelSize = dstPf->bitsPerPixel / 8;
+  // Byte order does not matter for 8-bit pixels.
+  kernel->swapBytes = dstPf->bigEndian != srcPf->bigEndian &&
+                      kernel->dstPixelSize > 1;
+
+  const UINT32 srcShift[3] = { srcPf->redShift, srcPf->greenShift,
+                               srcPf->blueShift };
+  const UINT32 srcMax[3] = { srcPf->redMax, srcPf->greenMax,
+                             srcPf->blueMax };
+  const UINT32 dstShift[3] = { dstPf->redShift, dstPf->greenShift,
+                               dstPf->blueShift };
+  const UINT32 dstMax[3] = { dstPf->redMax, dstPf->greenMax,
+                             dstPf->blueMax };
+  for (int c = 0; c < 3; c++) {
+    // Intermediate values must fit in 16 bits.
+    if (srcMax[c] == 0 || srcMax[c] > 255 || dstMax[c] > 255 ||
+        srcShift[c] >= srcPf->bitsPerPixel ||
+        dstShift[c] >= dstPf->bitsPerPixel) {
+      return false;
+    }
+    kernel->srcShift[c] = srcShift[c];
+    kernel->srcMax[c] = srcMax[c];
+    kernel->dstShift[c] = dstShift[c];
+    kernel->dstMax[c] = dstMax[c];
+    kernel->round[c] = kernel->srcPixelSize == 4 ? srcMax[c] / 2 : 0;
+    if (!findDivisor(srcMax[c], srcMax[c] * dstMax[c] + kernel->round[c],
+                     &kernel->divMul[c], &kernel->divShift[c])) {
+      return false;
+    }
+  }
+
+  if (kernel->srcPixelSize == 4) {
+    kernel->convertRow = selectConvertRow<UINT32>(kernel->dstPixelSize);
+  } else {
+    kernel->convertRow = selectConvertRow<UINT16>(kernel->dstPixelSize);
+  }
+
+  // If all the components are whole bytes of both pixels, the conversion
+  // is a byte shuffle.
+  bool byteAligned = kernel->srcPixelSize == 4 && kernel->dstPixelSize == 4;
+  for (int c = 0; c < 3; c++) {
+    byteAligned = byteAligned && srcMax[c] == 255 && dstMax[c] == 255 &&
+                  srcShift[c] % 8 == 0 && dstShift[c] % 8 == 0;
+  }
+  if (byteAligned && CpuFeatures::hasSsse3()) {
+    for (int i = 0; i < 16; i++) {
+      kernel->shuffle[i] = (char)0x80;
+    }
+    for (int i = 0; i < 4; i++) {
+      for (int c = 0; c < 3; c++) {
+        int dstPos = dstShift[c] / 8;
+        if (kernel->swapBytes) {
+          dstPos = 3 - dstPos;
+        }
+        kernel->shuffle[i * 4 + dstPos] = (char)(i * 4 + srcShift[c] / 8);
+      }
+    }
+    kernel->convertRow = swizzleRowSsse3;
+#if _MSC_VER >= 1800
+    if (CpuFeatures::hasAvx2()) {
+      kernel->convertRow = swizzleRowAvx2;
+    }
+#endif
+  }
+  return true;
+}
+
+void PixelConverterSimd::convertRow(const Kernel *kernel, const void *src,
+                                    void *dst, int count)
+{
+  kernel->convertRow(kernel, (const UINT8 *)src, (UINT8 *)dst, count);
+}
+
+//--------------------------------------------------------------------------//
+
+bool PixelConverterSimd::findDivisor(UINT32 divisor, UINT32 maxDividend,
+                                     UINT32 *divMul, UINT32 *divShift)
+{
+  // Try the most precise multipliers first, check them for all the
+  // dividends.
+  for (int shift = 15; shift >= 0; shift--) {
+    UINT32 mul = (UINT32)((((UINT64)1 << (16 + shift)) + divisor - 1) /
+                          divisor);
+    if (mul > 0xFFFF) {
+      continue;
+    }
+    bool exact = true;
+    for (UINT32 x = 0; x <= maxDividend && exact; x++) {
+      exact = (x * mul) >> (16 + shift) == x / divisor;
+    }
+    if (exact) {
+      *divMul = mul;
+      *divShift = (UINT32)shift;
+      return true;
+    }
+  }
+  return false;
+}
+
+UINT32 PixelConverterSimd::convertPixel(const Kernel *kernel, UINT32 pixel)
+{
+  UINT32 result = 0;
+  for (int c = 0; c < 3; c++) {
+    UINT32 v = pixel >> kernel->srcShift[c] & kernel->srcMax[c];
+    v = ((v * kernel->dstMax[c] + kernel->round[c]) * kernel->divMul[c] >> 16)
+        >> kernel->divShift[c];
+    result |= v << kernel->dstShift[c];
+  }
+  if (kernel->swapBytes) {
+    if (kernel->dstPixelSize == 4) {
+      result = result << 24 | (result << 8 & 0xFF0000) |
+               (result >> 8 & 0xFF00) | result >> 24;
+    } else {
+      result = (result << 8 & 0xFF00) | (result >> 8 & 0xFF);
+    }
+  }
+  return result;
+}
+
+template<class SRC_T, class DST_T>
+void PixelConverterSimd::convertRowScalar(const Kernel *kernel,
+                                          const UINT8 *src, UINT8 *dst,
+                                          int count)
+{
+  const SRC_T *srcPixels = (const SRC_T *)src;
+  DST_T *dstPixels = (DST_T *)dst;
+  for (int i = 0; i < count; i++) {
+    dstPixels[i] = (DST_T)convertPixel(kernel, srcPixels[i]);
+  }
+}
+
+template<class SRC_T, class DST_T>
+void PixelConverterSimd::convertRowSse2(const Kernel *kernel,
+                                        const UINT8 *src, UINT8 *dst,
+                                        int count)
+{
+  ComponentsSse2 comp;
+  loadComponentsSse2(kernel, &comp);
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i lowByte = _mm_set1_epi32(0xFF);
+
+  // Sixteen pixels per iteration, in four registers of 32-bit lanes.
+  int i = 0;
+  for (; i + 16 <= count; i += 16) {
+    __m128i p[4];
+    if (sizeof(SRC_T) == 4) {
+      for (int j = 0; j < 4; j++) {
+        p[j] = _mm_loadu_si128((const __m128i *)(src + (i + j * 4) * 4));
+      }
+    } else {
+      for (int j = 0; j < 2; j++) {
+        __m128i s = _mm_loadu_si128((const __m128i *)(src + (i + j * 8) * 2));
+        p[j * 2] = _mm_unpacklo_epi16(s, zero);
+        p[j * 2 + 1] = _mm_unpackhi_epi16(s, zero);
+      }
+    }
+
+    for (int j = 0; j < 4; j++) {
+      p[j] = convertPixelsSse2(p[j], &comp);
+      if (kernel->swapBytes) {
+        p[j] = sizeof(DST_T) == 4 ? swapBytes32Sse2(p[j])
+                                  : swapBytes16Sse2(p[j]);
+      }
+    }
+
+    if (sizeof(DST_T) == 4) {
+      for (int j = 0; j < 4; j++) {
+        _mm_storeu_si128((__m128i *)(dst + (i + j * 4) * 4), p[j]);
+      }
+    } else if (sizeof(DST_T) == 2) {
+      for (int j = 0; j < 4; j += 2) {
+        __m128i words = _mm_packs_epi32(signExtend16Sse2(p[j]),
+                                        signExtend16Sse2(p[j + 1]));
+        _mm_storeu_si128((__m128i *)(dst + (i + j * 4) * 2), words);
+      }
+    } else {
+      __m128i words0 = _mm_packs_epi32(_mm_and_si128(p[0], lowByte),
+                                       _mm_and_si128(p[1], lowByte));
+      __m128i words1 = _mm_packs_epi32(_mm_and_si128(p[2], lowByte),
+                                       _mm_and_si128(p[3], lowByte));
+      _mm_storeu_si128((__m128i *)(dst + i),
+                       _mm_packus_epi16(words0, words1));
+    }
+  }
+
+  convertRowScalar<SRC_T, DST_T>(kernel, src + i * sizeof(SRC_T),
+                                 dst + i * sizeof(DST_T), count - i);
+}
+
+#if _MSC_VER >= 1800
+template<class SRC_T, class DST_T>
+void PixelConverterSimd::convertRowAvx2(const Kernel *kernel,
+                                        const UINT8 *src, UINT8 *dst,
+                                        int count)
+{
+  ComponentsAvx2 comp;
+  loadComponentsAvx2(kernel, &comp);
+  const __m256i lowByte = _mm256_set1_epi32(0xFF);
+
+  // Sixteen pixels per iteration, in two registers of 32-bit lanes.
+  int i = 0;
+  for (; i + 16 <= count; i += 16) {
+    __m256i p[2];
+    for (int j = 0; j < 2; j++) {
+      if (sizeof(SRC_T) == 4) {
+        p[j] = _mm256_loadu_si256((const __m256i *)(src + (i + j * 8) * 4));
+      } else {
+        p[j] = _mm256_cvtepu16_epi32(
+          _mm_loadu_si128((const __m128i *)(src + (i + j * 8) * 2)));
+      }
+      p[j] = convertPixelsAvx2(p[j], &comp);
+      if (kernel->swapBytes) {
+        p[j] = sizeof(DST_T) == 4 ? swapBytes32Avx2(p[j])
+                                  : swapBytes16Avx2(p[j]);
+      }
+    }
+
+    if (sizeof(DST_T) == 4) {
+      _mm256_storeu_si256((__m256i *)(dst + i * 4), p[0]);
+      _mm256_storeu_si256((__m256i *)(dst + (i + 8) * 4), p[1]);
+    } else {
+      __m256i words;
+      if (sizeof(DST_T) == 2) {
+        words = _mm256_packs_epi32(signExtend16Avx2(p[0]),
+                                   signExtend16Avx2(p[1]));
+      } else {
+        words = _mm256_packs_epi32(_mm256_and_si256(p[0], lowByte),
+                                   _mm256_and_si256(p[1], lowByte));
+      }
+      // Packing works within 128-bit halves, restore the pixel order.
+      words = _mm256_permute4x64_epi64(words, 0xD8);
+      if (sizeof(DST_T) == 2) {
+        _mm256_storeu_si256((__m256i *)(dst + i * 2), words);
+      } else {
+        __m128i bytes = _mm_packus_epi16(_mm256_castsi256_si128(words),
+                                         _mm256_extracti128_si256(words, 1));
+        _mm_storeu_si128((__m128i *)(dst + i), bytes);
+      }
+    }
+  }
+  // Leave the upper half of the registers clean for SSE code.
+  _mm256_zeroupper();
+
+  convertRowScalar<SRC_T, DST_T>(kernel, src + i * sizeof(SRC_T),
+                                 dst + i * sizeof(DST_T), count - i);
+}
+#endif
+
+void PixelConverterSimd::swizzleRowSsse3(const Kernel *kernel,
+                                         const UINT8 *src, UINT8 *dst,
+                                         int count)
+{
+  const __m128i mask = _mm_loadu_si128((const __m128i *)kernel->shuffle);
+  int i = 0;
+  for (; i + 4 <= count; i += 4) {
+    __m128i p = _mm_loadu_si128((const __m128i *)(src + i * 4));
+    _mm_storeu_si128((__m128i *)(dst + i * 4), _mm_shuffle_epi8(p, mask));
+  }
+  convertRowScalar<UINT32, UINT32>(kernel, src + i * 4, dst + i * 4,
+                                   count - i);
+}
+
+#if _MSC_VER >= 1800
+void PixelConverterSimd::swizzleRowAvx2(const Kernel *kernel,
+                                        const UINT8 *src, UINT8 *dst,
+                                        int count)
+{
+  const __m128i mask128 = _mm_loadu_si128((const __m128i *)kernel->shuffle);
+  const __m256i mask =
+    _mm256_inserti128_si256(_mm256_castsi128_si256(mask128), mask128, 1);
+  int i = 0;
+  for (; i + 8 <= count; i += 8) {
+    __m256i p = _mm256_loadu_si256((const __m256i *)(src + i * 4));
+    _mm256_storeu_si256((__m256i *)(dst + i * 4),
+                        _mm256_shuffle_epi8(p, mask));
+  }
+  _mm256_zeroupper();
+  swizzleRowSsse3(kernel, src + i * 4, dst + i * 4, count - i);
+}
+#else
+void PixelConverterSimd::swizzleRowAvx2(const Kernel *kernel,
+                                        const UINT8 *src, UINT8 *dst,
+                                        int count)
+{
+  swizzleRowSsse3(kernel, src, dst, count);
+}
+#endif
+
+template<class SRC_T>
+PixelConverterSimd::ConvertRowFunc
+PixelConverterSimd::selectConvertRow(size_t dstPixelSize)
+{
+#if _MSC_VER >= 1800
+  if (CpuFeatures::hasAvx2()) {
+    switch (dstPixelSize) {
+    case 4:
+      return convertRowAvx2<SRC_T, UINT32>;
+    case 2:
+      return convertRowAvx2<SRC_T, UINT16>;
+    default:
+      return convertRowAvx2<SRC_T, UINT8>;
+    }
+  }
+#endif
+  switch (dstPixelSize) {
+  case 4:
+    return convertRowSse2<SRC_T, UINT32>;
+  case 2:
+    return convertRowSse2<SRC_T, UINT16>;
+  default:
+    return convertRowSse2<SRC_T, UINT8>;
+  }
+}
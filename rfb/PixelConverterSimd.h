@@ -0,0 +1,117 @@
+// Copyright (C) 2012 GlavSoft LLC.
+// All rights reserved.
+//
+//-------------------------------------------------------------------------
+// This file is part of the TightVNC software.  Please visit our Web site:
+//
+//                       http://www.tightvnc.com/
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+//-------------------------------------------------------------------------
+//
+
+#ifndef __RFB_PIXEL_CONVERTER_SIMD_H_INCLUDED__
+#define __RFB_PIXEL_CONVERTER_SIMD_H_INCLUDED__
+
+#include "util/inttypes.h"
+#include "PixelFormat.h"
+
+//
+// PixelConverterSimd contains vectorized kernels for the pixel format
+// conversions done by PixelConverter: from 32-bit or 16-bit pixels with
+// color components of up to 8 bits to 32-bit, 16-bit or 8-bit pixels
+// (32->32 channel swizzle, 32->16 565/555, 32->8 BGR233, 16->32 etc.).
+// The best kernel supported by the processor (AVX2, SSSE3 or SSE2) is
+// selected at run time. Other conversions, or processors without SSE2, are
+// left to the table-based code of PixelConverter.
+//
+// The kernels compute each color component as
+//   ((pixel >> srcShift & srcMax) * dstMax + round) / srcMax << dstShift
+// which is what the tables of PixelConverter contain, round being srcMax / 2
+// for 32-bit source pixels and 0 for 16-bit ones. The division is done by
+// multiplication, see findDivisor().
+//
+
+class PixelConverterSimd
+{
+public:
+  struct Kernel;
+
+  typedef void (*ConvertRowFunc)(const Kernel *kernel, const UINT8 *src,
+                                 UINT8 *dst, int count);
+
+  // Parameters of a conversion, filled in by prepare().
+  struct Kernel
+  {
+    ConvertRowFunc convertRow;
+    size_t srcPixelSize;
+    size_t dstPixelSize;
+    // Parameters of the red, green and blue components, see above. The
+    // division by srcMax is computed as (x * divMul) >> (16 + divShift).
+    UINT32 srcShift[3];
+    UINT32 srcMax[3];
+    UINT32 dstMax[3];
+    UINT32 round[3];
+    UINT32 divMul[3];
+    UINT32 divShift[3];
+    UINT32 dstShift[3];
+    // True if the byte order of destination pixels differs from the source.
+    bool swapBytes;
+    // Byte shuffle for four pixels used by the swizzle kernels, negative
+    // values zero the bytes.
+    char shuffle[16];
+  };
+
+  // Select the best kernel for conversion from srcPf to dstPf. Return false
+  // if there is no suitable kernel, the conversion must be done by the
+  // table-based code then.
+  static bool prepare(const PixelFormat *dstPf, const PixelFormat *srcPf,
+                      Kernel *kernel);
+
+  // Convert count pixels from src to dst using a kernel made by prepare().
+  static void convertRow(const Kernel *kernel, const void *src, void *dst,
+                         int count);
+
+protected:
+  // Find divMul and divShift to divide any value up to maxDividend by
+  // divisor. Return false if they do not exist.
+  static bool findDivisor(UINT32 divisor, UINT32 maxDividend,
+                          UINT32 *divMul, UINT32 *divShift);
+
+  // Convert a single pixel, used for the tails of rows.
+  static UINT32 convertPixel(const Kernel *kernel, UINT32 pixel);
+
+  template<class SRC_T, class DST_T>
+  static void convertRowScalar(const Kernel *kernel, const UINT8 *src,
+                               UINT8 *dst, int count);
+  template<class SRC_T, class DST_T>
+  static void convertRowSse2(const Kernel *kernel, const UINT8 *src,
+                             UINT8 *dst, int count);
+  template<class SRC_T, class DST_T>
+  static void convertRowAvx2(const Kernel *kernel, const UINT8 *src,
+                             UINT8 *dst, int count);
+
+  // 32-bit to 32-bit conversion when all the components occupy whole
+  // bytes of both pixel formats.
+  static void swizzleRowSsse3(const Kernel *kernel, const UINT8 *src,
+                              UINT8 *dst, int count);
+  static void swizzleRowAvx2(const Kernel *kernel, const UINT8 *src,
+                             UINT8 *dst, int count);
+
+  template<class SRC_T>
+  static ConvertRowFunc selectConvertRow(size_t dstPixelSize);
+};
+
+#endif // __RFB_PIXEL_CONVERTER_SIMD_H_INCLUDED__
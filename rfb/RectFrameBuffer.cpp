@@ -0,0 +1,54 @@
+// Copyright (C) 2012 GlavSoft LLC.
+// All rights reserved.
+//
+//-------------------------------------------------------------------------
+// This file is part of the TightVNC software.  Please visit our Web site:
+//
+//                       http://www.tightvnc.com/
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+//-------------------------------------------------------------------------
+//
+
+
+#include "RectFrameBuffer.h"
+
+RectFrameBuffer::RectFrameBuffer()
+: m_left(0),
+  m_top(0)
+{
+}
+
+RectFrameBuffer::~RectFrameBuffer()
+{
+  // The memory belongs to the owner of the view.
+  m_buffer = 0;
+}
+
+void RectFrameBuffer::setView(const Rect *rect, const PixelFormat *pf,
+                              void *buffer)
+{
+  Dimension dim(rect);
+  setPropertiesWithoutResize(&dim, pf);
+  setBuffer(buffer);
+  m_left = rect->left;
+  m_top = rect->top;
+}
+
+void *RectFrameBuffer::getBufferPtr(int x, int y) const
+{
+  _ASSERT(x >= m_left && y >= m_top);
+  return FrameBuffer::getBufferPtr(x - m_left, y - m_top);
+}
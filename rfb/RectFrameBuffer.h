@@ -0,0 +1,72 @@
+// Copyright (C) 2012 GlavSoft LLC.
+// All rights reserved.
+//
+//-------------------------------------------------------------------------
+// This file is part of the TightVNC software.  Please visit our Web site:
+//
+//                       http://www.tightvnc.com/
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+//-------------------------------------------------------------------------
+//
+
+
+#ifndef __RFB_RECT_FRAME_BUFFER_H_INCLUDED__
+#define __RFB_RECT_FRAME_BUFFER_H_INCLUDED__
+
+#include "FrameBuffer.h"
+
+//
+// RectFrameBuffer is a frame buffer holding the pixels of one rectangle of a
+// bigger frame buffer, in the memory provided by its owner. getBufferPtr()
+// takes the coordinates of the bigger frame buffer, so code reading pixels
+// with getBufferPtr() and getBytesPerRow() works the same for both. The
+// dimension is the size of the rectangle and all other functions use the
+// coordinates local to the rectangle.
+//
+// The memory is not owned by the object, and the view must not be resized
+// with setDimension() or setProperties(), use setView() instead.
+//
+
+class RectFrameBuffer : public FrameBuffer
+{
+public:
+  RectFrameBuffer();
+  virtual ~RectFrameBuffer();
+
+  // Make the object a view of `rect' in the pixel format `pf' stored in
+  // `buffer' without gaps between the rows. The buffer must hold at least
+  // rect->area() pixels.
+  void setView(const Rect *rect, const PixelFormat *pf, void *buffer);
+
+  // Return the origin of the rectangle in the bigger frame buffer.
+  int getLeft() const { return m_left; }
+  int getTop() const { return m_top; }
+
+  // Return a pointer to the pixel of the bigger frame buffer at (x, y) which
+  // must be within the rectangle of the view.
+  virtual void *getBufferPtr(int x, int y) const;
+
+protected:
+  int m_left;
+  int m_top;
+
+private:
+  // Do not allow copying objects.
+  RectFrameBuffer(const RectFrameBuffer &other);
+  RectFrameBuffer &operator=(const RectFrameBuffer &other);
+};
+
+#endif // __RFB_RECT_FRAME_BUFFER_H_INCLUDED__
@@ -638,6 +638,42 @@ bool Configurator::saveServerConfig(SettingsManager *sm)
   if (!sm->setUINT(_T("IdleTimeout"), (UINT)m_serverConfig.getIdleTimeout())) {
     saveResult = false;
   }
+  if (!sm->setBoolean(_T("EncodeGroups"), m_serverConfig.isEncodeGroupsEnabled())) {
+    saveResult = false;
+  }
+  if (!sm->setUINT(_T("EncodeGroupMaxLag"), m_serverConfig.getEncodeGroupMaxLag())) {
+    saveResult = false;
+  }
+  if (!sm->setUINT(_T("EncoderThreads"), m_serverConfig.getEncoderThreads())) {
+    saveResult = false;
+  }
+  if (!sm->setUINT(_T("VideoDetectionMode"), m_serverConfig.getVideoDetectionMode())) {
+    saveResult = false;
+  }
+  if (!sm->setBoolean(_T("AutoEncodingPolicy"), m_serverConfig.isAutoEncodingPolicyEnabled())) {
+    saveResult = false;
+  }
+  if (!sm->setUINT(_T("AutoEncodingCpuWeight"), m_serverConfig.getAutoEncodingCpuWeight())) {
+    saveResult = false;
+  }
+  if (!sm->setBoolean(_T("AdaptiveEncoding"), m_serverConfig.isAdaptiveEncodingEnabled())) {
+    saveResult = false;
+  }
+  if (!sm->setBoolean(_T("AsyncNetworkWrites"), m_serverConfig.isAsyncNetworkWritesEnabled())) {
+    saveResult = false;
+  }
+  if (!sm->setBoolean(_T("SharedFrameBuffer"), m_serverConfig.isSharedFrameBufferEnabled())) {
+    saveResult = false;
+  }
+  if (!sm->setBoolean(_T("IncrementalPolling"), m_serverConfig.isIncrementalPollingEnabled())) {
+    saveResult = false;
+  }
+  if (!sm->setBoolean(_T("RegionCoarsening"), m_serverConfig.isRegionCoarseningEnabled())) {
+    saveResult = false;
+  }
+  if (!sm->setBoolean(_T("MotionDetection"), m_serverConfig.isMotionDetectionEnabled())) {
+    saveResult = false;
+  }
   return saveResult;
 }
 
@@ -830,6 +866,78 @@ bool Configurator::loadServerConfig(SettingsManager *sm, ServerConfig *config)
     m_isConfigLoadedPartly = true;
     m_serverConfig.setShowTrayIconFlag(boolVal);
   }
+  if (!sm->getBoolean(_T("EncodeGroups"), &boolVal)) {
+    loadResult = false;
+  } else {
+    m_isConfigLoadedPartly = true;
+    m_serverConfig.setEncodeGroupsEnabled(boolVal);
+  }
+  if (!sm->getUINT(_T("EncodeGroupMaxLag"), &uintVal)) {
+    loadResult = false;
+  } else {
+    m_isConfigLoadedPartly = true;
+    m_serverConfig.setEncodeGroupMaxLag(uintVal);
+  }
+  if (!sm->getUINT(_T("EncoderThreads"), &uintVal)) {
+    loadResult = false;
+  } else {
+    m_isConfigLoadedPartly = true;
+    m_serverConfig.setEncoderThreads(uintVal);
+  }
+  if (!sm->getUINT(_T("VideoDetectionMode"), &uintVal)) {
+    loadResult = false;
+  } else {
+    m_isConfigLoadedPartly = true;
+    m_serverConfig.setVideoDetectionMode(uintVal);
+  }
+  if (!sm->getBoolean(_T("AutoEncodingPolicy"), &boolVal)) {
+    loadResult = false;
+  } else {
+    m_isConfigLoadedPartly = true;
+    m_serverConfig.setAutoEncodingPolicy(boolVal);
+  }
+  if (!sm->getUINT(_T("AutoEncodingCpuWeight"), &uintVal)) {
+    loadResult = false;
+  } else {
+    m_isConfigLoadedPartly = true;
+    m_serverConfig.setAutoEncodingCpuWeight(uintVal);
+  }
+  if (!sm->getBoolean(_T("AdaptiveEncoding"), &boolVal)) {
+    loadResult = false;
+  } else {
+    m_isConfigLoadedPartly = true;
+    m_serverConfig.setAdaptiveEncoding(boolVal);
+  }
+  if (!sm->getBoolean(_T("AsyncNetworkWrites"), &boolVal)) {
+    loadResult = false;
+  } else {
+    m_isConfigLoadedPartly = true;
+    m_serverConfig.setAsyncNetworkWrites(boolVal);
+  }
+  if (!sm->getBoolean(_T("SharedFrameBuffer"), &boolVal)) {
+    loadResult = false;
+  } else {
+    m_isConfigLoadedPartly = true;
+    m_serverConfig.setSharedFrameBuffer(boolVal);
+  }
+  if (!sm->getBoolean(_T("IncrementalPolling"), &boolVal)) {
+    loadResult = false;
+  } else {
+    m_isConfigLoadedPartly = true;
+    m_serverConfig.setIncrementalPolling(boolVal);
+  }
+  if (!sm->getBoolean(_T("RegionCoarsening"), &boolVal)) {
+    loadResult = false;
+  } else {
+    m_isConfigLoadedPartly = true;
+    m_serverConfig.setRegionCoarsening(boolVal);
+  }
+  if (!sm->getBoolean(_T("MotionDetection"), &boolVal)) {
+    loadResult = false;
+  } else {
+    m_isConfigLoadedPartly = true;
+    m_serverConfig.setMotionDetection(boolVal);
+  }
   updateLogDirPath();
   return loadResult;
 }
@@ -47,7 +47,19 @@ ServerConfig::ServerConfig()
   m_videoRecognitionInterval(3000), m_grabTransparentWindows(true),
   m_saveLogToAllUsersPath(false), m_hasControlPassword(false),
   m_showTrayIcon(true),
-  m_idleTimeout(0)
+  m_idleTimeout(0),
+  m_encodeGroupsEnabled(true),
+  m_encodeGroupMaxLag(500),
+  m_encoderThreads(0),
+  m_videoDetectionMode(0),
+  m_autoEncodingPolicy(false),
+  m_autoEncodingCpuWeight(50),
+  m_adaptiveEncoding(false),
+  m_asyncNetworkWrites(true),
+  m_sharedFrameBuffer(true),
+  m_incrementalPolling(true),
+  m_regionCoarsening(true),
+  m_motionDetection(true)
 {
   memset(m_primaryPassword,  0, sizeof(m_primaryPassword));
   memset(m_readonlyPassword, 0, sizeof(m_readonlyPassword));
@@ -123,6 +135,18 @@ void ServerConfig::serialize(DataOutputStream *output)
   output->writeInt8(m_hasControlPassword ? 1 : 0);
   output->writeInt8(m_showTrayIcon ? 1 : 0);
 
+  output->writeInt8(m_encodeGroupsEnabled ? 1 : 0);
+  output->writeUInt32(m_encodeGroupMaxLag);
+  output->writeUInt32(m_encoderThreads);
+  output->writeUInt32(m_videoDetectionMode);
+  output->writeInt8(m_autoEncodingPolicy ? 1 : 0);
+  output->writeUInt32(m_autoEncodingCpuWeight);
+  output->writeInt8(m_adaptiveEncoding ? 1 : 0);
+  output->writeInt8(m_asyncNetworkWrites ? 1 : 0);
+  output->writeInt8(m_sharedFrameBuffer ? 1 : 0);
+  output->writeInt8(m_incrementalPolling ? 1 : 0);
+  output->writeInt8(m_regionCoarsening ? 1 : 0);
+  output->writeInt8(m_motionDetection ? 1 : 0);
   output->writeUTF8(m_logFilePath.getString());
 }
 
@@ -193,6 +217,18 @@ void ServerConfig::deserialize(DataInputStream *input)
   m_hasControlPassword = input->readInt8() == 1;
   m_showTrayIcon = input->readInt8() == 1;
 
+  m_encodeGroupsEnabled = input->readInt8() == 1;
+  m_encodeGroupMaxLag = input->readUInt32();
+  m_encoderThreads = input->readUInt32();
+  m_videoDetectionMode = input->readUInt32();
+  m_autoEncodingPolicy = input->readInt8() == 1;
+  m_autoEncodingCpuWeight = input->readUInt32();
+  m_adaptiveEncoding = input->readInt8() == 1;
+  m_asyncNetworkWrites = input->readInt8() == 1;
+  m_sharedFrameBuffer = input->readInt8() == 1;
+  m_incrementalPolling = input->readInt8() == 1;
+  m_regionCoarsening = input->readInt8() == 1;
+  m_motionDetection = input->readInt8() == 1;
   input->readUTF8(&m_logFilePath);
 }
 
@@ -753,3 +789,147 @@ bool ServerConfig::getGrabTransparentWindowsFlag()
   AutoLock lock(&m_objectCS);
   return m_grabTransparentWindows;
 }
+
+bool ServerConfig::isEncodeGroupsEnabled()
+{
+  AutoLock lock(&m_objectCS);
+  return m_encodeGroupsEnabled;
+}
+
+void ServerConfig::setEncodeGroupsEnabled(bool enabled)
+{
+  AutoLock lock(&m_objectCS);
+  m_encodeGroupsEnabled = enabled;
+}
+
+unsigned int ServerConfig::getEncodeGroupMaxLag()
+{
+  AutoLock lock(&m_objectCS);
+  return m_encodeGroupMaxLag;
+}
+
+void ServerConfig::setEncodeGroupMaxLag(unsigned int value)
+{
+  AutoLock lock(&m_objectCS);
+  m_encodeGroupMaxLag = value;
+}
+
+unsigned int ServerConfig::getEncoderThreads()
+{
+  AutoLock lock(&m_objectCS);
+  return m_encoderThreads;
+}
+
+void ServerConfig::setEncoderThreads(unsigned int value)
+{
+  AutoLock lock(&m_objectCS);
+  m_encoderThreads = value;
+}
+
+unsigned int ServerConfig::getVideoDetectionMode()
+{
+  AutoLock lock(&m_objectCS);
+  return m_videoDetectionMode;
+}
+
+void ServerConfig::setVideoDetectionMode(unsigned int value)
+{
+  AutoLock lock(&m_objectCS);
+  m_videoDetectionMode = value;
+}
+
+bool ServerConfig::isAutoEncodingPolicyEnabled()
+{
+  AutoLock lock(&m_objectCS);
+  return m_autoEncodingPolicy;
+}
+
+void ServerConfig::setAutoEncodingPolicy(bool enabled)
+{
+  AutoLock lock(&m_objectCS);
+  m_autoEncodingPolicy = enabled;
+}
+
+unsigned int ServerConfig::getAutoEncodingCpuWeight()
+{
+  AutoLock lock(&m_objectCS);
+  return m_autoEncodingCpuWeight;
+}
+
+void ServerConfig::setAutoEncodingCpuWeight(unsigned int value)
+{
+  AutoLock lock(&m_objectCS);
+  m_autoEncodingCpuWeight = value;
+}
+
+bool ServerConfig::isAdaptiveEncodingEnabled()
+{
+  AutoLock lock(&m_objectCS);
+  return m_adaptiveEncoding;
+}
+
+void ServerConfig::setAdaptiveEncoding(bool enabled)
+{
+  AutoLock lock(&m_objectCS);
+  m_adaptiveEncoding = enabled;
+}
+
+bool ServerConfig::isAsyncNetworkWritesEnabled()
+{
+  AutoLock lock(&m_objectCS);
+  return m_asyncNetworkWrites;
+}
+
+void ServerConfig::setAsyncNetworkWrites(bool enabled)
+{
+  AutoLock lock(&m_objectCS);
+  m_asyncNetworkWrites = enabled;
+}
+
+bool ServerConfig::isSharedFrameBufferEnabled()
+{
+  AutoLock lock(&m_objectCS);
+  return m_sharedFrameBuffer;
+}
+
+void ServerConfig::setSharedFrameBuffer(bool enabled)
+{
+  AutoLock lock(&m_objectCS);
+  m_sharedFrameBuffer = enabled;
+}
+
+bool ServerConfig::isIncrementalPollingEnabled()
+{
+  AutoLock lock(&m_objectCS);
+  return m_incrementalPolling;
+}
+
+void ServerConfig::setIncrementalPolling(bool enabled)
+{
+  AutoLock lock(&m_objectCS);
+  m_incrementalPolling = enabled;
+}
+
+bool ServerConfig::isRegionCoarseningEnabled()
+{
+  AutoLock lock(&m_objectCS);
+  return m_regionCoarsening;
+}
+
+void ServerConfig::setRegionCoarsening(bool enabled)
+{
+  AutoLock lock(&m_objectCS);
+  m_regionCoarsening = enabled;
+}
+
+bool ServerConfig::isMotionDetectionEnabled()
+{
+  AutoLock lock(&m_objectCS);
+  return m_motionDetection;
+}
+
+void ServerConfig::setMotionDetection(bool enabled)
+{
+  AutoLock lock(&m_objectCS);
+  m_motionDetection = enabled;
+}
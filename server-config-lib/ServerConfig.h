@@ -60,6 +60,18 @@ public:
     DA_LOGOUT_WORKSTATION = 2
   };
 
+  //
+  // Enum defines where the server takes video regions from: window
+  // classes and rectangles listed in the configuration, automatic
+  // detection of frequently changing colorful areas, or both.
+  //
+
+  enum VideoDetectionMode {
+    VDM_CONFIGURED = 0,
+    VDM_AUTOMATIC = 1,
+    VDM_CONFIGURED_AND_AUTOMATIC = 2
+  };
+
 public:
   ServerConfig();
   virtual ~ServerConfig();
@@ -278,6 +290,42 @@ public:
   bool getShowTrayIconFlag();
   void setShowTrayIconFlag(bool val);
 
+  bool isEncodeGroupsEnabled();
+  void setEncodeGroupsEnabled(bool enabled);
+
+  unsigned int getEncodeGroupMaxLag();
+  void setEncodeGroupMaxLag(unsigned int value);
+
+  unsigned int getEncoderThreads();
+  void setEncoderThreads(unsigned int value);
+
+  unsigned int getVideoDetectionMode();
+  void setVideoDetectionMode(unsigned int value);
+
+  bool isAutoEncodingPolicyEnabled();
+  void setAutoEncodingPolicy(bool enabled);
+
+  unsigned int getAutoEncodingCpuWeight();
+  void setAutoEncodingCpuWeight(unsigned int value);
+
+  bool isAdaptiveEncodingEnabled();
+  void setAdaptiveEncoding(bool enabled);
+
+  bool isAsyncNetworkWritesEnabled();
+  void setAsyncNetworkWrites(bool enabled);
+
+  bool isSharedFrameBufferEnabled();
+  void setSharedFrameBuffer(bool enabled);
+
+  bool isIncrementalPollingEnabled();
+  void setIncrementalPolling(bool enabled);
+
+  bool isRegionCoarseningEnabled();
+  void setRegionCoarsening(bool enabled);
+
+  bool isMotionDetectionEnabled();
+  void setMotionDetection(bool enabled);
+
   void getLogFileDir(StringStorage *logFileDir);
   void setLogFileDir(const TCHAR *logFileDir);
 
@@ -411,6 +459,54 @@ protected:
   // Run control interface with TightVNC server or not.
   bool m_showTrayIcon;
 
+  // Share one encoder pipeline between clients with identical encoding
+  // settings, pixel format and view port.
+  bool m_encodeGroupsEnabled;
+
+  // Time (in milliseconds) other members of an encode group may wait for
+  // a client before it will be moved to its own encoder pipeline.
+  unsigned int m_encodeGroupMaxLag;
+
+  // Number of threads used for parallel Tight and ZRLE encoding, shared by
+  // all clients. Zero means the number of processors, one turns parallel
+  // encoding off.
+  unsigned int m_encoderThreads;
+
+  // Source of video regions, one of the VideoDetectionMode values.
+  unsigned int m_videoDetectionMode;
+
+  // If true, the Tight encoder selects subencodings by estimating the size
+  // and the encoding time of each candidate, see TightCostModel.
+  bool m_autoEncodingPolicy;
+
+  // Importance of the encoding time relative to the output size for the
+  // "auto" encoding policy, in percents.
+  unsigned int m_autoEncodingCpuWeight;
+
+  // Adapt compression level, JPEG quality and lossless refresh to the
+  // measured throughput and round-trip time of each client.
+  bool m_adaptiveEncoding;
+
+  // Write data to clients in a separate thread per client, so encoding
+  // does not wait for the network.
+  bool m_asyncNetworkWrites;
+
+  // Encode updates from the frame buffer shared by all clients when a client
+  // does not need a private copy of it.
+  bool m_sharedFrameBuffer;
+
+  // Poll a rotating subset of scanlines instead of the whole screen
+  // on each polling cycle.
+  bool m_incrementalPolling;
+
+  // Merge nearby changed rectangles when sending the pixels between them
+  // costs less than sending the rectangles separately.
+  bool m_regionCoarsening;
+
+  // Detect scrolled areas by comparing pixels and send them as CopyRect
+  // when no window movement has been detected.
+  bool m_motionDetection;
+
   StringStorage m_logFilePath;
 private:
 
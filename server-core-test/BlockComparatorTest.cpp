@@ -0,0 +1,201 @@
+// Copyright (C) 2012 GlavSoft LLC.
+// All rights reserved.
+//
+//-------------------------------------------------------------------------
+// This file is part of the TightVNC software.  Please visit our Web site:
+//
+//                       http://www.tightvnc.com/
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+//-------------------------------------------------------------------------
+//
+
+
+#include "BlockComparatorTest.h"
+#include "BenchmarkTimer.h"
+#include "util/CpuFeatures.h"
+#include "util/Exception.h"
+#include <stdio.h>
+
+bool BlockComparatorTest::TestComparator::setLevel(int level)
+{
+  switch (level) {
+  case SCALAR:
+    m_compareRow = compareRowScalar;
+    return true;
+  case SSE2:
+    m_compareRow = compareRowSse2;
+    return CpuFeatures::hasSse2();
+  case AVX2:
+    m_compareRow = compareRowAvx2;
+    return CpuFeatures::hasAvx2();
+  }
+  return false;
+}
+
+BlockComparatorTest::BlockComparatorTest()
+: m_seed(2024)
+{
+}
+
+BlockComparatorTest::~BlockComparatorTest()
+{
+}
+
+void BlockComparatorTest::run()
+{
+  checkBlocks();
+  runBenchmark();
+}
+
+void BlockComparatorTest::checkBlocks()
+{
+  // Rows of up to 300 bytes cover the vector loops and their tails, blocks
+  // start at odd offsets of the buffers.
+  const size_t bytesPerRow = 320;
+  const int maxHeight = 8;
+  std::vector<UINT8> oldBuffer(bytesPerRow * maxHeight + 16);
+  std::vector<UINT8> newBuffer(oldBuffer.size());
+  TestComparator comparators[NUM_LEVELS];
+  bool supported[NUM_LEVELS];
+  for (int level = 0; level < NUM_LEVELS; level++) {
+    supported[level] = comparators[level].setLevel(level);
+  }
+
+  for (int i = 0; i < 20000; i++) {
+    size_t rowSize = 1 + random() % 300;
+    int height = 1 + random() % maxHeight;
+    size_t offset = random() % 16;
+    for (size_t j = 0; j < oldBuffer.size(); j++) {
+      oldBuffer[j] = newBuffer[j] = (UINT8)random();
+    }
+    // None, one or a few differing bytes, some of them outside of the
+    // block.
+    int numChanges = random() % 4;
+    for (int j = 0; j < numChanges; j++) {
+      size_t pos = random() % oldBuffer.size();
+      if (random() % 4 != 0) {
+        pos = offset + (random() % height) * bytesPerRow + random() % rowSize;
+      }
+      newBuffer[pos] ^= (UINT8)(1 << random() % 8);
+    }
+
+    const UINT8 *oldPixels = &oldBuffer[offset];
+    const UINT8 *newPixels = &newBuffer[offset];
+    BlockComparator::Change expected = { 0, 0, 0, 0 };
+    bool expectedChanged = findChange(oldPixels, newPixels, bytesPerRow,
+                                      rowSize, height, &expected);
+    for (int level = 0; level < NUM_LEVELS; level++) {
+      if (!supported[level]) {
+        continue;
+      }
+      BlockComparator::Change change = { 0, 0, 0, 0 };
+      bool changed = comparators[level].compare(oldPixels, newPixels,
+                                                bytesPerRow, rowSize, height,
+                                                &change);
+      if (changed != expectedChanged ||
+          (changed && (change.top != expected.top ||
+                       change.bottom != expected.bottom ||
+                       change.left != expected.left ||
+                       change.right != expected.right))) {
+        throw Exception(_T("The %s comparison of a block of %d rows of %d")
+                        _T(" bytes found a wrong change"),
+                        getLevelName(level), height, (int)rowSize);
+      }
+    }
+  }
+}
+
+void BlockComparatorTest::runBenchmark()
+{
+  // Equal 64x64 blocks of 32-bit pixels in a 1920 pixels wide frame.
+  const size_t bytesPerRow = 1920 * 4;
+  const size_t rowSize = 64 * 4;
+  const int height = 64;
+  const int numBlocks = 2000;
+  std::vector<UINT8> oldBuffer(bytesPerRow * height);
+  for (size_t i = 0; i < oldBuffer.size(); i++) {
+    oldBuffer[i] = (UINT8)random();
+  }
+  std::vector<UINT8> newBuffer = oldBuffer;
+
+  _tprintf(_T("Equal 64x64 blocks:"));
+  for (int level = 0; level < NUM_LEVELS; level++) {
+    TestComparator comparator;
+    if (!comparator.setLevel(level)) {
+      continue;
+    }
+    BlockComparator::Change change;
+    BenchmarkTimer timer;
+    for (int i = 0; i < numBlocks; i++) {
+      size_t x = (i % 30) * rowSize;
+      if (comparator.compare(&oldBuffer[x], &newBuffer[x], bytesPerRow,
+                             rowSize, height, &change)) {
+        throw Exception(_T("Equal blocks were found different"));
+      }
+    }
+    _tprintf(_T(" %s %.3f us"), getLevelName(level),
+             timer.getElapsed() / numBlocks);
+  }
+  _tprintf(_T("\n"));
+}
+
+bool BlockComparatorTest::findChange(const UINT8 *oldPixels,
+                                     const UINT8 *newPixels,
+                                     size_t bytesPerRow, size_t rowSize,
+                                     int height,
+                                     BlockComparator::Change *change)
+{
+  bool changed = false;
+  for (int y = 0; y < height; y++) {
+    for (size_t x = 0; x < rowSize; x++) {
+      if (oldPixels[y * bytesPerRow + x] == newPixels[y * bytesPerRow + x]) {
+        continue;
+      }
+      if (!changed) {
+        changed = true;
+        change->top = y;
+        change->left = x;
+        change->right = x + 1;
+      }
+      change->bottom = y + 1;
+      if (x < change->left) {
+        change->left = x;
+      }
+      if (x + 1 > change->right) {
+        change->right = x + 1;
+      }
+    }
+  }
+  return changed;
+}
+
+UINT32 BlockComparatorTest::random()
+{
+  m_seed = m_seed * 1103515245 + 12345;
+  return m_seed >> 8;
+}
+
+const TCHAR *BlockComparatorTest::getLevelName(int level)
+{
+  switch (level) {
+  case SCALAR:
+    return _T("scalar");
+  case SSE2:
+    return _T("SSE2");
+  default:
+    return _T("AVX2");
+  }
+}
@@ -0,0 +1,77 @@
+// Copyright (C) 2012 GlavSoft LLC.
+// All rights reserved.
+//
+//-------------------------------------------------------------------------
+// This file is part of the TightVNC software.  Please visit our Web site:
+//
+//                       http://www.tightvnc.com/
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+//-------------------------------------------------------------------------
+//
+
+
+#ifndef __BLOCKCOMPARATORTEST_H__
+#define __BLOCKCOMPARATORTEST_H__
+
+#include "desktop/BlockComparator.h"
+#include <vector>
+
+// Compares random blocks with a few differing bytes by the scalar, SSE2
+// and AVX2 row comparisons of BlockComparator and checks that all of them
+// find the same bounds as a byte by byte search. The benchmark compares
+// their speed on equal blocks, the common case.
+class BlockComparatorTest
+{
+public:
+  BlockComparatorTest();
+  virtual ~BlockComparatorTest();
+
+  // Throws Exception if a check fails.
+  void run();
+
+private:
+  enum Level
+  {
+    SCALAR,
+    SSE2,
+    AVX2,
+    NUM_LEVELS
+  };
+
+  // Allows to select the row comparison.
+  class TestComparator : public BlockComparator
+  {
+  public:
+    // Returns false if the processor does not support the level.
+    bool setLevel(int level);
+  };
+
+  void checkBlocks();
+  void runBenchmark();
+
+  // Finds the bounds of the differing bytes byte by byte.
+  static bool findChange(const UINT8 *oldPixels, const UINT8 *newPixels,
+                         size_t bytesPerRow, size_t rowSize, int height,
+                         BlockComparator::Change *change);
+
+  UINT32 random();
+
+  static const TCHAR *getLevelName(int level);
+
+  UINT32 m_seed;
+};
+
+#endif // __BLOCKCOMPARATORTEST_H__
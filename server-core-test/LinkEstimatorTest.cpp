@@ -0,0 +1,268 @@
+// Copyright (C) 2012 GlavSoft LLC.
+// All rights reserved.
+//
+//-------------------------------------------------------------------------
+// This file is part of the TightVNC software.  Please visit our Web site:
+//
+//                       http://www.tightvnc.com/
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+//-------------------------------------------------------------------------
+//
+
+
+#include "LinkEstimatorTest.h"
+#include "rfb/EncodingDefs.h"
+#include "util/Exception.h"
+
+LinkEstimatorTest::LinkEstimatorTest()
+: m_time(1000000)
+{
+}
+
+LinkEstimatorTest::~LinkEstimatorTest()
+{
+}
+
+void LinkEstimatorTest::run()
+{
+  checkFastLink();
+  checkSlowLink();
+  checkChangingLink();
+  checkCongestion();
+  checkSmallUpdates();
+  checkEarlyRequest();
+  checkClientLimits();
+}
+
+void LinkEstimatorTest::checkFastLink()
+{
+  // 100 MB/s, 1 ms: the client's settings are kept.
+  m_estimator.reset();
+  SimulatedLink lan = { 100 * 1024 * 1024, 1, 0 };
+  sendUpdates(&lan, 256 * 1024, 30);
+  checkLinkClass(0, _T("a fast link"));
+
+  int jpegQuality, compressionLevel;
+  getLevels(&jpegQuality, &compressionLevel);
+  if (jpegQuality != 9 || compressionLevel != 1) {
+    throw Exception(_T("A fast link changed JPEG quality to %d and")
+                    _T(" compression level to %d"),
+                    jpegQuality, compressionLevel);
+  }
+  if (m_estimator.getLosslessRefreshArea(SCREEN_AREA) != SCREEN_AREA / 100) {
+    throw Exception(_T("Wrong lossless refresh area on a fast link"));
+  }
+}
+
+void LinkEstimatorTest::checkSlowLink()
+{
+  // 64 KB/s, 100 ms: the slowest class.
+  m_estimator.reset();
+  SimulatedLink modem = { 64 * 1024, 100, 0 };
+  sendUpdates(&modem, 64 * 1024, 30);
+  checkLinkClass(4, _T("a slow link"));
+
+  unsigned int throughput = m_estimator.getThroughput();
+  if (throughput < 50 * 1024 || throughput > 64 * 1024) {
+    throw Exception(_T("Throughput of a 64 KB/s link estimated as %u"),
+                    throughput);
+  }
+  int jpegQuality, compressionLevel;
+  getLevels(&jpegQuality, &compressionLevel);
+  if (jpegQuality != 2 || compressionLevel != 9) {
+    throw Exception(_T("A slow link got JPEG quality %d and")
+                    _T(" compression level %d"),
+                    jpegQuality, compressionLevel);
+  }
+  if (m_estimator.getLosslessRefreshArea(SCREEN_AREA) != SCREEN_AREA / 800) {
+    throw Exception(_T("Wrong lossless refresh area on a slow link"));
+  }
+}
+
+void LinkEstimatorTest::checkChangingLink()
+{
+  // A link shrinking from 100 MB/s to 64 KB/s and recovering. The class
+  // changes by one step per update.
+  m_estimator.reset();
+  SimulatedLink fast = { 100 * 1024 * 1024, 1, 0 };
+  SimulatedLink slow = { 64 * 1024, 100, 0 };
+  sendUpdates(&fast, 256 * 1024, 20);
+  checkLinkClass(0, _T("a fast link"));
+
+  int prevClass = m_estimator.getLinkClass();
+  for (int i = 0; i < 30; i++) {
+    sendUpdates(&slow, 64 * 1024, 1);
+    int linkClass = m_estimator.getLinkClass();
+    if (linkClass < prevClass || linkClass > prevClass + 1) {
+      throw Exception(_T("Link class changed from %d to %d on a shrinking")
+                      _T(" link"), prevClass, linkClass);
+    }
+    prevClass = linkClass;
+  }
+  checkLinkClass(4, _T("a shrunk link"));
+
+  sendUpdates(&fast, 256 * 1024, 30);
+  checkLinkClass(0, _T("a recovered link"));
+}
+
+void LinkEstimatorTest::checkCongestion()
+{
+  // 1 MB/s, 20 ms. A queue on the way delays the data by 300 ms, then the
+  // queue drains.
+  m_estimator.reset();
+  SimulatedLink link = { 1024 * 1024, 20, 0 };
+  sendUpdates(&link, 64 * 1024, 20);
+  if (m_estimator.isCongested()) {
+    throw Exception(_T("A steady link was considered congested"));
+  }
+  if (m_estimator.getLosslessRefreshArea(SCREEN_AREA) == 0) {
+    throw Exception(_T("No lossless refresh on a steady link"));
+  }
+
+  link.queueDelay = 300;
+  sendUpdates(&link, 64 * 1024, 5);
+  if (!m_estimator.isCongested()) {
+    throw Exception(_T("A queue of 300 ms was not detected"));
+  }
+  if (m_estimator.getLosslessRefreshArea(SCREEN_AREA) != 0) {
+    throw Exception(_T("Lossless refresh was not paused on a congested link"));
+  }
+
+  link.queueDelay = 0;
+  sendUpdates(&link, 64 * 1024, 10);
+  if (m_estimator.isCongested()) {
+    throw Exception(_T("Congestion was still detected after the queue")
+                    _T(" had drained"));
+  }
+}
+
+void LinkEstimatorTest::checkSmallUpdates()
+{
+  // Updates of 1 KB are mostly the round-trip time, so they give no
+  // throughput samples even on a slow link.
+  m_estimator.reset();
+  SimulatedLink modem = { 64 * 1024, 100, 0 };
+  sendUpdates(&modem, 1024, 20);
+  if (m_estimator.hasEstimate()) {
+    throw Exception(_T("Small updates produced a throughput estimate"));
+  }
+  checkLinkClass(0, _T("small updates"));
+}
+
+void LinkEstimatorTest::checkEarlyRequest()
+{
+  // A request sent by the client before it got the update does not measure
+  // anything.
+  m_estimator.reset();
+  DateTime start(m_time);
+  DateTime end(m_time + 10);
+  DateTime early(m_time + 5);
+  DateTime late(m_time + 500);
+  m_estimator.onUpdateSent(128 * 1024, &start, &end);
+  m_estimator.onUpdateRequest(&early);
+  if (m_estimator.hasEstimate()) {
+    throw Exception(_T("An early request was used for measurement"));
+  }
+  m_estimator.onUpdateRequest(&late);
+  if (!m_estimator.hasEstimate() ||
+      m_estimator.getThroughput() != 128 * 1024 * 2) {
+    throw Exception(_T("Wrong throughput after a valid request: %u"),
+                    m_estimator.getThroughput());
+  }
+  // The next request without a new update is ignored too.
+  DateTime later(m_time + 100000);
+  m_estimator.onUpdateRequest(&later);
+  if (m_estimator.getThroughput() != 128 * 1024 * 2) {
+    throw Exception(_T("A request without an update was used"));
+  }
+  m_time += 100000;
+}
+
+void LinkEstimatorTest::checkClientLimits()
+{
+  // A client which did not enable JPEG or set a compression level keeps
+  // the defaults even on the slowest link.
+  m_estimator.reset();
+  SimulatedLink modem = { 64 * 1024, 100, 0 };
+  sendUpdates(&modem, 64 * 1024, 30);
+
+  EncodeOptions options;
+  setClientOptions(&options, -1, -1);
+  m_estimator.adjustEncodeOptions(&options);
+  if (options.jpegEnabled() || options.getCompressionLevel(-1) != -1) {
+    throw Exception(_T("Encoding options the client did not set were")
+                    _T(" changed"));
+  }
+
+  // A client which asked for a lower quality keeps it on a fast link.
+  m_estimator.reset();
+  SimulatedLink lan = { 100 * 1024 * 1024, 1, 0 };
+  sendUpdates(&lan, 256 * 1024, 30);
+  setClientOptions(&options, 3, -1);
+  m_estimator.adjustEncodeOptions(&options);
+  if (options.getJpegQualityLevel() != 3) {
+    throw Exception(_T("JPEG quality was raised above the client's level"));
+  }
+}
+
+void LinkEstimatorTest::sendUpdates(const SimulatedLink *link,
+                                    UINT64 updateSize, int numUpdates)
+{
+  for (int i = 0; i < numUpdates; i++) {
+    DateTime startTime(m_time);
+    DateTime endTime(m_time + 1);
+    UINT64 transferTime = updateSize * 1000 / link->throughput;
+    DateTime requestTime(m_time + transferTime + link->roundTripTime +
+                         link->queueDelay);
+    m_estimator.onUpdateSent(updateSize, &startTime, &endTime);
+    m_estimator.onUpdateRequest(&requestTime);
+    m_time = requestTime.getTime();
+  }
+}
+
+void LinkEstimatorTest::getLevels(int *jpegQuality,
+                                  int *compressionLevel) const
+{
+  EncodeOptions options;
+  setClientOptions(&options, 9, 1);
+  m_estimator.adjustEncodeOptions(&options);
+  *jpegQuality = options.getJpegQualityLevel();
+  *compressionLevel = options.getCompressionLevel();
+}
+
+void LinkEstimatorTest::setClientOptions(EncodeOptions *options,
+                                         int jpegQuality,
+                                         int compressionLevel)
+{
+  std::vector<int> encodings(1, EncodingDefs::TIGHT);
+  if (jpegQuality >= 0) {
+    encodings.push_back(PseudoEncDefs::QUALITY_LEVEL_0 + jpegQuality);
+  }
+  if (compressionLevel >= 0) {
+    encodings.push_back(PseudoEncDefs::COMPR_LEVEL_0 + compressionLevel);
+  }
+  options->setEncodings(&encodings);
+}
+
+void LinkEstimatorTest::checkLinkClass(int expected,
+                                       const TCHAR *situation) const
+{
+  int linkClass = m_estimator.getLinkClass();
+  if (linkClass != expected) {
+    throw Exception(_T("Link class %d instead of %d for %s"),
+                    linkClass, expected, situation);
+  }
+}
@@ -0,0 +1,89 @@
+// Copyright (C) 2012 GlavSoft LLC.
+// All rights reserved.
+//
+//-------------------------------------------------------------------------
+// This file is part of the TightVNC software.  Please visit our Web site:
+//
+//                       http://www.tightvnc.com/
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+//-------------------------------------------------------------------------
+//
+
+
+#ifndef __LINKESTIMATORTEST_H__
+#define __LINKESTIMATORTEST_H__
+
+#include "fb-update-sender/LinkQualityEstimator.h"
+
+// Feeds LinkQualityEstimator with the timing of updates sent over simulated
+// links and checks the encoding parameters chosen for them: the link class,
+// the JPEG quality and compression level limits, the lossless refresh area
+// and congestion detection.
+class LinkEstimatorTest
+{
+public:
+  LinkEstimatorTest();
+  virtual ~LinkEstimatorTest();
+
+  // Throws Exception if a check fails.
+  void run();
+
+private:
+  // A link delivering throughput bytes per second with the given round-trip
+  // time (in milliseconds). queueDelay is added to the delivery time, as if
+  // the data waited in a queue on the way.
+  struct SimulatedLink
+  {
+    unsigned int throughput;
+    unsigned int roundTripTime;
+    unsigned int queueDelay;
+  };
+
+  void checkFastLink();
+  void checkSlowLink();
+  void checkChangingLink();
+  void checkCongestion();
+  void checkSmallUpdates();
+  void checkEarlyRequest();
+  void checkClientLimits();
+
+  // Sends numUpdates updates of updateSize bytes over the link. Writing
+  // takes one millisecond (the data fits into the socket buffers), the
+  // client requests the next update as soon as it has received one.
+  void sendUpdates(const SimulatedLink *link, UINT64 updateSize,
+                   int numUpdates);
+
+  // Returns the JPEG quality and the compression level chosen for a client
+  // which has asked for quality 9 and compression level 1.
+  void getLevels(int *jpegQuality, int *compressionLevel) const;
+
+  // Sets the encodings a client would request with SetEncodings: Tight with
+  // the given JPEG quality and compression level (negative values are not
+  // requested).
+  static void setClientOptions(EncodeOptions *options, int jpegQuality,
+                               int compressionLevel);
+
+  // Throws Exception if the link class differs from the expected one.
+  void checkLinkClass(int expected, const TCHAR *situation) const;
+
+  LinkQualityEstimator m_estimator;
+  // Simulated time, in milliseconds.
+  UINT64 m_time;
+
+  static const int SCREEN_AREA = 1024 * 768;
+};
+
+#endif // __LINKESTIMATORTEST_H__
@@ -0,0 +1,355 @@
+// Copyright (C) 2012 GlavSoft LLC.
+// All rights reserved.
+//
+//-------------------------------------------------------------------------
+// This file is part of the TightVNC software.  Please visit our Web site:
+//
+//                       http://www.tightvnc.com/
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+//-------------------------------------------------------------------------
+//
+
+
+#include "MotionDetectorTest.h"
+#include "BenchmarkTimer.h"
+#include "rfb/StandardPixelFormatFactory.h"
+#include "util/Exception.h"
+
+MotionDetectorTest::MotionDetectorTest()
+: m_docX(0),
+  m_docY(0),
+  m_seed(4242)
+{
+}
+
+MotionDetectorTest::~MotionDetectorTest()
+{
+}
+
+void MotionDetectorTest::run()
+{
+  drawDocument();
+  checkVerticalScroll();
+  checkHorizontalScroll();
+  checkTileChanges();
+  checkLongJump();
+  checkNoScroll();
+  checkNotGrabbed();
+  runBenchmark();
+}
+
+void MotionDetectorTest::checkVerticalScroll()
+{
+  // Mouse wheel steps down and up, single rows and page jumps.
+  Dimension desktop(1024, 768);
+  Rect window(128, 64, 896, 704);
+  startSession(&desktop, &window);
+  const int steps[] = { 3, 3, 3, 3, -3, -3, 1, -1, 40, -40, 120, 200, -250 };
+  for (size_t i = 0; i < sizeof(steps) / sizeof(steps[0]); i++) {
+    checkScroll(0, steps[i]);
+  }
+}
+
+void MotionDetectorTest::checkHorizontalScroll()
+{
+  Dimension desktop(1024, 768);
+  Rect window(128, 64, 896, 704);
+  startSession(&desktop, &window);
+  const int steps[] = { 16, 16, 64, -8, -88 };
+  for (size_t i = 0; i < sizeof(steps) / sizeof(steps[0]); i++) {
+    checkScroll(steps[i], 0);
+  }
+}
+
+void MotionDetectorTest::checkTileChanges()
+{
+  // The poller reports the changes as 16x16 tiles: the blank margins of the
+  // document are left out, the rest of the window should still be found.
+  Dimension desktop(1024, 768);
+  Rect window(128, 64, 896, 704);
+  startSession(&desktop, &window);
+  const int steps[] = { 3, 24, -5 };
+  for (size_t i = 0; i < sizeof(steps) / sizeof(steps[0]); i++) {
+    Rect expected = getMovedArea(0, steps[i]);
+    scroll(0, steps[i]);
+
+    Region changedRegion;
+    Rect tile;
+    for (int y = 0; y < desktop.height; y += 16) {
+      for (int x = 0; x < desktop.width; x += 16) {
+        tile.setRect(x, y, x + 16, y + 16);
+        if (!m_newFrame.cmpFrom(&tile, &m_oldFrame, x, y)) {
+          changedRegion.addRect(&tile);
+        }
+      }
+    }
+    Region grabbedRegion(desktop.getRect());
+    Rect dstRect;
+    Point src;
+    if (!m_detector.detect(&m_oldFrame, &m_newFrame, &changedRegion,
+                           &grabbedRegion, &dstRect, &src)) {
+      throw Exception(_T("A scroll by %d reported by tiles was not detected"),
+                      steps[i]);
+    }
+    checkMoved(&dstRect, &src);
+    Rect inside = dstRect.intersection(&expected);
+    if (!inside.isEqualTo(&dstRect) ||
+        dstRect.area() < expected.area() * 9 / 10) {
+      throw Exception(_T("A scroll by %d reported by tiles was detected")
+                      _T(" at (%d, %d, %d, %d) instead of (%d, %d, %d, %d)"),
+                      steps[i], dstRect.left, dstRect.top,
+                      dstRect.right, dstRect.bottom,
+                      expected.left, expected.top,
+                      expected.right, expected.bottom);
+    }
+  }
+}
+
+void MotionDetectorTest::checkLongJump()
+{
+  // The part of the window which stayed visible has to be MIN_SIZE rows
+  // high at least.
+  Dimension desktop(1024, 768);
+  Rect window(128, 64, 896, 704);
+  startSession(&desktop, &window);
+  checkScroll(0, window.getHeight() - MotionDetector::MIN_SIZE);
+
+  scroll(0, window.getHeight() - MotionDetector::MIN_SIZE + 1);
+  Region grabbedRegion(desktop.getRect());
+  Rect dstRect;
+  Point src;
+  if (detect(&grabbedRegion, &dstRect, &src)) {
+    throw Exception(_T("A scroll leaving less than MIN_SIZE rows visible")
+                    _T(" was detected"));
+  }
+}
+
+void MotionDetectorTest::checkNoScroll()
+{
+  Dimension desktop(1024, 768);
+  Rect window(128, 64, 896, 704);
+  startSession(&desktop, &window);
+  Region grabbedRegion(desktop.getRect());
+  Rect dstRect;
+  Point src;
+
+  // Another part of the document is opened, none of its lines were seen.
+  scroll(0, 1200);
+  if (detect(&grabbedRegion, &dstRect, &src)) {
+    throw Exception(_T("New content was detected as a scroll"));
+  }
+
+  // The window is cleared, its lines match at any shift.
+  show(&m_oldFrame, m_docX, m_docY);
+  show(&m_newFrame, m_docX, m_docY);
+  m_newFrame.fillRect(&m_window, 0xffffff);
+  if (detect(&grabbedRegion, &dstRect, &src)) {
+    throw Exception(_T("A cleared window was detected as a scroll"));
+  }
+
+  // The text is selected, each pixel changes in place.
+  show(&m_newFrame, m_docX, m_docY);
+  for (int y = m_window.top; y < m_window.bottom; y++) {
+    UINT32 *pixels = (UINT32 *)m_newFrame.getBufferPtr(0, y);
+    for (int x = m_window.left; x < m_window.right; x++) {
+      pixels[x] ^= 0xffffff;
+    }
+  }
+  if (detect(&grabbedRegion, &dstRect, &src)) {
+    throw Exception(_T("Selected text was detected as a scroll"));
+  }
+}
+
+void MotionDetectorTest::checkNotGrabbed()
+{
+  // The moved area cannot be trusted if a part of it was not grabbed.
+  Dimension desktop(1024, 768);
+  Rect window(128, 64, 896, 704);
+  startSession(&desktop, &window);
+  scroll(0, 10);
+
+  Region grabbedRegion(desktop.getRect());
+  Rect notGrabbed(window.left, window.bottom - 100,
+                  window.right, window.bottom);
+  Region notGrabbedRegion(notGrabbed);
+  grabbedRegion.subtract(&notGrabbedRegion);
+  Rect dstRect;
+  Point src;
+  if (detect(&grabbedRegion, &dstRect, &src)) {
+    throw Exception(_T("A scroll was detected in an area not grabbed"));
+  }
+
+  // The part not grabbed lies outside of the window.
+  Rect bounds = desktop.getRect();
+  grabbedRegion.addRect(&bounds);
+  Rect corner(0, 0, 64, 64);
+  Region cornerRegion(corner);
+  grabbedRegion.subtract(&cornerRegion);
+  if (!detect(&grabbedRegion, &dstRect, &src)) {
+    throw Exception(_T("A scroll was not detected with the window grabbed"));
+  }
+}
+
+void MotionDetectorTest::runBenchmark()
+{
+  // A three rows wheel step in a maximized window of a full HD desktop,
+  // and the same window getting new content.
+  Dimension desktop(1920, 1080);
+  Rect window(0, 40, 1920, 1040);
+  startSession(&desktop, &window);
+  Region changedRegion(window);
+  Region grabbedRegion(desktop.getRect());
+  Rect dstRect;
+  Point src;
+
+  const int numUpdates = 50;
+  double scrollTime = 0;
+  double noScrollTime = 0;
+  for (int i = 0; i < numUpdates; i++) {
+    scroll(0, 3);
+    BenchmarkTimer timer;
+    m_detector.detect(&m_oldFrame, &m_newFrame, &changedRegion,
+                      &grabbedRegion, &dstRect, &src);
+    scrollTime += timer.getElapsed();
+  }
+  for (int i = 0; i < numUpdates; i++) {
+    scroll(0, i % 2 == 0 ? 1200 : -1200);
+    BenchmarkTimer timer;
+    m_detector.detect(&m_oldFrame, &m_newFrame, &changedRegion,
+                      &grabbedRegion, &dstRect, &src);
+    noScrollTime += timer.getElapsed();
+  }
+
+  _tprintf(_T("Motion detection in a 1920x1000 window: scroll %.0f us,")
+           _T(" new content %.0f us\n"),
+           scrollTime / numUpdates, noScrollTime / numUpdates);
+}
+
+void MotionDetectorTest::drawDocument()
+{
+  Dimension dim(2560, 2560);
+  PixelFormat pf = StandardPixelFormatFactory::create32bppPixelFormat();
+  m_document.setProperties(&dim, &pf);
+  Rect bounds = dim.getRect();
+  m_document.fillRect(&bounds, 0xffffff);
+
+  // Glyphs are random 8x16 cells with a blank column, some of the cells
+  // are left blank as spaces between words.
+  int lineStep = LINE_HEIGHT + LINE_SPACING;
+  for (int top = 0; top + lineStep <= dim.height; top += lineStep) {
+    for (int left = MARGIN; left + 8 <= dim.width - MARGIN; left += 8) {
+      if (random() % 6 == 0) {
+        continue;
+      }
+      for (int y = top; y < top + LINE_HEIGHT; y++) {
+        UINT32 *pixels = (UINT32 *)m_document.getBufferPtr(left, y);
+        for (int x = 0; x < 7; x++) {
+          if (random() % 3 == 0) {
+            pixels[x] = 0x000000;
+          }
+        }
+      }
+    }
+  }
+}
+
+void MotionDetectorTest::startSession(const Dimension *dim,
+                                      const Rect *window)
+{
+  PixelFormat pf = StandardPixelFormatFactory::create32bppPixelFormat();
+  m_oldFrame.setProperties(dim, &pf);
+  m_newFrame.setProperties(dim, &pf);
+  m_window = *window;
+  m_docX = 0;
+  m_docY = 0;
+}
+
+void MotionDetectorTest::show(FrameBuffer *fb, int docX, int docY)
+{
+  Dimension dim = fb->getDimension();
+  for (int y = 0; y < dim.height; y++) {
+    UINT32 *pixels = (UINT32 *)fb->getBufferPtr(0, y);
+    for (int x = 0; x < dim.width; x++) {
+      pixels[x] = (x / 8 + y / 8) % 2 == 0 ? 0x3a6ea5 : 0x808080;
+    }
+  }
+  fb->copyFrom(&m_window, &m_document, docX, docY);
+}
+
+void MotionDetectorTest::scroll(int dx, int dy)
+{
+  show(&m_oldFrame, m_docX, m_docY);
+  m_docX += dx;
+  m_docY += dy;
+  show(&m_newFrame, m_docX, m_docY);
+}
+
+bool MotionDetectorTest::detect(const Region *grabbedRegion,
+                                Rect *dstRect, Point *src)
+{
+  Region changedRegion(m_window);
+  return m_detector.detect(&m_oldFrame, &m_newFrame, &changedRegion,
+                           grabbedRegion, dstRect, src);
+}
+
+void MotionDetectorTest::checkScroll(int dx, int dy)
+{
+  Rect expected = getMovedArea(dx, dy);
+  scroll(dx, dy);
+  Region grabbedRegion(m_newFrame.getDimension().getRect());
+  Rect dstRect;
+  Point src;
+  if (!detect(&grabbedRegion, &dstRect, &src)) {
+    throw Exception(_T("A scroll by (%d, %d) was not detected"), dx, dy);
+  }
+  checkMoved(&dstRect, &src);
+  if (!dstRect.isEqualTo(&expected) ||
+      src.x != expected.left + dx || src.y != expected.top + dy) {
+    throw Exception(_T("A scroll by (%d, %d) was detected at")
+                    _T(" (%d, %d, %d, %d) from (%d, %d)"),
+                    dx, dy, dstRect.left, dstRect.top,
+                    dstRect.right, dstRect.bottom, src.x, src.y);
+  }
+}
+
+Rect MotionDetectorTest::getMovedArea(int dx, int dy) const
+{
+  // The part of the window that was visible before the scroll.
+  Rect moved(m_window);
+  moved.move(-dx, -dy);
+  return moved.intersection(&m_window);
+}
+
+void MotionDetectorTest::checkMoved(const Rect *dstRect, const Point *src)
+{
+  Rect srcRect(*dstRect);
+  srcRect.move(src->x - dstRect->left, src->y - dstRect->top);
+  Rect frame = m_oldFrame.getDimension().getRect();
+  if (!frame.intersection(&srcRect).isEqualTo(&srcRect)) {
+    throw Exception(_T("The source of a moved area lies outside the frame"));
+  }
+  if (!m_newFrame.cmpFrom(dstRect, &m_oldFrame, src->x, src->y)) {
+    throw Exception(_T("The area at (%d, %d, %d, %d) did not move from")
+                    _T(" (%d, %d)"), dstRect->left, dstRect->top,
+                    dstRect->right, dstRect->bottom, src->x, src->y);
+  }
+}
+
+UINT32 MotionDetectorTest::random()
+{
+  m_seed = m_seed * 1103515245 + 12345;
+  return m_seed >> 8;
+}
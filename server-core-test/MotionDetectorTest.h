@@ -0,0 +1,102 @@
+// Copyright (C) 2012 GlavSoft LLC.
+// All rights reserved.
+//
+//-------------------------------------------------------------------------
+// This file is part of the TightVNC software.  Please visit our Web site:
+//
+//                       http://www.tightvnc.com/
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+//-------------------------------------------------------------------------
+//
+
+
+#ifndef __MOTIONDETECTORTEST_H__
+#define __MOTIONDETECTORTEST_H__
+
+#include "desktop/MotionDetector.h"
+
+// Scrolls a text document within a window of a synthetic desktop and checks
+// that MotionDetector finds the moved area and its source: wheel steps up
+// and down, a horizontal scroll, changes reported tile by tile, a jump too
+// long to detect, changes which are not a scroll and an area which was not
+// grabbed. The benchmark measures detection on a full HD desktop.
+class MotionDetectorTest
+{
+public:
+  MotionDetectorTest();
+  virtual ~MotionDetectorTest();
+
+  // Throws Exception if a check fails.
+  void run();
+
+private:
+  void checkVerticalScroll();
+  void checkHorizontalScroll();
+  void checkTileChanges();
+  void checkLongJump();
+  void checkNoScroll();
+  void checkNotGrabbed();
+  void runBenchmark();
+
+  // Sets up the desktop of the given dimension with the window showing the
+  // top left corner of the document.
+  void startSession(const Dimension *dim, const Rect *window);
+
+  // Draws the desktop to fb with the window showing the document from
+  // (docX, docY).
+  void show(FrameBuffer *fb, int docX, int docY);
+
+  // Fills the document with lines of random glyphs.
+  void drawDocument();
+
+  // Scrolls the document by (dx, dy): the old frame shows the current
+  // position, the new frame the scrolled one.
+  void scroll(int dx, int dy);
+
+  // Calls MotionDetector::detect() for the window reported as changed.
+  bool detect(const Region *grabbedRegion, Rect *dstRect, Point *src);
+
+  // Scrolls the document and throws Exception unless the whole area which
+  // stayed within the window is detected.
+  void checkScroll(int dx, int dy);
+
+  // Returns the area of the new frame expected to be detected after the
+  // scroll by (dx, dy).
+  Rect getMovedArea(int dx, int dy) const;
+
+  // Throws Exception if the area at dstRect in the new frame differs from
+  // the area at src in the old frame.
+  void checkMoved(const Rect *dstRect, const Point *src);
+
+  UINT32 random();
+
+  MotionDetector m_detector;
+  // Lines of random glyphs separated by blank rows.
+  FrameBuffer m_document;
+  FrameBuffer m_oldFrame;
+  FrameBuffer m_newFrame;
+  Rect m_window;
+  // The document position shown by the window.
+  int m_docX;
+  int m_docY;
+  UINT32 m_seed;
+
+  static const int LINE_HEIGHT = 16;
+  static const int LINE_SPACING = 4;
+  static const int MARGIN = 32;
+};
+
+#endif // __MOTIONDETECTORTEST_H__
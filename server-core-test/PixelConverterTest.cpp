@@ -0,0 +1,220 @@
+// Copyright (C) 2012 GlavSoft LLC.
+// All rights reserved.
+//
+//-------------------------------------------------------------------------
+// This file is part of the TightVNC software.  Please visit our Web site:
+//
+//                       http://www.tightvnc.com/
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+//-------------------------------------------------------------------------
+//
+
+
+#include "PixelConverterTest.h"
+#include "BenchmarkTimer.h"
+#include "rfb/StandardPixelFormatFactory.h"
+#include "util/Exception.h"
+#include <stdio.h>
+
+bool PixelConverterTest::TestConverter::hasSimdKernel() const
+{
+  return m_hasSimdKernel;
+}
+
+void PixelConverterTest::TestConverter::disableSimdKernel()
+{
+  m_hasSimdKernel = false;
+}
+
+PixelConverterTest::PixelConverterTest()
+: m_seed(777)
+{
+}
+
+PixelConverterTest::~PixelConverterTest()
+{
+}
+
+void PixelConverterTest::run()
+{
+  checkConversions();
+  runBenchmark();
+}
+
+void PixelConverterTest::checkConversions()
+{
+  std::vector<NamedFormat> formats = getFormats();
+  Dimension dim(256, 256);
+  FrameBuffer srcFb;
+  int numPairs = 0;
+  int numSimdPairs = 0;
+
+  for (size_t i = 0; i < formats.size(); i++) {
+    const NamedFormat *src = &formats[i];
+    if (src->pf.bitsPerPixel != 32 && src->pf.bitsPerPixel != 16) {
+      continue;
+    }
+    srcFb.setProperties(&dim, &src->pf);
+    fillPixels(&srcFb);
+
+    for (size_t j = 0; j < formats.size(); j++) {
+      const NamedFormat *dst = &formats[j];
+      if (j == i) {
+        continue;
+      }
+      numPairs++;
+      m_simdConverter.setPixelFormats(&dst->pf, &src->pf);
+      m_tableConverter.setPixelFormats(&dst->pf, &src->pf);
+      m_tableConverter.disableSimdKernel();
+      if (!m_simdConverter.hasSimdKernel()) {
+        continue;
+      }
+      numSimdPairs++;
+
+      m_simdFb.setProperties(&dim, &dst->pf);
+      m_tableFb.setProperties(&dim, &dst->pf);
+      // The whole frame buffer, then narrow rectangles at odd positions
+      // for the tails of the rows.
+      Rect bounds = dim.getRect();
+      checkRect(&bounds, &srcFb, src, dst);
+      for (int width = 1; width <= 40; width++) {
+        Rect rect(width, 3, width * 2, 7);
+        checkRect(&rect, &srcFb, src, dst);
+      }
+    }
+  }
+
+  _tprintf(_T("Pixel conversion: %d of %d format pairs are vectorized\n"),
+           numSimdPairs, numPairs);
+}
+
+void PixelConverterTest::checkRect(const Rect *rect, const FrameBuffer *srcFb,
+                                   const NamedFormat *src,
+                                   const NamedFormat *dst)
+{
+  Rect bounds = m_simdFb.getDimension().getRect();
+  m_simdFb.fillRect(&bounds, 0);
+  m_tableFb.fillRect(&bounds, 0);
+  m_simdConverter.convert(rect, &m_simdFb, srcFb);
+  m_tableConverter.convert(rect, &m_tableFb, srcFb);
+
+  for (int y = 0; y < bounds.bottom; y++) {
+    if (memcmp(m_simdFb.getBufferPtr(0, y), m_tableFb.getBufferPtr(0, y),
+               m_simdFb.getBytesPerRow()) != 0) {
+      throw Exception(_T("Vectorized conversion from %s to %s differs")
+                      _T(" from the tables in row %d of a %dx%d rectangle"),
+                      src->name, dst->name, y,
+                      rect->getWidth(), rect->getHeight());
+    }
+  }
+}
+
+void PixelConverterTest::runBenchmark()
+{
+  PixelFormat srcPf = StandardPixelFormatFactory::create32bppPixelFormat();
+  PixelFormat dstPf = StandardPixelFormatFactory::create16bppPixelFormat();
+  Dimension dim(1024, 768);
+  FrameBuffer srcFb;
+  srcFb.setProperties(&dim, &srcPf);
+  fillPixels(&srcFb);
+  m_simdFb.setProperties(&dim, &dstPf);
+  m_tableFb.setProperties(&dim, &dstPf);
+  m_simdConverter.setPixelFormats(&dstPf, &srcPf);
+  m_tableConverter.setPixelFormats(&dstPf, &srcPf);
+  m_tableConverter.disableSimdKernel();
+
+  const int numFrames = 20;
+  Rect bounds = dim.getRect();
+  BenchmarkTimer timer;
+  for (int i = 0; i < numFrames; i++) {
+    m_tableConverter.convert(&bounds, &m_tableFb, &srcFb);
+  }
+  double tableTime = timer.getElapsed() / numFrames;
+  timer.reset();
+  for (int i = 0; i < numFrames; i++) {
+    m_simdConverter.convert(&bounds, &m_simdFb, &srcFb);
+  }
+  double simdTime = timer.getElapsed() / numFrames;
+
+  _tprintf(_T("Pixel conversion of 1024x768 from 32 to 16 bits:")
+           _T(" tables %.0f us, vectorized %.0f us%s\n"),
+           tableTime, simdTime,
+           m_simdConverter.hasSimdKernel() ? _T("")
+                                           : _T(" (no kernel)"));
+}
+
+void PixelConverterTest::fillPixels(FrameBuffer *fb)
+{
+  Dimension dim = fb->getDimension();
+  size_t pixelSize = fb->getBytesPerPixel();
+  UINT32 index = 0;
+  for (int y = 0; y < dim.height; y++) {
+    UINT8 *pixels = (UINT8 *)fb->getBufferPtr(0, y);
+    for (int x = 0; x < dim.width; x++, index++) {
+      m_seed = m_seed * 1103515245 + 12345;
+      UINT32 pixel = m_seed ^ (m_seed >> 16 | m_seed << 16);
+      if (pixelSize == 4) {
+        ((UINT32 *)pixels)[x] = pixel;
+      } else if (index < 65536) {
+        ((UINT16 *)pixels)[x] = (UINT16)index;
+      } else {
+        ((UINT16 *)pixels)[x] = (UINT16)pixel;
+      }
+    }
+  }
+}
+
+std::vector<PixelConverterTest::NamedFormat> PixelConverterTest::getFormats()
+{
+  std::vector<NamedFormat> formats;
+  NamedFormat format;
+
+  format.name = _T("32 bpp");
+  format.pf = StandardPixelFormatFactory::create32bppPixelFormat();
+  formats.push_back(format);
+  format.name = _T("32 bpp byte-swapped");
+  format.pf.bigEndian = !format.pf.bigEndian;
+  formats.push_back(format);
+  format.name = _T("32 bpp BGR");
+  format.pf = StandardPixelFormatFactory::create32bppPixelFormat();
+  format.pf.redShift = 0;
+  format.pf.blueShift = 16;
+  formats.push_back(format);
+
+  format.name = _T("16 bpp");
+  format.pf = StandardPixelFormatFactory::create16bppPixelFormat();
+  formats.push_back(format);
+  format.name = _T("16 bpp byte-swapped");
+  format.pf.bigEndian = !format.pf.bigEndian;
+  formats.push_back(format);
+  format.name = _T("16 bpp 555");
+  format.pf = StandardPixelFormatFactory::create16bppPixelFormat();
+  format.pf.greenMax = 31;
+  format.pf.redShift = 10;
+  format.pf.colorDepth = 15;
+  formats.push_back(format);
+
+  format.name = _T("8 bpp");
+  format.pf = StandardPixelFormatFactory::create8bppPixelFormat();
+  formats.push_back(format);
+  format.name = _T("6 bpp");
+  format.pf = StandardPixelFormatFactory::create6bppPixelFormat();
+  formats.push_back(format);
+  format.name = _T("3 bpp");
+  format.pf = StandardPixelFormatFactory::create3bppPixelFormat();
+  formats.push_back(format);
+  return formats;
+}
@@ -0,0 +1,82 @@
+// Copyright (C) 2012 GlavSoft LLC.
+// All rights reserved.
+//
+//-------------------------------------------------------------------------
+// This file is part of the TightVNC software.  Please visit our Web site:
+//
+//                       http://www.tightvnc.com/
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+//-------------------------------------------------------------------------
+//
+
+
+#ifndef __PIXELCONVERTERTEST_H__
+#define __PIXELCONVERTERTEST_H__
+
+#include "rfb/PixelConverter.h"
+
+// Converts pixels with mixed color components between the formats of
+// StandardPixelFormatFactory (and their byte-swapped and BGR variants) by
+// the vectorized kernels and by the tables of PixelConverter, and checks
+// that the results are the same. The benchmark compares their speed.
+class PixelConverterTest
+{
+public:
+  PixelConverterTest();
+  virtual ~PixelConverterTest();
+
+  // Throws Exception if a check fails.
+  void run();
+
+private:
+  // Allows to turn off the vectorized kernel.
+  class TestConverter : public PixelConverter
+  {
+  public:
+    bool hasSimdKernel() const;
+    void disableSimdKernel();
+  };
+
+  struct NamedFormat
+  {
+    const TCHAR *name;
+    PixelFormat pf;
+  };
+
+  void checkConversions();
+  void runBenchmark();
+
+  // Converts the rectangle from srcFb with both converters and throws
+  // Exception unless the whole destination frame buffers are equal.
+  void checkRect(const Rect *rect, const FrameBuffer *srcFb,
+                 const NamedFormat *src, const NamedFormat *dst);
+
+  // Fills the frame buffer with pseudo-random pixels, all the bits
+  // including the unused ones are random. 16-bit frame buffers begin with
+  // all the 65536 pixel values.
+  void fillPixels(FrameBuffer *fb);
+
+  // Returns the formats to convert between.
+  static std::vector<NamedFormat> getFormats();
+
+  TestConverter m_simdConverter;
+  TestConverter m_tableConverter;
+  FrameBuffer m_simdFb;
+  FrameBuffer m_tableFb;
+  UINT32 m_seed;
+};
+
+#endif // __PIXELCONVERTERTEST_H__
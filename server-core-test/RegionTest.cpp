@@ -0,0 +1,282 @@
+// Copyright (C) 2012 GlavSoft LLC.
+// All rights reserved.
+//
+//-------------------------------------------------------------------------
+// This file is part of the TightVNC software.  Please visit our Web site:
+//
+//                       http://www.tightvnc.com/
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+//-------------------------------------------------------------------------
+//
+
+
+#include "RegionTest.h"
+#include "BenchmarkTimer.h"
+#include "util/Exception.h"
+#include <stdio.h>
+
+RegionTest::ReferenceRegion::ReferenceRegion()
+{
+  miRegionInit(&region, NullBox, 0);
+}
+
+RegionTest::ReferenceRegion::ReferenceRegion(const ReferenceRegion &other)
+{
+  miRegionInit(&region, NullBox, 0);
+  miRegionCopy(&region, (RegionPtr)&other.region);
+}
+
+RegionTest::ReferenceRegion::~ReferenceRegion()
+{
+  miRegionUninit(&region);
+}
+
+void RegionTest::ReferenceRegion::addRect(const Rect *rect)
+{
+  if (rect->isEmpty()) {
+    return;
+  }
+  BoxRec box = { (short)rect->left, (short)rect->top,
+                 (short)rect->right, (short)rect->bottom };
+  RegionRec other;
+  miRegionInit(&other, &box, 0);
+  miUnion(&region, &region, &other);
+  miRegionUninit(&other);
+}
+
+void RegionTest::ReferenceRegion::add(ReferenceRegion *other)
+{
+  miUnion(&region, &region, &other->region);
+}
+
+void RegionTest::ReferenceRegion::subtract(ReferenceRegion *other)
+{
+  miSubtract(&region, &region, &other->region);
+}
+
+void RegionTest::ReferenceRegion::intersect(ReferenceRegion *other)
+{
+  miIntersect(&region, &region, &other->region);
+}
+
+void RegionTest::ReferenceRegion::crop(const Rect *rect)
+{
+  ReferenceRegion other;
+  other.addRect(rect);
+  intersect(&other);
+}
+
+void RegionTest::ReferenceRegion::translate(int dx, int dy)
+{
+  miTranslateRegion(&region, dx, dy);
+}
+
+bool RegionTest::ReferenceRegion::isPointInside(int x, int y)
+{
+  BoxRec box;
+  return miPointInRegion(&region, x, y, &box) != 0;
+}
+
+RegionTest::RegionTest()
+: m_seed(1)
+{
+}
+
+RegionTest::~RegionTest()
+{
+}
+
+void RegionTest::run()
+{
+  checkRandomOperations();
+  runBenchmark();
+}
+
+void RegionTest::checkRandomOperations()
+{
+  for (int testCase = 0; testCase < NUM_CASES; testCase++) {
+    // Small areas give many touching and equal edges.
+    const int sizes[] = { 16, 64, 400 };
+    int size = sizes[testCase % 3];
+
+    // Regions built rectangle by rectangle and by addRects().
+    Region a, b;
+    ReferenceRegion refA, refB;
+    std::vector<Rect> rects;
+    int numRectsA = random(12);
+    for (int i = 0; i < numRectsA; i++) {
+      Rect r = getRandomRect(size);
+      if (random(2) == 0) {
+        a.addRect(&r);
+      } else {
+        rects.push_back(r);
+      }
+      refA.addRect(&r);
+    }
+    a.addRects(&rects);
+    int numRectsB = random(12);
+    for (int i = 0; i < numRectsB; i++) {
+      Rect r = getRandomRect(size);
+      b.addRect(&r);
+      refB.addRect(&r);
+    }
+    checkSame(&a, &refA, testCase, _T("building"));
+    checkSame(&b, &refB, testCase, _T("building"));
+
+    Region c = a;
+    ReferenceRegion refC(refA);
+    const TCHAR *operation = _T("");
+    switch (random(7)) {
+    case 0:
+      operation = _T("add");
+      c.add(&b);
+      refC.add(&refB);
+      break;
+    case 1:
+      operation = _T("subtract");
+      c.subtract(&b);
+      refC.subtract(&refB);
+      break;
+    case 2:
+      operation = _T("intersect");
+      c.intersect(&b);
+      refC.intersect(&refB);
+      break;
+    case 3:
+      {
+        operation = _T("crop");
+        Rect r = getRandomRect(size);
+        c.crop(&r);
+        refC.crop(&r);
+      }
+      break;
+    case 4:
+      {
+        operation = _T("translate");
+        int dx = random(21) - 10;
+        int dy = random(21) - 10;
+        c.translate(dx, dy);
+        refC.translate(dx, dy);
+      }
+      break;
+    case 5:
+      operation = _T("add itself");
+      c.add(&c);
+      refC.add(&refC);
+      break;
+    default:
+      operation = _T("subtract itself");
+      c.subtract(&c);
+      refC.subtract(&refC);
+      break;
+    }
+    checkSame(&c, &refC, testCase, operation);
+
+    for (int i = 0; i < 5; i++) {
+      int x = random(size);
+      int y = random(size);
+      if (c.isPointInside(x, y) != refC.isPointInside(x, y)) {
+        throw Exception(_T("Case %d: the point (%d, %d) is wrong after %s"),
+                        testCase, x, y, operation);
+      }
+    }
+    Region copy = c;
+    if (!copy.equals(&c)) {
+      throw Exception(_T("Case %d: a copy is not equal to the region"),
+                      testCase);
+    }
+  }
+}
+
+void RegionTest::runBenchmark()
+{
+  // 16x16 tiles of a 1920x1080 screen, every other tile in a checkerboard
+  // pattern, added one by one in row order and in random order.
+  std::vector<Rect> tiles;
+  for (int y = 0; y < 1080; y += 16) {
+    for (int x = (y / 16) % 2 * 16; x < 1920; x += 32) {
+      tiles.push_back(Rect(x, y, x + 16, y + 16));
+    }
+  }
+  std::vector<Rect> shuffled = tiles;
+  for (size_t i = shuffled.size() - 1; i > 0; i--) {
+    std::swap(shuffled[i], shuffled[random((int)i + 1)]);
+  }
+
+  const std::vector<Rect> *orders[2] = { &tiles, &shuffled };
+  const TCHAR *names[2] = { _T("row order"), _T("random order") };
+  for (int i = 0; i < 2; i++) {
+    const std::vector<Rect> *rects = orders[i];
+    BenchmarkTimer timer;
+    Region region;
+    for (size_t j = 0; j < rects->size(); j++) {
+      region.addRect(&(*rects)[j]);
+    }
+    double regionTime = timer.getElapsed();
+    timer.reset();
+    ReferenceRegion reference;
+    for (size_t j = 0; j < rects->size(); j++) {
+      reference.addRect(&(*rects)[j]);
+    }
+    double referenceTime = timer.getElapsed();
+    checkSame(&region, &reference, 0, names[i]);
+
+    _tprintf(_T("Adding %d tiles in %s: Region %.0f us,")
+             _T(" x11region %.0f us\n"),
+             (int)rects->size(), names[i], regionTime, referenceTime);
+  }
+}
+
+void RegionTest::checkSame(const Region *region, ReferenceRegion *reference,
+                           int testCase, const TCHAR *stage)
+{
+  std::vector<Rect> rects;
+  region->getRectVector(&rects);
+  long numRects = REGION_NUM_RECTS(&reference->region);
+  BoxPtr boxes = REGION_RECTS(&reference->region);
+  bool same = (long)rects.size() == numRects &&
+              region->isEmpty() == (numRects == 0);
+  for (long i = 0; same && i < numRects; i++) {
+    same = rects[i].left == boxes[i].x1 && rects[i].top == boxes[i].y1 &&
+           rects[i].right == boxes[i].x2 && rects[i].bottom == boxes[i].y2;
+  }
+  if (same && numRects != 0) {
+    Rect bounds = region->getBounds();
+    BoxPtr extents = REGION_EXTENTS(&reference->region);
+    same = bounds.left == extents->x1 && bounds.top == extents->y1 &&
+           bounds.right == extents->x2 && bounds.bottom == extents->y2;
+  }
+  if (!same) {
+    throw Exception(_T("Case %d: the region differs from x11region after %s")
+                    _T(" (%d rectangles instead of %d)"),
+                    testCase, stage, (int)rects.size(), (int)numRects);
+  }
+}
+
+Rect RegionTest::getRandomRect(int size)
+{
+  int x = random(size);
+  int y = random(size);
+  int width = random(size / 2);
+  int height = random(size / 2);
+  return Rect(x, y, x + width, y + height);
+}
+
+int RegionTest::random(int n)
+{
+  m_seed = m_seed * 1103515245 + 12345;
+  return (int)((m_seed >> 8) % n);
+}
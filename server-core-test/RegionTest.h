@@ -0,0 +1,88 @@
+// Copyright (C) 2012 GlavSoft LLC.
+// All rights reserved.
+//
+//-------------------------------------------------------------------------
+// This file is part of the TightVNC software.  Please visit our Web site:
+//
+//                       http://www.tightvnc.com/
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+//-------------------------------------------------------------------------
+//
+
+
+#ifndef __REGIONTEST_H__
+#define __REGIONTEST_H__
+
+#include "region/Region.h"
+
+extern "C" {
+#include "region/x11region.h"
+}
+
+// Differential test of Region against x11region, the implementation Region
+// used to wrap: random regions are combined by both and must give the same
+// rectangles, bounds and point tests. The benchmark compares them on the
+// tile grids the pollers produce.
+class RegionTest
+{
+public:
+  RegionTest();
+  virtual ~RegionTest();
+
+  // Throws Exception if a check fails.
+  void run();
+
+private:
+  // A region of x11region.
+  class ReferenceRegion
+  {
+  public:
+    ReferenceRegion();
+    ReferenceRegion(const ReferenceRegion &other);
+    virtual ~ReferenceRegion();
+
+    void addRect(const Rect *rect);
+    void add(ReferenceRegion *other);
+    void subtract(ReferenceRegion *other);
+    void intersect(ReferenceRegion *other);
+    void crop(const Rect *rect);
+    void translate(int dx, int dy);
+    bool isPointInside(int x, int y);
+
+    RegionRec region;
+
+  private:
+    ReferenceRegion &operator=(const ReferenceRegion &other);
+  };
+
+  void checkRandomOperations();
+  void runBenchmark();
+
+  // Throws Exception unless the regions have the same rectangles and
+  // bounds.
+  static void checkSame(const Region *region, ReferenceRegion *reference,
+                        int testCase, const TCHAR *stage);
+
+  // Returns a random rectangle within size x size pixels, it can be empty.
+  Rect getRandomRect(int size);
+  int random(int n);
+
+  UINT32 m_seed;
+
+  static const int NUM_CASES = 100000;
+};
+
+#endif // __REGIONTEST_H__
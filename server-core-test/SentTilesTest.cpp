@@ -0,0 +1,270 @@
+// Copyright (C) 2012 GlavSoft LLC.
+// All rights reserved.
+//
+//-------------------------------------------------------------------------
+// This file is part of the TightVNC software.  Please visit our Web site:
+//
+//                       http://www.tightvnc.com/
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+//-------------------------------------------------------------------------
+//
+
+
+#include "SentTilesTest.h"
+#include "BenchmarkTimer.h"
+#include "rfb/StandardPixelFormatFactory.h"
+#include "util/Exception.h"
+#include <stdio.h>
+
+SentTilesTest::SentTilesTest()
+: m_generation(0)
+{
+}
+
+SentTilesTest::~SentTilesTest()
+{
+  m_snapshot.release();
+}
+
+void SentTilesTest::run()
+{
+  checkRestoredTile();
+  checkChangedTile();
+  checkKeptTile();
+  checkOutOfSyncTile();
+  checkPartialSend();
+  checkLateChange();
+  checkRegion();
+  runBenchmark();
+}
+
+void SentTilesTest::checkRestoredTile()
+{
+  // A caret blinks twice between updates, the tile is the same as sent.
+  Dimension dim(256, 192);
+  startSession(&dim);
+  Rect caret(70, 10, 72, 26);
+  change(&caret, 0x000000);
+  restore(&caret);
+  checkFilter(&caret, 1, _T("a restored tile"));
+
+  // Tiles sent in part after the whole screen remain known.
+  change(&caret, 0x000000);
+  Region sent(caret);
+  Region outOfSync;
+  onUpdateSent(m_generation, &sent, &outOfSync);
+  change(&caret, 0xff0000);
+  change(&caret, 0x000000);
+  checkFilter(&caret, 1, _T("a restored tile sent in part"));
+}
+
+void SentTilesTest::checkChangedTile()
+{
+  Dimension dim(256, 192);
+  startSession(&dim);
+  Rect caret(70, 10, 72, 26);
+  change(&caret, 0x000000);
+  checkFilter(&caret, 0, _T("a changed tile"));
+}
+
+void SentTilesTest::checkKeptTile()
+{
+  Dimension dim(256, 192);
+  startSession(&dim);
+  Rect caret(70, 10, 72, 26);
+  change(&caret, 0x000000);
+  restore(&caret);
+  Region changedRegion(caret);
+  Region keepRegion(Rect(0, 0, 65, 1));
+  size_t numRemoved = filter(&changedRegion, &keepRegion);
+  Region expected(caret);
+  if (numRemoved != 0 || !changedRegion.equals(&expected)) {
+    throw Exception(_T("A tile to be kept was removed"));
+  }
+}
+
+void SentTilesTest::checkOutOfSyncTile()
+{
+  Dimension dim(256, 192);
+  startSession(&dim);
+  Rect caret(70, 10, 72, 26);
+  Region sent;
+  Region outOfSync(caret);
+  onUpdateSent(m_generation, &sent, &outOfSync);
+  change(&caret, 0x000000);
+  restore(&caret);
+  checkFilter(&caret, 0, _T("a tile out of sync"));
+}
+
+void SentTilesTest::checkPartialSend()
+{
+  // The client has not got the rest of the tile.
+  Dimension dim(256, 192);
+  startSession(&dim);
+  m_sentTiles.reset();
+  Rect caret(70, 10, 72, 26);
+  Region sent(Rect(64, 0, 128, 32));
+  Region outOfSync;
+  onUpdateSent(m_generation, &sent, &outOfSync);
+  change(&caret, 0x000000);
+  restore(&caret);
+  checkFilter(&caret, 0, _T("a tile sent in part"));
+}
+
+void SentTilesTest::checkLateChange()
+{
+  // The snapshot has a change which has not reached the sender, so the
+  // update does not tell what the client has. The change is sent when it
+  // arrives.
+  Dimension dim(256, 192);
+  startSession(&dim);
+  Rect caret(70, 10, 72, 26);
+  UINT64 updateGeneration = m_generation;
+  change(&caret, 0x000000);
+  Region sent(dim.getRect());
+  Region outOfSync;
+  onUpdateSent(updateGeneration, &sent, &outOfSync);
+  checkFilter(&caret, 0, _T("a tile changed after the update"));
+}
+
+void SentTilesTest::checkRegion()
+{
+  // A line across three tiles, the middle one is restored. Only the parts
+  // of the other tiles remain.
+  Dimension dim(256, 192);
+  startSession(&dim);
+  Rect line(10, 10, 150, 20);
+  Rect middle(64, 10, 128, 20);
+  change(&line, 0x000000);
+  Region sent(line);
+  Region outOfSync;
+  onUpdateSent(m_generation, &sent, &outOfSync);
+  change(&middle, 0xff0000);
+  change(&middle, 0x000000);
+  Rect left(10, 10, 64, 20);
+  Rect right(128, 10, 150, 20);
+  change(&left, 0x00ff00);
+  change(&right, 0x0000ff);
+
+  Region changedRegion(line);
+  Region keepRegion;
+  size_t numRemoved = filter(&changedRegion, &keepRegion);
+  Region expected(left);
+  expected.addRect(&right);
+  if (numRemoved != 1 || !changedRegion.equals(&expected)) {
+    throw Exception(_T("%d tiles were removed from a line across three")
+                    _T(" tiles instead of the middle one"), (int)numRemoved);
+  }
+}
+
+void SentTilesTest::runBenchmark()
+{
+  Dimension dim(3840, 2160);
+  startSession(&dim);
+  const int numUpdates = 1000;
+  Rect caret(70, 10, 72, 26);
+  Region outOfSync;
+  double filterTime = 0;
+  double sentTime = 0;
+  for (int i = 0; i < numUpdates; i++) {
+    UINT64 generation = i % 2 == 0 ? change(&caret, 0x000000)
+                                    : restore(&caret);
+    Region changedRegion(caret);
+    Region keepRegion;
+    m_snapshot.acquire(&m_sharedFrame);
+    BenchmarkTimer timer;
+    m_sentTiles.filter(&m_snapshot, &changedRegion, &keepRegion);
+    filterTime += timer.getElapsed();
+    timer.reset();
+    m_sentTiles.onUpdateSent(&m_snapshot, generation, &changedRegion,
+                             &outOfSync);
+    sentTime += timer.getElapsed();
+  }
+  m_snapshot.release();
+
+  _tprintf(_T("Sent tiles of a 3840x2160 frame, one-tile updates:")
+           _T(" filter %.2f us, onUpdateSent %.2f us\n"),
+           filterTime / numUpdates, sentTime / numUpdates);
+}
+
+void SentTilesTest::startSession(const Dimension *dim)
+{
+  PixelFormat pf = StandardPixelFormatFactory::create32bppPixelFormat();
+  m_desktop.setProperties(dim, &pf);
+  Rect bounds = dim->getRect();
+  restore(&bounds);
+
+  m_sentTiles.reset();
+  Region all(bounds);
+  Region outOfSync;
+  onUpdateSent(m_generation, &all, &outOfSync);
+}
+
+UINT64 SentTilesTest::change(const Rect *rect, UINT32 color)
+{
+  m_desktop.fillRect(rect, color);
+  return update(rect);
+}
+
+UINT64 SentTilesTest::restore(const Rect *rect)
+{
+  for (int y = rect->top; y < rect->bottom; y++) {
+    UINT32 *pixels = (UINT32 *)m_desktop.getBufferPtr(0, y);
+    for (int x = rect->left; x < rect->right; x++) {
+      pixels[x] = (x / 8 + y / 8) % 2 == 0 ? 0xffffff : 0x808080;
+    }
+  }
+  return update(rect);
+}
+
+UINT64 SentTilesTest::update(const Rect *rect)
+{
+  Region changed(*rect);
+  m_generation = m_sharedFrame.update(&m_desktop, &changed);
+  return m_generation;
+}
+
+size_t SentTilesTest::filter(Region *changedRegion, const Region *keepRegion)
+{
+  m_snapshot.acquire(&m_sharedFrame);
+  size_t numRemoved = m_sentTiles.filter(&m_snapshot, changedRegion,
+                                         keepRegion);
+  m_snapshot.release();
+  return numRemoved;
+}
+
+void SentTilesTest::onUpdateSent(UINT64 frameGeneration,
+                                 const Region *sentRegion,
+                                 const Region *outOfSyncRegion)
+{
+  m_snapshot.acquire(&m_sharedFrame);
+  m_sentTiles.onUpdateSent(&m_snapshot, frameGeneration, sentRegion,
+                           outOfSyncRegion);
+  m_snapshot.release();
+}
+
+void SentTilesTest::checkFilter(const Rect *changedRect, size_t expected,
+                                const TCHAR *situation)
+{
+  Region changedRegion(*changedRect);
+  Region keepRegion;
+  size_t numRemoved = filter(&changedRegion, &keepRegion);
+  bool isEmpty = changedRegion.isEmpty();
+  if (numRemoved != expected || isEmpty != (expected != 0)) {
+    throw Exception(_T("%d tiles were removed instead of %d for %s"),
+                    (int)numRemoved, (int)expected, situation);
+  }
+}
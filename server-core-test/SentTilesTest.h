@@ -0,0 +1,85 @@
+// Copyright (C) 2012 GlavSoft LLC.
+// All rights reserved.
+//
+//-------------------------------------------------------------------------
+// This file is part of the TightVNC software.  Please visit our Web site:
+//
+//                       http://www.tightvnc.com/
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+//-------------------------------------------------------------------------
+//
+
+
+#ifndef __SENTTILESTEST_H__
+#define __SENTTILESTEST_H__
+
+#include "fb-update-sender/SentTiles.h"
+
+// Changes the tiles of a SharedFrameBuffer, passes updates to SentTiles
+// and checks which changed tiles it removes as already known to the client:
+// a tile changed and restored before the update, a tile changed for real,
+// kept, out of sync, sent in part or changed after the update generation.
+// The benchmark measures one-tile updates on a big frame buffer.
+class SentTilesTest
+{
+public:
+  SentTilesTest();
+  virtual ~SentTilesTest();
+
+  // Throws Exception if a check fails.
+  void run();
+
+private:
+  void checkRestoredTile();
+  void checkChangedTile();
+  void checkKeptTile();
+  void checkOutOfSyncTile();
+  void checkPartialSend();
+  void checkLateChange();
+  void checkRegion();
+  void runBenchmark();
+
+  // Draws the desktop pattern of the given dimension, copies it to the
+  // shared frame buffer and sends it to the client whole.
+  void startSession(const Dimension *dim);
+
+  // Fill the rectangle of the desktop with a color or with the original
+  // pattern and copy it to the shared frame buffer. Return the frame
+  // generation.
+  UINT64 change(const Rect *rect, UINT32 color);
+  UINT64 restore(const Rect *rect);
+  UINT64 update(const Rect *rect);
+
+  // Calls SentTiles::filter() with a new snapshot.
+  size_t filter(Region *changedRegion, const Region *keepRegion);
+
+  // Calls SentTiles::onUpdateSent() with a new snapshot.
+  void onUpdateSent(UINT64 frameGeneration, const Region *sentRegion,
+                    const Region *outOfSyncRegion);
+
+  // Throws Exception unless filter() removes the expected number of tiles
+  // from the rectangle.
+  void checkFilter(const Rect *changedRect, size_t expected,
+                   const TCHAR *situation);
+
+  FrameBuffer m_desktop;
+  SharedFrameBuffer m_sharedFrame;
+  FrameSnapshot m_snapshot;
+  SentTiles m_sentTiles;
+  UINT64 m_generation;
+};
+
+#endif // __SENTTILESTEST_H__
@@ -0,0 +1,340 @@
+// Copyright (C) 2012 GlavSoft LLC.
+// All rights reserved.
+//
+//-------------------------------------------------------------------------
+// This file is part of the TightVNC software.  Please visit our Web site:
+//
+//                       http://www.tightvnc.com/
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+//-------------------------------------------------------------------------
+//
+
+
+#include "TightOutputTest.h"
+#include "BenchmarkTimer.h"
+#include "rfb/EncodingDefs.h"
+#include "rfb/StandardPixelFormatFactory.h"
+#include "util/Exception.h"
+#include <stdio.h>
+
+TightOutputTest::CountingOutputStream::CountingOutputStream()
+: numCalls(0)
+{
+}
+
+size_t TightOutputTest::CountingOutputStream::write(const void *buffer,
+                                                    size_t len)
+{
+  const UINT8 *bytes = (const UINT8 *)buffer;
+  data.insert(data.end(), bytes, bytes + len);
+  numCalls++;
+  return len;
+}
+
+size_t TightOutputTest::CountingOutputStream::writeVector(
+  const OutputSegment *segments, size_t count)
+{
+  size_t totalLength = 0;
+  for (size_t i = 0; i < count; i++) {
+    const UINT8 *bytes = (const UINT8 *)segments[i].data;
+    data.insert(data.end(), bytes, bytes + segments[i].length);
+    totalLength += segments[i].length;
+  }
+  numCalls++;
+  return totalLength;
+}
+
+void TightOutputTest::CountingOutputStream::clear()
+{
+  data.clear();
+  numCalls = 0;
+}
+
+TightOutputTest::TightOutputTest()
+: m_seed(54321),
+  m_photo(600, 420, 1000, 740),
+  m_buffered(&m_sink),
+  m_output(&m_buffered),
+  m_readPos(0)
+{
+  PixelFormat pf = StandardPixelFormatFactory::create32bppPixelFormat();
+  Dimension dim(1024, 768);
+  m_fb.setProperties(&dim, &pf);
+  m_decoded.setProperties(&dim, &pf);
+  m_conv.setPixelFormats(&pf, &pf);
+  for (int i = 0; i < 4; i++) {
+    m_inflaters[i] = new Inflater;
+  }
+}
+
+TightOutputTest::~TightOutputTest()
+{
+  for (int i = 0; i < 4; i++) {
+    delete m_inflaters[i];
+  }
+}
+
+void TightOutputTest::run()
+{
+  drawDesktop();
+  checkDecoding();
+  runBenchmark();
+}
+
+void TightOutputTest::checkDecoding()
+{
+  TightEncoder encoder(&m_conv, &m_output);
+  Rect bounds = m_fb.getDimension().getRect();
+
+  // Two updates, the second one is decoded with the zlib streams left by
+  // the first one.
+  for (int update = 0; update < 2; update++) {
+    m_sink.clear();
+    UINT64 copiedBefore = m_buffered.getTotalCopied();
+    size_t numRects = sendUpdate(&encoder);
+    UINT64 copied = m_buffered.getTotalCopied() - copiedBefore;
+
+    m_decoded.fillRect(&bounds, 0);
+    decode(numRects);
+    for (int y = 0; y < bounds.bottom; y++) {
+      if (memcmp(m_fb.getBufferPtr(0, y), m_decoded.getBufferPtr(0, y),
+                 m_fb.getBytesPerRow()) != 0) {
+        throw Exception(_T("The decoded update differs in row %d"), y);
+      }
+    }
+
+    // The encoder writes a vector per 64 KB of output, the payloads big
+    // enough to be written in place are not copied by the buffer.
+    size_t size = m_sink.data.size();
+    size_t maxCalls = size / (32 * 1024) + 2;
+    if (m_sink.numCalls > maxCalls) {
+      throw Exception(_T("%d bytes were written by %d calls"),
+                      (int)size, (int)m_sink.numCalls);
+    }
+    if (copied > size / 4) {
+      throw Exception(_T("%d bytes of %d were copied by the buffer"),
+                      (int)copied, (int)size);
+    }
+  }
+}
+
+void TightOutputTest::runBenchmark()
+{
+  TightEncoder encoder(&m_conv, &m_output);
+  UINT64 copiedBefore = m_buffered.getTotalCopied();
+  UINT64 writtenBefore = m_buffered.getTotalWritten();
+  size_t numCalls = 0;
+  size_t numRects = 0;
+
+  BenchmarkTimer timer;
+  for (int i = 0; i < NUM_BENCHMARK_UPDATES; i++) {
+    // New noise in the photo, so that it is compressed again.
+    fillNoise(&m_photo, 0);
+    m_sink.clear();
+    numRects += sendUpdate(&encoder);
+    numCalls += m_sink.numCalls;
+  }
+  double time = timer.getElapsed();
+
+  UINT64 copied = m_buffered.getTotalCopied() - copiedBefore;
+  UINT64 written = m_buffered.getTotalWritten() - writtenBefore;
+  _tprintf(_T("Tight output per update: %d rectangles, %d writes,")
+           _T(" %d bytes copied of %d, %.0f us\n"),
+           (int)(numRects / NUM_BENCHMARK_UPDATES),
+           (int)(numCalls / NUM_BENCHMARK_UPDATES),
+           (int)(copied / NUM_BENCHMARK_UPDATES),
+           (int)(written / NUM_BENCHMARK_UPDATES),
+           time / NUM_BENCHMARK_UPDATES);
+}
+
+size_t TightOutputTest::sendUpdate(TightEncoder *encoder)
+{
+  Rect bounds = m_fb.getDimension().getRect();
+  std::vector<Rect> rects;
+  encoder->splitRectangle(&bounds, &rects, &m_fb, &m_options);
+  encoder->sendRectangles(&rects, &m_fb, &m_options);
+  m_buffered.flush();
+  return rects.size();
+}
+
+void TightOutputTest::decode(size_t numRects)
+{
+  m_readPos = 0;
+  for (size_t i = 0; i < numRects; i++) {
+    const UINT8 *header = read(RECT_HEADER_SIZE);
+    int x = header[0] << 8 | header[1];
+    int y = header[2] << 8 | header[3];
+    int w = header[4] << 8 | header[5];
+    int h = header[6] << 8 | header[7];
+    if (header[8] != 0 || header[9] != 0 || header[10] != 0 ||
+        header[11] != EncodingDefs::TIGHT) {
+      throw Exception(_T("Wrong encoding in the rectangle header"));
+    }
+    Rect rect(x, y, x + w, y + h);
+    decodeRect(&rect);
+  }
+  if (m_readPos != m_sink.data.size()) {
+    throw Exception(_T("%d bytes are left after the update"),
+                    (int)(m_sink.data.size() - m_readPos));
+  }
+}
+
+void TightOutputTest::decodeRect(const Rect *rect)
+{
+  UINT8 control = *read(1);
+  for (int i = 0; i < 4; i++) {
+    if (control & (1 << i)) {
+      delete m_inflaters[i];
+      m_inflaters[i] = new Inflater;
+    }
+  }
+  int type = control >> 4;
+  if (type == 0x08) {
+    UINT32 color;
+    readPixels(&color, 1);
+    m_decoded.fillRect(rect, color);
+    return;
+  }
+  if (type > 0x07) {
+    throw Exception(_T("Unexpected Tight subencoding %d"), type);
+  }
+
+  int width = rect->getWidth();
+  int height = rect->getHeight();
+  UINT32 palette[256];
+  int numColors = 0;
+  if (type & 0x04) {
+    UINT8 filter = *read(1);
+    if (filter != 0x01) {
+      throw Exception(_T("Unexpected Tight filter %d"), (int)filter);
+    }
+    numColors = *read(1) + 1;
+    readPixels(palette, numColors);
+  }
+
+  int rowLength = width * 3;
+  if (numColors == 2) {
+    rowLength = (width + 7) / 8;
+  } else if (numColors != 0) {
+    rowLength = width;
+  }
+  const UINT8 *data = readCompressed(rowLength * height, type & 0x03);
+
+  for (int y = 0; y < height; y++) {
+    UINT32 *pixels = (UINT32 *)m_decoded.getBufferPtr(rect->left,
+                                                      rect->top + y);
+    const UINT8 *row = data + y * rowLength;
+    for (int x = 0; x < width; x++) {
+      if (numColors == 2) {
+        pixels[x] = palette[row[x / 8] >> (7 - x % 8) & 1];
+      } else if (numColors != 0) {
+        pixels[x] = palette[row[x]];
+      } else {
+        const UINT8 *rgb = row + x * 3;
+        pixels[x] = rgb[0] << 16 | rgb[1] << 8 | rgb[2];
+      }
+    }
+  }
+}
+
+const UINT8 *TightOutputTest::readCompressed(size_t rawLength, int streamId)
+{
+  if (rawLength < 12) {
+    return read(rawLength);
+  }
+  size_t length = readCompactLength();
+  Inflater *inflater = m_inflaters[streamId];
+  inflater->setInput((const char *)read(length), length);
+  inflater->setUnpackedSize(rawLength);
+  inflater->inflate();
+  if (inflater->getOutputSize() != rawLength) {
+    throw Exception(_T("%d bytes were decompressed instead of %d"),
+                    (int)inflater->getOutputSize(), (int)rawLength);
+  }
+  return (const UINT8 *)inflater->getOutput();
+}
+
+void TightOutputTest::readPixels(UINT32 *pixels, size_t count)
+{
+  // 24-bit pixels are packed into three bytes, red first.
+  const UINT8 *rgb = read(count * 3);
+  for (size_t i = 0; i < count; i++) {
+    pixels[i] = rgb[i * 3] << 16 | rgb[i * 3 + 1] << 8 | rgb[i * 3 + 2];
+  }
+}
+
+const UINT8 *TightOutputTest::read(size_t length)
+{
+  if (length > m_sink.data.size() - m_readPos) {
+    throw Exception(_T("The update ends in the middle of a rectangle"));
+  }
+  const UINT8 *data = &m_sink.data.front() + m_readPos;
+  m_readPos += length;
+  return data;
+}
+
+size_t TightOutputTest::readCompactLength()
+{
+  size_t length = 0;
+  for (int i = 0; i < 3; i++) {
+    UINT8 b = *read(1);
+    length |= (size_t)(i < 2 ? b & 0x7F : b) << (i * 7);
+    if (i < 2 && !(b & 0x80)) {
+      break;
+    }
+  }
+  return length;
+}
+
+void TightOutputTest::drawDesktop()
+{
+  Rect bounds = m_fb.getDimension().getRect();
+  m_fb.fillRect(&bounds, 0x204060);
+
+  // A window with text: two colors.
+  Rect text(30, 30, 560, 400);
+  m_fb.fillRect(&text, 0xffffff);
+  for (int y = text.top + 8; y + 10 <= text.bottom; y += 16) {
+    Rect line(text.left + 8, y, text.right - 8, y + 10);
+    fillNoise(&line, 2);
+  }
+
+  // Icons: a few colors.
+  Rect icons(600, 30, 1000, 400);
+  fillNoise(&icons, 12);
+
+  // A photo: full color.
+  fillNoise(&m_photo, 0);
+}
+
+void TightOutputTest::fillNoise(const Rect *rect, UINT32 numColors)
+{
+  static const UINT32 colors[] = {
+    0xffffff, 0x000000, 0xff0000, 0x00ff00, 0x0000ff, 0xffff00,
+    0x00ffff, 0xff00ff, 0x808080, 0x804000, 0x408000, 0x004080
+  };
+  for (int y = rect->top; y < rect->bottom; y++) {
+    UINT32 *pixels = (UINT32 *)m_fb.getBufferPtr(rect->left, y);
+    for (int x = 0; x < rect->getWidth(); x++) {
+      m_seed = m_seed * 1103515245 + 12345;
+      if (numColors == 0) {
+        pixels[x] = (m_seed >> 8) & 0xffffff;
+      } else {
+        pixels[x] = colors[(m_seed >> 16) % numColors];
+      }
+    }
+  }
+}
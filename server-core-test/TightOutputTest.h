@@ -0,0 +1,109 @@
+// Copyright (C) 2012 GlavSoft LLC.
+// All rights reserved.
+//
+//-------------------------------------------------------------------------
+// This file is part of the TightVNC software.  Please visit our Web site:
+//
+//                       http://www.tightvnc.com/
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+//-------------------------------------------------------------------------
+//
+
+
+#ifndef __TIGHTOUTPUTTEST_H__
+#define __TIGHTOUTPUTTEST_H__
+
+#include "rfb-sconn/TightEncoder.h"
+#include "io-lib/BufferedOutputStream.h"
+#include "util/Inflater.h"
+
+// Writes Tight updates through BufferedOutputStream, as the server does,
+// and checks that the gathered output decodes to the original pixels, that
+// it goes out by few writes and that big payloads are not copied by the
+// buffer. The benchmark counts the writes and the copied bytes per update.
+class TightOutputTest
+{
+public:
+  TightOutputTest();
+  virtual ~TightOutputTest();
+
+  // Throws Exception if a check fails.
+  void run();
+
+private:
+  // Stores the written data and counts the calls, each of them would be a
+  // send call on a socket.
+  class CountingOutputStream : public OutputStream
+  {
+  public:
+    CountingOutputStream();
+
+    virtual size_t write(const void *buffer, size_t len);
+    virtual size_t writeVector(const OutputSegment *segments, size_t count);
+
+    // Forgets the data and the number of calls.
+    void clear();
+
+    std::vector<UINT8> data;
+    size_t numCalls;
+  };
+
+  void checkDecoding();
+  void runBenchmark();
+
+  // Splits the whole frame buffer and sends it as one update through
+  // m_buffered. Returns the number of rectangles.
+  size_t sendUpdate(TightEncoder *encoder);
+
+  // Decodes numRects Tight rectangles from m_sink.data into m_decoded.
+  void decode(size_t numRects);
+  void decodeRect(const Rect *rect);
+  // Reads the compact length and the zlib data following it, returns the
+  // uncompressed data.
+  const UINT8 *readCompressed(size_t rawLength, int streamId);
+  void readPixels(UINT32 *pixels, size_t count);
+  const UINT8 *read(size_t length);
+  size_t readCompactLength();
+
+  // Draws a synthetic desktop with solid, two-color, few-color and noisy
+  // areas, so that all kinds of Tight rectangles are produced.
+  void drawDesktop();
+  // Fills the rectangle with pseudo-random pixels of the first numColors
+  // colors of a fixed table, or of any colors if numColors is 0.
+  void fillNoise(const Rect *rect, UINT32 numColors);
+
+  FrameBuffer m_fb;
+  FrameBuffer m_decoded;
+  PixelConverter m_conv;
+  EncodeOptions m_options;
+  UINT32 m_seed;
+  // The full-color area of the synthetic desktop.
+  Rect m_photo;
+
+  CountingOutputStream m_sink;
+  BufferedOutputStream m_buffered;
+  DataOutputStream m_output;
+
+  // Decoder state.
+  size_t m_readPos;
+  Inflater *m_inflaters[4];
+
+  // The size of the RFB rectangle header preceding encoded data.
+  static const size_t RECT_HEADER_SIZE = 12;
+  static const int NUM_BENCHMARK_UPDATES = 50;
+};
+
+#endif // __TIGHTOUTPUTTEST_H__
@@ -0,0 +1,226 @@
+// Copyright (C) 2012 GlavSoft LLC.
+// All rights reserved.
+//
+//-------------------------------------------------------------------------
+// This file is part of the TightVNC software.  Please visit our Web site:
+//
+//                       http://www.tightvnc.com/
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+//-------------------------------------------------------------------------
+//
+
+
+#include "TightSplitTest.h"
+#include "BenchmarkTimer.h"
+#include "rfb/StandardPixelFormatFactory.h"
+#include "region/Region.h"
+#include "io-lib/ByteArrayOutputStream.h"
+#include "util/Exception.h"
+#include <stdio.h>
+
+TightSplitTest::TestEncoder::TestEncoder(PixelConverter *conv,
+                                         DataOutputStream *output)
+: TightEncoder(conv, output)
+{
+}
+
+void TightSplitTest::TestEncoder::splitPlain(const Rect *rect,
+                                             std::vector<Rect> *rectList,
+                                             const EncodeOptions *options)
+{
+  splitRectangleSimple(rect, rectList, options);
+}
+
+int TightSplitTest::TestEncoder::getMaxRectSize(const EncodeOptions *options)
+{
+  return getConf(options).maxRectSize;
+}
+
+TightSplitTest::TightSplitTest()
+: m_seed(12345)
+{
+  PixelFormat pf = StandardPixelFormatFactory::create32bppPixelFormat();
+  Dimension dim(1024, 768);
+  m_fb.setProperties(&dim, &pf);
+  m_conv.setPixelFormats(&pf, &pf);
+}
+
+TightSplitTest::~TightSplitTest()
+{
+}
+
+void TightSplitTest::run()
+{
+  checkSolidWindow();
+  checkNoise();
+  runBenchmark();
+}
+
+void TightSplitTest::checkSolidWindow()
+{
+  Rect bounds = m_fb.getDimension().getRect();
+  fillNoise(&bounds);
+  // The edges are not aligned to the 16-pixel search grid.
+  Rect solid(100, 70, 555, 397);
+  m_fb.fillRect(&solid, 0x336699);
+
+  ByteArrayOutputStream bytes(OUTPUT_BUFFER_SIZE);
+  DataOutputStream output(&bytes);
+  TestEncoder encoder(&m_conv, &output);
+
+  std::vector<Rect> rects;
+  encoder.splitRectangle(&bounds, &rects, &m_fb, &m_options);
+  checkCoverage(&rects, &bounds);
+
+  int maxRectSize = TestEncoder::getMaxRectSize(&m_options);
+  bool solidFound = false;
+  for (size_t i = 0; i < rects.size(); i++) {
+    if (rects[i].isEqualTo(&solid)) {
+      solidFound = true;
+    } else if (rects[i].area() > maxRectSize) {
+      throw Exception(_T("A rectangle of %d pixels exceeds the limit of %d"),
+                      rects[i].area(), maxRectSize);
+    }
+  }
+  if (!solidFound) {
+    throw Exception(_T("The solid area was not passed as a single rectangle"));
+  }
+
+  // The solid area is sent as a fill: the control byte and a packed pixel.
+  encoder.sendRectangle(&solid, &m_fb, &m_options);
+  const UINT8 *data = (const UINT8 *)bytes.toByteArray();
+  if (bytes.size() != 4 || data[0] != 0x80 ||
+      data[1] != 0x33 || data[2] != 0x66 || data[3] != 0x99) {
+    throw Exception(_T("The solid area was not sent as a fill (%d bytes)"),
+                    (int)bytes.size());
+  }
+}
+
+void TightSplitTest::checkNoise()
+{
+  Rect bounds = m_fb.getDimension().getRect();
+  fillNoise(&bounds);
+
+  ByteArrayOutputStream bytes(OUTPUT_BUFFER_SIZE);
+  DataOutputStream output(&bytes);
+  TestEncoder encoder(&m_conv, &output);
+
+  // Without solid areas the result should be the same as plain tiling.
+  std::vector<Rect> rects;
+  std::vector<Rect> plainRects;
+  encoder.splitRectangle(&bounds, &rects, &m_fb, &m_options);
+  encoder.splitPlain(&bounds, &plainRects, &m_options);
+  if (rects.size() != plainRects.size()) {
+    throw Exception(_T("Noise was split into %d rectangles instead of %d"),
+                    (int)rects.size(), (int)plainRects.size());
+  }
+  for (size_t i = 0; i < rects.size(); i++) {
+    if (!rects[i].isEqualTo(&plainRects[i])) {
+      throw Exception(_T("Noise was not split into plain tiles"));
+    }
+  }
+}
+
+void TightSplitTest::runBenchmark()
+{
+  // A synthetic desktop: a solid background with windows consisting of
+  // solid title bars and margins around noisy content.
+  Rect bounds = m_fb.getDimension().getRect();
+  m_fb.fillRect(&bounds, 0x204060);
+  const Rect windows[] = {
+    Rect(40, 30, 600, 420),
+    Rect(300, 250, 980, 700),
+    Rect(650, 60, 1000, 230)
+  };
+  for (size_t i = 0; i < sizeof(windows) / sizeof(windows[0]); i++) {
+    const Rect *w = &windows[i];
+    Rect titleBar(w->left, w->top, w->right, w->top + 24);
+    Rect client(w->left, w->top + 24, w->right, w->bottom);
+    Rect content(w->left + 40, w->top + 60, w->right - 40, w->bottom - 80);
+    m_fb.fillRect(&titleBar, 0x3050a0);
+    m_fb.fillRect(&client, 0xf0f0f0);
+    fillNoise(&content);
+  }
+
+  size_t plainRects, solidRects;
+  double plainTime, solidTime;
+  size_t plainBytes = splitAndEncode(true, &plainRects, &plainTime);
+  size_t solidBytes = splitAndEncode(false, &solidRects, &solidTime);
+
+  _tprintf(_T("Tight split, plain tiling: %d rectangles, %d bytes, %.0f us\n"),
+           (int)plainRects, (int)plainBytes, plainTime);
+  _tprintf(_T("Tight split, solid areas:  %d rectangles, %d bytes, %.0f us\n"),
+           (int)solidRects, (int)solidBytes, solidTime);
+
+  if (solidRects >= plainRects || solidBytes >= plainBytes) {
+    throw Exception(_T("Solid area extraction did not reduce the output"));
+  }
+}
+
+size_t TightSplitTest::splitAndEncode(bool plain, size_t *numRects,
+                                      double *time)
+{
+  ByteArrayOutputStream bytes(OUTPUT_BUFFER_SIZE);
+  DataOutputStream output(&bytes);
+  TestEncoder encoder(&m_conv, &output);
+
+  BenchmarkTimer timer;
+  Rect bounds = m_fb.getDimension().getRect();
+  std::vector<Rect> rects;
+  if (plain) {
+    encoder.splitPlain(&bounds, &rects, &m_options);
+  } else {
+    encoder.splitRectangle(&bounds, &rects, &m_fb, &m_options);
+  }
+  encoder.sendRectangles(&rects, &m_fb, &m_options);
+  *time = timer.getElapsed();
+
+  checkCoverage(&rects, &bounds);
+  *numRects = rects.size();
+  return bytes.size() + rects.size() * RECT_HEADER_SIZE;
+}
+
+void TightSplitTest::checkCoverage(const std::vector<Rect> *rects,
+                                   const Rect *bounds)
+{
+  // The union equals the bounds and the areas sum up to the area of the
+  // bounds, so the rectangles do not overlap.
+  Region covered;
+  int totalArea = 0;
+  for (size_t i = 0; i < rects->size(); i++) {
+    const Rect *r = &(*rects)[i];
+    if (r->area() == 0) {
+      throw Exception(_T("An empty rectangle in the split result"));
+    }
+    covered.addRect(r);
+    totalArea += r->area();
+  }
+  Region expected(*bounds);
+  if (!covered.equals(&expected) || totalArea != bounds->area()) {
+    throw Exception(_T("The rectangles do not cover the bounds exactly once"));
+  }
+}
+
+void TightSplitTest::fillNoise(const Rect *rect)
+{
+  for (int y = rect->top; y < rect->bottom; y++) {
+    UINT32 *pixels = (UINT32 *)m_fb.getBufferPtr(rect->left, y);
+    for (int x = 0; x < rect->getWidth(); x++) {
+      m_seed = m_seed * 1103515245 + 12345;
+      pixels[x] = (m_seed >> 8) & 0xffffff;
+    }
+  }
+}
@@ -0,0 +1,82 @@
+// Copyright (C) 2012 GlavSoft LLC.
+// All rights reserved.
+//
+//-------------------------------------------------------------------------
+// This file is part of the TightVNC software.  Please visit our Web site:
+//
+//                       http://www.tightvnc.com/
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+//-------------------------------------------------------------------------
+//
+
+
+#ifndef __TIGHTSPLITTEST_H__
+#define __TIGHTSPLITTEST_H__
+
+#include "rfb-sconn/TightEncoder.h"
+
+// Checks that TightEncoder::splitRectangle() passes big solid-color areas as
+// separate rectangles, sends them as solid fills and covers the rest with
+// ordinary tiles. Compares the number of rectangles and bytes with plain
+// tiling on a synthetic desktop.
+class TightSplitTest
+{
+public:
+  TightSplitTest();
+  virtual ~TightSplitTest();
+
+  // Throws Exception if a check fails.
+  void run();
+
+private:
+  // Gives access to the plain tiling used when no solid areas are found.
+  class TestEncoder : public TightEncoder
+  {
+  public:
+    TestEncoder(PixelConverter *conv, DataOutputStream *output);
+
+    void splitPlain(const Rect *rect, std::vector<Rect> *rectList,
+                    const EncodeOptions *options);
+    static int getMaxRectSize(const EncodeOptions *options);
+  };
+
+  void checkSolidWindow();
+  void checkNoise();
+  void runBenchmark();
+
+  // Splits the whole frame buffer with a new encoder, either plainly or
+  // with solid area extraction, and encodes the rectangles. Returns the
+  // number of bytes including the RFB rectangle headers.
+  size_t splitAndEncode(bool plain, size_t *numRects, double *time);
+
+  // Throws Exception unless the rectangles cover the bounds exactly once.
+  static void checkCoverage(const std::vector<Rect> *rects,
+                            const Rect *bounds);
+
+  // Fills the rectangle with pseudo-random pixels.
+  void fillNoise(const Rect *rect);
+
+  FrameBuffer m_fb;
+  PixelConverter m_conv;
+  EncodeOptions m_options;
+  UINT32 m_seed;
+
+  // The size of the RFB rectangle header preceding encoded data.
+  static const size_t RECT_HEADER_SIZE = 12;
+  static const size_t OUTPUT_BUFFER_SIZE = 8 * 1024 * 1024;
+};
+
+#endif // __TIGHTSPLITTEST_H__
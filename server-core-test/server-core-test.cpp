@@ -0,0 +1,62 @@
+// Copyright (C) 2012 GlavSoft LLC.
+// All rights reserved.
+//
+//-------------------------------------------------------------------------
+// This file is part of the TightVNC software.  Please visit our Web site:
+//
+//                       http://www.tightvnc.com/
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+//-------------------------------------------------------------------------
+//
+
+
+#include "TightSplitTest.h"
+#include "LinkEstimatorTest.h"
+#include "TightOutputTest.h"
+#include "PixelConverterTest.h"
+#include "SentTilesTest.h"
+#include "BlockComparatorTest.h"
+#include "RegionTest.h"
+#include "MotionDetectorTest.h"
+#include "util/Exception.h"
+#include <stdio.h>
+
+int _tmain(int argc, TCHAR *argv[])
+{
+  try {
+    TightSplitTest tightSplitTest;
+    tightSplitTest.run();
+    LinkEstimatorTest linkEstimatorTest;
+    linkEstimatorTest.run();
+    TightOutputTest tightOutputTest;
+    tightOutputTest.run();
+    PixelConverterTest pixelConverterTest;
+    pixelConverterTest.run();
+    SentTilesTest sentTilesTest;
+    sentTilesTest.run();
+    BlockComparatorTest blockComparatorTest;
+    blockComparatorTest.run();
+    RegionTest regionTest;
+    regionTest.run();
+    MotionDetectorTest motionDetectorTest;
+    motionDetectorTest.run();
+  } catch (Exception &e) {
+    _ftprintf(stderr, _T("Error: %s\n"), e.getMessage());
+    return 1;
+  }
+  _tprintf(_T("All tests passed\n"));
+  return 0;
+}
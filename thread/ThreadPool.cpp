@@ -0,0 +1,186 @@
+// Copyright (C) 2012 GlavSoft LLC.
+// All rights reserved.
+//
+//-------------------------------------------------------------------------
+// This file is part of the TightVNC software.  Please visit our Web site:
+//
+//                       http://www.tightvnc.com/
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+//-------------------------------------------------------------------------
+//
+
+#include "ThreadPool.h"
+#include "AutoLock.h"
+
+ThreadPoolTask::ThreadPoolTask()
+: m_state(IDLE),
+  m_failed(false)
+{
+}
+
+ThreadPoolTask::~ThreadPoolTask()
+{
+  _ASSERT(m_state != QUEUED && m_state != RUNNING);
+}
+
+ThreadPool::Worker::Worker(ThreadPool *pool)
+: m_pool(pool)
+{
+  resume();
+}
+
+ThreadPool::Worker::~Worker()
+{
+}
+
+void ThreadPool::Worker::execute()
+{
+  while (!isTerminating()) {
+    ThreadPoolTask *task = m_pool->takeTask();
+    if (task == 0) {
+      m_pool->m_taskAdded.waitForEvent();
+    } else {
+      m_pool->runTask(task);
+    }
+  }
+  // Other workers may be still waiting for the signal.
+  m_pool->m_taskAdded.notify();
+}
+
+void ThreadPool::Worker::onTerminate()
+{
+  m_pool->m_taskAdded.notify();
+}
+
+ThreadPool::ThreadPool(size_t numThreads)
+{
+  if (numThreads == 0) {
+    numThreads = getNumberOfProcessors();
+  }
+  for (size_t i = 0; i < numThreads; i++) {
+    m_workers.push_back(new Worker(this));
+  }
+}
+
+ThreadPool::~ThreadPool()
+{
+  _ASSERT(m_queue.empty());
+
+  std::vector<Worker *>::iterator it;
+  for (it = m_workers.begin(); it != m_workers.end(); it++) {
+    (*it)->terminate();
+  }
+  for (it = m_workers.begin(); it != m_workers.end(); it++) {
+    (*it)->wait();
+    delete *it;
+  }
+}
+
+size_t ThreadPool::getNumThreads() const
+{
+  return m_workers.size();
+}
+
+void ThreadPool::addTask(ThreadPoolTask *task)
+{
+  {
+    AutoLock al(&m_lock);
+    _ASSERT(task->m_state != ThreadPoolTask::QUEUED &&
+            task->m_state != ThreadPoolTask::RUNNING);
+    task->m_state = ThreadPoolTask::QUEUED;
+    task->m_failed = false;
+    m_queue.push_back(task);
+  }
+  m_taskAdded.notify();
+}
+
+void ThreadPool::waitForTask(ThreadPoolTask *task)
+{
+  bool runHere = false;
+  {
+    AutoLock al(&m_lock);
+    if (task->m_state == ThreadPoolTask::QUEUED) {
+      m_queue.remove(task);
+      task->m_state = ThreadPoolTask::RUNNING;
+      runHere = true;
+    }
+  }
+  if (runHere) {
+    runTask(task);
+  }
+
+  // The completion event may remain signaled since a previous use of the
+  // task, so check the state after each wake up.
+  while (true) {
+    {
+      AutoLock al(&m_lock);
+      if (task->m_state != ThreadPoolTask::RUNNING) {
+        break;
+      }
+    }
+    task->m_completed.waitForEvent();
+  }
+
+  if (task->m_failed) {
+    throw Exception(_T("%s"), task->m_errorMessage.getString());
+  }
+}
+
+size_t ThreadPool::getNumberOfProcessors()
+{
+  SYSTEM_INFO systemInfo;
+  GetSystemInfo(&systemInfo);
+  size_t numProcessors = systemInfo.dwNumberOfProcessors;
+  return numProcessors != 0 ? numProcessors : 1;
+}
+
+ThreadPoolTask *ThreadPool::takeTask()
+{
+  ThreadPoolTask *task = 0;
+  bool moreTasks = false;
+  {
+    AutoLock al(&m_lock);
+    if (!m_queue.empty()) {
+      task = m_queue.front();
+      m_queue.pop_front();
+      task->m_state = ThreadPoolTask::RUNNING;
+      moreTasks = !m_queue.empty();
+    }
+  }
+  if (moreTasks) {
+    // Wake up one more worker.
+    m_taskAdded.notify();
+  }
+  return task;
+}
+
+void ThreadPool::runTask(ThreadPoolTask *task)
+{
+  try {
+    task->run();
+  } catch (Exception &e) {
+    task->m_failed = true;
+    task->m_errorMessage.setString(e.getMessage());
+  } catch (...) {
+    task->m_failed = true;
+    task->m_errorMessage.setString(_T("Unknown error in a thread pool task"));
+  }
+  {
+    AutoLock al(&m_lock);
+    task->m_state = ThreadPoolTask::DONE;
+  }
+  task->m_completed.notify();
+}
@@ -0,0 +1,170 @@
+// Copyright (C) 2012 GlavSoft LLC.
+// All rights reserved.
+//
+//-------------------------------------------------------------------------
+// This file is part of the TightVNC software.  Please visit our Web site:
+//
+//                       http://www.tightvnc.com/
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+//-------------------------------------------------------------------------
+//
+
+#ifndef __THREADPOOL_H__
+#define __THREADPOOL_H__
+
+#include "util/CommonHeader.h"
+#include "util/Exception.h"
+#include "win-system/WindowsEvent.h"
+#include "Thread.h"
+#include "LocalMutex.h"
+
+#include <list>
+#include <vector>
+
+class ThreadPool;
+
+/**
+ * Unit of work executed by ThreadPool.
+ *
+ * @remark the same task object may be added to a pool again after the
+ * previous execution has been waited for with ThreadPool::waitForTask().
+ */
+class ThreadPoolTask
+{
+public:
+  ThreadPoolTask();
+  virtual ~ThreadPoolTask();
+
+  /**
+   * Does the work. Called by a worker thread of the pool or by the thread
+   * waiting for the task.
+   * @throws Exception on error, the exception is passed to the thread
+   * waiting for the task.
+   */
+  virtual void run() throw(Exception) = 0;
+
+private:
+  friend class ThreadPool;
+
+  enum State
+  {
+    IDLE,
+    QUEUED,
+    RUNNING,
+    DONE
+  };
+
+  /**
+   * Task state, protected by the pool mutex.
+   */
+  State m_state;
+  /**
+   * Set when run() has thrown an exception.
+   */
+  bool m_failed;
+  /**
+   * Message of the exception thrown by run().
+   */
+  StringStorage m_errorMessage;
+  /**
+   * Notified on the task completion.
+   */
+  WindowsEvent m_completed;
+};
+
+/**
+ * Fixed set of worker threads executing tasks in the order they were added.
+ *
+ * @remark all methods are thread-safe. Tasks added to the pool must be
+ * waited for by the owner before being destroyed, a pool may be shared by
+ * several owners.
+ */
+class ThreadPool
+{
+public:
+  /**
+   * Creates a pool and starts worker threads.
+   * @param numThreads number of worker threads, number of processors is
+   * used if zero.
+   */
+  ThreadPool(size_t numThreads);
+  /**
+   * Stops all worker threads.
+   * @remark all tasks must be completed at this moment.
+   */
+  virtual ~ThreadPool();
+
+  /**
+   * Returns the number of worker threads.
+   */
+  size_t getNumThreads() const;
+
+  /**
+   * Queues a task for execution.
+   */
+  void addTask(ThreadPoolTask *task);
+
+  /**
+   * Waits until the task is completed. If no worker has taken the task yet,
+   * it's executed by the calling thread.
+   * @throws Exception if the task has failed.
+   */
+  void waitForTask(ThreadPoolTask *task) throw(Exception);
+
+  /**
+   * Returns the number of logical processors in the system.
+   */
+  static size_t getNumberOfProcessors();
+
+private:
+  /**
+   * Worker thread, executes tasks until terminated.
+   */
+  class Worker : public Thread
+  {
+  public:
+    Worker(ThreadPool *pool);
+    virtual ~Worker();
+
+  protected:
+    virtual void execute();
+    virtual void onTerminate();
+
+    ThreadPool *m_pool;
+  };
+
+  /**
+   * Takes the first queued task and marks it as running.
+   * @return task or 0 if the queue is empty.
+   */
+  ThreadPoolTask *takeTask();
+  /**
+   * Runs the task and marks it as completed.
+   */
+  void runTask(ThreadPoolTask *task);
+
+  std::list<ThreadPoolTask *> m_queue;
+  LocalMutex m_lock;
+  /**
+   * Wakes up a single idle worker. A worker that takes a task while more
+   * tasks are queued passes the signal further.
+   */
+  WindowsEvent m_taskAdded;
+
+  std::vector<Worker *> m_workers;
+};
+
+#endif // __THREADPOOL_H__
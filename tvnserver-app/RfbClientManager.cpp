@@ -35,9 +35,15 @@ RfbClientManager::RfbClientManager(const TCHAR *serverName,
   m_desktop(0),
   m_newConnectionEvents(newConnectionEvents),
   m_log(log),
-  m_desktopFactory(desktopFactory)
+  m_desktopFactory(desktopFactory),
+  m_encoderPool(createEncoderPool()),
+  m_encodeGroups(&m_damageJournal, m_encoderPool, log)
 {
   m_log->info(_T("Starting rfb client manager"));
+  if (m_encoderPool != 0) {
+    m_log->info(_T("Parallel encoding uses %d threads"),
+                (int)m_encoderPool->getNumThreads());
+  }
 }
 
 RfbClientManager::~RfbClientManager()
@@ -45,6 +51,11 @@ RfbClientManager::~RfbClientManager()
   m_log->info(_T("~RfbClientManager() has been called"));
   disconnectAllClients();
   waitUntilAllClientAreBeenDestroyed();
+  // No encoders are left at this moment (encode groups are destroyed
+  // together with their last members).
+  if (m_encoderPool != 0) {
+    delete m_encoderPool;
+  }
   m_log->info(_T("~RfbClientManager() has been completed"));
 }
 
@@ -189,13 +200,17 @@ void RfbClientManager::onClipboardUpdate(const StringStorage *newClipboard)
 void RfbClientManager::onSendUpdate(const UpdateContainer *updateContainer,
                                     const CursorShape *cursorShape)
 {
+  // The update is kept once for all clients.
+  m_damageJournal.append(updateContainer);
+
   AutoLock al(&m_clientListLocker);
   for (ClientListIter iter = m_clientList.begin();
        iter != m_clientList.end(); iter++) {
     if ((*iter)->getClientState() == IN_NORMAL_PHASE) {
-      (*iter)->sendUpdate(updateContainer, cursorShape);
+      (*iter)->sendUpdate(cursorShape);
     }
   }
+  m_encodeGroups.newUpdates(cursorShape);
 }
 
 bool RfbClientManager::isReadyToSend()
@@ -208,7 +223,7 @@ bool RfbClientManager::isReadyToSend()
       isReady = isReady || (*iter)->clientIsReady();
     }
   }
-  return isReady;
+  return isReady || m_encodeGroups.isReadyToSend();
 }
 
 void RfbClientManager::onAbnormalDesktopTerminate()
@@ -386,6 +401,10 @@ void RfbClientManager::addNewConnection(SocketIPv4 *socket,
 
   m_log->error(_T("Client #%d connected"), m_nextClientId);
 
+  m_encodeGroups.setMaxLag(config->getEncodeGroupMaxLag());
+  EncodeGroupManager *encodeGroups = config->isEncodeGroupsEnabled() ?
+                                     &m_encodeGroups : 0;
+
   m_nonAuthClientList.push_back(new RfbClient(m_newConnectionEvents,
                                               socket, this, this, viewOnly,
                                               isOutgoing,
@@ -393,10 +412,26 @@ void RfbClientManager::addNewConnection(SocketIPv4 *socket,
                                               constViewPort,
                                               &m_dynViewPort,
                                               timeout,
+                                              &m_damageJournal,
+                                              encodeGroups,
+                                              m_encoderPool,
                                               m_log));
   m_nextClientId++;
 }
 
+ThreadPool *RfbClientManager::createEncoderPool()
+{
+  ServerConfig *config = Configurator::getInstance()->getServerConfig();
+  unsigned int numThreads = config->getEncoderThreads();
+  if (numThreads == 0) {
+    numThreads = (unsigned int)ThreadPool::getNumberOfProcessors();
+  }
+  if (numThreads < 2) {
+    return 0;
+  }
+  return new ThreadPool(numThreads);
+}
+
 void RfbClientManager::getClientsInfo(RfbClientInfoList *list)
 {
   AutoLock al(&m_clientListLocker);
@@ -33,6 +33,7 @@
 #include "win-system/WindowsEvent.h"
 #include "desktop/Desktop.h"
 #include "desktop/DesktopFactory.h"
+#include "desktop/DamageJournal.h"
 #include "log-writer/LogWriter.h"
 
 // Listener interfaces
@@ -154,6 +155,19 @@ private:
   NewConnectionEvents *m_newConnectionEvents;
 
   LogWriter *m_log;
+
+  // Creates the thread pool for parallel encoding according to the server
+  // configuration. Returns 0 if parallel encoding is turned off.
+  static ThreadPool *createEncoderPool();
+
+  // Thread pool for parallel encoding shared by all clients, may be 0.
+  ThreadPool *m_encoderPool;
+
+  // Desktop updates for all clients, each client takes them when it sends.
+  DamageJournal m_damageJournal;
+
+  // Clients with identical encoding settings share one encoder pipeline.
+  EncodeGroupManager m_encodeGroups;
 };
 
 #endif // __RFBCLIENTMANAGER_H__
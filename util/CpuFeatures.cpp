@@ -0,0 +1,84 @@
+// Copyright (C) 2012 GlavSoft LLC.
+// All rights reserved.
+//
+//-------------------------------------------------------------------------
+// This file is part of the TightVNC software.  Please visit our Web site:
+//
+//                       http://www.tightvnc.com/
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+//-------------------------------------------------------------------------
+//
+
+#include "CpuFeatures.h"
+
+#include <intrin.h>
+
+bool CpuFeatures::hasSse2()
+{
+  return getFeatures().sse2;
+}
+
+bool CpuFeatures::hasSsse3()
+{
+  return getFeatures().ssse3;
+}
+
+bool CpuFeatures::hasAvx2()
+{
+  return getFeatures().avx2;
+}
+
+const CpuFeatures::Features &CpuFeatures::getFeatures()
+{
+  // Concurrent initialization is harmless since all threads compute the
+  // same values.
+  static const Features features = detect();
+  return features;
+}
+
+CpuFeatures::Features CpuFeatures::detect()
+{
+  Features features;
+  features.sse2 = false;
+  features.ssse3 = false;
+  features.avx2 = false;
+
+  int info[4];
+  __cpuid(info, 0);
+  int maxLeaf = info[0];
+  if (maxLeaf < 1) {
+    return features;
+  }
+
+  __cpuid(info, 1);
+  features.sse2 = (info[3] & (1 << 26)) != 0;
+  features.ssse3 = (info[2] & (1 << 9)) != 0;
+
+#if _MSC_VER >= 1800
+  // AVX2 also needs the operating system to save YMM registers (OSXSAVE
+  // and XCR0 bits 1 and 2).
+  bool osSavesYmm = false;
+  if ((info[2] & (1 << 27)) != 0 && (info[2] & (1 << 28)) != 0) {
+    osSavesYmm = (_xgetbv(0) & 6) == 6;
+  }
+  if (osSavesYmm && maxLeaf >= 7) {
+    __cpuidex(info, 7, 0);
+    features.avx2 = (info[1] & (1 << 5)) != 0;
+  }
+#endif
+
+  return features;
+}
@@ -0,0 +1,68 @@
+// Copyright (C) 2012 GlavSoft LLC.
+// All rights reserved.
+//
+//-------------------------------------------------------------------------
+// This file is part of the TightVNC software.  Please visit our Web site:
+//
+//                       http://www.tightvnc.com/
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+//-------------------------------------------------------------------------
+//
+
+#ifndef _CPU_FEATURES_H_
+#define _CPU_FEATURES_H_
+
+/**
+ * Instruction set extensions of the processor the program runs on.
+ *
+ * @remark the features are detected once on the first call, all methods
+ * are thread-safe.
+ */
+class CpuFeatures
+{
+public:
+  /**
+   * Returns true if SSE2 instructions are supported.
+   */
+  static bool hasSse2();
+
+  /**
+   * Returns true if SSSE3 instructions are supported.
+   */
+  static bool hasSsse3();
+
+  /**
+   * Returns true if AVX2 instructions are supported by both the processor
+   * and the operating system.
+   */
+  static bool hasAvx2();
+
+private:
+  /**
+   * Detected features, filled in by detect().
+   */
+  struct Features
+  {
+    bool sse2;
+    bool ssse3;
+    bool avx2;
+  };
+
+  static const Features &getFeatures();
+  static Features detect();
+};
+
+#endif
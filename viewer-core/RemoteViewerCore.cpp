@@ -37,6 +37,8 @@
 #include "RichCursorDecoder.h"
 #include "RfbFramebufferUpdateRequestClientMessage.h"
 #include "RfbCutTextEventClientMessage.h"
+#include "RfbEnableContinuousUpdatesClientMessage.h"
+#include "RfbFenceClientMessage.h"
 #include "RfbKeyEventClientMessage.h"
 #include "RfbPointerEventClientMessage.h"
 #include "RfbSetEncodingsClientMessage.h"
@@ -57,6 +59,8 @@
 #include "LastRectDecoder.h"
 #include "PointerPosDecoder.h"
 #include "RichCursorDecoder.h"
+#include "FenceDecoder.h"
+#include "ContinuousUpdatesDecoder.h"
 
 #include <algorithm>
 
@@ -129,6 +133,8 @@ void RemoteViewerCore::init()
   m_decoderStore.addDecoder(new LastRectDecoder(&m_logWriter), -1);
   m_decoderStore.addDecoder(new PointerPosDecoder(&m_logWriter), -1);
   m_decoderStore.addDecoder(new RichCursorDecoder(&m_logWriter), -1);
+  m_decoderStore.addDecoder(new FenceDecoder(&m_logWriter), -1);
+  m_decoderStore.addDecoder(new ContinuousUpdatesDecoder(&m_logWriter), -1);
 
   m_input = 0;
   m_output = 0;
@@ -139,6 +145,9 @@ void RemoteViewerCore::init()
   m_isFreeze = false;
   m_isNeedRequestUpdate = true;
   m_forceFullUpdate = false;
+  m_isContinuousUpdatesAllowed = true;
+  m_isContinuousUpdatesSupported = false;
+  m_isContinuousUpdatesActive = false;
 
   m_updateTimeout = 0;
 }
@@ -313,12 +322,14 @@ void RemoteViewerCore::forceFullUpdateRequests(const bool& forceUpdate)
 {
 	m_forceFullUpdate = forceUpdate;
 	m_updateRequestSender.setIsIncremental(!forceUpdate);
+	updateContinuousUpdates();
 }
 
 void RemoteViewerCore::deferUpdateRequests(const int& milliseconds)
 {
 	m_updateTimeout = milliseconds;
 	m_updateRequestSender.setTimeout(milliseconds);
+	updateContinuousUpdates();
 }
 
 void RemoteViewerCore::sendFbUpdateRequest(bool incremental)
@@ -348,6 +359,13 @@ void RemoteViewerCore::sendFbUpdateRequest(bool incremental)
   if (isRefresh || isUpdateFbProperties || m_updateRequestSender.getTimeout() <= 0)
   {
 	bool isIncremental = incremental && !isRefresh && !isUpdateFbProperties;
+	if (isIncremental) {
+	  AutoLock al(&m_continuousUpdatesLock);
+	  if (m_isContinuousUpdatesActive) {
+	    // The server sends updates without requests.
+	    return;
+	  }
+	}
 	Rect updateRect;
 	{
 	  AutoLock al(&m_fbLock);
@@ -506,6 +524,7 @@ void RemoteViewerCore::stopUpdating(bool isStopped)
     m_logWriter.detail(_T("Sending of frame buffer update request..."));
     sendFbUpdateRequest(!m_forceFullUpdate);
   }
+  updateContinuousUpdates();
 }
 
 PixelFormat RemoteViewerCore::readPixelFormat()
@@ -602,6 +621,61 @@ void RemoteViewerCore::enableTightSecurityType(bool enabled)
   m_isTightEnabled = enabled;	
 }
 
+void RemoteViewerCore::enableContinuousUpdates(bool enabled)
+{
+  {
+    AutoLock al(&m_continuousUpdatesLock);
+    m_isContinuousUpdatesAllowed = enabled;
+  }
+  bool needUpdate;
+  if (enabled) {
+    needUpdate = m_decoderStore.addDecoder(new ContinuousUpdatesDecoder(&m_logWriter), -1);
+  } else {
+    needUpdate = m_decoderStore.removeDecoder(PseudoEncDefs::CONTINUOUS_UPDATES);
+  }
+  if (needUpdate) {
+    sendEncodings();
+  }
+  updateContinuousUpdates();
+}
+
+void RemoteViewerCore::updateContinuousUpdates(bool areaChanged)
+{
+  // If core isn't connected, then m_output may be isn't initialized.
+  // Exit from function, if it is.
+  if (!wasConnected()) {
+    return;
+  }
+
+  bool isFreeze;
+  {
+    AutoLock al(&m_freezeLock);
+    isFreeze = m_isFreeze;
+  }
+  Rect updateRect;
+  {
+    AutoLock al(&m_fbLock);
+    updateRect = m_frameBuffer.getDimension().getRect();
+  }
+
+  bool enable;
+  bool needSend;
+  {
+    AutoLock al(&m_continuousUpdatesLock);
+    enable = m_isContinuousUpdatesAllowed && m_isContinuousUpdatesSupported &&
+             !isFreeze && !m_forceFullUpdate && m_updateTimeout <= 0;
+    needSend = enable != m_isContinuousUpdatesActive || (enable && areaChanged);
+    m_isContinuousUpdatesActive = enable;
+  }
+  if (needSend) {
+    m_logWriter.debug(_T("%s continuous updates [%dx%d]..."),
+                      enable ? _T("Enabling") : _T("Disabling"),
+                      updateRect.getWidth(), updateRect.getHeight());
+    RfbEnableContinuousUpdatesClientMessage enableMessage(enable, updateRect);
+    enableMessage.send(m_output);
+  }
+}
+
 int RemoteViewerCore::negotiateAboutSecurityType()
 {
   m_logWriter.detail(_T("Reading list of security types..."));
@@ -900,6 +974,16 @@ void RemoteViewerCore::execute()
         receiveServerCutText();
         break;
 
+      case ServerMsgDefs::END_OF_CONTINUOUS_UPDATES:
+        m_logWriter.detail(_T("Received message: END_OF_CONTINUOUS_UPDATES"));
+        receiveEndOfContinuousUpdates();
+        break;
+
+      case ServerMsgDefs::FENCE:
+        m_logWriter.detail(_T("Received message: FENCE"));
+        receiveFence();
+        break;
+
       default:
         if (m_serverMsgHandlers.find(msgType) != m_serverMsgHandlers.end()) {
           m_logWriter.detail(_T("Received message (%d) transmit to capability handler"), msgType);
@@ -1062,6 +1146,7 @@ void RemoteViewerCore::processPseudoEncoding(const Rect *rect,
       AutoLock al(&m_fbLock);
       setFbProperties(&Dimension(rect), &m_frameBuffer.getPixelFormat());
     }
+    updateContinuousUpdates(true);
     break;
     
   case PseudoEncDefs::RICH_CURSOR:
@@ -1124,6 +1209,73 @@ void RemoteViewerCore::receiveSetColorMapEntries()
   }
 }
 
+void RemoteViewerCore::receiveEndOfContinuousUpdates()
+{
+  // message type is already known: 150
+
+  bool isFirst;
+  bool wasActive;
+  {
+    AutoLock al(&m_continuousUpdatesLock);
+    isFirst = !m_isContinuousUpdatesSupported;
+    wasActive = m_isContinuousUpdatesActive;
+    m_isContinuousUpdatesSupported = true;
+    m_isContinuousUpdatesActive = false;
+  }
+  if (isFirst) {
+    m_logWriter.info(_T("Server supports continuous updates"));
+    updateContinuousUpdates();
+    return;
+  }
+  if (wasActive) {
+    m_logWriter.info(_T("Server has stopped continuous updates"));
+  }
+
+  // Continuous updates are off now, so the next update must be requested.
+  {
+    AutoLock al(&m_requestUpdateLock);
+    m_isNeedRequestUpdate = true;
+  }
+  {
+    AutoLock al(&m_freezeLock);
+    if (m_isFreeze)
+      return;
+  }
+  sendFbUpdateRequest(!m_forceFullUpdate);
+}
+
+void RemoteViewerCore::receiveFence()
+{
+  // message type is already known: 248
+
+  // read padding: 3 bytes
+  m_input->readUInt8();
+  m_input->readUInt16();
+
+  UINT32 flags = m_input->readUInt32();
+  UINT8 length = m_input->readUInt8();
+  if (length > FenceDefs::MAX_PAYLOAD_LENGTH) {
+    throw Exception(_T("Error in protocol: fence payload is too long"));
+  }
+  vector<UINT8> payload(length);
+  if (length != 0) {
+    m_input->readFully(&payload.front(), length);
+  }
+
+  // We never send fence requests, so responses are not expected.
+  if ((flags & FenceDefs::REQUEST) == 0) {
+    m_logWriter.debug(_T("Ignoring fence response"));
+    return;
+  }
+
+  // All the messages before the fence have been processed by the input
+  // thread, and it will not read anything else until the response is sent.
+  // SyncNext is not supported, so the flag is cleared in the response.
+  RfbFenceClientMessage fenceMessage(flags & (FenceDefs::BLOCK_BEFORE | FenceDefs::BLOCK_AFTER),
+                                     &payload);
+  fenceMessage.send(m_output);
+}
+
 void RemoteViewerCore::receiveBell()
 {
   // message is already readed. Message type: 2
@@ -413,6 +413,16 @@ public:
   // the server claims that supports it.
   //
   void enableTightSecurityType(bool enabled);
+
+  //
+  // Enable or disable continuous updates (enabled by default). If enabled and
+  // the server supports the ContinuousUpdates extension, the server sends
+  // updates as soon as the screen changes instead of waiting for a request
+  // after each update. Continuous updates are not used while updating is
+  // stopped, full update requests are forced or update requests are
+  // deferred.
+  //
+  void enableContinuousUpdates(bool enabled);
   
   //
   // Work with capabilities is documented in interface CapabilitiesManager.
@@ -524,6 +534,27 @@ private:
   //
   void receiveSetColorMapEntries();
 
+  //
+  // Receive EndOfContinuousUpdates server message (code 150). The first one
+  // tells that the server supports continuous updates, so they are enabled
+  // if allowed. Next ones mean that the server has stopped sending
+  // continuous updates, so we return to requesting each update.
+  //
+  void receiveEndOfContinuousUpdates();
+
+  //
+  // Receive Fence server message (code 248) and respond to it if it's a
+  // request.
+  //
+  void receiveFence();
+
+  //
+  // Enable or disable continuous updates on the server, depending on the
+  // current settings. If areaChanged is true and continuous updates are on,
+  // the server will be informed about the new frame buffer size.
+  //
+  void updateContinuousUpdates(bool areaChanged = false);
+
   void handleDispatcherProtocol(DispatchDataProvider *callback);
 
   bool isRfbProtocolString(const char protocol[12]) const;
@@ -655,6 +686,15 @@ private:
   LocalMutex m_requestUpdateLock;
   bool m_isNeedRequestUpdate;
 
+  // m_isContinuousUpdatesAllowed is set by enableContinuousUpdates(),
+  // m_isContinuousUpdatesSupported is set when the server has sent the
+  // first EndOfContinuousUpdates, m_isContinuousUpdatesActive is true while
+  // we have continuous updates enabled on the server.
+  LocalMutex m_continuousUpdatesLock;
+  bool m_isContinuousUpdatesAllowed;
+  bool m_isContinuousUpdatesSupported;
+  bool m_isContinuousUpdatesActive;
+
   bool m_sharedFlag;
   int m_major;
   int m_minor;